@@ -1,19 +1,29 @@
 #ifndef __SANCUS_BUFFER_H__
 #define __SANCUS_BUFFER_H__
 
+#include <sancus/fd.h>
+
 #include <errno.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <string.h>
 
+/**
+ * struct sancus_buffer - buffer control structure
+ *
+ * @buf:	pointer to the data buffer
+ * @base:	offset to the base of the stored data
+ * @len:	length of the stored data
+ * @size:	size of the data buffer
+ */
 struct sancus_buffer {
 	char *buf;
-	uint_fast16_t base, len, size;
+	size_t base, len, size;
 };
 
 static inline int sancus_buffer_init(struct sancus_buffer *b,
-				     char *buf, unsigned size)
+				     char *buf, size_t size)
 {
 	if (b == NULL || buf == NULL || size == 0)
 		return -EINVAL;
@@ -26,6 +36,19 @@ static inline int sancus_buffer_init(struct sancus_buffer *b,
 	return 0;
 }
 
+/**
+ * sancus_buffer_bind - binds a bytes array to a buffer struct, which
+ * may be empty (%NULL, 0)
+ */
+static inline void sancus_buffer_bind(struct sancus_buffer *b,
+				      char *buf, size_t size)
+{
+	*b = (struct sancus_buffer) {
+		.buf = size > 0 ? buf : NULL,
+		.size = buf != NULL ? size : 0,
+	};
+}
+
 /*
  * accessors
  */
@@ -40,12 +63,50 @@ static inline int sancus_buffer_init(struct sancus_buffer *b,
 #define sancus_buffer_is_empty(B) (sancus_buffer_len(B)  == 0)
 #define sancus_buffer_is_off(B)   (sancus_buffer_base(B) != 0)
 
+#define sancus_buffer_available(B) sancus_buffer_tail_size(B)
+#define sancus_buffer_data(B)      sancus_buffer_ptr(B)
+
+/* NUL terminate the stored data, if there is room for it */
+static inline void sancus_buffer__terminate(struct sancus_buffer *b)
+{
+	size_t off = b->base + b->len;
+
+	if (off < b->size)
+		b->buf[off] = '\0';
+}
+
 /*
  * strip
  */
 ssize_t sancus_buffer__stripchar(struct sancus_buffer *, bool, const char *, ssize_t);
 
-ssize_t sancus_buffer_strip(struct sancus_buffer *, const char *s, ssize_t);
+static inline ssize_t sancus_buffer_strip(struct sancus_buffer *b,
+					  const char *s, ssize_t l)
+{
+	size_t bl = sancus_buffer_len(b);
+
+	/* s vs l */
+	if (s != NULL) {
+		if (l < 0)
+			l = (ssize_t)strlen(s);
+	} else if (l > 0) {
+		return -EINVAL;
+	}
+
+	if (l > 0 && bl >= (size_t)l) {
+		size_t lu = (size_t)l;
+		char *p = sancus_buffer_ptr(b) + (bl - lu);
+
+		if (memcmp(p, s, lu) == 0) {
+			/* match, remove */
+			b->len -= lu;
+			*p = '\0';
+			return l;
+		}
+	}
+
+	return 0;
+}
 
 static inline ssize_t sancus_buffer_stripz(struct sancus_buffer *b, const char *s)
 {
@@ -56,8 +117,28 @@ static inline ssize_t sancus_buffer_stripz(struct sancus_buffer *b, const char *
 	return 0;
 }
 
-ssize_t sancus_buffer_truncate(struct sancus_buffer *, size_t);
-ssize_t sancus_buffer_stripn(struct sancus_buffer *, size_t);
+static inline ssize_t sancus_buffer_truncate(struct sancus_buffer *b, size_t n)
+{
+	if (n < b->len)
+		b->len = n;
+
+	if (b->len == 0)
+		b->base = 0;
+
+	sancus_buffer__terminate(b);
+	return (ssize_t)b->len;
+}
+
+static inline ssize_t sancus_buffer_stripn(struct sancus_buffer *b, size_t n)
+{
+	if (n < b->len)
+		b->len -= n;
+	else
+		b->base = b->len = 0;
+
+	sancus_buffer__terminate(b);
+	return (ssize_t)b->len;
+}
 
 #define sancus_buffer_striponce(B, S) sancus_buffer__stripchar((B), false, (S), -1)
 #define sancus_buffer_stripany(B, S)  sancus_buffer__stripchar((B), true, (S), -1)
@@ -65,6 +146,56 @@ ssize_t sancus_buffer_stripn(struct sancus_buffer *, size_t);
 #define sancus_buffer_pop(B, N) sancus_buffer_stripn((B), (N))
 #define sancus_buffer_reset(B)  sancus_buffer_truncate((B), 0)
 
+/*
+ * consume
+ */
+
+/**
+ * sancus_buffer_rebase - moves data to the head of the buffer
+ */
+static inline void sancus_buffer_rebase(struct sancus_buffer *b)
+{
+	if (b->base > 0) {
+		if (b->len > 0)
+			memmove(b->buf, b->buf + b->base, b->len);
+		b->base = 0;
+	}
+}
+
+/**
+ * sancus_buffer_skip - drop the first @n chars from the buffer,
+ * returns the space left in the tail
+ */
+static inline size_t sancus_buffer_skip(struct sancus_buffer *b, size_t n)
+{
+	if (n >= b->len) {
+		b->base = b->len = 0;
+		return b->size;
+	}
+
+	b->base += n;
+	b->len -= n;
+
+	/* if there is less than 10% available, try to rebase */
+	if (sancus_buffer_tail_size(b) < b->size / 10)
+		sancus_buffer_rebase(b);
+
+	return sancus_buffer_tail_size(b);
+}
+
+/**
+ * sancus_buffer_read - read from fd into the tail of the buffer
+ */
+static inline ssize_t sancus_buffer_read(struct sancus_buffer *b, int fd)
+{
+	ssize_t l = sancus_read(fd, sancus_buffer_tail_ptr(b),
+				sancus_buffer_tail_size(b));
+	if (l > 0)
+		b->len += (size_t)l;
+
+	return l;
+}
+
 /*
  * append
  */
@@ -73,11 +204,41 @@ static inline ssize_t sancus_buffer_sparse(struct sancus_buffer *b, size_t n)
 	if (sancus_buffer_tail_size(b) < n)
 		return -EINVAL;
 
-	b->len += (uint_fast16_t)n;
+	b->len += n;
 	return (ssize_t)n;
 }
 
-ssize_t sancus_buffer__append(struct sancus_buffer *, bool, const char *, ssize_t);
+static inline ssize_t sancus_buffer__append(struct sancus_buffer *b, bool truncate,
+					    const char *s, ssize_t l)
+{
+	char *buf = sancus_buffer_tail_ptr(b);
+	ssize_t buf_size = (ssize_t)sancus_buffer_tail_size(b);
+
+	/* s vs l */
+	if (s != NULL) {
+		if (l < 0)
+			l = (ssize_t)strlen(s);
+	} else if (l > 0) {
+		return -EINVAL;
+	}
+
+	/* buf vs l */
+	if (buf == NULL)
+		l = -EINVAL;
+	else if (l <= buf_size)
+		;
+	else if (truncate)
+		l = buf_size;
+	else
+		l = -ENOBUFS;
+
+	if (l > 0) {
+		memcpy(buf, s, (size_t)l);
+		b->len += (size_t)l;
+	}
+
+	return l;
+}
 
 static inline ssize_t sancus_buffer__appendz(struct sancus_buffer *b, bool truncate, const char *s)
 {
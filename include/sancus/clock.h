@@ -12,6 +12,13 @@ struct sancus_clock {
 int sancus_now(struct timespec *);
 void sancus_set_now_clock(struct sancus_clock *);
 
+/**
+ * sancus_now_coarse - like sancus_now() but reading the time the
+ * kernel cached at the last tick, cheaper but only as precise as
+ * the tick. Mocked clocks are used as-is
+ */
+int sancus_now_coarse(struct timespec *);
+
 static inline struct timespec sancus_now_ts(void)
 {
 	struct timespec ts;
@@ -0,0 +1,181 @@
+#ifndef __SANCUS_CONN_SLAB_H__
+#define __SANCUS_CONN_SLAB_H__
+
+#include <stdint.h>
+
+/*
+ * connection slab, a fixed number of connection records allocated at
+ * once and recycled through a free list.
+ *
+ * Records are referred to by 32bit handles holding the record index
+ * in the low bits and its generation above. The generation is odd
+ * while the record is in use and advances on every alloc and free, so
+ * a handle kept by a timer or posted by another thread stops resolving
+ * as soon as its connection is freed, even if the record is reused.
+ *
+ * A slab belongs to a single loop and is not thread-safe, other
+ * threads only pass handles around.
+ */
+enum {
+	SANCUS_CONN_SLAB_CACHELINE = 64,
+	SANCUS_CONN_SLAB_MAX       = 1 << 20,	/* records, leaving 12 bits of generation */
+};
+
+/* never a valid handle */
+#define SANCUS_CONN_HANDLE_NONE	((uint32_t)0)
+
+/**
+ * struct sancus_conn - connection record, cache line aligned with the
+ * user area following on the next cache line
+ *
+ * @gen:	generation, odd while in use
+ * @next:	next free record, while free
+ * @stream:	server side connection
+ * @conn:	client side connection
+ */
+struct sancus_conn {
+	uint32_t gen;
+	uint32_t next;
+
+	union {
+		struct sancus_stream stream;
+		struct sancus_tcp_conn conn;
+	};
+};
+
+/**
+ * struct sancus_conn_slab - connection slab
+ *
+ * @mem:	as allocated
+ * @base:	first record, cache line aligned
+ * @stride:	distance between records
+ * @user_size:	size of the user area of each record
+ * @capacity:	number of records
+ * @used:	records in use
+ * @free:	first free record, @capacity when full
+ * @index_bits:	low bits of a handle holding the index
+ */
+struct sancus_conn_slab {
+	void *mem;
+	char *base;
+	size_t stride;
+	size_t user_size;
+
+	uint32_t capacity;
+	uint32_t used;
+	uint32_t free;
+	unsigned index_bits;
+};
+
+/**
+ * sancus_conn_slab_init - allocates and initializes a slab
+ *
+ * @self:	slab to initialize
+ * @capacity:	number of records, up to %SANCUS_CONN_SLAB_MAX
+ * @user_size:	bytes of user area per record
+ *
+ * Returns 0 on success and -1 on error, %EINVAL if @capacity is out of
+ * range or %ENOMEM. errno set accordingly.
+ */
+int sancus_conn_slab_init(struct sancus_conn_slab *self,
+			  uint32_t capacity, size_t user_size);
+
+/**
+ * sancus_conn_slab_destroy - releases the memory of a slab, all its
+ * connections shall be already closed
+ *
+ * @self:	slab to destroy
+ */
+void sancus_conn_slab_destroy(struct sancus_conn_slab *self);
+
+/**
+ * sancus_conn_slab_alloc - takes a zeroed record
+ *
+ * @self:	slab
+ *
+ * Returns %NULL with errno set to %ENOBUFS if the slab is full.
+ */
+struct sancus_conn *sancus_conn_slab_alloc(struct sancus_conn_slab *self);
+
+/**
+ * sancus_conn_slab_free - returns a record to the slab, invalidating
+ * its handles
+ *
+ * @self:	slab
+ * @c:		record in use
+ */
+void sancus_conn_slab_free(struct sancus_conn_slab *self, struct sancus_conn *c);
+
+/**
+ * sancus_conn_slab_at - record by index
+ */
+static inline struct sancus_conn *sancus_conn_slab_at(const struct sancus_conn_slab *self,
+						      uint32_t index)
+{
+	return (struct sancus_conn *)(self->base + (size_t)index * self->stride);
+}
+
+/**
+ * sancus_conn_slab_index - index of a record
+ */
+static inline uint32_t sancus_conn_slab_index(const struct sancus_conn_slab *self,
+					      const struct sancus_conn *c)
+{
+	return (uint32_t)((size_t)((const char *)c - self->base) / self->stride);
+}
+
+/**
+ * sancus_conn_slab_get - resolves a handle
+ *
+ * @self:	slab
+ * @h:		handle
+ *
+ * Returns the record, or %NULL if @h is stale or invalid.
+ */
+static inline struct sancus_conn *sancus_conn_slab_get(const struct sancus_conn_slab *self,
+						       uint32_t h)
+{
+	uint32_t index = h & ((UINT32_C(1) << self->index_bits) - 1);
+	uint32_t gen = h >> self->index_bits;
+	struct sancus_conn *c;
+
+	if (index >= self->capacity || !(gen & 1))
+		return NULL;
+
+	c = sancus_conn_slab_at(self, index);
+	return c->gen == gen ? c : NULL;
+}
+
+/**
+ * sancus_conn_slab_handle - current handle of a record in use
+ */
+static inline uint32_t sancus_conn_slab_handle(const struct sancus_conn_slab *self,
+					       const struct sancus_conn *c)
+{
+	return (c->gen << self->index_bits) | sancus_conn_slab_index(self, c);
+}
+
+/* the user area starts on the next cache line */
+#define SANCUS_CONN_USER_OFFSET \
+	((sizeof(struct sancus_conn) + SANCUS_CONN_SLAB_CACHELINE - 1) & \
+	 ~(size_t)(SANCUS_CONN_SLAB_CACHELINE - 1))
+
+/**
+ * sancus_conn_user - user area of a record
+ */
+static inline void *sancus_conn_user(struct sancus_conn *c)
+{
+	return (char *)c + SANCUS_CONN_USER_OFFSET;
+}
+
+/**
+ * sancus_conn_from_stream - record of a stream
+ */
+#define sancus_conn_from_stream(S)	container_of(S, struct sancus_conn, stream)
+
+/**
+ * sancus_conn_from_conn - record of a client connection
+ */
+#define sancus_conn_from_conn(C)	container_of(C, struct sancus_conn, conn)
+
+#endif /* !__SANCUS_CONN_SLAB_H__ */
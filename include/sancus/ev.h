@@ -5,8 +5,10 @@
 
 struct sancus_ev_loop;
 struct sancus_ev_fd;
+struct sancus_ev_timer;
 
 typedef void (*sancus_ev_fd_cb) (struct sancus_ev_loop *, struct sancus_ev_fd *, int);
+typedef void (*sancus_ev_timer_cb) (struct sancus_ev_loop *, struct sancus_ev_timer *, int);
 
 enum {
 	SANCUS_EV_READ,
@@ -54,4 +56,41 @@ static inline struct timespec sancus_ev_now(struct sancus_ev_loop *loop)
 {
 	return loop->now;
 }
+
+/*
+ * timers, @at is when it's due in loop time, zero while stopped
+ */
+struct sancus_ev_timer {
+	struct timespec at;
+	sancus_ev_timer_cb cb;
+};
+
+static inline void sancus_ev_timer_init(struct sancus_ev_timer *w, sancus_ev_timer_cb cb)
+{
+	w->at = (struct timespec) { 0, 0 };
+	w->cb = cb;
+}
+
+static inline int sancus_ev_timer_start(struct sancus_ev_loop *loop, struct sancus_ev_timer *w,
+					struct timespec after)
+{
+	w->at.tv_sec = loop->now.tv_sec + after.tv_sec;
+	w->at.tv_nsec = loop->now.tv_nsec + after.tv_nsec;
+	if (w->at.tv_nsec >= 1000000000) {
+		w->at.tv_sec++;
+		w->at.tv_nsec -= 1000000000;
+	}
+	return -38 /*-ENOSYS*/;
+}
+
+static inline int sancus_ev_timer_stop(struct sancus_ev_loop *UNUSED(loop), struct sancus_ev_timer *w)
+{
+	w->at = (struct timespec) { 0, 0 };
+	return -38 /*-ENOSYS*/;
+}
+
+static inline int sancus_ev_timer_is_active(const struct sancus_ev_timer *w)
+{
+	return w->at.tv_sec != 0 || w->at.tv_nsec != 0;
+}
 #endif /* !__SANCUS_EV_H__ */
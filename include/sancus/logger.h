@@ -4,8 +4,11 @@
 #include <sancus/bit.h>
 
 #include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 struct sancus_logger;
 struct sancus_logger_backend;
@@ -34,6 +37,57 @@ enum {
 	SANCUS_LOG_VERBOSE = SANCUS_LOG_NORMAL | SANCUS_LOG_DEBUG,
 };
 
+/*
+ * structured fields
+ */
+enum sancus_log_field_type {
+	SANCUS_LOG_FIELD_INT,
+	SANCUS_LOG_FIELD_UINT,
+	SANCUS_LOG_FIELD_STRING,
+	SANCUS_LOG_FIELD_DURATION,
+};
+
+/**
+ * struct sancus_log_field - typed key/value attached to a message
+ *
+ * @key:	name of the field
+ * @type:	enum sancus_log_field_type
+ * @i:		value of %SANCUS_LOG_FIELD_INT fields
+ * @u:		value of %SANCUS_LOG_FIELD_UINT fields
+ * @s:		value of %SANCUS_LOG_FIELD_STRING fields, @len long
+ * @ts:		value of %SANCUS_LOG_FIELD_DURATION fields
+ */
+struct sancus_log_field {
+	const char *key;
+	enum sancus_log_field_type type;
+
+	union {
+		int64_t i;
+		uint64_t u;
+		struct {
+			const char *s;
+			size_t len;
+		};
+		struct timespec ts;
+	};
+};
+
+#define SANCUS_LOG_INT(K, V)      { .key = (K), .type = SANCUS_LOG_FIELD_INT, .i = (int64_t)(V) }
+#define SANCUS_LOG_UINT(K, V)     { .key = (K), .type = SANCUS_LOG_FIELD_UINT, .u = (uint64_t)(V) }
+#define SANCUS_LOG_STRN(K, V, L)  { .key = (K), .type = SANCUS_LOG_FIELD_STRING, .s = (V), .len = (L) }
+#define SANCUS_LOG_STR(K, V)      SANCUS_LOG_STRN((K), (V), sancus_log__strlen(V))
+#define SANCUS_LOG_DURATION(K, V) { .key = (K), .type = SANCUS_LOG_FIELD_DURATION, .ts = (V) }
+
+static inline size_t sancus_log__strlen(const char *s)
+{
+	return s != NULL ? strlen(s) : 0;
+}
+
+/* expands to the array and count arguments of the _fields macros */
+#define SANCUS_LOG_FIELDS(...) \
+	(const struct sancus_log_field[]) { __VA_ARGS__ }, \
+	(sizeof((const struct sancus_log_field[]) { __VA_ARGS__ }) / sizeof(struct sancus_log_field))
+
 /*
  * sancus_logger_backend
  */
@@ -43,11 +97,38 @@ typedef int (*sancus_logger_backend_f) (unsigned level,
 					const char *extra, size_t extra_len,
 					void *ctx);
 
+typedef int (*sancus_logger_vprintf_f) (unsigned level,
+					const char *prefix, size_t prefix_len,
+					const char *func, unsigned line,
+					const char *fmt, va_list ap,
+					void *ctx);
+
+typedef int (*sancus_logger_fields_f) (unsigned level,
+				       const char *prefix, size_t prefix_len,
+				       const char *msg, size_t msg_len,
+				       const struct sancus_log_field *fields, size_t count,
+				       void *ctx);
+
+typedef int (*sancus_logger_flush_f) (void *ctx);
+
 typedef ssize_t (*sancus_logger_prefixer_f) (const struct sancus_logger *logger,
 					     char *buf, size_t len);
 
+/**
+ * struct sancus_logger_backend - logger output
+ *
+ * @f:		writes an already formatted message
+ * @vprintf:	optional, receives printf-style messages unformatted
+ * @fields:	optional, receives structured fields unrendered. Without
+ *		it fields are rendered as `key=value` extra data
+ * @flush:	optional, waits until the output reaches its destination
+ * @ctx:	backend's data
+ */
 struct sancus_logger_backend {
 	sancus_logger_backend_f f;
+	sancus_logger_vprintf_f vprintf;
+	sancus_logger_fields_f fields;
+	sancus_logger_flush_f flush;
 	void *ctx;
 };
 
@@ -55,9 +136,154 @@ int sancus_logger_set_default_backend(const struct sancus_logger_backend *);
 
 int sancus_logger_set_fd_backend(int);
 
+/**
+ * sancus_logger_set_json_backend - makes a backend writing one JSON
+ * object per line to @fd the default one
+ */
+int sancus_logger_set_json_backend(int fd);
+
+/*
+ * datagram backend
+ */
+enum sancus_logger_datagram_format {
+	SANCUS_LOGGER_JOURNALD,
+	SANCUS_LOGGER_SYSLOG,
+};
+
+/**
+ * struct sancus_logger_datagram_settings - datagram backend settings
+ *
+ * @format:	journald native protocol, or RFC 5424 syslog
+ * @path:	AF_UNIX socket to send to, %NULL for the default of @format,
+ *		/run/systemd/journal/socket or /dev/log
+ * @ident:	SYSLOG_IDENTIFIER or APP-NAME, %NULL for none
+ * @facility:	syslog facility, as LOG_* from <syslog.h>, 0 for LOG_USER
+ */
+struct sancus_logger_datagram_settings {
+	enum sancus_logger_datagram_format format;
+	const char *path;
+	const char *ident;
+	int facility;
+};
+
+/**
+ * sancus_logger_set_datagram_backend - makes a backend sending each
+ * record as one datagram the default one. Records arriving while
+ * others are being sent are batched with sendmmsg()
+ */
+int sancus_logger_set_datagram_backend(const struct sancus_logger_datagram_settings *);
+
+/*
+ * memory-mapped ring file backend
+ *
+ * records are copied into a shared mapping of a file used as a ring,
+ * so the last ones survive the process dying hard. See
+ * <sancus/logger_ring.h> and sancus-logring.
+ */
+
+/**
+ * struct sancus_logger_ring_settings - ring file backend settings
+ *
+ * @path:	file to map, created if needed. An existing ring of the
+ *		same size is appended to
+ * @size:	size of the ring, rounded up to a power of two, 0 for
+ *		the default
+ */
+struct sancus_logger_ring_settings {
+	const char *path;
+	size_t size;
+};
+
+/**
+ * sancus_logger_set_ring_backend - maps the ring file and makes the
+ * ring backend the default one. Flushing it, as sancus_assert() does
+ * before abort(), msync()s the ring. Only one ring can be mapped
+ */
+int sancus_logger_set_ring_backend(const struct sancus_logger_ring_settings *);
+
+/*
+ * asynchronous fd backend
+ *
+ * each thread renders its lines into its own ring, and a writer
+ * thread drains all of them into the fd using batched writev()s.
+ */
+enum sancus_logger_async_policy {
+	SANCUS_LOGGER_ASYNC_DROP,	/* drop lines when the ring is full */
+	SANCUS_LOGGER_ASYNC_BLOCK,	/* wait for the writer to make room */
+};
+
+/**
+ * struct sancus_logger_async_settings - asynchronous fd backend settings
+ *
+ * @fd:		file descriptor to write to
+ * @ring_size:	size of each per-thread ring, 0 for the default
+ * @policy:	what to do when a thread's ring is full
+ * @binary:	write binary records instead of text, deferring the
+ *		formatting of printf-style messages to sancus-logdecode.
+ *		See <sancus/logger_binary.h>
+ */
+struct sancus_logger_async_settings {
+	int fd;
+	size_t ring_size;
+	enum sancus_logger_async_policy policy;
+	bool binary;
+};
+
+/**
+ * sancus_logger_set_async_backend - starts the writer thread and
+ * makes the asynchronous backend the default one. Pending lines are
+ * flushed at exit()
+ */
+int sancus_logger_set_async_backend(const struct sancus_logger_async_settings *);
+
+/**
+ * sancus_logger_async_flush - waits until all pending lines are written
+ */
+int sancus_logger_async_flush(void);
+
+/**
+ * sancus_logger_async_stop - flushes and stops the writer thread,
+ * lines logged afterwards are written synchronously. Lines being
+ * logged by other threads meanwhile are waited for
+ */
+int sancus_logger_async_stop(void);
+
+/**
+ * sancus_logger_async_dropped - number of lines dropped so far
+ */
+unsigned long sancus_logger_async_dropped(void);
+
+/**
+ * sancus_logger_flush - flushes the backend used by a logger, if needed
+ */
+int sancus_logger_flush(const struct sancus_logger *);
+
 /*
  * sancus_logger
  */
+
+/**
+ * struct sancus_logger_cache - settings resolved from the parent chain
+ *
+ * @stamp:	sancus_logger__generation when resolved, 0 if never
+ * @mask:	effective mask
+ * @prefix:	logger providing the prefix, if any
+ * @backend:	backend to use, %NULL for the default one
+ */
+struct sancus_logger_cache {
+	unsigned stamp;
+	unsigned mask;
+
+	const struct sancus_logger *prefix;
+	const struct sancus_logger_backend *backend;
+};
+
+/*
+ * loggers declared with DECL_SANCUS_LOGGER() or set up at runtime, by
+ * sancus_logger_init2() or any setter, cache what they resolve from
+ * their parents in @cached. Those initialized with SANCUS_LOGGER_INIT(),
+ * possibly in read-only memory, resolve on every use.
+ */
 struct sancus_logger {
 	const struct sancus_logger *parent;
 
@@ -67,15 +293,85 @@ struct sancus_logger {
 	sancus_logger_prefixer_f prefixer;
 
 	const struct sancus_logger_backend *backend;
+
+	struct sancus_logger_cache *cache;
+	struct sancus_logger_cache cached;
 };
 
+/*
+ * bumped by every setter, so a cache stamped with the current value
+ * is valid without looking at the parents. Never 0.
+ */
+extern unsigned sancus_logger__generation;
+
+void sancus_logger__resolve(const struct sancus_logger *, unsigned gen,
+			    struct sancus_logger_cache *);
+
+static inline void sancus_logger__touch(struct sancus_logger *log)
+{
+	log->cache = &log->cached;
+
+	if (__atomic_add_fetch(&sancus_logger__generation, 1, __ATOMIC_RELEASE) == 0)
+		__atomic_add_fetch(&sancus_logger__generation, 1, __ATOMIC_RELEASE);
+}
+
+/* a copied logger points to the cache of the original */
+static inline
+const struct sancus_logger_cache *sancus_logger__cached(const struct sancus_logger *log,
+							unsigned gen)
+{
+	const struct sancus_logger_cache *c = log->cache;
+
+	if (c == &log->cached && __atomic_load_n(&c->stamp, __ATOMIC_ACQUIRE) == gen)
+		return c;
+	return NULL;
+}
+
+static inline
+struct sancus_logger_cache sancus_logger__settings(const struct sancus_logger *log)
+{
+	struct sancus_logger_cache c;
+	unsigned gen = __atomic_load_n(&sancus_logger__generation, __ATOMIC_ACQUIRE);
+	const struct sancus_logger_cache *p = sancus_logger__cached(log, gen);
+
+	if (p != NULL) {
+		c.stamp = gen;
+		c.mask = __atomic_load_n(&p->mask, __ATOMIC_RELAXED);
+		c.prefix = __atomic_load_n(&p->prefix, __ATOMIC_RELAXED);
+		c.backend = __atomic_load_n(&p->backend, __ATOMIC_RELAXED);
+	} else {
+		sancus_logger__resolve(log, gen, &c);
+	}
+
+	return c;
+}
+
+static inline unsigned sancus_logger__mask(const struct sancus_logger *log)
+{
+	struct sancus_logger_cache c;
+	unsigned gen = __atomic_load_n(&sancus_logger__generation, __ATOMIC_ACQUIRE);
+	const struct sancus_logger_cache *p = sancus_logger__cached(log, gen);
+
+	if (p != NULL)
+		return __atomic_load_n(&p->mask, __ATOMIC_RELAXED);
+
+	sancus_logger__resolve(log, gen, &c);
+	return c.mask;
+}
+
 #define SANCUS__LOGGER_INIT(S, M) { \
 	.prefix = (S), \
 	.mask = (M) == 0 ? SANCUS_LOG_NORMAL : (M), \
 }
 
+#define SANCUS__LOGGER_INIT_CACHED(N, S, M) { \
+	.prefix = (S), \
+	.mask = (M) == 0 ? SANCUS_LOG_NORMAL : (M), \
+	.cache = &(N).cached, \
+}
+
 #define SANCUS_LOGGER_INIT(S, M) (struct sancus_logger) SANCUS__LOGGER_INIT(S, M)
-#define DECL_SANCUS_LOGGER(N, S, M) struct sancus_logger N = SANCUS__LOGGER_INIT(S, M)
+#define DECL_SANCUS_LOGGER(N, S, M) struct sancus_logger N = SANCUS__LOGGER_INIT_CACHED(N, S, M)
 
 static inline void sancus_logger_init2(struct sancus_logger *log,
 				       const struct sancus_logger *parent,
@@ -94,6 +390,7 @@ static inline void sancus_logger_init2(struct sancus_logger *log,
 			.mask = mask,
 			.prefixer = f,
 		};
+		sancus_logger__touch(log);
 	}
 }
 
@@ -115,6 +412,7 @@ void sancus_logger_set_prefix(struct sancus_logger *log,
 			      const char *prefix)
 {
 	log->prefix = prefix;
+	sancus_logger__touch(log);
 }
 
 static inline
@@ -128,6 +426,15 @@ void sancus_logger_set_prefixer(struct sancus_logger *log,
 				sancus_logger_prefixer_f f)
 {
 	log->prefixer = f;
+	sancus_logger__touch(log);
+}
+
+static inline
+void sancus_logger_set_backend(struct sancus_logger *log,
+			       const struct sancus_logger_backend *backend)
+{
+	log->backend = backend;
+	sancus_logger__touch(log);
 }
 
 ssize_t sancus_logger_render_prefix(const struct sancus_logger *, char *, size_t);
@@ -137,6 +444,7 @@ void sancus_logger_set_mask(struct sancus_logger *log,
 			    unsigned mask)
 {
 	log->mask = mask;
+	sancus_logger__touch(log);
 }
 
 static inline
@@ -144,6 +452,7 @@ void sancus_logger_extend_mask(struct sancus_logger *log,
 			       unsigned mask)
 {
 	log->mask = (unsigned)sancus_bit_cms(log->mask, mask, mask, 0);
+	sancus_logger__touch(log);
 }
 
 static inline
@@ -151,6 +460,7 @@ void sancus_logger_unset_mask(struct sancus_logger *log,
 			      unsigned mask)
 {
 	log->mask = (unsigned)sancus_bit_cms(log->mask, 0, mask, 0);
+	sancus_logger__touch(log);
 }
 
 static inline
@@ -161,12 +471,8 @@ int sancus_logger_has_level(const struct sancus_logger *log,
 		mask = 1;
 	else if (log == NULL)
 		mask &= SANCUS_LOG_NORMAL;
-	else if (log->mask != 0)
-		mask &= log->mask;
-	else if (log->parent == NULL)
-		mask &= SANCUS_LOG_NORMAL;
 	else
-		return sancus_logger_has_level(log->parent, mask);
+		mask &= sancus_logger__mask(log);
 
 	return !!mask;
 }
@@ -219,6 +525,23 @@ int sancus_logger__hexdumpf(const struct sancus_logger *log,
 			    size_t width, const void *data, size_t data_len,
 			    const char *fmt, ...);
 
+/*
+ * logs a message with structured fields
+ */
+__attr_vprintf(7)
+int sancus_logger__vfieldsf(const struct sancus_logger *log,
+			    enum sancus_log_level level,
+			    const char *func, unsigned line,
+			    const struct sancus_log_field *fields, size_t count,
+			    const char *fmt, va_list ap);
+
+__attr_printf(7)
+int sancus_logger__fieldsf(const struct sancus_logger *log,
+			   enum sancus_log_level level,
+			   const char *func, unsigned line,
+			   const struct sancus_log_field *fields, size_t count,
+			   const char *fmt, ...);
+
 /*
  * assert()
  */
@@ -251,80 +574,166 @@ int sancus__trap(const struct sancus_logger *log, int ndebug,
 #define sancus_log__error(D, ...)          sancus_logger__printf((D),   SANCUS_LOG_ERROR_BIT,   NULL, 0, __VA_ARGS__)
 #define sancus_log__error_dump(D, ...)     sancus_logger__dumpf((D),    SANCUS_LOG_ERROR_BIT,   NULL, 0, __VA_ARGS__)
 #define sancus_log__error_hexdump(D, ...)  sancus_logger__hexdumpf((D), SANCUS_LOG_ERROR_BIT,   NULL, 0, __VA_ARGS__)
+#define sancus_log__error_fields(D, ...)   sancus_logger__fieldsf((D),  SANCUS_LOG_ERROR_BIT,   NULL, 0, __VA_ARGS__)
 
 #define sancus_log__warn(D, ...)           sancus_logger__printf((D),   SANCUS_LOG_WARN_BIT,  NULL, 0, __VA_ARGS__)
 #define sancus_log__warn_dump(D, ...)      sancus_logger__dumpf((D),    SANCUS_LOG_WARN_BIT,  NULL, 0, __VA_ARGS__)
 #define sancus_log__warn_hexdump(D, ...)   sancus_logger__hexdumpf((D), SANCUS_LOG_WARN_BIT,  NULL, 0, __VA_ARGS__)
+#define sancus_log__warn_fields(D, ...)    sancus_logger__fieldsf((D),  SANCUS_LOG_WARN_BIT,  NULL, 0, __VA_ARGS__)
 
 #define sancus_log__info(D, ...)           sancus_logger__printf((D),   SANCUS_LOG_INFO_BIT,  NULL, 0, __VA_ARGS__)
 #define sancus_log__info_dump(D, ...)      sancus_logger__dumpf((D),    SANCUS_LOG_INFO_BIT,  NULL, 0, __VA_ARGS__)
 #define sancus_log__info_hexdump(D, ...)   sancus_logger__hexdumpf((D), SANCUS_LOG_INFO_BIT,  NULL, 0, __VA_ARGS__)
+#define sancus_log__info_fields(D, ...)    sancus_logger__fieldsf((D),  SANCUS_LOG_INFO_BIT,  NULL, 0, __VA_ARGS__)
 
 #define sancus_log__trace(D, ...)          sancus_logger__printf((D),   SANCUS_LOG_TRACE_BIT, __func__, __LINE__, __VA_ARGS__)
 #define sancus_log__trace_dump(D, ...)     sancus_logger__dumpf((D),    SANCUS_LOG_TRACE_BIT, __func__, __LINE__, __VA_ARGS__)
 #define sancus_log__trace_hexdump(D, ...)  sancus_logger__hexdumpf((D), SANCUS_LOG_TRACE_BIT, __func__, __LINE__, __VA_ARGS__)
+#define sancus_log__trace_fields(D, ...)   sancus_logger__fieldsf((D),  SANCUS_LOG_TRACE_BIT, __func__, __LINE__, __VA_ARGS__)
 
 #define sancus_log__debug(D, ...)          sancus_logger__printf((D),   SANCUS_LOG_DEBUG_BIT, __func__, 0, __VA_ARGS__)
 #define sancus_log__debug_dump(D, ...)     sancus_logger__dumpf((D),    SANCUS_LOG_DEBUG_BIT, __func__, 0, __VA_ARGS__)
 #define sancus_log__debug_hexdump(D, ...)  sancus_logger__hexdumpf((D), SANCUS_LOG_DEBUG_BIT, __func__, 0, __VA_ARGS__)
+#define sancus_log__debug_fields(D, ...)   sancus_logger__fieldsf((D),  SANCUS_LOG_DEBUG_BIT, __func__, 0, __VA_ARGS__)
 
 #define sancus_log__notice(D, ...)         sancus_logger__printf((D),   SANCUS_LOG_DEBUG_BIT, NULL, 0, __VA_ARGS__)
 #define sancus_log__notice_dump(D, ...)    sancus_logger__dumpf((D),    SANCUS_LOG_DEBUG_BIT, NULL, 0, __VA_ARGS__)
 #define sancus_log__notice_hexdump(D, ...) sancus_logger__hexdumpf((D), SANCUS_LOG_DEBUG_BIT, NULL, 0, __VA_ARGS__)
 
-#define sancus_log__if_level(D, L, F, ...) do { \
-	if (sancus_logger_has_level((D), (L))) \
+/*
+ * SANCUS_LOG_MIN_LEVEL - least important level built in. Log sites of
+ * less important levels compile to nothing, their arguments included,
+ * e.g. -DSANCUS_LOG_MIN_LEVEL=SANCUS_LOG_INFO_BIT drops trace and
+ * debug. Errors are always kept.
+ */
+#ifndef SANCUS_LOG_MIN_LEVEL
+#define SANCUS_LOG_MIN_LEVEL SANCUS_LOG_DEBUG_BIT
+#endif
+
+#define sancus_log__is_built(B) ((B) == SANCUS_LOG_ERROR_BIT || (B) <= (SANCUS_LOG_MIN_LEVEL))
+
+#define sancus_log__if_level(D, L, B, F, ...) do { \
+	if (sancus_log__is_built(B) && sancus_logger_has_level((D), (L))) \
 		sancus_log__ ##F(D, __VA_ARGS__); \
 	} while(0)
 
-#define sancus_log_error2(D, L, ...)          sancus_log__if_level((D), (L), error,  __VA_ARGS__)
-#define sancus_log_error_dump2(D, L, ...)     sancus_log__if_level((D), (L), error_dump,  __VA_ARGS__)
-#define sancus_log_error_hexdump2(D, L, ...)  sancus_log__if_level((D), (L), error_hexdump,  __VA_ARGS__)
+#define sancus_log_error2(D, L, ...)          sancus_log__if_level((D), (L), SANCUS_LOG_ERROR_BIT, error,  __VA_ARGS__)
+#define sancus_log_error_dump2(D, L, ...)     sancus_log__if_level((D), (L), SANCUS_LOG_ERROR_BIT, error_dump,  __VA_ARGS__)
+#define sancus_log_error_hexdump2(D, L, ...)  sancus_log__if_level((D), (L), SANCUS_LOG_ERROR_BIT, error_hexdump,  __VA_ARGS__)
+#define sancus_log_error_fields2(D, L, ...)   sancus_log__if_level((D), (L), SANCUS_LOG_ERROR_BIT, error_fields,  __VA_ARGS__)
 
-#define sancus_log_warn2(D, L, ...)           sancus_log__if_level((D), (L), warn,   __VA_ARGS__)
-#define sancus_log_warn_dump2(D, L, ...)      sancus_log__if_level((D), (L), warn_dump,   __VA_ARGS__)
-#define sancus_log_warn_hexdump2(D, L, ...)   sancus_log__if_level((D), (L), warn_hexdump,   __VA_ARGS__)
+#define sancus_log_warn2(D, L, ...)           sancus_log__if_level((D), (L), SANCUS_LOG_WARN_BIT, warn,   __VA_ARGS__)
+#define sancus_log_warn_dump2(D, L, ...)      sancus_log__if_level((D), (L), SANCUS_LOG_WARN_BIT, warn_dump,   __VA_ARGS__)
+#define sancus_log_warn_hexdump2(D, L, ...)   sancus_log__if_level((D), (L), SANCUS_LOG_WARN_BIT, warn_hexdump,   __VA_ARGS__)
+#define sancus_log_warn_fields2(D, L, ...)    sancus_log__if_level((D), (L), SANCUS_LOG_WARN_BIT, warn_fields,  __VA_ARGS__)
 
-#define sancus_log_info2(D, L, ...)           sancus_log__if_level((D), (L), info,   __VA_ARGS__)
-#define sancus_log_info_dump2(D, L, ...)      sancus_log__if_level((D), (L), info_dump,   __VA_ARGS__)
-#define sancus_log_info_hexdump2(D, L, ...)   sancus_log__if_level((D), (L), info_hexdump,   __VA_ARGS__)
+#define sancus_log_info2(D, L, ...)           sancus_log__if_level((D), (L), SANCUS_LOG_INFO_BIT, info,   __VA_ARGS__)
+#define sancus_log_info_dump2(D, L, ...)      sancus_log__if_level((D), (L), SANCUS_LOG_INFO_BIT, info_dump,   __VA_ARGS__)
+#define sancus_log_info_hexdump2(D, L, ...)   sancus_log__if_level((D), (L), SANCUS_LOG_INFO_BIT, info_hexdump,   __VA_ARGS__)
+#define sancus_log_info_fields2(D, L, ...)    sancus_log__if_level((D), (L), SANCUS_LOG_INFO_BIT, info_fields,  __VA_ARGS__)
 
-#define sancus_log_trace2(D, L, ...)          sancus_log__if_level((D), (L), trace,  __VA_ARGS__)
-#define sancus_log_trace_dump2(D, L, ...)     sancus_log__if_level((D), (L), trace_dump,  __VA_ARGS__)
-#define sancus_log_trace_hexdump2(D, L, ...)  sancus_log__if_level((D), (L), trace_hexdump,  __VA_ARGS__)
+#define sancus_log_trace2(D, L, ...)          sancus_log__if_level((D), (L), SANCUS_LOG_TRACE_BIT, trace,  __VA_ARGS__)
+#define sancus_log_trace_dump2(D, L, ...)     sancus_log__if_level((D), (L), SANCUS_LOG_TRACE_BIT, trace_dump,  __VA_ARGS__)
+#define sancus_log_trace_hexdump2(D, L, ...)  sancus_log__if_level((D), (L), SANCUS_LOG_TRACE_BIT, trace_hexdump,  __VA_ARGS__)
+#define sancus_log_trace_fields2(D, L, ...)   sancus_log__if_level((D), (L), SANCUS_LOG_TRACE_BIT, trace_fields,  __VA_ARGS__)
 
-#define sancus_log_debug2(D, L, ...)          sancus_log__if_level((D), (L), debug,  __VA_ARGS__)
-#define sancus_log_debug_dump2(D, L, ...)     sancus_log__if_level((D), (L), debug_dump,  __VA_ARGS__)
-#define sancus_log_debug_hexdump2(D, L, ...)  sancus_log__if_level((D), (L), debug_hexdump,  __VA_ARGS__)
+#define sancus_log_debug2(D, L, ...)          sancus_log__if_level((D), (L), SANCUS_LOG_DEBUG_BIT, debug,  __VA_ARGS__)
+#define sancus_log_debug_dump2(D, L, ...)     sancus_log__if_level((D), (L), SANCUS_LOG_DEBUG_BIT, debug_dump,  __VA_ARGS__)
+#define sancus_log_debug_hexdump2(D, L, ...)  sancus_log__if_level((D), (L), SANCUS_LOG_DEBUG_BIT, debug_hexdump,  __VA_ARGS__)
+#define sancus_log_debug_fields2(D, L, ...)   sancus_log__if_level((D), (L), SANCUS_LOG_DEBUG_BIT, debug_fields,  __VA_ARGS__)
 
-#define sancus_log_notice2(D, L, ...)         sancus_log__if_level((D), (L), notice, __VA_ARGS__)
-#define sancus_log_notice_dump2(D, L, ...)    sancus_log__if_level((D), (L), notice_dump, __VA_ARGS__)
-#define sancus_log_notice_hexdump2(D, L, ...) sancus_log__if_level((D), (L), notice_hexdump, __VA_ARGS__)
+#define sancus_log_notice2(D, L, ...)         sancus_log__if_level((D), (L), SANCUS_LOG_DEBUG_BIT, notice, __VA_ARGS__)
+#define sancus_log_notice_dump2(D, L, ...)    sancus_log__if_level((D), (L), SANCUS_LOG_DEBUG_BIT, notice_dump, __VA_ARGS__)
+#define sancus_log_notice_hexdump2(D, L, ...) sancus_log__if_level((D), (L), SANCUS_LOG_DEBUG_BIT, notice_hexdump, __VA_ARGS__)
 
 #define sancus_log_error(...)                 sancus_log__error(__VA_ARGS__)
 #define sancus_log_error_dump(...)            sancus_log__error_dump(__VA_ARGS__)
 #define sancus_log_error_hexdump(...)         sancus_log__error_hexdump(__VA_ARGS__)
+#define sancus_log_error_fields(...)          sancus_log__error_fields(__VA_ARGS__)
 
 #define sancus_log_warn(D, ...)               sancus_log_warn2((D), SANCUS_LOG_WARN, __VA_ARGS__)
 #define sancus_log_warn_dump(D, ...)          sancus_log_warn_dump2((D), SANCUS_LOG_WARN, __VA_ARGS__)
 #define sancus_log_warn_hexdump(D, ...)       sancus_log_warn_hexdump2((D), SANCUS_LOG_WARN, __VA_ARGS__)
+#define sancus_log_warn_fields(D, ...)        sancus_log_warn_fields2((D), SANCUS_LOG_WARN, __VA_ARGS__)
 
 #define sancus_log_info(D, ...)               sancus_log_info2((D), SANCUS_LOG_INFO, __VA_ARGS__)
 #define sancus_log_info_dump(D, ...)          sancus_log_info_dump2((D), SANCUS_LOG_INFO, __VA_ARGS__)
 #define sancus_log_info_hexdump(D, ...)       sancus_log_info_hexdump2((D), SANCUS_LOG_INFO, __VA_ARGS__)
+#define sancus_log_info_fields(D, ...)        sancus_log_info_fields2((D), SANCUS_LOG_INFO, __VA_ARGS__)
 
 #define sancus_log_trace(D, ...)              sancus_log_trace2((D), SANCUS_LOG_TRACE, __VA_ARGS__)
 #define sancus_log_trace_dump(D, ...)         sancus_log_trace_dump2((D), SANCUS_LOG_TRACE, __VA_ARGS__)
 #define sancus_log_trace_hexdump(D, ...)      sancus_log_trace_hexdump2((D), SANCUS_LOG_TRACE, __VA_ARGS__)
+#define sancus_log_trace_fields(D, ...)       sancus_log_trace_fields2((D), SANCUS_LOG_TRACE, __VA_ARGS__)
 
 #define sancus_log_debug(D, ...)              sancus_log_debug2((D), SANCUS_LOG_DEBUG, __VA_ARGS__)
 #define sancus_log_debug_dump(D, ...)         sancus_log_debug_dump2((D), SANCUS_LOG_DEBUG, __VA_ARGS__)
 #define sancus_log_debug_hexdump(D, ...)      sancus_log_debug_hexdump2((D), SANCUS_LOG_DEBUG, __VA_ARGS__)
+#define sancus_log_debug_fields(D, ...)       sancus_log_debug_fields2((D), SANCUS_LOG_DEBUG, __VA_ARGS__)
 
 #define sancus_log_notice(D, ...)             sancus_log_notice2((D), SANCUS_LOG_DEBUG, __VA_ARGS__)
 #define sancus_log_notice_dump(D, ...)        sancus_log_notice_dump2((D), SANCUS_LOG_DEBUG, __VA_ARGS__)
 #define sancus_log_notice_hexdump(D, ...)     sancus_log_notice_hexdump2((D), SANCUS_LOG_DEBUG, __VA_ARGS__)
 
+/*
+ * rate limited and sampled log sites, each one keeping its own state.
+ *
+ * rate limited sites allow bursts of up to @N messages every @MS
+ * milliseconds, and report how many were suppressed when they reopen.
+ * sampled sites log one of every @N messages.
+ */
+
+/**
+ * struct sancus_logger_ratelimit - state of a rate limited log site
+ *
+ * @interval_ms:	length of the window
+ * @burst:		messages allowed per window
+ * @tat:		theoretical arrival time of the next message, in ns
+ * @suppressed:		messages suppressed since the last one logged
+ */
+struct sancus_logger_ratelimit {
+	unsigned interval_ms;
+	unsigned burst;
+
+	uint64_t tat;
+	unsigned suppressed;
+};
+
+#define SANCUS_LOGGER_RATELIMIT_INIT(MS, N) { .interval_ms = (MS), .burst = (N) }
+
+bool sancus_logger__ratelimit(struct sancus_logger_ratelimit *,
+			      const struct sancus_logger *,
+			      enum sancus_log_level);
+
+static inline bool sancus_logger__sample(unsigned *count, unsigned n)
+{
+	return n < 2 || __atomic_fetch_add(count, 1, __ATOMIC_RELAXED) % n == 0;
+}
+
+#define sancus_log__ratelimited(D, L, B, F, MS, N, ...) do { \
+	static struct sancus_logger_ratelimit __rl = SANCUS_LOGGER_RATELIMIT_INIT(MS, N); \
+	if (sancus_log__is_built(B) && sancus_logger_has_level((D), (L)) && \
+	    sancus_logger__ratelimit(&__rl, (D), (B))) \
+		sancus_log__ ##F(D, __VA_ARGS__); \
+	} while(0)
+
+#define sancus_log__sampled(D, L, B, F, N, ...) do { \
+	static unsigned __count; \
+	if (sancus_log__is_built(B) && sancus_logger_has_level((D), (L)) && \
+	    sancus_logger__sample(&__count, (N))) \
+		sancus_log__ ##F(D, __VA_ARGS__); \
+	} while(0)
+
+#define sancus_log_error_ratelimited(D, MS, N, ...) sancus_log__ratelimited((D), SANCUS_LOG_ERR,   SANCUS_LOG_ERROR_BIT, error, (MS), (N), __VA_ARGS__)
+#define sancus_log_warn_ratelimited(D, MS, N, ...)  sancus_log__ratelimited((D), SANCUS_LOG_WARN,  SANCUS_LOG_WARN_BIT,  warn,  (MS), (N), __VA_ARGS__)
+#define sancus_log_info_ratelimited(D, MS, N, ...)  sancus_log__ratelimited((D), SANCUS_LOG_INFO,  SANCUS_LOG_INFO_BIT,  info,  (MS), (N), __VA_ARGS__)
+#define sancus_log_trace_ratelimited(D, MS, N, ...) sancus_log__ratelimited((D), SANCUS_LOG_TRACE, SANCUS_LOG_TRACE_BIT, trace, (MS), (N), __VA_ARGS__)
+#define sancus_log_debug_ratelimited(D, MS, N, ...) sancus_log__ratelimited((D), SANCUS_LOG_DEBUG, SANCUS_LOG_DEBUG_BIT, debug, (MS), (N), __VA_ARGS__)
+
+#define sancus_log_info_sampled(D, N, ...)          sancus_log__sampled((D), SANCUS_LOG_INFO,  SANCUS_LOG_INFO_BIT,  info,  (N), __VA_ARGS__)
+#define sancus_log_trace_sampled(D, N, ...)         sancus_log__sampled((D), SANCUS_LOG_TRACE, SANCUS_LOG_TRACE_BIT, trace, (N), __VA_ARGS__)
+#define sancus_log_debug_sampled(D, N, ...)         sancus_log__sampled((D), SANCUS_LOG_DEBUG, SANCUS_LOG_DEBUG_BIT, debug, (N), __VA_ARGS__)
+
 /*
  */
 #define sancus_log_perror2(D, E, F, ...)      sancus_log_error((D), F ": %s (%d)", __VA_ARGS__, strerror(E), (E))
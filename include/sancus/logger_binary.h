@@ -0,0 +1,140 @@
+#ifndef __SANCUS_LOGGER_BINARY_H__
+#define __SANCUS_LOGGER_BINARY_H__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * binary log stream, as written by the asynchronous backend in binary
+ * mode. A header followed by records, all in host byte order.
+ *
+ * Formats and function names are identified by a hash of their
+ * contents and length, and defined by a %SANCUS_LOGGER_RECORD_STRING
+ * record written right before the first record using them that makes
+ * it to the stream, so a dropped record doesn't leave others without
+ * it. Threads racing may define the same string more than once.
+ * Records of different threads are interleaved by batches, so readers
+ * need to collect all the definitions and sort messages by timestamp.
+ */
+#define SANCUS_LOGGER_BINARY_MAGIC "SANCUSLB"
+
+enum {
+	SANCUS_LOGGER_BINARY_VERSION    = 1,
+	SANCUS_LOGGER_BINARY_BYTE_ORDER = 0x0102,
+	SANCUS_LOGGER_BINARY_RECORD_MAX = 4096,
+};
+
+struct sancus_logger_binary_header {
+	char magic[8];
+	uint16_t version;
+	uint16_t byte_order;
+	uint32_t reserved;
+};
+
+/**
+ * enum sancus_logger_record_type - type of binary record
+ *
+ * @SANCUS_LOGGER_RECORD_STRING:	defines @fmt, payload is the string
+ * @SANCUS_LOGGER_RECORD_PRINTF:	payload is the prefix followed by
+ *					the encoded arguments of @fmt
+ * @SANCUS_LOGGER_RECORD_TEXT:		payload is the prefix, followed by
+ *					message and extra data, each one
+ *					preceded by its uint32_t length
+ */
+enum sancus_logger_record_type {
+	SANCUS_LOGGER_RECORD_STRING,
+	SANCUS_LOGGER_RECORD_PRINTF,
+	SANCUS_LOGGER_RECORD_TEXT,
+};
+
+enum {
+	SANCUS_LOGGER_RECORD_TRUNCATED = 1,
+};
+
+/**
+ * struct sancus_logger_record - binary record header
+ *
+ * @len:	length of the record, header included
+ * @type:	enum sancus_logger_record_type
+ * @level:	enum sancus_log_level
+ * @prefix_len:	length of the prefix at the start of the payload
+ * @line:	source line, if any
+ * @flags:	%SANCUS_LOGGER_RECORD_TRUNCATED if the payload didn't fit
+ * @ts:		nanoseconds since the epoch
+ * @fmt:	id of the format, or of the defined string
+ * @func:	id of the function name, 0 if none
+ */
+struct sancus_logger_record {
+	uint32_t len;
+	uint8_t type;
+	uint8_t level;
+	uint16_t prefix_len;
+	uint32_t line;
+	uint32_t flags;
+	uint64_t ts;
+	uint64_t fmt;
+	uint64_t func;
+};
+
+/*
+ * printf arguments are encoded in order, `*` widths and precisions as
+ * int32_t, integers as int64_t/uint64_t, floating point as double,
+ * pointers as uint64_t and strings (including %m) as an uint32_t
+ * length followed by the bytes, UINT32_MAX meaning %NULL.
+ */
+enum sancus_logger_arg {
+	SANCUS_LOGGER_ARG_NONE,
+	SANCUS_LOGGER_ARG_INT,
+	SANCUS_LOGGER_ARG_UINT,
+	SANCUS_LOGGER_ARG_DOUBLE,
+	SANCUS_LOGGER_ARG_PTR,
+	SANCUS_LOGGER_ARG_STRING,
+	SANCUS_LOGGER_ARG_ERRNO,
+};
+
+enum sancus_logger_arg_length {
+	SANCUS_LOGGER_ARG_LEN_NONE,
+	SANCUS_LOGGER_ARG_LEN_HH,
+	SANCUS_LOGGER_ARG_LEN_H,
+	SANCUS_LOGGER_ARG_LEN_L,
+	SANCUS_LOGGER_ARG_LEN_LL,
+	SANCUS_LOGGER_ARG_LEN_J,
+	SANCUS_LOGGER_ARG_LEN_Z,
+	SANCUS_LOGGER_ARG_LEN_T,
+	SANCUS_LOGGER_ARG_LEN_BIG_L,
+};
+
+/**
+ * struct sancus_logger_binary_spec - printf conversion specification
+ *
+ * @start:	the `%` starting the conversion
+ * @head_len:	length of the `%`, flags, width and precision
+ * @len:	length of the whole conversion
+ * @conv:	conversion specifier
+ * @type:	type of the argument
+ * @length:	length modifier of the argument
+ * @prec:	literal precision, -1 if none
+ * @star_width:	width is taken from an int argument
+ * @star_prec:	precision is taken from an int argument
+ */
+struct sancus_logger_binary_spec {
+	const char *start;
+	unsigned head_len, len;
+	char conv;
+	int prec;
+
+	enum sancus_logger_arg type;
+	enum sancus_logger_arg_length length;
+
+	bool star_width;
+	bool star_prec;
+};
+
+/**
+ * sancus_logger_binary_next - finds the next conversion of a printf
+ * format, returns %NULL when there are no more
+ */
+const char *sancus_logger_binary_next(const char *fmt,
+				      struct sancus_logger_binary_spec *spec);
+
+#endif /* !__SANCUS_LOGGER_BINARY_H__ */
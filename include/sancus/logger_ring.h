@@ -0,0 +1,99 @@
+#ifndef __SANCUS_LOGGER_RING_H__
+#define __SANCUS_LOGGER_RING_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * log ring file, as written by the ring backend. A header page
+ * followed by @size bytes used as a ring of records, all in host
+ * byte order.
+ *
+ * Writers reserve space by advancing @head and copy their record in,
+ * wrapping around the end if needed, storing the record's @pos last.
+ * A record is valid only if its @pos matches where it is and is not
+ * older than a whole ring behind @head, which rules out both torn
+ * records and leftovers of previous laps after a crash. @pos is stored
+ * complemented so never written zeroes don't pass as records.
+ */
+#define SANCUS_LOGGER_RING_MAGIC "SANCUSLR"
+
+enum {
+	SANCUS_LOGGER_RING_VERSION     = 1,
+	SANCUS_LOGGER_RING_BYTE_ORDER  = 0x0102,
+	SANCUS_LOGGER_RING_HEADER_SIZE = 4096,
+	SANCUS_LOGGER_RING_ALIGN       = 8,
+	SANCUS_LOGGER_RING_TEXT_MAX    = 4096,
+};
+
+enum {
+	SANCUS_LOGGER_RING_TRUNCATED = 1,
+};
+
+/**
+ * struct sancus_logger_ring_header - ring file header
+ *
+ * @size:	size of the ring, a power of two
+ * @head:	bytes ever reserved, the ring offset is @head % @size
+ */
+struct sancus_logger_ring_header {
+	char magic[8];
+	uint16_t version;
+	uint16_t byte_order;
+	uint32_t reserved;
+	uint64_t size;
+	uint64_t head;
+};
+
+/**
+ * struct sancus_logger_ring_record - ring record header
+ *
+ * @pos:	~ absolute position of the record, written last
+ * @len:	length of the text following the header
+ * @level:	enum sancus_log_level
+ * @flags:	%SANCUS_LOGGER_RING_TRUNCATED if the text didn't fit
+ * @ts:		nanoseconds since the epoch
+ *
+ * records are padded to %SANCUS_LOGGER_RING_ALIGN
+ */
+struct sancus_logger_ring_record {
+	uint64_t pos;
+	uint32_t len;
+	uint8_t level;
+	uint8_t flags;
+	uint16_t reserved;
+	uint64_t ts;
+};
+
+#define SANCUS_LOGGER_RING_RECORD_SIZE(L) \
+	((sizeof(struct sancus_logger_ring_record) + (L) + \
+	  SANCUS_LOGGER_RING_ALIGN - 1) & ~(size_t)(SANCUS_LOGGER_RING_ALIGN - 1))
+
+/**
+ * struct sancus_logger_ring_reader - walks a mapped ring file
+ */
+struct sancus_logger_ring_reader {
+	const char *data;
+	uint64_t size;
+	uint64_t pos, head;
+};
+
+/**
+ * sancus_logger_ring_reader_init - validates the header of a mapped
+ * ring file and positions the reader at its oldest surviving record
+ */
+int sancus_logger_ring_reader_init(struct sancus_logger_ring_reader *,
+				   const void *map, size_t map_len);
+
+/**
+ * sancus_logger_ring_reader_next - copies the next valid record, and
+ * as much of its text as fits in @buf, with @rec->pos already
+ * uncomplemented. Returns the length copied, or -ENOENT once there are
+ * no more
+ */
+int sancus_logger_ring_reader_next(struct sancus_logger_ring_reader *,
+				   struct sancus_logger_ring_record *rec,
+				   char *buf, size_t size);
+
+#endif /* !__SANCUS_LOGGER_RING_H__ */
@@ -85,4 +85,35 @@ accept_retry:
 	return ret;
 }
 
+/**
+ * sancus_accept4 - auto-retrying wrapper for accept4(), returning the
+ * new fd already close-on-exec and/or non-blocking. Falls back to
+ * accept() and fcntl() where accept4() isn't available
+ */
+static inline int sancus_accept4(int fd, struct sockaddr *sa, socklen_t *sa_len,
+				 int cloexec, int nonblock)
+{
+	int ret;
+#if defined(_GNU_SOURCE) && defined(SOCK_CLOEXEC) && defined(SOCK_NONBLOCK)
+	int flags = (cloexec ? SOCK_CLOEXEC : 0) | (nonblock ? SOCK_NONBLOCK : 0);
+
+accept4_retry:
+	if ((ret = accept4(fd, sa, sa_len, flags)) < 0 && errno == EINTR)
+		goto accept4_retry;
+#else
+	if ((ret = sancus_accept(fd, sa, sa_len)) < 0)
+		goto accept4_done;
+
+	if ((cloexec && fcntl(ret, F_SETFD, FD_CLOEXEC) < 0) ||
+	    (nonblock && fcntl(ret, F_SETFL, fcntl(ret, F_GETFL) | O_NONBLOCK) < 0)) {
+		int e = errno;
+		close(ret);
+		errno = e;
+		ret = -1;
+	}
+accept4_done:
+#endif
+	return ret;
+}
+
 #endif /* !_SANCUS_SOCKET_H */
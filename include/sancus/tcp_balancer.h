@@ -0,0 +1,197 @@
+#ifndef __SANCUS_TCP_BALANCER_H__
+#define __SANCUS_TCP_BALANCER_H__
+
+/*
+ * balancer of requests over a fixed set of upstream connections.
+ *
+ * Each peer is a sancus_tcp_conn owned by the balancer, picked once per
+ * request and released with sancus_tcp_balancer_done() when the request
+ * completes or fails. Picking is O(1) for every policy: peers are kept
+ * on lists bucketed by outstanding requests for least-outstanding, on
+ * an array of healthy peers for power-of-two-choices, and a smooth
+ * weighted round-robin schedule of the healthy peers is recomputed as
+ * they are ejected or rejoin.
+ *
+ * Peers failing to connect or whose watcher fails are ejected from
+ * selection and reconnected after a backoff delay, rejoining once
+ * connected. A balancer belongs to a single loop, nothing is locked.
+ */
+struct sancus_tcp_balancer;
+
+enum {
+	SANCUS_TCP_BALANCER_MAX        = 32,	/* peers */
+	SANCUS_TCP_BALANCER_WEIGHT_MAX = 100,
+	SANCUS_TCP_BALANCER_LOAD_MAX   = 64,	/* outstanding buckets, the last one open ended */
+};
+
+enum sancus_tcp_balancer_policy {
+	SANCUS_TCP_BALANCER_LEAST_OUTSTANDING,
+	SANCUS_TCP_BALANCER_POWER_OF_TWO,
+	SANCUS_TCP_BALANCER_ROUND_ROBIN,	/* weighted */
+};
+
+/**
+ * struct sancus_tcp_balancer_settings - policy and callbacks
+ *
+ * @conn:	callbacks of the peers, on_connect() and on_error() are
+ *		called after the balancer has seen them
+ * @policy:	how peers are picked
+ * @reconnect:	backoff of ejected peers, 100ms doubling up to 10s with
+ *		50% jitter if left zero. Overrides the one of @conn
+ */
+struct sancus_tcp_balancer_settings {
+	const struct sancus_tcp_conn_settings *conn;
+	enum sancus_tcp_balancer_policy policy;
+	struct sancus_tcp_conn_reconnect reconnect;
+};
+
+/**
+ * struct sancus_tcp_balancer_peer - upstream
+ *
+ * @conn:	the connection
+ * @balancer:	balancer it belongs to
+ * @entry:	load bucket entry, while healthy
+ * @weight:	share of round-robin picks
+ * @outstanding: requests picked and not done
+ * @slot:	index in the healthy array, while healthy
+ * @ejected:	out of selection until reconnected
+ * @picked:	requests picked
+ * @ejections:	times ejected
+ */
+struct sancus_tcp_balancer_peer {
+	struct sancus_tcp_conn conn;
+	struct sancus_tcp_balancer *balancer;
+
+	struct sancus_list entry;
+	unsigned weight;
+	unsigned outstanding;
+	unsigned slot;
+	bool ejected;
+
+	unsigned long picked;
+	unsigned long ejections;
+};
+
+/**
+ * struct sancus_tcp_balancer - upstream balancer, not to be moved once
+ * initialized
+ *
+ * @settings:	policy and callbacks
+ * @conn_settings: callbacks given to the peers
+ * @count:	peers added
+ * @healthy_count: peers not ejected
+ * @healthy:	indices of the peers not ejected
+ * @least:	no non-empty bucket below this one
+ * @load:	healthy peers by outstanding requests, least recently
+ *		picked first
+ * @seed:	power-of-two-choices random state
+ * @cursor:	next entry of @schedule
+ * @schedule_len: entries in @schedule, sum of the healthy weights
+ * @schedule:	round-robin order of healthy peer indices
+ * @peers:	the peers
+ */
+struct sancus_tcp_balancer {
+	const struct sancus_tcp_balancer_settings *settings;
+	struct sancus_tcp_conn_settings conn_settings;
+
+	unsigned count;
+	unsigned healthy_count;
+	uint8_t healthy[SANCUS_TCP_BALANCER_MAX];
+
+	unsigned least;
+	struct sancus_list load[SANCUS_TCP_BALANCER_LOAD_MAX];
+
+	uint32_t seed;
+
+	unsigned cursor;
+	unsigned schedule_len;
+	uint8_t schedule[SANCUS_TCP_BALANCER_MAX * SANCUS_TCP_BALANCER_WEIGHT_MAX];
+
+	struct sancus_tcp_balancer_peer peers[SANCUS_TCP_BALANCER_MAX];
+};
+
+/**
+ * sancus_tcp_balancer_peer_of - peer of a connection
+ */
+#define sancus_tcp_balancer_peer_of(C)	container_of(C, struct sancus_tcp_balancer_peer, conn)
+
+/**
+ * sancus_tcp_balancer_init - initializes a balancer without peers
+ *
+ * @self:	balancer to initialize
+ * @settings:	policy and callbacks
+ */
+void sancus_tcp_balancer_init(struct sancus_tcp_balancer *self,
+			      const struct sancus_tcp_balancer_settings *settings);
+
+/**
+ * sancus_tcp_balancer_add - adds a peer and starts connecting to it
+ *
+ * @self:	balancer
+ * @sa:		address of the peer
+ * @sa_len:	length of @sa
+ * @weight:	round-robin share, 1 to %SANCUS_TCP_BALANCER_WEIGHT_MAX
+ *
+ * Returns the peer, watched from sancus_tcp_balancer_start(), or %NULL
+ * on error, %EINVAL for an invalid @weight or %ENOSPC if there are
+ * already %SANCUS_TCP_BALANCER_MAX peers. errno set accordingly.
+ */
+struct sancus_tcp_balancer_peer *sancus_tcp_balancer_add(struct sancus_tcp_balancer *self,
+							 const struct sockaddr *sa,
+							 socklen_t sa_len,
+							 unsigned weight);
+
+/**
+ * sancus_tcp_balancer_pick - picks a healthy peer for a request
+ *
+ * @self:	balancer
+ *
+ * Returns the peer, its outstanding requests already counted, or %NULL
+ * with errno set to %EHOSTUNREACH if all are ejected.
+ */
+struct sancus_tcp_balancer_peer *sancus_tcp_balancer_pick(struct sancus_tcp_balancer *self);
+
+/**
+ * sancus_tcp_balancer_done - a request to a peer has completed or failed
+ *
+ * @self:	balancer
+ * @peer:	peer previously picked
+ */
+void sancus_tcp_balancer_done(struct sancus_tcp_balancer *self,
+			      struct sancus_tcp_balancer_peer *peer);
+
+/**
+ * sancus_tcp_balancer_eject - takes a peer out of selection and
+ * reconnects it after the backoff delay, e.g. on a read timeout
+ *
+ * @self:	balancer
+ * @loop:	event loop
+ * @peer:	peer to eject
+ */
+void sancus_tcp_balancer_eject(struct sancus_tcp_balancer *self, struct sancus_ev_loop *loop,
+			       struct sancus_tcp_balancer_peer *peer);
+
+/**
+ * sancus_tcp_balancer_start - starts watching all peers
+ *
+ * @self:	balancer
+ * @loop:	event loop
+ */
+void sancus_tcp_balancer_start(struct sancus_tcp_balancer *self, struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_balancer_stop - stops watching all peers
+ *
+ * @self:	balancer
+ * @loop:	event loop
+ */
+void sancus_tcp_balancer_stop(struct sancus_tcp_balancer *self, struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_balancer_close - closes all peers, already stopped
+ *
+ * @self:	balancer
+ */
+void sancus_tcp_balancer_close(struct sancus_tcp_balancer *self);
+
+#endif /* !__SANCUS_TCP_BALANCER_H__ */
@@ -34,6 +34,9 @@ struct sancus_tcp_conn;
 enum sancus_tcp_conn_error {
 	SANCUS_TCP_CONN_WATCHER_ERROR,
 	SANCUS_TCP_CONN_CONNECT_ERROR,
+	SANCUS_TCP_CONN_WRITE_ERROR,
+	SANCUS_TCP_CONN_CONNECT_TIMEOUT,
+	SANCUS_TCP_CONN_READ_TIMEOUT,
 };
 
 enum sancus_tcp_conn_state {
@@ -41,8 +44,47 @@ enum sancus_tcp_conn_state {
 	SANCUS_TCP_CONN_CONNECTED,
 	SANCUS_TCP_CONN_RUNNING,
 	SANCUS_TCP_CONN_FAILED,
+	SANCUS_TCP_CONN_WAITING,	/* to reconnect */
 };
 
+/**
+ * struct sancus_tcp_conn_reconnect - reconnect policy
+ *
+ * @initial_delay: delay before the first reconnect, doubled on every
+ *		failed attempt. Zero disables reconnecting
+ * @max_delay:	delay cap, zero for none
+ * @jitter:	percentage of each delay randomized, 100 for a delay
+ *		anywhere between zero and the full one
+ */
+struct sancus_tcp_conn_reconnect {
+	struct timespec initial_delay;
+	struct timespec max_delay;
+	unsigned jitter;
+};
+
+/**
+ * struct sancus_tcp_conn_settings - driving callbacks of tcp connection
+ *
+ * @on_read:	there is data to read
+ * @on_connect:	connection established, queued output already sent
+ * @on_error:	an error has happened, check %errno
+ * @on_drain:	optional, output that had to wait for the socket is
+ *		all sent
+ * @reconnect:	reconnect policy after a failed or timed out connect.
+ *		A peer dropping an established connection is only seen
+ *		by whoever reads from it, who can then call
+ *		sancus_tcp_conn_reconnect()
+ * @connect_timeout: time given to connect before failing with
+ *		%SANCUS_TCP_CONN_CONNECT_TIMEOUT, zero for none
+ * @read_timeout: time allowed without anything to read once running,
+ *		reported once as %SANCUS_TCP_CONN_READ_TIMEOUT until
+ *		sancus_tcp_conn_start() arms it again, zero for none
+ * @fastopen:	try TCP Fast Open, output queued before connecting goes
+ *		out in the SYN if the peer's cookie is known. Otherwise,
+ *		or if unsupported, it's sent after a regular handshake.
+ *		Either way @on_connect and @connect_timeout follow the
+ *		handshake, not connect() returning
+ */
 struct sancus_tcp_conn_settings {
 	void (*on_read) (struct sancus_tcp_conn *,
 			 struct sancus_ev_loop *);
@@ -51,23 +93,61 @@ struct sancus_tcp_conn_settings {
 	void (*on_error) (struct sancus_tcp_conn *,
 			  struct sancus_ev_loop *,
 			  enum sancus_tcp_conn_error);
+	void (*on_drain) (struct sancus_tcp_conn *,
+			  struct sancus_ev_loop *);
+
+	struct sancus_tcp_conn_reconnect reconnect;
+
+	struct timespec connect_timeout;
+	struct timespec read_timeout;
+
+	bool fastopen;
 };
 
+/**
+ * struct sancus_tcp_conn - tcp connection
+ *
+ * @io:		connection watcher
+ * @events:	events @io is watching
+ * @state:	connection state
+ * @last_activity: last time something was read
+ * @out:	output queue, see sancus_tcp_conn_set_output()
+ * @settings:	driving callbacks
+ * @timer:	connect and read deadlines, and reconnect delay
+ * @attempts:	failed connects in a row
+ * @seed:	jitter random state
+ * @cloexec:	close-on-exec of the socket
+ * @addrlen:	length of @addr
+ * @addr:	address to connect to
+ */
 struct sancus_tcp_conn {
 	struct sancus_ev_fd io;
+	unsigned events;
 
 	enum sancus_tcp_conn_state state;
 	struct timespec last_activity;
 
+	struct sancus_buffer out;
+
 	const struct sancus_tcp_conn_settings *settings;
+
+	struct sancus_ev_timer timer;
+	unsigned attempts;
+	uint32_t seed;
+
+	bool cloexec;
+	socklen_t addrlen;
+	struct sockaddr_storage addr;
 };
 
 #define sancus_tcp_conn_fd(P)	((P)->io.fd)
+#define sancus_tcp_conn_pending(P)	sancus_buffer_len(&(P)->out)
 #define sancus_tcp_conn_touch(C, L)	do { (C)->last_activity = sancus_ev_now(L); } while(0)
 #define sancus_tcp_conn_elapsed(C, L)	sancus_time_elapsed(&(C)->last_activity, &sancus_ev_now(L))
 
 /**
- * sancus_tcp_conn_start - start watching connection
+ * sancus_tcp_conn_start - start watching connection, arming the
+ * deadline of the current state
  *
  * @self:	connection to be started
  * @loop:	event loop
@@ -84,6 +164,63 @@ void sancus_tcp_conn_start(struct sancus_tcp_conn *self,
 void sancus_tcp_conn_stop(struct sancus_tcp_conn *self,
 			  struct sancus_ev_loop *loop);
 
+/**
+ * sancus_tcp_conn_set_output - binds the output queue
+ *
+ * @self:	connection, already initialized
+ * @buf:	output buffer, %NULL for none
+ * @size:	size of @buf
+ *
+ * Shall be called before the first sancus_tcp_conn_write(), anything
+ * already queued is dropped.
+ */
+void sancus_tcp_conn_set_output(struct sancus_tcp_conn *self,
+				char *buf, size_t size);
+
+/**
+ * sancus_tcp_conn_write - sends or queues data
+ *
+ * @self:	connection
+ * @loop:	event loop
+ * @data:	data to send
+ * @len:	length of @data
+ *
+ * While connecting the data is queued, to go out as soon as the
+ * handshake completes. Once connected it's sent right away, and what
+ * the socket doesn't take is queued and the connection watches for
+ * writability until the queue is empty, calling on_drain().
+ *
+ * Returns @len on success and -1 on error, %ENOBUFS if @len doesn't
+ * fit in the free space of the queue, in which case nothing is sent.
+ * errno set accordingly.
+ */
+ssize_t sancus_tcp_conn_write(struct sancus_tcp_conn *self,
+			      struct sancus_ev_loop *loop,
+			      const void *data, size_t len);
+
+/**
+ * sancus_tcp_conn_reconnect - closes the socket and connects again to
+ * the same address after the backoff delay, e.g. when on_read() finds
+ * the peer has closed the connection. End of stream and resets aren't
+ * detected by the connection itself
+ *
+ * @self:	connection
+ * @loop:	event loop
+ *
+ * Returns 0 on success and -1 on error, %ENOTSUP if the settings have
+ * no reconnect policy. errno set accordingly.
+ */
+int sancus_tcp_conn_reconnect(struct sancus_tcp_conn *self,
+			      struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_conn_fastopened - tells if the data sent in the SYN was
+ * accepted by the peer, saving the round trip of the handshake
+ *
+ * @self:	connection
+ */
+bool sancus_tcp_conn_fastopened(const struct sancus_tcp_conn *self);
+
 /**
  * sancus_tcp_conn_close - closes an already stopped connection
  *
@@ -91,6 +228,19 @@ void sancus_tcp_conn_stop(struct sancus_tcp_conn *self,
  */
 void sancus_tcp_conn_close(struct sancus_tcp_conn *self);
 
+/**
+ * sancus_tcp_conn_connect - initialized and prepares a tcp connection to
+ * an already resolved address
+ *
+ * @self:	connection structure
+ *
+ * Returns 1 on success and -1 on error. errno set accordingly.
+ */
+int sancus_tcp_conn_connect(struct sancus_tcp_conn *self,
+			    const struct sancus_tcp_conn_settings *settings,
+			    const struct sockaddr *sa, socklen_t sa_len,
+			    bool cloexec);
+
 /**
  * sancus_tcp_ipv4_connect - initialized and prepares an ipv4 tcp connection
  *
@@ -0,0 +1,186 @@
+#ifndef __SANCUS_TCP_INFO_H__
+#define __SANCUS_TCP_INFO_H__
+
+#include <stdint.h>
+
+/*
+ * TCP_INFO sampling of connected sockets.
+ *
+ * A sampler follows the fd of a watcher, the io of a sancus_tcp_conn
+ * across reconnects or the read watcher of an accepted stream, and
+ * samples it on a loop timer, folding each sample into a per-loop
+ * aggregate. Sampling costs a getsockopt() and two ioctl()s per
+ * connection and interval, the aggregate is a handful of counters and
+ * a log2 histogram of the RTT, so network time can be told apart from
+ * processing time without running ss(8) on the hosts.
+ */
+struct sancus_tcp_info_sampler;
+
+enum {
+	SANCUS_TCP_INFO_RTT_SHIFT   = 6,	/* first bucket, below 64us */
+	SANCUS_TCP_INFO_RTT_BUCKETS = 16,	/* the last one open ended, 1s and over */
+};
+
+/**
+ * struct sancus_tcp_info - sample of a connection
+ *
+ * @rtt:	smoothed round trip time, in microseconds
+ * @rttvar:	round trip time variance, in microseconds
+ * @retransmits: segments retransmitted since connected
+ * @cwnd:	congestion window, in segments
+ * @unacked:	bytes sent and not acknowledged yet
+ * @unsent:	bytes queued and not sent yet
+ */
+struct sancus_tcp_info {
+	uint32_t rtt;
+	uint32_t rttvar;
+	uint32_t retransmits;
+	uint32_t cwnd;
+	uint32_t unacked;
+	uint32_t unsent;
+};
+
+/**
+ * struct sancus_tcp_info_stats - aggregate of the samples taken on a
+ * loop
+ *
+ * @since:	when counting started
+ * @samples:	samples taken
+ * @rtt:	samples by RTT, bucket k counts those below
+ *		2^(%SANCUS_TCP_INFO_RTT_SHIFT + k) microseconds
+ * @rtt_max:	highest RTT sampled
+ * @retransmits: segments retransmitted between samples
+ */
+struct sancus_tcp_info_stats {
+	struct timespec since;
+
+	unsigned long samples;
+	unsigned long rtt[SANCUS_TCP_INFO_RTT_BUCKETS];
+	uint32_t rtt_max;
+
+	unsigned long retransmits;
+};
+
+/**
+ * struct sancus_tcp_info_sampler - periodic sampling of a connection
+ *
+ * @timer:	sampling timer
+ * @io:		watcher of the socket, skipped while its fd is negative
+ * @interval:	time between samples
+ * @stats:	aggregate, optional
+ * @last:	last sample
+ * @socket:	inode of the socket @last was taken from, a new one
+ *		after a reconnect is counted from zero even if it got
+ *		the same fd
+ * @on_sample:	optional, called after every sample
+ */
+struct sancus_tcp_info_sampler {
+	struct sancus_ev_timer timer;
+	const struct sancus_ev_fd *io;
+	struct timespec interval;
+
+	struct sancus_tcp_info_stats *stats;
+	struct sancus_tcp_info last;
+	uint64_t socket;
+
+	void (*on_sample) (struct sancus_tcp_info_sampler *, struct sancus_ev_loop *);
+};
+
+/**
+ * sancus_tcp_info_get - samples a tcp socket
+ *
+ * @fd:		socket
+ * @info:	output
+ *
+ * Returns 0 on success and -1 on error. errno set accordingly.
+ */
+int sancus_tcp_info_get(int fd, struct sancus_tcp_info *info);
+
+/**
+ * sancus_tcp_info_stats_init - resets an aggregate
+ *
+ * @self:	aggregate
+ * @loop:	event loop it belongs to
+ */
+void sancus_tcp_info_stats_init(struct sancus_tcp_info_stats *self,
+				struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_info_stats_add - folds a sample into an aggregate
+ *
+ * @self:	aggregate
+ * @info:	sample
+ * @retransmits: segments retransmitted since the previous sample of
+ *		the same connection
+ */
+void sancus_tcp_info_stats_add(struct sancus_tcp_info_stats *self,
+			       const struct sancus_tcp_info *info,
+			       uint32_t retransmits);
+
+/**
+ * sancus_tcp_info_stats_rtt - RTT percentile
+ *
+ * @self:	aggregate
+ * @pct:	percentile, 0 to 100
+ *
+ * Returns the upper bound of the bucket holding it, in microseconds, 0
+ * if there are no samples or %UINT32_MAX if it's on the last bucket.
+ */
+uint32_t sancus_tcp_info_stats_rtt(const struct sancus_tcp_info_stats *self, unsigned pct);
+
+/**
+ * sancus_tcp_info_stats_retransmit_rate - segments retransmitted per
+ * second since the aggregate was reset
+ *
+ * @self:	aggregate
+ * @loop:	event loop
+ */
+double sancus_tcp_info_stats_retransmit_rate(const struct sancus_tcp_info_stats *self,
+					     struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_info_sampler_init - prepares a sampler
+ *
+ * @self:	sampler to initialize
+ * @io:		watcher of the socket to sample
+ * @interval:	time between samples
+ * @stats:	aggregate to feed, or %NULL
+ */
+void sancus_tcp_info_sampler_init(struct sancus_tcp_info_sampler *self,
+				  const struct sancus_ev_fd *io,
+				  struct timespec interval,
+				  struct sancus_tcp_info_stats *stats);
+
+/**
+ * sancus_tcp_info_sampler_start - starts sampling every @interval
+ *
+ * @self:	sampler
+ * @loop:	event loop
+ */
+void sancus_tcp_info_sampler_start(struct sancus_tcp_info_sampler *self,
+				   struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_info_sampler_stop - stops sampling, to be called before
+ * the socket is closed
+ *
+ * @self:	sampler
+ * @loop:	event loop
+ */
+void sancus_tcp_info_sampler_stop(struct sancus_tcp_info_sampler *self,
+				  struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_info_sampler_sample - samples right away, into @last and
+ * @stats
+ *
+ * @self:	sampler
+ * @loop:	event loop
+ *
+ * Returns 0 on success and -1 on error, %EBADF if there is no socket.
+ * errno set accordingly.
+ */
+int sancus_tcp_info_sampler_sample(struct sancus_tcp_info_sampler *self,
+				   struct sancus_ev_loop *loop);
+
+#endif /* !__SANCUS_TCP_INFO_H__ */
@@ -0,0 +1,216 @@
+#ifndef __SANCUS_TCP_POOL_H__
+#define __SANCUS_TCP_POOL_H__
+
+/*
+ * pool of keepalive connections to one upstream address.
+ *
+ * Idle connections are kept on an intrusive list, checked in at the
+ * head and checked out from the head, so the warmest one is reused
+ * first and the surplus ages out at the tail. A checkout with nothing
+ * idle opens a new connection, returned right away still connecting so
+ * requests can be pipelined, or fails with %EAGAIN at @max_conns, when
+ * the caller may wait for a connection to be checked in.
+ */
+struct sancus_tcp_pool;
+struct sancus_tcp_pool_waiter;
+
+/**
+ * struct sancus_tcp_pool_settings - pool limits and callbacks
+ *
+ * @conn:	callbacks of the pooled connections
+ * @out_size:	output queue size of each connection
+ * @min_idle:	idle connections kept open by sancus_tcp_pool_maintain()
+ * @max_idle:	idle connections beyond this are closed on checkin, 0
+ *		for no limit
+ * @max_conns:	open connections, idle or not, 0 for no limit
+ * @idle_timeout: idle connections without activity for this long are
+ *		closed by sancus_tcp_pool_maintain(), zero to keep them
+ * @health_check: optional, tells if an idle connection is still good
+ *		to use. By default connections closed or with unexpected
+ *		data pending are discarded
+ */
+struct sancus_tcp_pool_settings {
+	const struct sancus_tcp_conn_settings *conn;
+	size_t out_size;
+
+	unsigned min_idle;
+	unsigned max_idle;
+	unsigned max_conns;
+	struct timespec idle_timeout;
+
+	bool (*health_check) (struct sancus_tcp_pool *, struct sancus_tcp_conn *);
+};
+
+/**
+ * struct sancus_tcp_pool_stats - occupancy and counters
+ *
+ * @idle:	idle connections
+ * @busy:	checked out connections
+ * @waiting:	waiters queued
+ * @opened:	connections opened
+ * @reused:	idle connections checked out
+ * @closed:	connections closed, for any reason
+ * @expired:	idle connections closed after @idle_timeout
+ * @unhealthy:	idle connections failing the health check
+ * @waits:	waiters served
+ * @wait_time:	total time waiters spent queued
+ * @wait_max:	longest time a waiter spent queued
+ */
+struct sancus_tcp_pool_stats {
+	unsigned idle;
+	unsigned busy;
+	unsigned waiting;
+
+	unsigned long opened;
+	unsigned long reused;
+	unsigned long closed;
+	unsigned long expired;
+	unsigned long unhealthy;
+
+	unsigned long waits;
+	struct timespec wait_time;
+	struct timespec wait_max;
+};
+
+/**
+ * struct sancus_tcp_pool_conn - pooled connection
+ *
+ * @conn:	the connection
+ * @entry:	idle list entry, while idle
+ */
+struct sancus_tcp_pool_conn {
+	struct sancus_tcp_conn conn;
+	struct sancus_list entry;
+};
+
+/**
+ * struct sancus_tcp_pool_waiter - checkout waiting for a connection
+ *
+ * @entry:	waiters list entry
+ * @since:	when it started waiting
+ * @on_conn:	called with a checked out connection
+ */
+struct sancus_tcp_pool_waiter {
+	struct sancus_list entry;
+	struct timespec since;
+
+	void (*on_conn) (struct sancus_tcp_pool_waiter *, struct sancus_ev_loop *,
+			 struct sancus_tcp_conn *);
+};
+
+/**
+ * struct sancus_tcp_pool - upstream connection pool
+ *
+ * @settings:	limits and callbacks
+ * @addr:	upstream address
+ * @addrlen:	length of @addr
+ * @idle:	idle connections, warmest first
+ * @waiters:	waiters, oldest first
+ * @stats:	occupancy and counters
+ */
+struct sancus_tcp_pool {
+	const struct sancus_tcp_pool_settings *settings;
+
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+
+	struct sancus_list idle;
+	struct sancus_list waiters;
+
+	struct sancus_tcp_pool_stats stats;
+};
+
+/**
+ * sancus_tcp_pool_conn_of - pooled connection of a connection
+ */
+#define sancus_tcp_pool_conn_of(C)	container_of(C, struct sancus_tcp_pool_conn, conn)
+
+/**
+ * sancus_tcp_pool_init - initializes an empty pool
+ *
+ * @self:	pool to initialize
+ * @settings:	limits and callbacks
+ * @addr:	ipv4 or ipv6 string
+ * @port:	port number
+ *
+ * Returns 0 if @addr is invalid and 1 on success.
+ */
+int sancus_tcp_pool_init(struct sancus_tcp_pool *self,
+			 const struct sancus_tcp_pool_settings *settings,
+			 const char *addr, uint16_t port);
+
+/**
+ * sancus_tcp_pool_checkout - takes a healthy idle connection, or opens
+ * a new one
+ *
+ * @self:	pool
+ * @loop:	event loop
+ *
+ * Returns %NULL on error, %EAGAIN if @max_conns are already open.
+ * errno set accordingly.
+ */
+struct sancus_tcp_conn *sancus_tcp_pool_checkout(struct sancus_tcp_pool *self,
+						 struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_pool_checkin - returns a connection for reuse, handing it
+ * to the oldest waiter if any
+ *
+ * @self:	pool
+ * @loop:	event loop
+ * @conn:	checked out connection, failed ones are discarded
+ */
+void sancus_tcp_pool_checkin(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop,
+			     struct sancus_tcp_conn *conn);
+
+/**
+ * sancus_tcp_pool_discard - closes a checked out connection that is not
+ * to be reused, opening a new one for the oldest waiter if any
+ *
+ * @self:	pool
+ * @loop:	event loop
+ * @conn:	checked out connection
+ */
+void sancus_tcp_pool_discard(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop,
+			     struct sancus_tcp_conn *conn);
+
+/**
+ * sancus_tcp_pool_wait - queues a waiter for the next connection
+ * available, after sancus_tcp_pool_checkout() failed with %EAGAIN
+ *
+ * @self:	pool
+ * @loop:	event loop
+ * @waiter:	waiter, with @on_conn set
+ */
+void sancus_tcp_pool_wait(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop,
+			  struct sancus_tcp_pool_waiter *waiter);
+
+/**
+ * sancus_tcp_pool_cancel - removes a queued waiter
+ *
+ * @self:	pool
+ * @waiter:	queued waiter
+ */
+void sancus_tcp_pool_cancel(struct sancus_tcp_pool *self,
+			    struct sancus_tcp_pool_waiter *waiter);
+
+/**
+ * sancus_tcp_pool_maintain - closes expired and unhealthy idle
+ * connections, and opens new ones up to @min_idle. To be called
+ * periodically
+ *
+ * @self:	pool
+ * @loop:	event loop
+ */
+void sancus_tcp_pool_maintain(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_pool_close - closes all idle connections, none shall be
+ * checked out nor waiting
+ *
+ * @self:	pool
+ * @loop:	event loop
+ */
+void sancus_tcp_pool_close(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop);
+
+#endif /* !__SANCUS_TCP_POOL_H__ */
@@ -30,6 +30,7 @@
 #define _SANCUS_TCP_SERVER_H
 
 struct sancus_tcp_server;
+struct sancus_tcp_server_group;
 
 /**
  * enum sancus_tcp_server_error - list of possible errors
@@ -40,12 +41,83 @@ enum sancus_tcp_server_error {
 	SANCUS_TCP_SERVER_ACCEPT_ERROR,
 };
 
+enum {
+	SANCUS_TCP_SERVER_ACCEPT_BUDGET = 64,	/* default accepts per wakeup */
+	SANCUS_TCP_SERVER_BATCH_MAX     = 32,	/* connections per on_connect_batch */
+	SANCUS_TCP_SERVER_HANDOFF_MAX   = 64,	/* listeners per handoff message */
+	SANCUS_TCP_SERVER_GROUP_MAX     = 8,	/* listeners per group */
+};
+
+/**
+ * struct sancus_tcp_server_accepted - connection accepted in a batch
+ *
+ * @fd:		non-blocking and close-on-exec socket
+ * @addrlen:	length of @addr
+ * @addr:	peer address
+ */
+struct sancus_tcp_server_accepted {
+	int fd;
+	socklen_t addrlen;
+	struct sockaddr_storage addr;
+};
+
+/**
+ * enum sancus_tcp_server_option - listener socket options
+ */
+enum sancus_tcp_server_option {
+	SANCUS_TCP_SERVER_OPT_DEFER_ACCEPT,
+	SANCUS_TCP_SERVER_OPT_FASTOPEN,
+	SANCUS_TCP_SERVER_OPT_RCVBUF,
+	SANCUS_TCP_SERVER_OPT_SNDBUF,
+	SANCUS_TCP_SERVER_OPT_NODELAY,
+	SANCUS_TCP_SERVER_OPT_INCOMING_CPU,
+};
+
+/**
+ * struct sancus_tcp_server_options - listener socket options, applied
+ * before pre_bind() and read back to verify them. Zero leaves an
+ * option alone
+ *
+ * @defer_accept:	TCP_DEFER_ACCEPT, seconds to wait for data before
+ *			waking up the listener
+ * @fastopen:		TCP_FASTOPEN, length of the pending queue
+ * @rcvbuf:		SO_RCVBUF, bytes
+ * @sndbuf:		SO_SNDBUF, bytes
+ * @nodelay:		TCP_NODELAY, inherited by accepted connections
+ * @incoming_cpu:	SO_INCOMING_CPU, CPU number plus one
+ *
+ * TCP level options are ignored on local sockets.
+ */
+struct sancus_tcp_server_options {
+	unsigned defer_accept;
+	unsigned fastopen;
+	unsigned rcvbuf;
+	unsigned sndbuf;
+	bool nodelay;
+	unsigned incoming_cpu;
+};
+
 /**
  * struct sancus_tcp_server_settings - driving callbacks of tcp server
  *
  * @pre_bind:	hook to tweak fd's sockopts before calling bind()
  * @on_connect:	new connection received, return %false if it should be closed
+ * @on_connect_batch: optional, receives up to %SANCUS_TCP_SERVER_BATCH_MAX
+ *		new connections at once instead of @on_connect, and owns
+ *		their fds
  * @on_error:	an error has happened, tell the world
+ * @on_option_error: optional, an option of @options couldn't be set,
+ *		with the errno of the failed call, or %ERANGE if the value
+ *		read back doesn't match
+ * @accept_budget: connections accepted per wakeup at most, 0 for
+ *		%SANCUS_TCP_SERVER_ACCEPT_BUDGET
+ * @max_connections: live connections cap, 0 for none. At the cap the
+ *		listener is paused until sancus_tcp_server_release() brings
+ *		them down to @resume_connections
+ * @resume_connections: low-water mark, 0 for 90% of @max_connections
+ * @shed_load:	at the cap, keep accepting but reset new connections
+ *		right away instead of pausing
+ * @options:	listener socket options
  */
 struct sancus_tcp_server_settings {
 	void (*pre_bind) (struct sancus_tcp_server *);
@@ -53,9 +125,53 @@ struct sancus_tcp_server_settings {
 	bool (*on_connect) (struct sancus_tcp_server *, struct sancus_ev_loop *,
 			    int, struct sockaddr *, socklen_t);
 
+	void (*on_connect_batch) (struct sancus_tcp_server *, struct sancus_ev_loop *,
+				  struct sancus_tcp_server_accepted *, size_t);
+
 	void (*on_error) (struct sancus_tcp_server *,
 			  struct sancus_ev_loop *,
 			  enum sancus_tcp_server_error);
+
+	void (*on_option_error) (struct sancus_tcp_server *,
+				 enum sancus_tcp_server_option, int);
+
+	unsigned accept_budget;
+
+	unsigned max_connections;
+	unsigned resume_connections;
+	bool shed_load;
+
+	struct sancus_tcp_server_options options;
+};
+
+/**
+ * struct sancus_tcp_server_stats - admission control counters
+ *
+ * @connections:	live connections
+ * @accepted:		connections handed to the application
+ * @rejected:		connections reset because of @shed_load
+ * @pauses:		times the listener was paused
+ * @paused_time:	time spent paused
+ */
+struct sancus_tcp_server_stats {
+	unsigned connections;
+	unsigned long accepted;
+	unsigned long rejected;
+	unsigned long pauses;
+	struct timespec paused_time;
+};
+
+/**
+ * struct sancus_tcp_server_admission - admission control state
+ *
+ * @stats:	counters
+ * @paused:	listeners paused
+ * @paused_since: when they were paused
+ */
+struct sancus_tcp_server_admission {
+	struct sancus_tcp_server_stats stats;
+	bool paused;
+	struct timespec paused_since;
 };
 
 /**
@@ -63,11 +179,37 @@ struct sancus_tcp_server_settings {
  *
  * @connect:	connection watcher
  * @settings:	driving callbacks
+ * @admission:	admission control state, unused while in a @group
+ * @group:	group the server belongs to, if any
+ * @started:	started by the application, watched unless paused
  */
 struct sancus_tcp_server {
 	struct sancus_ev_fd connect;
 
 	const struct sancus_tcp_server_settings *settings;
+
+	struct sancus_tcp_server_admission admission;
+	struct sancus_tcp_server_group *group;
+	bool started;
+};
+
+/**
+ * struct sancus_tcp_server_group - listeners sharing callbacks,
+ * admission limits and counters
+ *
+ * @settings:	driving callbacks, shared by all listeners
+ * @admission:	admission control state
+ * @count:	number of listeners
+ * @next:	listener to accept from first on the next wakeup
+ * @listeners:	member servers
+ */
+struct sancus_tcp_server_group {
+	const struct sancus_tcp_server_settings *settings;
+
+	struct sancus_tcp_server_admission admission;
+
+	unsigned count, next;
+	struct sancus_tcp_server *listeners[SANCUS_TCP_SERVER_GROUP_MAX];
 };
 
 /**
@@ -76,7 +218,8 @@ struct sancus_tcp_server {
  * @self:	server to be started
  * @loop:	event loop
  *
- * The server shall not be already active. Nothing returned
+ * The server shall not be already active. A member of a paused group
+ * is only watched once the group resumes. Nothing returned
  */
 void sancus_tcp_server_start(struct sancus_tcp_server *self, struct sancus_ev_loop *loop);
 
@@ -85,10 +228,48 @@ void sancus_tcp_server_start(struct sancus_tcp_server *self, struct sancus_ev_lo
  * @self:	server to be stopped
  * @loop:	event loop
  *
- * The server shall not be already stopped. Nothing returned
+ * The server shall not be already stopped. A pause of its group only
+ * ends once all members are stopped, the others are resumed as usual.
+ * Nothing returned
  */
 void sancus_tcp_server_stop(struct sancus_tcp_server *self, struct sancus_ev_loop *loop);
 
+/**
+ * sancus_tcp_server_accept - accepts pending connections
+ *
+ * @self:	listening server
+ * @loop:	event loop
+ *
+ * Accepts until there are no more pending or the accept budget is
+ * spent, handing them to on_connect() or on_connect_batch(). Called by
+ * the connection watcher, returns the number of connections accepted.
+ */
+unsigned sancus_tcp_server_accept(struct sancus_tcp_server *self,
+				  struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_server_release - tells admission control a connection
+ * handed by the server is gone, resuming a paused listener below the
+ * low-water mark
+ *
+ * @self:	server the connection came from
+ * @loop:	event loop
+ */
+void sancus_tcp_server_release(struct sancus_tcp_server *self,
+			       struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_server_get_stats - admission control counters, including
+ * the current pause if any
+ *
+ * @self:	server to query
+ * @loop:	event loop
+ * @stats:	output
+ */
+void sancus_tcp_server_get_stats(const struct sancus_tcp_server *self,
+				 struct sancus_ev_loop *loop,
+				 struct sancus_tcp_server_stats *stats);
+
 /**
  * sancus_tcp_server_close - closes an already stopped port
  *
@@ -149,6 +330,126 @@ int sancus_tcp_local_listen(struct sancus_tcp_server *self,
 			    const char *path,
 			    bool cloexec, unsigned backlog);
 
+/**
+ * sancus_tcp_server_adopt - initializes a tcp server on an already
+ * listening socket, inherited or received with
+ * sancus_tcp_server_receive_fds()
+ *
+ * @self:	server structure to initialize
+ * @settings:	driving callbacks
+ * @fd:		listening stream socket, owned by @self from now on
+ * @cloexec:	enable close-on-exec or not
+ *
+ * Neither bind() nor listen() are called, so the pending connections
+ * stay queued. @settings->options and pre_bind() are not applied, the
+ * socket keeps the options it had.
+ *
+ * Returns 0 if @fd isn't a listening stream socket, 1 on success and -1
+ * on error. errno set accordingly.
+ */
+int sancus_tcp_server_adopt(struct sancus_tcp_server *self,
+			    const struct sancus_tcp_server_settings *settings,
+			    int fd, bool cloexec);
+
+/**
+ * sancus_tcp_server_send_fds - hands listening sockets over to another
+ * process
+ *
+ * @sock:	connected local domain socket
+ * @servers:	servers to export
+ * @count:	number of @servers, up to %SANCUS_TCP_SERVER_HANDOFF_MAX
+ *
+ * The fds are sent in a single %SCM_RIGHTS message and remain open
+ * here, so both processes share the listen queues until this side
+ * stops and closes its servers, while it keeps draining the
+ * connections it already accepted.
+ *
+ * Returns 0 on success and -1 on error. errno set accordingly.
+ */
+int sancus_tcp_server_send_fds(int sock, struct sancus_tcp_server *const *servers,
+			       size_t count);
+
+/**
+ * sancus_tcp_server_receive_fds - receives listening sockets sent with
+ * sancus_tcp_server_send_fds(), in the same order, to be passed to
+ * sancus_tcp_server_adopt()
+ *
+ * @sock:	connected local domain socket
+ * @fds:	output
+ * @max:	size of @fds
+ *
+ * Returns the number of fds received and -1 on error, %EMSGSIZE if
+ * they were more than @max. errno set accordingly.
+ */
+ssize_t sancus_tcp_server_receive_fds(int sock, int *fds, size_t max);
+
+/**
+ * sancus_tcp_server_group_init - initializes an empty group
+ *
+ * @self:	group to initialize
+ * @settings:	driving callbacks of all listeners
+ */
+void sancus_tcp_server_group_init(struct sancus_tcp_server_group *self,
+				  const struct sancus_tcp_server_settings *settings);
+
+/**
+ * sancus_tcp_server_group_add - moves a listening server into a group
+ *
+ * @self:	group
+ * @server:	stopped server, initialized with the same settings and
+ *		without connections yet. Its storage shall outlive @self
+ *
+ * From here on its connections count against the group's limits and
+ * sancus_tcp_server_release() and sancus_tcp_server_get_stats() act on
+ * the group.
+ *
+ * Returns 0 on success and -1 on error, %EINVAL if @server doesn't
+ * match or %ENOSPC if the group is full. errno set accordingly.
+ */
+int sancus_tcp_server_group_add(struct sancus_tcp_server_group *self,
+				struct sancus_tcp_server *server);
+
+/**
+ * sancus_tcp_server_group_accept - accepts pending connections on all
+ * listeners
+ *
+ * @self:	group
+ * @loop:	event loop
+ *
+ * The accept budget is shared, and spent in turns of a fair share per
+ * listener so none starves the others, starting with a different one
+ * each time. Called by the watcher of any member, returns the number
+ * of connections accepted.
+ */
+unsigned sancus_tcp_server_group_accept(struct sancus_tcp_server_group *self,
+					struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_server_group_start - start watching all listeners
+ *
+ * @self:	group
+ * @loop:	event loop
+ */
+void sancus_tcp_server_group_start(struct sancus_tcp_server_group *self,
+				   struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_server_group_stop - stop watching all listeners
+ *
+ * @self:	group
+ * @loop:	event loop
+ */
+void sancus_tcp_server_group_stop(struct sancus_tcp_server_group *self,
+				  struct sancus_ev_loop *loop);
+
+/**
+ * sancus_tcp_server_group_close - closes all the already stopped
+ * listeners and empties the group
+ *
+ * @self:	group
+ */
+void sancus_tcp_server_group_close(struct sancus_tcp_server_group *self);
+
 /**
  * sancus_tcp_server_fd - returns fd been listened by a tcp server
  *
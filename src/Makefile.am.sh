@@ -61,6 +61,62 @@ endif
 
 $(list_find_files EXTRA_DIST * -name '*.h')
 
+# tools
+#
+bin_PROGRAMS =
+EOT
+
+find tools -name '*.c' 2> /dev/null | cut -d/ -f2 | sort -uV | while read f; do
+
+	k="${f%.c}"
+
+	n="sancus-$k"
+	N="$(echo $n | tr '-' '_')"
+	cat <<EOT >> $F~
+
+# $n
+#
+bin_PROGRAMS += $n
+$(list_find_files ${N}_SOURCES tools/$f -name '*.c')
+${N}_LDADD = libsancus-core.la
+EOT
+done
+
+cat <<EOT >> $F~
+
+# benchmarks, built by \`make bench\`
+#
+EXTRA_PROGRAMS =
+bench_programs =
+EOT
+
+find bench -name '*.c' 2> /dev/null | cut -d/ -f2 | sort -uV | while read f; do
+
+	k="${f%.c}"
+
+	n="bench-$k"
+	N="$(echo $n | tr '-' '_')"
+	cat <<EOT >> $F~
+
+# $n
+#
+EXTRA_PROGRAMS += $n
+bench_programs += $n
+$(list_find_files ${N}_SOURCES bench/$f -name '*.c')
+${N}_LDADD = libsancus-core.la
+EOT
+done
+
+cat <<EOT >> $F~
+
+bench: \$(bench_programs)
+.PHONY: bench
+
+CLEANFILES = \$(EXTRA_PROGRAMS)
+EOT
+
+cat <<EOT >> $F~
+
 # tests
 #
 TESTS =
@@ -0,0 +1,287 @@
+/*
+ * bench-logger - logger throughput and per-call latency
+ *
+ * usage: bench-logger [-n <calls per thread>] [-t <threads>]
+ *
+ * one JSON object per line and scenario, covering the printf, dump and
+ * hexdump paths, enabled and disabled levels, one and many threads, and
+ * the fd backend writing to /dev/null, a pipe and a file.
+ */
+#include <sancus/common.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define pr_err(...) fprintf(stderr, __VA_ARGS__)
+
+enum {
+	BENCH_CALLS   = 100000,
+	BENCH_THREADS = 4,
+};
+
+enum bench_path {
+	BENCH_PRINTF,
+	BENCH_DUMP,
+	BENCH_HEXDUMP,
+};
+
+enum bench_sink {
+	BENCH_DEVNULL,
+	BENCH_PIPE,
+	BENCH_FILE,
+};
+
+static const char *const path_names[] = {
+	[BENCH_PRINTF]  = "printf",
+	[BENCH_DUMP]    = "dump",
+	[BENCH_HEXDUMP] = "hexdump",
+};
+
+static const char *const sink_names[] = {
+	[BENCH_DEVNULL] = "devnull",
+	[BENCH_PIPE]    = "pipe",
+	[BENCH_FILE]    = "file",
+};
+
+/* debug calls, only the first one lets them through */
+static DECL_SANCUS_LOGGER(enabled, "bench", SANCUS_LOG_VERBOSE);
+static DECL_SANCUS_LOGGER(disabled, "bench", SANCUS_LOG_NORMAL);
+
+struct bench_run {
+	const struct sancus_logger *logger;
+	enum bench_path path;
+	unsigned calls;
+
+	pthread_barrier_t *barrier;
+	uint32_t *latency;
+};
+
+static const char payload[] =
+	"GET /index.html HTTP/1.1\r\nHost: example.org\r\n\r\n";
+
+static inline uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void *bench_worker(void *arg)
+{
+	struct bench_run *run = arg;
+	const struct sancus_logger *logger = run->logger;
+
+	pthread_barrier_wait(run->barrier);
+
+	for (unsigned i = 0; i < run->calls; i++) {
+		uint64_t t0 = bench_ns(), dt;
+
+		switch (run->path) {
+		case BENCH_PRINTF:
+			sancus_log_debug(logger, "request %u from %s:%d took %.3fms",
+					 i, "192.0.2.1", 443, 1.25);
+			break;
+		case BENCH_DUMP:
+			sancus_log_debug_dump(logger, payload, sizeof(payload) - 1,
+					      "request %u", i);
+			break;
+		case BENCH_HEXDUMP:
+			sancus_log_debug_hexdump(logger, 16, payload, sizeof(payload) - 1,
+						 "request %u", i);
+			break;
+		default: /* -Wswitch-default */
+			break;
+		}
+
+		dt = bench_ns() - t0;
+		run->latency[i] = dt > UINT32_MAX ? UINT32_MAX : (uint32_t)dt;
+	}
+
+	return NULL;
+}
+
+/*
+ * pipe reader, so writers don't block
+ */
+static void *bench_drain(void *arg)
+{
+	int fd = *(int *)arg;
+	char buf[65536];
+
+	while (read(fd, buf, sizeof(buf)) > 0)
+		;
+	return NULL;
+}
+
+static int bench_u32_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static inline uint32_t bench_pct(const uint32_t *v, size_t n, unsigned per_mille)
+{
+	size_t i = n * per_mille / 1000;
+
+	return v[i < n ? i : n - 1];
+}
+
+static int bench_open_sink(enum bench_sink sink, int *fd, int *drain_fd)
+{
+	char path[] = "/tmp/bench-logger.XXXXXX";
+	int p[2];
+
+	*fd = *drain_fd = -1;
+
+	switch (sink) {
+	case BENCH_DEVNULL:
+		*fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		break;
+	case BENCH_PIPE:
+		if (pipe(p) < 0)
+			return -errno;
+		*fd = p[1];
+		*drain_fd = p[0];
+		break;
+	case BENCH_FILE:
+		*fd = mkstemp(path);
+		if (*fd >= 0)
+			unlink(path);
+		break;
+	default: /* -Wswitch-default */
+		errno = EINVAL;
+		break;
+	}
+
+	return *fd < 0 ? -errno : 0;
+}
+
+static int bench(enum bench_path path, bool on, unsigned threads,
+		 enum bench_sink sink, unsigned calls)
+{
+	struct bench_run run[threads];
+	pthread_t tid[threads], drainer;
+	pthread_barrier_t barrier;
+	uint32_t *latency;
+	size_t total = (size_t)threads * calls;
+	uint64_t t0, t1;
+	double seconds;
+	int fd, drain_fd, err;
+
+	latency = calloc(total, sizeof(*latency));
+	if (latency == NULL)
+		return -ENOMEM;
+
+	err = bench_open_sink(sink, &fd, &drain_fd);
+	if (err < 0) {
+		free(latency);
+		return err;
+	}
+
+	if (drain_fd >= 0)
+		pthread_create(&drainer, NULL, bench_drain, &drain_fd);
+
+	sancus_logger_set_fd_backend(fd);
+	pthread_barrier_init(&barrier, NULL, threads + 1);
+
+	for (unsigned i = 0; i < threads; i++) {
+		run[i] = (struct bench_run) {
+			.logger = on ? &enabled : &disabled,
+			.path = path,
+			.calls = calls,
+			.barrier = &barrier,
+			.latency = latency + (size_t)i * calls,
+		};
+		pthread_create(&tid[i], NULL, bench_worker, &run[i]);
+	}
+
+	t0 = bench_ns();
+	pthread_barrier_wait(&barrier);
+	for (unsigned i = 0; i < threads; i++)
+		pthread_join(tid[i], NULL);
+	t1 = bench_ns();
+
+	sancus_logger_set_fd_backend(STDERR_FILENO);
+	pthread_barrier_destroy(&barrier);
+	close(fd);
+
+	if (drain_fd >= 0) {
+		pthread_join(drainer, NULL);
+		close(drain_fd);
+	}
+
+	qsort(latency, total, sizeof(*latency), bench_u32_cmp);
+	seconds = (double)(t1 - t0) / 1e9;
+
+	printf("{\"bench\":\"logger\",\"path\":\"%s\",\"level\":\"%s\","
+	       "\"threads\":%u,\"sink\":\"%s\",\"calls\":%zu,\"seconds\":%.6f,"
+	       "\"calls_per_sec\":%.0f,\"p50_ns\":%u,\"p90_ns\":%u,"
+	       "\"p99_ns\":%u,\"p999_ns\":%u,\"max_ns\":%u}\n",
+	       path_names[path], on ? "enabled" : "disabled",
+	       threads, sink_names[sink], total, seconds,
+	       seconds > 0 ? (double)total / seconds : 0.0,
+	       bench_pct(latency, total, 500), bench_pct(latency, total, 900),
+	       bench_pct(latency, total, 990), bench_pct(latency, total, 999),
+	       latency[total - 1]);
+	fflush(stdout);
+
+	free(latency);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned calls = BENCH_CALLS, threads = BENCH_THREADS;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:t:")) != -1) {
+		switch (opt) {
+		case 'n':
+			calls = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			threads = (unsigned)strtoul(optarg, NULL, 10);
+			break;
+		default:
+			pr_err("usage: %s [-n <calls per thread>] [-t <threads>]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (calls == 0 || threads == 0) {
+		pr_err("%s: -n and -t must be positive\n", argv[0]);
+		return 2;
+	}
+
+	for (enum bench_path path = BENCH_PRINTF; path <= BENCH_HEXDUMP; path++) {
+		unsigned counts[] = { 1, threads };
+
+		for (unsigned i = 0; i < (threads > 1 ? 2u : 1u); i++) {
+			int err;
+
+			/* nothing reaches the sink when disabled */
+			err = bench(path, false, counts[i], BENCH_DEVNULL, calls);
+
+			for (enum bench_sink sink = BENCH_DEVNULL; err == 0 && sink <= BENCH_FILE; sink++)
+				err = bench(path, true, counts[i], sink, calls);
+
+			if (err < 0) {
+				pr_err("%s: %s\n", path_names[path], strerror(-err));
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
@@ -47,97 +47,14 @@ match:
 	}
 
 	if (count)
-		b->len -= (uint_fast16_t)count;
+		b->len -= count;
 
 	return (ssize_t)count;
 }
 
-ssize_t sancus_buffer_strip(struct sancus_buffer *b, const char *s, ssize_t l)
-{
-	size_t bl = sancus_buffer_len(b);
-
-	/* s vs l */
-	if (likely(s != NULL)) {
-		if (l < 0)
-			l = (ssize_t)strlen(s);
-	} else if (l > 0) {
-		return -EINVAL;
-	}
-
-	if (l > 0 && bl >= (size_t)l) {
-		size_t lu = (size_t)l;
-		size_t off = bl - lu;
-		char *p = sancus_buffer_ptr(b) + off;
-
-		if (memcmp(p, s, lu) == 0) {
-			/* match, remove */
-			b->len -= (uint_fast16_t)lu;
-			*p = '\0';
-			return l;
-		}
-	}
-
-	return 0;
-}
-
-ssize_t sancus_buffer_truncate(struct sancus_buffer *b, size_t n)
-{
-	if (n < b->len)
-		b->len = (uint_fast16_t)n;
-
-	if (b->len == 0)
-		b->base = 0;
-
-	b->buf[b->base + b->len] = '\0';
-	return (ssize_t)b->len;
-}
-
-ssize_t sancus_buffer_stripn(struct sancus_buffer *b, size_t n)
-{
-	if (n < b->len)
-		b->len -= (uint_fast16_t)n;
-	else
-		b->base = b->len = 0;
-
-	b->buf[b->base + b->len] = '\0';
-	return (ssize_t)b->len;
-}
-
 /*
  * append
  */
-ssize_t sancus_buffer__append(struct sancus_buffer *b, bool truncate,
-			      const char *s, ssize_t l)
-{
-	char *buf = sancus_buffer_tail_ptr(b);
-	ssize_t buf_size = (ssize_t)sancus_buffer_tail_size(b);
-
-	/* s vs l */
-	if (likely(s != NULL)) {
-		if (l < 0)
-			l = (ssize_t)strlen(s);
-	} else if (l > 0) {
-		return -EINVAL;
-	}
-
-	/* buf vs l */
-	if (buf == NULL)
-		l = -EINVAL;
-	else if (l <= buf_size)
-		;
-	else if (truncate)
-		l = buf_size;
-	else
-		l = -ENOBUFS;
-
-	if (l > 0) {
-		memcpy(buf, s, (size_t)l);
-		b->len += (uint_fast16_t)l;
-	}
-
-	return l;
-}
-
 ssize_t sancus_buffer__appendv(struct sancus_buffer *b, bool truncate,
 			       const char *fmt, va_list ap)
 {
@@ -160,7 +77,7 @@ ssize_t sancus_buffer__appendv(struct sancus_buffer *b, bool truncate,
 	}
 
 	if (n > 0)
-		b->len += (uint_fast16_t)n;
+		b->len += (size_t)n;
 	return n;
 }
 
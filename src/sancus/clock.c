@@ -12,3 +12,17 @@ int sancus_now(struct timespec *ts)
 {
 	return sancus_clock_gettime(backend, ts);
 }
+
+int sancus_now_coarse(struct timespec *ts)
+{
+#ifdef CLOCK_REALTIME_COARSE
+	if (backend == NULL && ts != NULL) {
+		int err = clock_gettime(CLOCK_REALTIME_COARSE, ts);
+
+		if (err != 0)
+			*ts = (struct timespec) { 0, 0 };
+		return err;
+	}
+#endif
+	return sancus_clock_gettime(backend, ts);
+}
@@ -0,0 +1,124 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/time.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <sancus/alloc.h>
+#include <sancus/buffer.h>
+#include <sancus/stream.h>
+#include <sancus/tcp_conn.h>
+#include <sancus/conn_slab.h>
+
+#define CACHELINE_MASK	((size_t)SANCUS_CONN_SLAB_CACHELINE - 1)
+
+static inline size_t cacheline_round(size_t l)
+{
+	return (l + CACHELINE_MASK) & ~CACHELINE_MASK;
+}
+
+/* generations wrap within the bits left by the index, keeping parity */
+static inline uint32_t next_gen(const struct sancus_conn_slab *self, uint32_t gen)
+{
+	return (gen + 1) & (UINT32_MAX >> self->index_bits);
+}
+
+int sancus_conn_slab_init(struct sancus_conn_slab *self,
+			  uint32_t capacity, size_t user_size)
+{
+	size_t stride = SANCUS_CONN_USER_OFFSET + cacheline_round(user_size);
+	unsigned bits = 1;
+	void *mem;
+	char *base;
+
+	assert(self);
+
+	if (capacity == 0 || capacity > SANCUS_CONN_SLAB_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	while ((UINT32_C(1) << bits) < capacity)
+		bits++;
+
+	/* extra room to align the first record */
+	mem = sancus_alloc((size_t)capacity * stride + CACHELINE_MASK);
+	if (mem == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	base = (char *)(((uintptr_t)mem + CACHELINE_MASK) & ~(uintptr_t)CACHELINE_MASK);
+
+	*self = (struct sancus_conn_slab) {
+		.mem = mem,
+		.base = base,
+		.stride = stride,
+		.user_size = user_size,
+		.capacity = capacity,
+		.free = 0,
+		.index_bits = bits,
+	};
+
+	for (uint32_t i = 0; i < capacity; i++) {
+		struct sancus_conn *c = sancus_conn_slab_at(self, i);
+
+		c->gen = 0;
+		c->next = i + 1;
+	}
+
+	return 0;
+}
+
+void sancus_conn_slab_destroy(struct sancus_conn_slab *self)
+{
+	assert(self->used == 0);
+
+	if (self->mem != NULL)
+		sancus_free(self->mem);
+
+	*self = (struct sancus_conn_slab) { .mem = NULL };
+}
+
+struct sancus_conn *sancus_conn_slab_alloc(struct sancus_conn_slab *self)
+{
+	struct sancus_conn *c;
+	uint32_t gen;
+
+	if (self->free >= self->capacity) {
+		errno = ENOBUFS;
+		return NULL;
+	}
+
+	/* last freed first, likely still in cache */
+	c = sancus_conn_slab_at(self, self->free);
+	self->free = c->next;
+	self->used++;
+
+	gen = next_gen(self, c->gen);
+	memset(c, 0, SANCUS_CONN_USER_OFFSET + self->user_size);
+	c->gen = gen;
+
+	assert(c->gen & 1);
+	return c;
+}
+
+void sancus_conn_slab_free(struct sancus_conn_slab *self, struct sancus_conn *c)
+{
+	uint32_t index = sancus_conn_slab_index(self, c);
+
+	assert(index < self->capacity);
+	assert(c->gen & 1);
+	assert(self->used > 0);
+
+	c->gen = next_gen(self, c->gen);
+	c->next = self->free;
+
+	self->free = index;
+	self->used--;
+}
@@ -11,8 +11,9 @@
 #include <pthread.h>
 #include <signal.h>
 
+#include "logger_private.h"
+
 enum {
-	LOG_PRELUDE_SIZE =  64,
 	LOG_PREFIX_SIZE  = 128,
 	LOG_MESSAGE_SIZE = 256,
 	LOG_DATA_SIZE    = 256,
@@ -35,18 +36,85 @@ int sancus_logger_set_default_backend(const struct sancus_logger_backend *backen
 	return 0;
 }
 
+/*
+ * resolved settings
+ */
+unsigned sancus_logger__generation = 1;
+
+void sancus_logger__resolve(const struct sancus_logger *logger, unsigned gen,
+			    struct sancus_logger_cache *out)
+{
+	struct sancus_logger_cache *c = logger->cache;
+	const struct sancus_logger *prefix = NULL;
+	const struct sancus_logger_backend *backend = NULL;
+	const struct sancus_logger *l;
+	unsigned mask = 0;
+
+	/* one walk, stopping at the first ancestor with a valid cache */
+	for (l = logger; l != NULL; l = l->parent) {
+		const struct sancus_logger_cache *pc;
+
+		if (l != logger && (pc = sancus_logger__cached(l, gen)) != NULL) {
+			if (mask == 0)
+				mask = __atomic_load_n(&pc->mask, __ATOMIC_RELAXED);
+			if (prefix == NULL)
+				prefix = __atomic_load_n(&pc->prefix, __ATOMIC_RELAXED);
+			if (backend == NULL)
+				backend = __atomic_load_n(&pc->backend, __ATOMIC_RELAXED);
+			break;
+		}
+
+		if (mask == 0)
+			mask = l->mask;
+		if (prefix == NULL && (l->prefixer != NULL || l->prefix != NULL))
+			prefix = l;
+		if (backend == NULL && l->backend != NULL && l->backend->f != NULL)
+			backend = l->backend;
+	}
+
+	if (mask == 0)
+		mask = SANCUS_LOG_NORMAL;
+
+	*out = (struct sancus_logger_cache) {
+		.stamp = gen,
+		.mask = mask,
+		.prefix = prefix,
+		.backend = backend,
+	};
+
+	/* only the first of concurrent resolvers updates the cache */
+	if (c == &logger->cached) {
+		unsigned old = __atomic_load_n(&c->stamp, __ATOMIC_RELAXED);
+
+		if (old != gen &&
+		    __atomic_compare_exchange_n(&c->stamp, &old, 0, false,
+						__ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			__atomic_store_n(&c->mask, mask, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->prefix, prefix, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->backend, backend, __ATOMIC_RELAXED);
+			__atomic_store_n(&c->stamp, gen, __ATOMIC_RELEASE);
+		}
+	}
+}
+
 static inline
 const struct sancus_logger_backend *log_find_backend(const struct sancus_logger *logger,
 						     const struct sancus_logger_backend *fallback)
 {
-	for (;;) {
-		if (logger == NULL)
-			return fallback;
-		else if (logger->backend && logger->backend->f)
-			return logger->backend;
-		else
-			logger = logger->parent;
-	}
+	const struct sancus_logger_backend *backend = NULL;
+
+	if (logger != NULL)
+		backend = sancus_logger__settings(logger).backend;
+
+	return backend != NULL ? backend : fallback;
+}
+
+int sancus_logger_flush(const struct sancus_logger *logger)
+{
+	const struct sancus_logger_backend *d;
+
+	d = log_find_backend(logger, default_backend);
+	return d->flush != NULL ? d->flush(d->ctx) : 0;
 }
 
 static inline size_t log_buffer_trim(const struct sancus_buffer *buf,
@@ -146,67 +214,75 @@ static inline struct iovec log_iov(const char *s, size_t l)
 	return (struct iovec) { (void*)s, l };
 }
 
-static inline struct iovec log_iov2(const struct sancus_buffer *b)
-{
-	return (struct iovec) {
-		sancus_buffer_ptr(b),
-		sancus_buffer_len(b)
-	};
-}
+/*
+ * prelude
+ *
+ * nanoseconds of the first line and of the last one, shared by all
+ * threads without locking. Lines racing may see a slightly stale @prev,
+ * so negative deltas are clamped.
+ */
+static int64_t log_first_ns, log_prev_ns;
 
-static int fd_logger_write(unsigned level,
-			   const char *prefix, size_t plen,
-			   const char *msg, size_t mlen,
-			   const char *data, size_t dlen,
-			   void *_ctx)
+/* `S.mmm` of @ns, rendered backwards from @pe */
+static inline char *log_fmt_ms(char *pe, int64_t ns)
 {
-	static const char levels[] = "EWITD";
-	DECL_SANCUS_LBUFFER(prelude, LOG_PRELUDE_SIZE);
-	struct sancus_logger_fd_backend_data *ctx = (struct sancus_logger_fd_backend_data *)_ctx;
-	struct iovec iov[7];
-	int iovcnt = 0;
-	int ret = 0;
+	uint64_t ms = ns > 0 ? (uint64_t)ns / 1000000 : 0;
 
-	if (ctx == NULL)
-		return -EINVAL;
+	for (unsigned i = 0; i < 3; i++, ms /= 10)
+		*--pe = (char)('0' + ms % 10);
+	*--pe = '.';
+	do {
+		*--pe = (char)('0' + ms % 10);
+		ms /= 10;
+	} while (ms > 0);
 
-	/*
-	 * prelude
-	 */
-	if (ctx->timestamp) {
-		static struct timespec first, prev;
-		struct timespec ts, dt0, dt1;
-
-		sancus_now(&ts);
-
-		if (unlikely(sancus_time_is_zero(&prev) ||
-			     sancus_time_is_lt(&ts, &first))) {
-			/* first or time warped */
-			dt0 = dt1 = TIMESPEC_INIT(0, 0);
-			first = ts;
-		} else {
-			dt0 = dt1 = ts;
-			sancus_time_sub(&dt0, &first);
-			sancus_time_sub(&dt1, &prev);
-		}
+	return pe;
+}
 
-		prev = ts;
-		sancus_lbuffer_appendf(&prelude,
-				       "[" TIMESPEC_FMT_MS " +" TIMESPEC_FMT_MS "] ",
-				       TIMESPEC_SPLIT_MS(&dt0),
-				       TIMESPEC_SPLIT_MS(&dt1));
+/* `[elapsed +delta] `, returns its length */
+static size_t log_fmt_timestamp(char *buf, int64_t dt0, int64_t dt1)
+{
+	char tmp[LOG_PRELUDE_SIZE], *pe = tmp + sizeof(tmp), *p = pe;
+
+	*--p = ' ';
+	*--p = ']';
+	p = log_fmt_ms(p, dt1);
+	*--p = '+';
+	*--p = ' ';
+	p = log_fmt_ms(p, dt0);
+	*--p = '[';
+
+	memcpy(buf, p, (size_t)(pe - p));
+	return (size_t)(pe - p);
+}
+
+static size_t log_prelude_timestamp(char *buf)
+{
+	struct timespec ts;
+	int64_t now, first, prev;
+
+	sancus_now_coarse(&ts);
+	now = (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+
+	first = __atomic_load_n(&log_first_ns, __ATOMIC_RELAXED);
+	if (unlikely(first == 0 || now < first)) {
+		/* first or time warped */
+		__atomic_store_n(&log_first_ns, now, __ATOMIC_RELAXED);
+		__atomic_store_n(&log_prev_ns, now, __ATOMIC_RELAXED);
+		return log_fmt_timestamp(buf, 0, 0);
 	}
 
-	if (level < sizeof(levels))
-		sancus_lbuffer_appendf(&prelude, "%c/", levels[level]);
-	else
-		sancus_lbuffer_appendf(&prelude, "%u/", level);
+	prev = __atomic_exchange_n(&log_prev_ns, now, __ATOMIC_RELAXED);
+	return log_fmt_timestamp(buf, now - first, now - prev);
+}
 
-	iov[iovcnt++] = log_iov2(sancus_lbuffer_to_buffer(&prelude));
+int sancus_logger__text_iov(struct iovec *iov,
+			    const char *prefix, size_t plen,
+			    const char *msg, size_t mlen,
+			    const char *data, size_t dlen)
+{
+	int iovcnt = 0;
 
-	/*
-	 * prefix
-	 */
 	if (plen) {
 		iov[iovcnt++] = log_iov(prefix, plen);
 
@@ -214,9 +290,6 @@ static int fd_logger_write(unsigned level,
 			iov[iovcnt++] = log_iov(": ", 2);
 	}
 
-	/*
-	 * message
-	 */
 	if (mlen) {
 		iov[iovcnt++] = log_iov(msg, mlen);
 
@@ -224,20 +297,77 @@ static int fd_logger_write(unsigned level,
 			iov[iovcnt++] = log_iov(": ", 2);
 	}
 
+	if (dlen)
+		iov[iovcnt++] = log_iov(data, dlen);
+
+	return iovcnt;
+}
+
+size_t sancus_logger__render_line(struct sancus_logger_line *line,
+				  bool timestamp, unsigned level,
+				  const char *prefix, size_t plen,
+				  const char *msg, size_t mlen,
+				  const char *data, size_t dlen)
+{
+	static const char levels[] = "EWITD";
+	struct iovec *iov = line->iov;
+	char *prelude = line->prelude;
+	int iovcnt = 0;
+	size_t l = 0, len = 0;
+
 	/*
-	 * extra data
+	 * prelude
 	 */
-	if (dlen) {
-		iov[iovcnt++] = log_iov(data, dlen);
+	if (timestamp)
+		l = log_prelude_timestamp(prelude);
+
+	if (likely(level < sizeof(levels) - 1)) {
+		prelude[l++] = levels[level];
+		prelude[l++] = '/';
+	} else {
+		int n = snprintf(prelude + l, sizeof(line->prelude) - l, "%u/", level);
+
+		if (n > 0)
+			l += (size_t)n;
 	}
 
+	iov[iovcnt++] = log_iov(prelude, l);
+
 	/*
-	 * write
+	 * prefix, message and extra data
 	 */
+	iovcnt += sancus_logger__text_iov(iov + iovcnt, prefix, plen, msg, mlen, data, dlen);
+
 	iov[iovcnt++] = log_iov("\n", 1);
 
+	line->iovcnt = iovcnt;
+	while (iovcnt--)
+		len += iov[iovcnt].iov_len;
+
+	return len;
+}
+
+static int fd_logger_write(unsigned level,
+			   const char *prefix, size_t plen,
+			   const char *msg, size_t mlen,
+			   const char *data, size_t dlen,
+			   void *_ctx)
+{
+	struct sancus_logger_fd_backend_data *ctx = (struct sancus_logger_fd_backend_data *)_ctx;
+	struct sancus_logger_line line;
+	int ret = 0;
+
+	if (ctx == NULL)
+		return -EINVAL;
+
+	sancus_logger__render_line(&line, ctx->timestamp, level,
+				   prefix, plen, msg, mlen, data, dlen);
+
+	/*
+	 * write
+	 */
 	pthread_mutex_lock(&ctx->mutex);
-	ret = (int)sancus_writev(ctx->fd, iov, iovcnt);
+	ret = (int)sancus_writev(ctx->fd, line.iov, line.iovcnt);
 	pthread_mutex_unlock(&ctx->mutex);
 
 	return ret;
@@ -248,6 +378,9 @@ static inline ssize_t log_ctx_prefix(const struct sancus_logger *ctx,
 {
 	ssize_t rc = 0;
 
+	if (ctx != NULL)
+		ctx = sancus_logger__settings(ctx).prefix;
+
 	if (ctx != NULL && buf != NULL && size > 0) {
 		if (ctx->prefixer != NULL) {
 			rc = ctx->prefixer(ctx, buf, size);
@@ -263,9 +396,6 @@ static inline ssize_t log_ctx_prefix(const struct sancus_logger *ctx,
 
 				rc = (ssize_t)l;
 			}
-
-		} else if (ctx->parent != NULL) {
-			rc = log_ctx_prefix(ctx->parent, buf, size);
 		}
 	}
 
@@ -332,12 +462,23 @@ int sancus_logger__vprintf(const struct sancus_logger *ctx,
 	DECL_SANCUS_LBUFFER(mbuf0, LOG_MESSAGE_SIZE);
 	struct sancus_buffer *pbuf = sancus_lbuffer_to_buffer(&pbuf0);
 	struct sancus_buffer *mbuf = sancus_lbuffer_to_buffer(&mbuf0);
+	const struct sancus_logger_backend *d;
 	ssize_t rc;
 
 	rc = log_ctx_prefix2(ctx, pbuf);
 	if (rc < 0)
 		goto done;
 
+	d = log_find_backend(ctx, default_backend);
+	if (d->vprintf != NULL) {
+		/* formatting deferred to the backend */
+		const char *prefix;
+		size_t plen = log_buffer_trim(pbuf, &prefix);
+
+		rc = d->vprintf(level, prefix, plen, func, line, fmt, ap, d->ctx);
+		goto done;
+	}
+
 	rc = log_fmt(mbuf, func, line, fmt, ap);
 	if (rc < 0)
 		goto done;
@@ -362,31 +503,75 @@ int sancus_logger__printf(const struct sancus_logger *ctx,
 	return rc;
 }
 
+static const char log_hexa[] = "0123456789abcdef";
+
+#define DUMP_ONES  UINT64_C(0x0101010101010101)
+#define DUMP_HIGHS UINT64_C(0x8080808080808080)
+
+/* bytes of @v equal to zero, or lower than @n (n <= 0x80) */
+#define dump_has_less(V, N) (((V) - DUMP_ONES * (N)) & ~(V) & DUMP_HIGHS)
+#define dump_has_zero(V)    dump_has_less((V), 1)
+
+static inline bool dump_is_plain(unsigned char c)
+{
+	return c > 0x1f && c < 0x7f && c != '"' && c != '\\';
+}
+
+/* true if none of the 8 bytes of @v needs escaping */
+static inline bool dump_is_plain8(uint64_t v)
+{
+	return !((v & DUMP_HIGHS) |
+		 dump_has_less(v, 0x20) |
+		 dump_has_zero(v ^ (DUMP_ONES * 0x7f)) |
+		 dump_has_zero(v ^ (DUMP_ONES * '"')) |
+		 dump_has_zero(v ^ (DUMP_ONES * '\\')));
+}
+
+/* length of the leading run of characters that don't need escaping */
+static inline size_t dump_plain_run(const unsigned char *p, size_t l)
+{
+	size_t n = 0;
+
+	while (l - n >= sizeof(uint64_t)) {
+		uint64_t v;
+
+		memcpy(&v, p + n, sizeof(v));
+		if (!dump_is_plain8(v))
+			break;
+		n += sizeof(v);
+	}
+
+	while (n < l && dump_is_plain(p[n]))
+		n++;
+
+	return n;
+}
+
 static inline ssize_t dump_enc(struct sancus_buffer *buf,
 			       const char *sp, size_t l)
 {
-	static const char hexa[] = "0123456789abcdef";
 	static const unsigned char CEC[] = "abtnvfr";
 	const unsigned char *p = (unsigned char *)sp, *pe = p + l;
 	ssize_t count = 0;
 
 	while (p < pe) {
-		unsigned char c = *p++;
+		size_t n = dump_plain_run(p, (size_t)(pe - p));
+		unsigned char c;
 		ssize_t rc = 0;
 
-		if (c > 0x1f && c < 0x7f) {
-			/* ASCII printable characters */
-			switch (c) {
-			case '"':
-			case '\\':
-				goto escape2;
-			default:
-				count += 1;
-				if (buf)
-					rc = sancus_buffer_append(buf,
-								  (const char *)&c,
-								  1);
-			}
+		if (n > 0) {
+			/* printable run, copied as-is */
+			count += (ssize_t)n;
+			if (buf)
+				rc = sancus_buffer_append(buf, (const char *)p,
+							  (ssize_t)n);
+			p += n;
+			goto next;
+		}
+
+		c = *p++;
+		if (c == '"' || c == '\\') {
+			goto escape2;
 		} else if (c >= '\a' && c <= '\r') {
 			/* C Character Escape Codes */
 			c = CEC[c - '\a'];
@@ -402,13 +587,13 @@ escape2:
 			if (buf) {
 				char out[] = {
 					'\\', 'x',
-					hexa[(c & (0x0f << 4)) >> 4],
-					hexa[c & 0x0f]};
+					log_hexa[c >> 4],
+					log_hexa[c & 0x0f]};
 
 				rc = sancus_buffer_append(buf, out, 4);
 			}
 		}
-
+next:
 		if (rc < 0)
 			return rc;
 	}
@@ -416,7 +601,6 @@ escape2:
 	return count;
 }
 
-
 int sancus_logger__vdumpf(const struct sancus_logger *ctx,
 			  enum sancus_log_level level,
 			  const char *func, unsigned line,
@@ -507,6 +691,173 @@ int sancus_logger__dumpf(const struct sancus_logger *log,
 	return err;
 }
 
+/*
+ * structured fields, rendered as `key=value` for backends not
+ * taking them as they are
+ */
+static bool fields_needs_quotes(const char *s, size_t l)
+{
+	if (l == 0)
+		return true;
+
+	for (size_t i = 0; i < l; i++) {
+		unsigned char c = (unsigned char)s[i];
+
+		if (!dump_is_plain(c) || c == ' ' || c == '=')
+			return true;
+	}
+	return false;
+}
+
+static ssize_t fields_fmt(struct sancus_buffer *buf,
+			  const struct sancus_log_field *fields, size_t count)
+{
+	ssize_t rc = 0;
+
+	for (size_t i = 0; i < count && rc >= 0; i++) {
+		const struct sancus_log_field *f = &fields[i];
+
+		if (i > 0)
+			sancus_buffer_append(buf, " ", 1);
+
+		sancus_buffer_appendz(buf, f->key);
+		sancus_buffer_append(buf, "=", 1);
+
+		switch (f->type) {
+		case SANCUS_LOG_FIELD_INT:
+			rc = sancus_buffer_appendf(buf, "%lld", (long long)f->i);
+			break;
+		case SANCUS_LOG_FIELD_UINT:
+			rc = sancus_buffer_appendf(buf, "%llu", (unsigned long long)f->u);
+			break;
+		case SANCUS_LOG_FIELD_DURATION:
+			rc = sancus_buffer_appendf(buf, TIMESPEC_FMT_MS "s",
+						   TIMESPEC_SPLIT_MS(&f->ts));
+			break;
+		case SANCUS_LOG_FIELD_STRING:
+			if (f->s == NULL) {
+				rc = sancus_buffer_append(buf, "-", 1);
+			} else if (!fields_needs_quotes(f->s, f->len)) {
+				rc = sancus_buffer_append(buf, f->s, (ssize_t)f->len);
+			} else if ((size_t)dump_enc(NULL, f->s, f->len) + 2 <= sancus_buffer_tail_size(buf)) {
+				sancus_buffer_append(buf, "\"", 1);
+				dump_enc(buf, f->s, f->len);
+				rc = sancus_buffer_append(buf, "\"", 1);
+			} else {
+				rc = -ENOBUFS;
+			}
+			break;
+		default:
+			rc = sancus_buffer_append(buf, "?", 1);
+		}
+	}
+
+	return rc;
+}
+
+int sancus_logger__vfieldsf(const struct sancus_logger *ctx,
+			    enum sancus_log_level level,
+			    const char *func, unsigned line,
+			    const struct sancus_log_field *fields, size_t count,
+			    const char *fmt, va_list ap)
+{
+	DECL_SANCUS_LBUFFER(pbuf0, LOG_PREFIX_SIZE);
+	DECL_SANCUS_LBUFFER(mbuf0, LOG_MESSAGE_SIZE);
+	DECL_SANCUS_LBUFFER(dbuf0, LOG_DATA_SIZE);
+
+	struct sancus_buffer *pbuf = sancus_lbuffer_to_buffer(&pbuf0);
+	struct sancus_buffer *mbuf = sancus_lbuffer_to_buffer(&mbuf0);
+	struct sancus_buffer *buf = sancus_lbuffer_to_buffer(&dbuf0);
+	const struct sancus_logger_backend *d;
+	ssize_t rc;
+
+	if (fields == NULL && count > 0)
+		return -EINVAL;
+
+	rc = log_ctx_prefix2(ctx, pbuf);
+	if (rc < 0)
+		goto fail_rc;
+
+	rc = log_fmt(mbuf, func, line, fmt, ap);
+	if (rc < 0)
+		goto fail_rc;
+
+	d = log_find_backend(ctx, default_backend);
+	if (d->fields != NULL) {
+		const char *prefix, *msg;
+		size_t plen = log_buffer_trim(pbuf, &prefix);
+		size_t mlen = log_buffer_trim(mbuf, &msg);
+
+		rc = d->fields(level, prefix, plen, msg, mlen, fields, count, d->ctx);
+		goto fail_rc;
+	}
+
+	/* truncated fields are still logged */
+	fields_fmt(buf, fields, count);
+
+	rc = log_write(ctx, level, pbuf, mbuf, buf);
+fail_rc:
+	return (int)rc;
+}
+
+int sancus_logger__fieldsf(const struct sancus_logger *log,
+			   enum sancus_log_level level,
+			   const char *func, unsigned line,
+			   const struct sancus_log_field *fields, size_t count,
+			   const char *fmt, ...)
+{
+	va_list ap;
+	int err;
+
+	va_start(ap, fmt);
+	err = sancus_logger__vfieldsf(log, level, func, line,
+				      fields, count, fmt, ap);
+	va_end(ap);
+	return err;
+}
+
+/* "%08x " offset, " %02x" per column, " |" ascii "|" */
+#define HEXDUMP_ROW_SIZE(W, O) (((O) ? 9u : 0u) + 4 * (size_t)(W) + 3)
+
+/*
+ * renders a whole `hexdump -C` row of @n bytes into @out, which needs
+ * HEXDUMP_ROW_SIZE(@width, @offset) bytes. returns the length.
+ */
+static size_t hexdump_row(char *out, unsigned off,
+			  const unsigned char *p, size_t n,
+			  size_t width, bool offset)
+{
+	char *q = out, *a;
+	size_t i;
+
+	if (offset) {
+		for (i = 8; i-- > 0; off >>= 4)
+			q[i] = log_hexa[off & 0x0f];
+		q[8] = ' ';
+		q += 9;
+	}
+
+	/* the ascii column starts after the aligned hexa columns */
+	a = q + 3 * (width > n ? width : n);
+	memset(q, ' ', (size_t)(a - q));
+	a[0] = ' ';
+	a[1] = '|';
+	a += 2;
+
+	for (i = 0; i < n; i++) {
+		unsigned char c = p[i];
+
+		q[1] = log_hexa[c >> 4];
+		q[2] = log_hexa[c & 0x0f];
+		q += 3;
+
+		a[i] = (c < 0x20 || c > 0x7e) ? '.' : (char)c;
+	}
+
+	a[n] = '|';
+	return (size_t)(a + n + 1 - out);
+}
+
 int sancus_logger__vhexdumpf(const struct sancus_logger *ctx,
 			     enum sancus_log_level level,
 			     const char *func, unsigned line,
@@ -523,6 +874,8 @@ int sancus_logger__vhexdumpf(const struct sancus_logger *ctx,
 
 	const char *p, *pe;
 	unsigned off;
+	size_t row;
+	bool offset;
 	ssize_t rc;
 
 	if (!data && data_len > 0)
@@ -543,33 +896,28 @@ int sancus_logger__vhexdumpf(const struct sancus_logger *ctx,
 	p = data;
 	pe = p + data_len;
 
+	/*
+	 * without width, rows are as long as they fit, have no offset
+	 * and aren't padded
+	 */
+	offset = width > 0;
+	row = width;
+	if (row == 0 || HEXDUMP_ROW_SIZE(row, offset) > sancus_buffer_tail_size(buf))
+		row = (sancus_buffer_tail_size(buf) - HEXDUMP_ROW_SIZE(0, offset)) / 4;
+	if (width > row)
+		width = row;
+
 	while (p < pe) {
-		const char *q = p;
-
-		if (width) {
-			size_t i;
-			sancus_buffer_appendf(buf, "%08x ", off);
-			for (i = 0; i < width && p < pe; i++, off++)
-				sancus_buffer_appendf(buf, " %02x", *p++ & 0xff);
-
-			/* align */
-			for (; i < width; i++)
-				sancus_buffer_append(buf, "   ", 3);
-		} else {
-			for (; p < pe; off++)
-				sancus_buffer_appendf(buf, " %02x", *p++ & 0xff);
-		}
+		size_t n = (size_t)(pe - p);
 
-		/* ascii */
-		sancus_buffer_append(buf, " |", 2);
-		while (q < p) {
-			unsigned char c = (unsigned char)*q++;
-			if (c < 0x20 || c > 0x7e)
-				c = '.';
-			sancus_buffer_append(buf, (const char*)&c, 1);
-		}
+		if (n > row)
+			n = row;
 
-		sancus_buffer_append(buf, "|", 1);
+		sancus_buffer_sparse(buf, hexdump_row(sancus_buffer_tail_ptr(buf),
+						      off, (const unsigned char *)p, n,
+						      width > 0 ? width : n, offset));
+		p += n;
+		off += (unsigned)n;
 
 		rc = log_write(ctx, level, pbuf, mbuf, buf);
 		if (rc < 0)
@@ -611,8 +959,10 @@ int sancus__assert(const struct sancus_logger *log, int ndebug,
 		sancus_logger__vprintf(log, SANCUS_LOG_ERROR_BIT, func, line, fmt, ap);
 		va_end(ap);
 
-		if (!ndebug)
+		if (!ndebug) {
+			sancus_logger_flush(log);
 			abort();
+		}
 	}
 	return e;
 }
@@ -630,8 +980,10 @@ int sancus__trap(const struct sancus_logger *log, int ndebug,
 		sancus_logger__vprintf(log, SANCUS_LOG_WARN_BIT, func, line, fmt, ap);
 		va_end(ap);
 
-		if (!ndebug && ptrace(PTRACE_TRACEME, 0, NULL, 0) == -1)
+		if (!ndebug && ptrace(PTRACE_TRACEME, 0, NULL, 0) == -1) {
+			sancus_logger_flush(log);
 			raise(SIGTRAP);
+		}
 	}
 	return e;
 }
@@ -0,0 +1,628 @@
+#include <sancus/common.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+#include <sancus/logger_binary.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sancus/alloc.h>
+
+#include "logger_private.h"
+
+enum {
+	ASYNC_RING_SIZE    = 64 * 1024,
+	ASYNC_IOV_MAX      = 64,
+	ASYNC_FLUSH_TIMEOUT = 1, /* seconds */
+};
+
+/*
+ * struct log_ring - single producer, single consumer byte ring
+ *
+ * @head is only written by the owning thread and @tail only by the
+ * writer thread, both grow forever and get masked when accessing @data.
+ * Only whole lines are published.
+ */
+struct log_ring {
+	struct log_ring *next;
+
+	char *data;
+	size_t mask;
+
+	size_t head;
+	size_t tail;
+
+	unsigned long dropped;
+	bool dead;
+};
+
+/*
+ * struct log_async - writer state
+ *
+ * @mutex guards the ring list and the condition variables, @drain
+ * serializes the writes to @fd so no line is written twice and lines
+ * written synchronously don't cut into queued ones. @producers
+ * counts the threads between reading @running and publishing their
+ * line, so stopping can wait for them before the last drain.
+ */
+struct log_async {
+	pthread_mutex_t mutex;
+	pthread_mutex_t drain;
+	pthread_cond_t wake;
+	pthread_cond_t drained;
+
+	pthread_key_t key;
+	pthread_t thread;
+
+	struct log_ring *rings;
+
+	int fd;
+	size_t ring_size;
+	enum sancus_logger_async_policy policy;
+
+	unsigned long dropped;
+	unsigned producers;
+
+	bool binary;
+	bool has_key;
+	bool running;
+	bool stopping;
+	bool signalled;
+};
+
+static int async_logger_write(unsigned level,
+			      const char *prefix, size_t prefix_len,
+			      const char *msg, size_t msg_len,
+			      const char *data, size_t data_len,
+			      void *ctx);
+static int async_logger_vprintf(unsigned level,
+				const char *prefix, size_t prefix_len,
+				const char *func, unsigned line,
+				const char *fmt, va_list ap,
+				void *ctx);
+static int async_logger_flush(void *ctx);
+
+static struct log_async async_data = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.drain = PTHREAD_MUTEX_INITIALIZER,
+	.wake = PTHREAD_COND_INITIALIZER,
+	.drained = PTHREAD_COND_INITIALIZER,
+	.fd = STDERR_FILENO,
+};
+
+static const struct sancus_logger_backend async_backend = {
+	.f = async_logger_write,
+	.flush = async_logger_flush,
+	.ctx = &async_data,
+};
+
+static const struct sancus_logger_backend binary_backend = {
+	.f = async_logger_write,
+	.vprintf = async_logger_vprintf,
+	.flush = async_logger_flush,
+	.ctx = &async_data,
+};
+
+static __thread struct log_ring *local_ring;
+
+/*
+ * ring
+ */
+static inline size_t ring_used(const struct log_ring *r)
+{
+	size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+	size_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+
+	return head - tail;
+}
+
+static inline bool ring_fits(const struct log_ring *r, size_t len)
+{
+	return r->mask + 1 - ring_used(r) >= len;
+}
+
+static inline void ring_copy(struct log_ring *r, size_t off,
+			     const char *s, size_t l)
+{
+	size_t o = off & r->mask;
+	size_t n = r->mask + 1 - o;
+
+	if (n >= l) {
+		memcpy(r->data + o, s, l);
+	} else {
+		memcpy(r->data + o, s, n);
+		memcpy(r->data, s + n, l - n);
+	}
+}
+
+/* called by the owner only */
+static bool ring_push(struct log_ring *r, const struct iovec *iov, int iovcnt,
+		      size_t len)
+{
+	size_t head = r->head;
+
+	if (!ring_fits(r, len))
+		return false;
+
+	for (int i = 0; i < iovcnt; i++) {
+		ring_copy(r, head, iov[i].iov_base, iov[i].iov_len);
+		head += iov[i].iov_len;
+	}
+
+	__atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+	return true;
+}
+
+static void ring_release(void *data)
+{
+	struct log_ring *r = data;
+
+	if (r != NULL)
+		__atomic_store_n(&r->dead, true, __ATOMIC_RELEASE);
+}
+
+static struct log_ring *async_ring(struct log_async *ctx)
+{
+	struct log_ring *r = local_ring;
+
+	if (likely(r != NULL))
+		return r;
+
+	r = sancus_zalloc(sizeof(*r));
+	if (r == NULL)
+		return NULL;
+
+	r->data = sancus_alloc(ctx->ring_size);
+	if (r->data == NULL) {
+		sancus_free(r);
+		return NULL;
+	}
+	r->mask = ctx->ring_size - 1;
+
+	pthread_mutex_lock(&ctx->mutex);
+	r->next = ctx->rings;
+	ctx->rings = r;
+	pthread_mutex_unlock(&ctx->mutex);
+
+	pthread_setspecific(ctx->key, r);
+	local_ring = r;
+	return r;
+}
+
+/*
+ * writer
+ */
+static inline void async_wake(struct log_async *ctx)
+{
+	if (!__atomic_exchange_n(&ctx->signalled, true, __ATOMIC_ACQ_REL)) {
+		pthread_mutex_lock(&ctx->mutex);
+		pthread_cond_signal(&ctx->wake);
+		pthread_mutex_unlock(&ctx->mutex);
+	}
+}
+
+/* call with the mutex held */
+static bool async_is_empty(const struct log_async *ctx)
+{
+	for (const struct log_ring *r = ctx->rings; r; r = r->next) {
+		if (ring_used(r))
+			return false;
+	}
+	return true;
+}
+
+/* call with the mutex held */
+static void async_reap(struct log_async *ctx)
+{
+	struct log_ring **pp = &ctx->rings;
+
+	while (*pp != NULL) {
+		struct log_ring *r = *pp;
+
+		/* drops not reported yet wait for the next drain */
+		if (__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE) && !ring_used(r) &&
+		    !__atomic_load_n(&r->dropped, __ATOMIC_ACQUIRE)) {
+			*pp = r->next;
+			sancus_free(r->data);
+			sancus_free(r);
+		} else {
+			pp = &r->next;
+		}
+	}
+}
+
+static ssize_t async_dropped_note(char *buf, size_t size, bool binary,
+				  unsigned long dropped)
+{
+	char msg[64];
+	int l = snprintf(msg, sizeof(msg), "%lu log lines dropped", dropped);
+
+	if (l <= 0)
+		return 0;
+	else if (binary)
+		return sancus_logger__encode_text(buf, size, SANCUS_LOG_WARN_BIT,
+						  "sancus", 6, msg, (size_t)l,
+						  NULL, 0);
+
+	return snprintf(buf, size, "W/sancus: %s\n", msg);
+}
+
+/*
+ * writes one batch of pending lines, returns the number of bytes
+ * consumed from the rings
+ */
+static ssize_t async_drain_locked(struct log_async *ctx)
+{
+	struct iovec iov[ASYNC_IOV_MAX + 1];
+	struct log_ring *rings[ASYNC_IOV_MAX / 2];
+	size_t heads[ASYNC_IOV_MAX / 2];
+	unsigned long dropped = 0;
+	uint64_t note[128 / sizeof(uint64_t)];
+	size_t total = 0;
+	int i, n = 0, iovcnt = 0;
+
+	pthread_mutex_lock(&ctx->mutex);
+	for (struct log_ring *r = ctx->rings; r && n < (int)ARRAY_SIZE(rings); r = r->next) {
+		size_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		size_t tail = r->tail;
+
+		dropped += __atomic_exchange_n(&r->dropped, 0, __ATOMIC_ACQ_REL);
+
+		if (head != tail) {
+			size_t o = tail & r->mask;
+			size_t l = head - tail;
+			size_t l0 = r->mask + 1 - o;
+
+			if (l0 >= l) {
+				iov[iovcnt++] = (struct iovec) { r->data + o, l };
+			} else {
+				iov[iovcnt++] = (struct iovec) { r->data + o, l0 };
+				iov[iovcnt++] = (struct iovec) { r->data, l - l0 };
+			}
+
+			rings[n] = r;
+			heads[n++] = head;
+			total += l;
+		}
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+
+	if (dropped) {
+		ssize_t l = async_dropped_note((char *)note, sizeof(note),
+					       ctx->binary, dropped);
+		if (l > 0)
+			iov[iovcnt++] = (struct iovec) { note, (size_t)l };
+
+		__atomic_add_fetch(&ctx->dropped, dropped, __ATOMIC_RELAXED);
+	}
+
+	if (iovcnt > 0) {
+		/* on failure the lines are discarded anyway */
+		sancus_writev(ctx->fd, iov, iovcnt);
+
+		for (i = 0; i < n; i++)
+			__atomic_store_n(&rings[i]->tail, heads[i], __ATOMIC_RELEASE);
+	}
+
+	return (ssize_t)total;
+}
+
+static ssize_t async_drain(struct log_async *ctx)
+{
+	ssize_t rc;
+
+	pthread_mutex_lock(&ctx->drain);
+	rc = async_drain_locked(ctx);
+	pthread_mutex_unlock(&ctx->drain);
+	return rc;
+}
+
+static void *async_thread(void *arg)
+{
+	struct log_async *ctx = arg;
+	bool stopping;
+
+	do {
+		pthread_mutex_lock(&ctx->mutex);
+		while (!__atomic_load_n(&ctx->signalled, __ATOMIC_ACQUIRE) &&
+		       !ctx->stopping)
+			pthread_cond_wait(&ctx->wake, &ctx->mutex);
+
+		__atomic_store_n(&ctx->signalled, false, __ATOMIC_RELEASE);
+		stopping = ctx->stopping;
+		pthread_mutex_unlock(&ctx->mutex);
+
+		while (async_drain(ctx) > 0)
+			;
+
+		pthread_mutex_lock(&ctx->mutex);
+		async_reap(ctx);
+		pthread_cond_broadcast(&ctx->drained);
+		pthread_mutex_unlock(&ctx->mutex);
+	} while (!stopping);
+
+	return NULL;
+}
+
+/*
+ * backend
+ */
+static int async_push(struct log_async *ctx,
+		      const struct iovec *iov, int iovcnt, size_t len)
+{
+	struct log_ring *r = NULL;
+	ssize_t rc;
+
+	/* seen by sancus_logger_async_stop() before its last drain */
+	__atomic_add_fetch(&ctx->producers, 1, __ATOMIC_SEQ_CST);
+
+	if (likely(__atomic_load_n(&ctx->running, __ATOMIC_SEQ_CST)))
+		r = async_ring(ctx);
+
+	if (unlikely(r == NULL || len > r->mask + 1))
+		goto sync;
+
+	while (!ring_push(r, iov, iovcnt, len)) {
+		bool running;
+
+		if (ctx->policy == SANCUS_LOGGER_ASYNC_DROP) {
+			__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(&ctx->producers, 1, __ATOMIC_RELEASE);
+			async_wake(ctx);
+			return -ENOBUFS;
+		}
+
+		pthread_mutex_lock(&ctx->mutex);
+		running = __atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE);
+		if (running && !ring_fits(r, len)) {
+			__atomic_store_n(&ctx->signalled, true, __ATOMIC_RELEASE);
+			pthread_cond_signal(&ctx->wake);
+			pthread_cond_wait(&ctx->drained, &ctx->mutex);
+		}
+		pthread_mutex_unlock(&ctx->mutex);
+
+		if (!running)
+			goto sync;
+	}
+
+	__atomic_sub_fetch(&ctx->producers, 1, __ATOMIC_RELEASE);
+	async_wake(ctx);
+	return (int)len;
+sync:
+	__atomic_sub_fetch(&ctx->producers, 1, __ATOMIC_RELEASE);
+
+	/*
+	 * no writer or too long for the ring, write it ourselves after
+	 * the lines already queued, ours included
+	 */
+	pthread_mutex_lock(&ctx->drain);
+	while (async_drain_locked(ctx) > 0)
+		;
+	rc = sancus_writev(ctx->fd, (struct iovec *)iov, iovcnt);
+	pthread_mutex_unlock(&ctx->drain);
+	return (int)rc;
+}
+
+static int async_logger_write(unsigned level,
+			      const char *prefix, size_t plen,
+			      const char *msg, size_t mlen,
+			      const char *data, size_t dlen,
+			      void *_ctx)
+{
+	struct log_async *ctx = (struct log_async *)_ctx;
+	struct sancus_logger_line line;
+	size_t len;
+
+	if (ctx == NULL)
+		return -EINVAL;
+
+	if (ctx->binary) {
+		uint64_t buf[SANCUS_LOGGER_BINARY_RECORD_MAX / sizeof(uint64_t)];
+		ssize_t rc = sancus_logger__encode_text((char *)buf, sizeof(buf), level,
+							prefix, plen, msg, mlen,
+							data, dlen);
+		if (rc < 0)
+			return (int)rc;
+
+		line.iov[0] = (struct iovec) { buf, (size_t)rc };
+		return async_push(ctx, line.iov, 1, (size_t)rc);
+	}
+
+	len = sancus_logger__render_line(&line, true, level,
+					 prefix, plen, msg, mlen, data, dlen);
+
+	return async_push(ctx, line.iov, line.iovcnt, len);
+}
+
+static int async_logger_vprintf(unsigned level,
+				const char *prefix, size_t plen,
+				const char *func, unsigned line,
+				const char *fmt, va_list ap,
+				void *_ctx)
+{
+	struct log_async *ctx = (struct log_async *)_ctx;
+	uint64_t buf[SANCUS_LOGGER_BINARY_RECORD_MAX / sizeof(uint64_t)];
+	struct iovec iov;
+	ssize_t rc;
+
+	if (ctx == NULL)
+		return -EINVAL;
+
+	rc = sancus_logger__encode_printf((char *)buf, sizeof(buf), level,
+					  prefix, plen, func, line, fmt, ap);
+	if (rc < 0)
+		return (int)rc;
+
+	iov = (struct iovec) { buf, (size_t)rc };
+	rc = async_push(ctx, &iov, 1, iov.iov_len);
+
+	/* definitions of dropped records go with the next one instead */
+	if (rc >= 0)
+		sancus_logger__binary_commit((const char *)buf, iov.iov_len);
+	return (int)rc;
+}
+
+static int async_logger_flush(void *_ctx)
+{
+	struct log_async *ctx = (struct log_async *)_ctx;
+	struct timespec deadline;
+	int rc = 0;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += ASYNC_FLUSH_TIMEOUT;
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (!__atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_unlock(&ctx->mutex);
+
+		while (async_drain(ctx) > 0)
+			;
+		return 0;
+	}
+
+	while (!async_is_empty(ctx)) {
+		__atomic_store_n(&ctx->signalled, true, __ATOMIC_RELEASE);
+		pthread_cond_signal(&ctx->wake);
+
+		rc = pthread_cond_timedwait(&ctx->drained, &ctx->mutex, &deadline);
+		if (rc != 0) {
+			rc = -rc;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&ctx->mutex);
+
+	return rc;
+}
+
+static void async_atexit(void)
+{
+	sancus_logger_async_stop();
+}
+
+/*
+ * exported functions
+ */
+int sancus_logger_set_async_backend(const struct sancus_logger_async_settings *settings)
+{
+	static bool registered;
+	struct log_async *ctx = &async_data;
+	size_t size = ASYNC_RING_SIZE;
+	sigset_t all, old;
+	int rc;
+
+	if (settings == NULL || settings->fd < 0)
+		return -EINVAL;
+
+	/* round up to a power of two */
+	if (settings->ring_size > 0) {
+		size_t min = settings->binary ? SANCUS_LOGGER_BINARY_RECORD_MAX : LOG_PRELUDE_SIZE;
+
+		for (size = min; size < settings->ring_size; size <<= 1)
+			;
+	}
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (__atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE)) {
+		rc = -EBUSY;
+		goto done;
+	}
+
+	if (!ctx->has_key) {
+		rc = pthread_key_create(&ctx->key, ring_release);
+		if (rc != 0) {
+			rc = -rc;
+			goto done;
+		}
+		ctx->has_key = true;
+	}
+
+	ctx->fd = settings->fd;
+	ctx->policy = settings->policy;
+	ctx->ring_size = size;
+	ctx->binary = settings->binary;
+	ctx->stopping = false;
+
+	if (ctx->binary) {
+		struct sancus_logger_binary_header h;
+
+		sancus_logger__binary_header(&h);
+		sancus_logger__binary_reset();
+
+		rc = (int)sancus_write(ctx->fd, (const char *)&h, sizeof(h));
+		if (rc < 0)
+			goto done;
+	}
+
+	/* the writer thread takes no signals */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	rc = pthread_create(&ctx->thread, NULL, async_thread, ctx);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (rc != 0) {
+		rc = -rc;
+		goto done;
+	}
+
+	__atomic_store_n(&ctx->running, true, __ATOMIC_RELEASE);
+
+	if (!registered) {
+		atexit(async_atexit);
+		registered = true;
+	}
+done:
+	pthread_mutex_unlock(&ctx->mutex);
+
+	if (rc == 0)
+		rc = sancus_logger_set_default_backend(settings->binary ?
+						       &binary_backend :
+						       &async_backend);
+	return rc;
+}
+
+int sancus_logger_async_flush(void)
+{
+	return async_logger_flush(&async_data);
+}
+
+int sancus_logger_async_stop(void)
+{
+	struct log_async *ctx = &async_data;
+
+	pthread_mutex_lock(&ctx->mutex);
+	if (!__atomic_load_n(&ctx->running, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_unlock(&ctx->mutex);
+		return 0;
+	}
+
+	/* new lines are written synchronously, blocked producers too */
+	__atomic_store_n(&ctx->running, false, __ATOMIC_SEQ_CST);
+	ctx->stopping = true;
+	pthread_cond_signal(&ctx->wake);
+	pthread_cond_broadcast(&ctx->drained);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	/* and those that saw it running finish pushing */
+	while (__atomic_load_n(&ctx->producers, __ATOMIC_SEQ_CST) > 0)
+		sched_yield();
+
+	pthread_join(ctx->thread, NULL);
+
+	/* lines pushed after the writer's last drain */
+	while (async_drain(ctx) > 0)
+		;
+
+	return 0;
+}
+
+unsigned long sancus_logger_async_dropped(void)
+{
+	return __atomic_load_n(&async_data.dropped, __ATOMIC_RELAXED);
+}
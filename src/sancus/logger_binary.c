@@ -0,0 +1,562 @@
+#include <sancus/common.h>
+#include <sancus/clock.h>
+#include <sancus/logger.h>
+#include <sancus/logger_binary.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <wchar.h>
+
+#include "logger_private.h"
+
+enum {
+	LOG_DICT_SIZE   = 4096,
+	LOG_DICT_PROBES = 16,
+};
+
+/*
+ * format parser
+ */
+const char *sancus_logger_binary_next(const char *fmt,
+				      struct sancus_logger_binary_spec *spec)
+{
+	const char *p, *q;
+
+	if (fmt == NULL || (p = strchr(fmt, '%')) == NULL)
+		return NULL;
+
+	*spec = (struct sancus_logger_binary_spec) {
+		.start = p,
+		.prec = -1,
+	};
+	q = p + 1;
+
+	/* flags */
+	while (*q != '\0' && strchr("-+ #0'I", *q) != NULL)
+		q++;
+
+	/* width */
+	if (*q == '*') {
+		spec->star_width = true;
+		q++;
+	} else {
+		while (*q >= '0' && *q <= '9')
+			q++;
+	}
+
+	/* precision */
+	if (*q == '.') {
+		q++;
+		if (*q == '*') {
+			spec->star_prec = true;
+			q++;
+		} else {
+			spec->prec = 0;
+			while (*q >= '0' && *q <= '9')
+				spec->prec = spec->prec * 10 + (*q++ - '0');
+		}
+	}
+
+	spec->head_len = (unsigned)(q - p);
+
+	/* length modifier */
+	switch (*q) {
+	case 'h':
+		if (*++q == 'h') {
+			spec->length = SANCUS_LOGGER_ARG_LEN_HH;
+			q++;
+		} else {
+			spec->length = SANCUS_LOGGER_ARG_LEN_H;
+		}
+		break;
+	case 'l':
+		if (*++q == 'l') {
+			spec->length = SANCUS_LOGGER_ARG_LEN_LL;
+			q++;
+		} else {
+			spec->length = SANCUS_LOGGER_ARG_LEN_L;
+		}
+		break;
+	case 'q':
+		spec->length = SANCUS_LOGGER_ARG_LEN_LL;
+		q++;
+		break;
+	case 'j':
+		spec->length = SANCUS_LOGGER_ARG_LEN_J;
+		q++;
+		break;
+	case 'z':
+		spec->length = SANCUS_LOGGER_ARG_LEN_Z;
+		q++;
+		break;
+	case 't':
+		spec->length = SANCUS_LOGGER_ARG_LEN_T;
+		q++;
+		break;
+	case 'L':
+		spec->length = SANCUS_LOGGER_ARG_LEN_BIG_L;
+		q++;
+		break;
+	default:
+		;
+	}
+
+	/* conversion */
+	switch (*q) {
+	case 'd':
+	case 'i':
+	case 'c':
+		spec->type = SANCUS_LOGGER_ARG_INT;
+		break;
+	case 'u':
+	case 'o':
+	case 'x':
+	case 'X':
+		spec->type = SANCUS_LOGGER_ARG_UINT;
+		break;
+	case 'e':
+	case 'E':
+	case 'f':
+	case 'F':
+	case 'g':
+	case 'G':
+	case 'a':
+	case 'A':
+		spec->type = SANCUS_LOGGER_ARG_DOUBLE;
+		break;
+	case 'p':
+		spec->type = SANCUS_LOGGER_ARG_PTR;
+		break;
+	case 's':
+		spec->type = SANCUS_LOGGER_ARG_STRING;
+		break;
+	case 'm':
+		spec->type = SANCUS_LOGGER_ARG_ERRNO;
+		break;
+	case '\0':
+		/* truncated conversion */
+		return NULL;
+	default: /* %%, %n and unknown */
+		spec->type = SANCUS_LOGGER_ARG_NONE;
+	}
+
+	spec->conv = *q++;
+	spec->len = (unsigned)(q - p);
+	return p;
+}
+
+/*
+ * dictionary of the strings already defined in the stream, by id
+ */
+static uint64_t log_dict[LOG_DICT_SIZE];
+
+/* FNV-1a of the contents, mixed with the length. Never 0 */
+static inline uint64_t log_string_id(const char *s, size_t l)
+{
+	uint64_t h = UINT64_C(0xcbf29ce484222325);
+
+	for (size_t i = 0; i < l; i++) {
+		h ^= (unsigned char)s[i];
+		h *= UINT64_C(0x100000001b3);
+	}
+
+	h ^= (uint64_t)l * UINT64_C(0x9e3779b97f4a7c15);
+	return h != 0 ? h : 1;
+}
+
+static inline size_t log_dict_hash(uint64_t id)
+{
+	return (size_t)((id * UINT64_C(0x9e3779b97f4a7c15)) >> 52);
+}
+
+static bool log_dict_has(uint64_t id)
+{
+	size_t h = log_dict_hash(id);
+
+	for (unsigned i = 0; i < LOG_DICT_PROBES; i++) {
+		uint64_t cur = __atomic_load_n(&log_dict[(h + i) & (LOG_DICT_SIZE - 1)],
+					       __ATOMIC_ACQUIRE);
+
+		if (cur == id)
+			return true;
+		else if (cur == 0)
+			break;
+	}
+	return false;
+}
+
+static void log_dict_insert(uint64_t id)
+{
+	size_t h = log_dict_hash(id);
+
+	for (unsigned i = 0; i < LOG_DICT_PROBES; i++) {
+		uint64_t *slot = &log_dict[(h + i) & (LOG_DICT_SIZE - 1)];
+		uint64_t cur = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+
+		if (cur == 0 &&
+		    __atomic_compare_exchange_n(slot, &cur, id, false,
+						__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return;
+		else if (cur == id)
+			return;
+	}
+
+	/* crowded, defined again every time */
+}
+
+void sancus_logger__binary_commit(const char *buf, size_t len)
+{
+	size_t off = 0;
+
+	while (len - off >= sizeof(struct sancus_logger_record)) {
+		const struct sancus_logger_record *rec = (const void *)(buf + off);
+
+		if (rec->len < sizeof(*rec) || rec->len > len - off)
+			break;
+		else if (rec->type == SANCUS_LOGGER_RECORD_STRING)
+			log_dict_insert(rec->fmt);
+
+		off += rec->len;
+	}
+}
+
+void sancus_logger__binary_reset(void)
+{
+	for (unsigned i = 0; i < LOG_DICT_SIZE; i++)
+		__atomic_store_n(&log_dict[i], 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * encoder
+ */
+struct log_enc {
+	char *p, *pe;
+	bool truncated;
+};
+
+static inline bool enc_put(struct log_enc *e, const void *v, size_t l)
+{
+	if ((size_t)(e->pe - e->p) < l) {
+		e->truncated = true;
+		return false;
+	}
+
+	memcpy(e->p, v, l);
+	e->p += l;
+	return true;
+}
+
+static inline bool enc_u32(struct log_enc *e, uint32_t v)
+{
+	return enc_put(e, &v, sizeof(v));
+}
+
+static inline bool enc_u64(struct log_enc *e, uint64_t v)
+{
+	return enc_put(e, &v, sizeof(v));
+}
+
+/* length prefixed, truncated to fit */
+static bool enc_str(struct log_enc *e, const char *s, size_t l)
+{
+	size_t room = (size_t)(e->pe - e->p);
+
+	if (s == NULL) {
+		return enc_u32(e, UINT32_MAX);
+	} else if (room < sizeof(uint32_t)) {
+		e->truncated = true;
+		return false;
+	}
+
+	room -= sizeof(uint32_t);
+	if (l > room) {
+		l = room;
+		e->truncated = true;
+	}
+
+	enc_u32(e, (uint32_t)l);
+	return enc_put(e, s, l);
+}
+
+static bool enc_wstr(struct log_enc *e, const wchar_t *ws, int prec)
+{
+	char buf[256];
+	size_t l = 0;
+
+	if (ws == NULL)
+		return enc_u32(e, UINT32_MAX);
+
+	/* ASCII only */
+	while (ws[l] != L'\0' && l < sizeof(buf) && (prec < 0 || l < (size_t)prec)) {
+		wchar_t c = ws[l];
+		buf[l++] = (c > 0 && c < 0x80) ? (char)c : '?';
+	}
+	return enc_str(e, buf, l);
+}
+
+static inline uint64_t log_ts(void)
+{
+	struct timespec ts;
+
+	sancus_now(&ts);
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+static struct sancus_logger_record *enc_record(struct log_enc *e,
+					       enum sancus_logger_record_type type,
+					       unsigned level, uint64_t ts)
+{
+	struct sancus_logger_record *rec = (struct sancus_logger_record *)e->p;
+
+	if (!enc_put(e, &(struct sancus_logger_record) {
+			.type = (uint8_t)type,
+			.level = (uint8_t)level,
+			.ts = ts,
+		     }, sizeof(*rec)))
+		return NULL;
+
+	return rec;
+}
+
+/* records are padded to keep them 8 byte aligned */
+static inline void enc_record_done(struct log_enc *e,
+				   struct sancus_logger_record *rec)
+{
+	size_t pad = (size_t)(-(e->p - (char *)rec)) & 7;
+
+	memset(e->p, 0, pad);
+	e->p += pad;
+
+	rec->len = (uint32_t)(e->p - (char *)rec);
+	if (e->truncated)
+		rec->flags |= SANCUS_LOGGER_RECORD_TRUNCATED;
+}
+
+/*
+ * defines @s ahead of the record using it unless the stream already
+ * has it, returns its id
+ */
+static uint64_t enc_define(struct log_enc *e, const char *s, uint64_t ts)
+{
+	struct sancus_logger_record *rec;
+	uint64_t id;
+	size_t l;
+
+	if (s == NULL)
+		return 0;
+
+	l = strlen(s);
+	id = log_string_id(s, l);
+	if (log_dict_has(id))
+		return id;
+
+	rec = enc_record(e, SANCUS_LOGGER_RECORD_STRING, 0, ts);
+	if (rec != NULL) {
+		size_t room = (size_t)(e->pe - e->p);
+
+		rec->fmt = id;
+		enc_put(e, s, l < room ? l : room);
+		enc_record_done(e, rec);
+	}
+	e->truncated = false;
+	return id;
+}
+
+static void enc_args(struct log_enc *e, const char *fmt, va_list ap, int saved_errno)
+{
+	struct sancus_logger_binary_spec spec;
+
+	while ((fmt = sancus_logger_binary_next(fmt, &spec)) != NULL) {
+		int prec = spec.prec;
+		bool ok = true;
+
+		fmt += spec.len;
+
+		if (spec.star_width)
+			ok = enc_u32(e, (uint32_t)va_arg(ap, int));
+		if (spec.star_prec) {
+			prec = va_arg(ap, int);
+			ok = ok && enc_u32(e, (uint32_t)prec);
+		}
+
+		switch (spec.type) {
+		case SANCUS_LOGGER_ARG_INT: {
+			int64_t v;
+
+			switch (spec.length) {
+			case SANCUS_LOGGER_ARG_LEN_HH:
+				v = (signed char)va_arg(ap, int);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_H:
+				v = (short)va_arg(ap, int);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_L:
+				v = va_arg(ap, long);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_LL:
+			case SANCUS_LOGGER_ARG_LEN_BIG_L: /* glibc's %Ld */
+				v = va_arg(ap, long long);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_J:
+				v = va_arg(ap, intmax_t);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_Z:
+				v = va_arg(ap, ssize_t);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_T:
+				v = va_arg(ap, ptrdiff_t);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_NONE:
+			default: /* -Wswitch-default */
+				v = va_arg(ap, int);
+			}
+			ok = ok && enc_u64(e, (uint64_t)v);
+			}
+			break;
+		case SANCUS_LOGGER_ARG_UINT: {
+			uint64_t v;
+
+			switch (spec.length) {
+			case SANCUS_LOGGER_ARG_LEN_HH:
+				v = (unsigned char)va_arg(ap, unsigned);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_H:
+				v = (unsigned short)va_arg(ap, unsigned);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_L:
+				v = va_arg(ap, unsigned long);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_LL:
+			case SANCUS_LOGGER_ARG_LEN_BIG_L:
+				v = va_arg(ap, unsigned long long);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_J:
+				v = va_arg(ap, uintmax_t);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_Z:
+				v = va_arg(ap, size_t);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_T:
+				v = (uint64_t)va_arg(ap, ptrdiff_t);
+				break;
+			case SANCUS_LOGGER_ARG_LEN_NONE:
+			default: /* -Wswitch-default */
+				v = va_arg(ap, unsigned);
+			}
+			ok = ok && enc_u64(e, v);
+			}
+			break;
+		case SANCUS_LOGGER_ARG_DOUBLE: {
+			double v;
+
+			if (spec.length == SANCUS_LOGGER_ARG_LEN_BIG_L)
+				v = (double)va_arg(ap, long double);
+			else
+				v = va_arg(ap, double);
+			ok = ok && enc_put(e, &v, sizeof(v));
+			}
+			break;
+		case SANCUS_LOGGER_ARG_PTR:
+			ok = ok && enc_u64(e, (uintptr_t)va_arg(ap, void *));
+			break;
+		case SANCUS_LOGGER_ARG_STRING:
+			if (spec.length == SANCUS_LOGGER_ARG_LEN_L) {
+				ok = ok && enc_wstr(e, va_arg(ap, const wchar_t *), prec);
+			} else {
+				const char *s = va_arg(ap, const char *);
+				size_t l = 0;
+
+				if (s != NULL)
+					l = prec < 0 ? strlen(s) : strnlen(s, (size_t)prec);
+				ok = ok && enc_str(e, s, l);
+			}
+			break;
+		case SANCUS_LOGGER_ARG_ERRNO: {
+			const char *s = strerror(saved_errno);
+			ok = ok && enc_str(e, s, strlen(s));
+			}
+			break;
+		case SANCUS_LOGGER_ARG_NONE:
+		default:
+			if (spec.conv == 'n')
+				(void)va_arg(ap, void *);
+		}
+
+		if (!ok)
+			break;
+	}
+}
+
+ssize_t sancus_logger__encode_printf(char *buf, size_t size, unsigned level,
+				     const char *prefix, size_t plen,
+				     const char *func, unsigned line,
+				     const char *fmt, va_list ap)
+{
+	int saved_errno = errno;
+	struct log_enc e = { buf, buf + size, false };
+	struct sancus_logger_record *rec;
+	uint64_t ts = log_ts();
+	uint64_t fmt_id, func_id;
+
+	if (func != NULL && *func == '\0')
+		func = NULL;
+	if (fmt != NULL && *fmt == '\0')
+		fmt = NULL;
+
+	fmt_id = enc_define(&e, fmt, ts);
+	func_id = enc_define(&e, func, ts);
+
+	rec = enc_record(&e, SANCUS_LOGGER_RECORD_PRINTF, level, ts);
+	if (rec == NULL)
+		return -ENOBUFS;
+
+	rec->fmt = fmt_id;
+	rec->func = func_id;
+	rec->line = line;
+
+	if (plen > UINT16_MAX)
+		plen = UINT16_MAX;
+	if (enc_put(&e, prefix, plen))
+		rec->prefix_len = (uint16_t)plen;
+
+	if (fmt != NULL)
+		enc_args(&e, fmt, ap, saved_errno);
+
+	enc_record_done(&e, rec);
+	return e.p - buf;
+}
+
+ssize_t sancus_logger__encode_text(char *buf, size_t size, unsigned level,
+				   const char *prefix, size_t plen,
+				   const char *msg, size_t mlen,
+				   const char *data, size_t dlen)
+{
+	struct log_enc e = { buf, buf + size, false };
+	struct sancus_logger_record *rec;
+
+	rec = enc_record(&e, SANCUS_LOGGER_RECORD_TEXT, level, log_ts());
+	if (rec == NULL)
+		return -ENOBUFS;
+
+	if (plen > UINT16_MAX)
+		plen = UINT16_MAX;
+	if (enc_put(&e, prefix, plen))
+		rec->prefix_len = (uint16_t)plen;
+
+	enc_str(&e, msg, mlen);
+	enc_str(&e, data, dlen);
+
+	enc_record_done(&e, rec);
+	return e.p - buf;
+}
+
+void sancus_logger__binary_header(struct sancus_logger_binary_header *h)
+{
+	*h = (struct sancus_logger_binary_header) {
+		.version = SANCUS_LOGGER_BINARY_VERSION,
+		.byte_order = SANCUS_LOGGER_BINARY_BYTE_ORDER,
+	};
+	memcpy(h->magic, SANCUS_LOGGER_BINARY_MAGIC, sizeof(h->magic));
+}
@@ -0,0 +1,524 @@
+#define _GNU_SOURCE /* sendmmsg() */
+
+#include <sancus/common.h>
+#include <sancus/buffer.h>
+#include <sancus/clock.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <syslog.h>
+#include <pthread.h>
+#include <time.h>
+
+#include <sancus/socket.h>
+
+#include "logger_private.h"
+
+enum {
+	LOG_DGRAM_SIZE       = 2048,
+	LOG_DGRAM_BATCH      = 32,
+	LOG_DGRAM_IDENT_SIZE = 48,
+	LOG_DGRAM_HOST_SIZE  = 256,
+};
+
+#define LOG_JOURNALD_PATH "/run/systemd/journal/socket"
+#define LOG_SYSLOG_PATH   "/dev/log"
+
+/* private enterprise number reserved for documentation, RFC 5612 */
+#define LOG_SYSLOG_SD_ID  "fields@32473"
+
+struct log_dgram {
+	char buf[LOG_DGRAM_SIZE];
+	size_t len;
+};
+
+struct log_dgram_queue {
+	struct log_dgram dgram[LOG_DGRAM_BATCH];
+	unsigned count;
+};
+
+/*
+ * records are queued on the active queue, and whoever finds nobody
+ * sending sends it, swapping queues so others can keep queuing
+ * behind, until there is nothing left.
+ */
+struct sancus_logger_datagram_backend_data {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+
+	int fd;
+	enum sancus_logger_datagram_format format;
+	int facility;
+	pid_t pid;
+
+	char ident[LOG_DGRAM_IDENT_SIZE];
+	char host[LOG_DGRAM_HOST_SIZE];
+
+	struct log_dgram_queue queue[2];
+	unsigned active;
+	bool sending;
+};
+
+static struct sancus_logger_datagram_backend_data dgram_backend_data = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.fd = -1,
+};
+
+static inline int log_priority(unsigned level)
+{
+	static const int priorities[] = {
+		[SANCUS_LOG_ERROR_BIT] = LOG_ERR,
+		[SANCUS_LOG_WARN_BIT]  = LOG_WARNING,
+		[SANCUS_LOG_INFO_BIT]  = LOG_INFO,
+		[SANCUS_LOG_TRACE_BIT] = LOG_DEBUG,
+		[SANCUS_LOG_DEBUG_BIT] = LOG_DEBUG,
+	};
+
+	return level < ARRAY_SIZE(priorities) ? priorities[level] : LOG_DEBUG;
+}
+
+/*
+ * journald native protocol
+ */
+static void jd_key(struct sancus_buffer *b, const char *key)
+{
+	char name[64];
+	size_t l = 0;
+
+	/* [A-Z0-9_], not starting with `_` or a digit */
+	if (!((*key >= 'a' && *key <= 'z') || (*key >= 'A' && *key <= 'Z')))
+		name[l++] = 'X';
+
+	for (; *key != '\0' && l < sizeof(name); key++) {
+		char c = *key;
+
+		if (c >= 'a' && c <= 'z')
+			c = (char)(c - 'a' + 'A');
+		else if (!((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+			c = '_';
+		name[l++] = c;
+	}
+
+	sancus_buffer_append(b, name, (ssize_t)l);
+}
+
+/* KEY=value\n, or KEY\n<le64 length>value\n if @value has newlines */
+static void jd_field(struct sancus_buffer *b, const char *key,
+		     const struct iovec *iov, int iovcnt)
+{
+	size_t len = 0, room;
+	bool binary = false;
+
+	for (int i = 0; i < iovcnt; i++) {
+		len += iov[i].iov_len;
+		if (!binary && memchr(iov[i].iov_base, '\n', iov[i].iov_len) != NULL)
+			binary = true;
+	}
+
+	jd_key(b, key);
+
+	if (binary) {
+		uint8_t le[8];
+
+		/* the length goes first, so it has to be right */
+		room = sancus_buffer_tail_size(b);
+		room = room > sizeof(le) + 2 ? room - sizeof(le) - 2 : 0;
+		if (len > room)
+			len = room;
+
+		for (unsigned i = 0; i < sizeof(le); i++)
+			le[i] = (uint8_t)((uint64_t)len >> (8 * i));
+
+		sancus_buffer_append(b, "\n", 1);
+		sancus_buffer__append(b, true, (const char *)le, sizeof(le));
+	} else {
+		sancus_buffer__append(b, true, "=", 1);
+	}
+
+	for (int i = 0; i < iovcnt && len > 0; i++) {
+		size_t l = iov[i].iov_len < len ? iov[i].iov_len : len;
+
+		sancus_buffer__append(b, true, iov[i].iov_base, (ssize_t)l);
+		len -= l;
+	}
+
+	sancus_buffer__append(b, true, "\n", 1);
+}
+
+static void jd_fieldf(struct sancus_buffer *b, const char *key, const char *fmt, ...)
+	__attr_printf(3);
+
+static void jd_fieldf(struct sancus_buffer *b, const char *key, const char *fmt, ...)
+{
+	char value[64];
+	struct iovec iov;
+	va_list ap;
+	int l;
+
+	va_start(ap, fmt);
+	l = vsnprintf(value, sizeof(value), fmt, ap);
+	va_end(ap);
+
+	if (l < 0)
+		return;
+	else if ((size_t)l >= sizeof(value))
+		l = sizeof(value) - 1;
+
+	iov = (struct iovec) { value, (size_t)l };
+	jd_field(b, key, &iov, 1);
+}
+
+/*
+ * RFC 5424
+ */
+static void sl_header(struct sancus_buffer *b,
+		      const struct sancus_logger_datagram_backend_data *ctx,
+		      unsigned level)
+{
+	struct timespec ts;
+	struct tm tm;
+
+	sancus_now(&ts);
+	gmtime_r(&ts.tv_sec, &tm);
+
+	sancus_buffer_appendf(b, "<%d>1 %04d-%02d-%02dT%02d:%02d:%02d.%06ldZ %s %s %ld - ",
+			      ctx->facility | log_priority(level),
+			      tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+			      tm.tm_hour, tm.tm_min, tm.tm_sec,
+			      ts.tv_nsec / 1000,
+			      ctx->host[0] != '\0' ? ctx->host : "-",
+			      ctx->ident[0] != '\0' ? ctx->ident : "-",
+			      (long)ctx->pid);
+}
+
+static void sl_param_value(struct sancus_buffer *b, const char *s, size_t l)
+{
+	const char *p = s, *pe = s + l;
+
+	while (p < pe) {
+		const char *q = p;
+
+		while (q < pe && *q != '"' && *q != '\\' && *q != ']')
+			q++;
+
+		sancus_buffer__append(b, true, p, q - p);
+		if (q < pe) {
+			char out[] = { '\\', *q++ };
+			sancus_buffer__append(b, true, out, 2);
+		}
+		p = q;
+	}
+}
+
+static void sl_structured_data(struct sancus_buffer *b,
+			       const struct sancus_log_field *fields, size_t count)
+{
+	if (count == 0) {
+		sancus_buffer_append(b, "- ", 2);
+		return;
+	}
+
+	sancus_buffer__appendz(b, true, "[" LOG_SYSLOG_SD_ID);
+
+	for (size_t i = 0; i < count; i++) {
+		const struct sancus_log_field *f = &fields[i];
+		char name[33];
+		size_t l = 0;
+
+		if (f->key == NULL)
+			continue;
+
+		/* PARAM-NAME, printable but `=`, ` `, `]` and `"` */
+		for (const char *k = f->key; *k != '\0' && l < sizeof(name) - 1; k++) {
+			char c = *k;
+
+			if (c <= ' ' || c > '~' || c == '=' || c == ']' || c == '"')
+				c = '_';
+			name[l++] = c;
+		}
+		name[l] = '\0';
+
+		sancus_buffer__appendf(b, true, " %s=\"", name);
+
+		switch (f->type) {
+		case SANCUS_LOG_FIELD_INT:
+			sancus_buffer__appendf(b, true, "%lld", (long long)f->i);
+			break;
+		case SANCUS_LOG_FIELD_UINT:
+			sancus_buffer__appendf(b, true, "%llu", (unsigned long long)f->u);
+			break;
+		case SANCUS_LOG_FIELD_STRING:
+			if (f->s != NULL)
+				sl_param_value(b, f->s, f->len);
+			break;
+		case SANCUS_LOG_FIELD_DURATION:
+			sancus_buffer__appendf(b, true, TIMESPEC_FMT_MS "s",
+					       TIMESPEC_SPLIT_MS(&f->ts));
+			break;
+		default:
+			;
+		}
+
+		sancus_buffer__append(b, true, "\"", 1);
+	}
+
+	sancus_buffer__append(b, true, "] ", 2);
+}
+
+/*
+ * record
+ */
+static size_t log_dgram_render(struct log_dgram *d,
+			       const struct sancus_logger_datagram_backend_data *ctx,
+			       unsigned level,
+			       const char *prefix, size_t plen,
+			       const char *msg, size_t mlen,
+			       const char *data, size_t dlen,
+			       const struct sancus_log_field *fields, size_t count)
+{
+	struct sancus_buffer b;
+	struct iovec iov[LOG_TEXT_IOVCNT];
+	int iovcnt = sancus_logger__text_iov(iov, prefix, plen, msg, mlen, data, dlen);
+
+	sancus_buffer_init(&b, d->buf, sizeof(d->buf));
+
+	if (ctx->format == SANCUS_LOGGER_JOURNALD) {
+		jd_fieldf(&b, "PRIORITY", "%d", log_priority(level));
+		jd_fieldf(&b, "SYSLOG_FACILITY", "%d", ctx->facility >> 3);
+		if (ctx->ident[0] != '\0')
+			jd_fieldf(&b, "SYSLOG_IDENTIFIER", "%s", ctx->ident);
+
+		jd_field(&b, "MESSAGE", iov, iovcnt);
+
+		for (size_t i = 0; i < count; i++) {
+			const struct sancus_log_field *f = &fields[i];
+			struct iovec v;
+
+			if (f->key == NULL)
+				continue;
+
+			switch (f->type) {
+			case SANCUS_LOG_FIELD_INT:
+				jd_fieldf(&b, f->key, "%lld", (long long)f->i);
+				break;
+			case SANCUS_LOG_FIELD_UINT:
+				jd_fieldf(&b, f->key, "%llu", (unsigned long long)f->u);
+				break;
+			case SANCUS_LOG_FIELD_STRING:
+				v = (struct iovec) { (void *)f->s, f->s != NULL ? f->len : 0 };
+				jd_field(&b, f->key, &v, 1);
+				break;
+			case SANCUS_LOG_FIELD_DURATION:
+				jd_fieldf(&b, f->key, TIMESPEC_FMT_MS "s",
+					  TIMESPEC_SPLIT_MS(&f->ts));
+				break;
+			default:
+				;
+			}
+		}
+	} else {
+		sl_header(&b, ctx, level);
+		sl_structured_data(&b, fields, count);
+
+		for (int i = 0; i < iovcnt; i++)
+			sancus_buffer__append(&b, true, iov[i].iov_base,
+					      (ssize_t)iov[i].iov_len);
+	}
+
+	d->len = sancus_buffer_len(&b);
+	return d->len;
+}
+
+static void log_dgram_send(struct sancus_logger_datagram_backend_data *ctx,
+			   struct log_dgram_queue *q)
+{
+	struct mmsghdr msgs[LOG_DGRAM_BATCH];
+	struct iovec iov[LOG_DGRAM_BATCH];
+	unsigned i, sent = 0;
+
+	for (i = 0; i < q->count; i++) {
+		iov[i] = (struct iovec) { q->dgram[i].buf, q->dgram[i].len };
+		msgs[i] = (struct mmsghdr) {
+			.msg_hdr = {
+				.msg_iov = &iov[i],
+				.msg_iovlen = 1,
+			},
+		};
+	}
+
+	while (sent < q->count) {
+		int rc = sendmmsg(ctx->fd, msgs + sent, q->count - sent, 0);
+
+		if (rc > 0) {
+			sent += (unsigned)rc;
+		} else if (rc < 0 && errno == EINTR) {
+			continue;
+		} else if (rc < 0 && errno == EMSGSIZE) {
+			/* too big for the receiver, skip it */
+			sent++;
+		} else {
+			/* dropped, nowhere better to report it */
+			break;
+		}
+	}
+}
+
+static int log_dgram_write(struct sancus_logger_datagram_backend_data *ctx,
+			   unsigned level,
+			   const char *prefix, size_t plen,
+			   const char *msg, size_t mlen,
+			   const char *data, size_t dlen,
+			   const struct sancus_log_field *fields, size_t count)
+{
+	struct log_dgram d;
+	struct log_dgram_queue *q;
+	size_t len;
+
+	if (ctx == NULL)
+		return -EINVAL;
+
+	len = log_dgram_render(&d, ctx, level, prefix, plen, msg, mlen,
+			       data, dlen, fields, count);
+
+	pthread_mutex_lock(&ctx->mutex);
+
+	while (ctx->queue[ctx->active].count == LOG_DGRAM_BATCH)
+		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+
+	q = &ctx->queue[ctx->active];
+	memcpy(q->dgram[q->count].buf, d.buf, len);
+	q->dgram[q->count].len = len;
+	q->count++;
+
+	if (!ctx->sending) {
+		ctx->sending = true;
+
+		while (ctx->queue[ctx->active].count > 0) {
+			q = &ctx->queue[ctx->active];
+			ctx->active ^= 1;
+
+			pthread_mutex_unlock(&ctx->mutex);
+			log_dgram_send(ctx, q);
+			pthread_mutex_lock(&ctx->mutex);
+
+			q->count = 0;
+			pthread_cond_broadcast(&ctx->cond);
+		}
+
+		ctx->sending = false;
+		pthread_cond_broadcast(&ctx->cond);
+	}
+
+	pthread_mutex_unlock(&ctx->mutex);
+	return (int)len;
+}
+
+static int dgram_logger_write(unsigned level,
+			      const char *prefix, size_t plen,
+			      const char *msg, size_t mlen,
+			      const char *data, size_t dlen,
+			      void *ctx)
+{
+	return log_dgram_write(ctx, level, prefix, plen, msg, mlen,
+			       data, dlen, NULL, 0);
+}
+
+static int dgram_logger_fields(unsigned level,
+			       const char *prefix, size_t plen,
+			       const char *msg, size_t mlen,
+			       const struct sancus_log_field *fields, size_t count,
+			       void *ctx)
+{
+	return log_dgram_write(ctx, level, prefix, plen, msg, mlen,
+			       NULL, 0, fields, count);
+}
+
+static int dgram_logger_flush(void *_ctx)
+{
+	struct sancus_logger_datagram_backend_data *ctx = _ctx;
+
+	if (ctx == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&ctx->mutex);
+	while (ctx->sending)
+		pthread_cond_wait(&ctx->cond, &ctx->mutex);
+	pthread_mutex_unlock(&ctx->mutex);
+
+	return 0;
+}
+
+static const struct sancus_logger_backend dgram_backend = {
+	.f = dgram_logger_write,
+	.fields = dgram_logger_fields,
+	.flush = dgram_logger_flush,
+	.ctx = &dgram_backend_data,
+};
+
+int sancus_logger_set_datagram_backend(const struct sancus_logger_datagram_settings *settings)
+{
+	struct sancus_logger_datagram_backend_data *ctx = &dgram_backend_data;
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	const char *path;
+	int fd, old;
+
+	if (settings == NULL)
+		return -EINVAL;
+
+	switch (settings->format) {
+	case SANCUS_LOGGER_JOURNALD:
+		path = LOG_JOURNALD_PATH;
+		break;
+	case SANCUS_LOGGER_SYSLOG:
+		path = LOG_SYSLOG_PATH;
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (settings->path != NULL)
+		path = settings->path;
+	if (strlen(path) >= sizeof(sa.sun_path))
+		return -ENAMETOOLONG;
+	strcpy(sa.sun_path, path);
+
+	fd = sancus_socket(AF_UNIX, SOCK_DGRAM, 0, 1, 0);
+	if (fd < 0)
+		return -errno;
+
+	if (connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		int err = -errno;
+		sancus_close(fd);
+		return err;
+	}
+
+	dgram_logger_flush(ctx);
+
+	pthread_mutex_lock(&ctx->mutex);
+	old = ctx->fd;
+
+	ctx->fd = fd;
+	ctx->format = settings->format;
+	ctx->facility = settings->facility != 0 ? settings->facility : LOG_USER;
+	ctx->pid = getpid();
+
+	snprintf(ctx->ident, sizeof(ctx->ident), "%s",
+		 settings->ident != NULL ? settings->ident : "");
+	if (gethostname(ctx->host, sizeof(ctx->host)) < 0)
+		ctx->host[0] = '\0';
+	ctx->host[sizeof(ctx->host) - 1] = '\0';
+	pthread_mutex_unlock(&ctx->mutex);
+
+	if (old >= 0)
+		sancus_close(old);
+
+	return sancus_logger_set_default_backend(&dgram_backend);
+}
@@ -0,0 +1,349 @@
+#include <sancus/common.h>
+#include <sancus/clock.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+
+enum {
+	LOG_JSON_LINE_SIZE = 4096,
+	LOG_JSON_RESERVE   = 2, /* "}\n" */
+};
+
+/*
+ * encoder
+ */
+struct log_json_enc {
+	char *p, *pe;
+};
+
+/* 0 if copied as-is, otherwise the character following the `\` */
+static const char json_esc[256] = {
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	['"'] = '"',
+	['\\'] = '\\',
+};
+
+static inline size_t json_room(const struct log_json_enc *e)
+{
+	return (size_t)(e->pe - e->p);
+}
+
+static inline bool json_put(struct log_json_enc *e, const char *s, size_t l)
+{
+	if (json_room(e) < l)
+		return false;
+
+	memcpy(e->p, s, l);
+	e->p += l;
+	return true;
+}
+
+#define json_putz(E, S) json_put((E), (S), sizeof(S) - 1)
+
+static bool json_u64(struct log_json_enc *e, uint64_t v)
+{
+	char buf[20], *p = buf + sizeof(buf);
+
+	do {
+		*--p = (char)('0' + v % 10);
+		v /= 10;
+	} while (v > 0);
+
+	return json_put(e, p, (size_t)(buf + sizeof(buf) - p));
+}
+
+static bool json_i64(struct log_json_enc *e, int64_t v)
+{
+	if (v < 0) {
+		return json_putz(e, "-") &&
+			json_u64(e, ~(uint64_t)v + 1);
+	}
+	return json_u64(e, (uint64_t)v);
+}
+
+/*
+ * seconds, with @digits decimals out of the nanoseconds. Negative
+ * values have the sign apart and the magnitude formatted, {-2, 5e8}
+ * being -1.5
+ */
+static bool json_seconds(struct log_json_enc *e, const struct timespec *ts,
+			 unsigned digits)
+{
+	char frac[9];
+	long sec = ts->tv_sec + ts->tv_nsec / 1000000000;
+	long nsec = ts->tv_nsec % 1000000000;
+	uint64_t whole;
+
+	if (nsec < 0) {
+		nsec += 1000000000;
+		sec--;
+	}
+
+	if (sec < 0) {
+		if (!json_putz(e, "-"))
+			return false;
+
+		whole = (uint64_t)-(sec + 1);
+		if (nsec > 0)
+			nsec = 1000000000 - nsec;
+		else
+			whole++;
+	} else {
+		whole = (uint64_t)sec;
+	}
+
+	for (unsigned i = 9; i-- > 0; nsec /= 10)
+		frac[i] = (char)('0' + nsec % 10);
+
+	return json_u64(e, whole) &&
+		json_putz(e, ".") &&
+		json_put(e, frac, digits);
+}
+
+/* length of the well-formed UTF-8 sequence at @p, 0 if there is none */
+static size_t json_utf8_len(const unsigned char *p, const unsigned char *pe)
+{
+	unsigned char lo = 0x80, hi = 0xbf;
+	size_t n;
+
+	if (*p >= 0xc2 && *p <= 0xdf) {
+		n = 2;
+	} else if (*p >= 0xe0 && *p <= 0xef) {
+		n = 3;
+		if (*p == 0xe0)
+			lo = 0xa0;	/* overlong */
+		else if (*p == 0xed)
+			hi = 0x9f;	/* surrogates */
+	} else if (*p >= 0xf0 && *p <= 0xf4) {
+		n = 4;
+		if (*p == 0xf0)
+			lo = 0x90;	/* overlong */
+		else if (*p == 0xf4)
+			hi = 0x8f;	/* beyond U+10FFFF */
+	} else {
+		return 0;
+	}
+
+	if ((size_t)(pe - p) < n || p[1] < lo || p[1] > hi)
+		return 0;
+
+	for (size_t i = 2; i < n; i++) {
+		if ((p[i] & 0xc0) != 0x80)
+			return 0;
+	}
+	return n;
+}
+
+/*
+ * quoted and escaped, truncated to fit on an UTF-8 boundary. Bytes
+ * not part of well-formed UTF-8 become U+FFFD
+ */
+static bool json_str(struct log_json_enc *e, const char *s, size_t l)
+{
+	const unsigned char *p = (const unsigned char *)s, *pe = p + l;
+
+	if (s == NULL)
+		return json_putz(e, "null");
+	else if (json_room(e) < 2)
+		return false;
+
+	json_putz(e, "\"");
+
+	while (p < pe) {
+		const unsigned char *q = p;
+		char esc;
+
+		while (q < pe) {
+			size_t n = 1;
+
+			if (*q < 0x80 ? json_esc[*q] != 0 : (n = json_utf8_len(q, pe)) == 0)
+				break;
+			q += n;
+		}
+
+		if (q > p) {
+			size_t n = (size_t)(q - p), room = json_room(e);
+
+			if (room < n + 1) {
+				/* truncate */
+				n = room > 0 ? room - 1 : 0;
+				while (n > 0 && (p[n] & 0xc0) == 0x80)
+					n--;
+				json_put(e, (const char *)p, n);
+				break;
+			}
+
+			json_put(e, (const char *)p, n);
+			p = q;
+			continue;
+		}
+
+		esc = *p < 0x80 ? json_esc[*p] : 0;
+		if (esc == 0) {
+			if (json_room(e) < 7 || !json_putz(e, "\\ufffd"))
+				break;
+		} else if (esc == 'u') {
+			static const char hexa[] = "0123456789abcdef";
+			char out[] = { '\\', 'u', '0', '0', hexa[*p >> 4], hexa[*p & 0x0f] };
+
+			if (json_room(e) < sizeof(out) + 1 || !json_put(e, out, sizeof(out)))
+				break;
+		} else {
+			char out[] = { '\\', esc };
+
+			if (json_room(e) < sizeof(out) + 1 || !json_put(e, out, sizeof(out)))
+				break;
+		}
+		p++;
+	}
+
+	return json_putz(e, "\"");
+}
+
+static bool json_key(struct log_json_enc *e, const char *key)
+{
+	return json_putz(e, ",") &&
+		json_str(e, key, strlen(key)) &&
+		json_putz(e, ":");
+}
+
+/* string member, skipped entirely if it doesn't fit */
+static bool json_member(struct log_json_enc *e, const char *key,
+			const char *s, size_t l)
+{
+	char *p = e->p;
+
+	if (json_key(e, key) && json_str(e, s, l))
+		return true;
+
+	e->p = p;
+	return false;
+}
+
+static bool json_field(struct log_json_enc *e, const struct sancus_log_field *f)
+{
+	if (f->key == NULL || !json_key(e, f->key))
+		return false;
+
+	switch (f->type) {
+	case SANCUS_LOG_FIELD_INT:
+		return json_i64(e, f->i);
+	case SANCUS_LOG_FIELD_UINT:
+		return json_u64(e, f->u);
+	case SANCUS_LOG_FIELD_STRING:
+		return json_str(e, f->s, f->len);
+	case SANCUS_LOG_FIELD_DURATION:
+		return json_seconds(e, &f->ts, 9);
+	default:
+		return json_putz(e, "null");
+	}
+}
+
+/*
+ * backend
+ */
+struct sancus_logger_json_backend_data {
+	pthread_mutex_t mutex;
+	int fd;
+};
+
+static struct sancus_logger_json_backend_data json_backend_data = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.fd = STDERR_FILENO,
+};
+
+static int json_logger_emit(struct sancus_logger_json_backend_data *ctx,
+			    unsigned level,
+			    const char *prefix, size_t plen,
+			    const char *msg, size_t mlen,
+			    const char *data, size_t dlen,
+			    const struct sancus_log_field *fields, size_t count)
+{
+	static const char *const levels[] = {
+		"error", "warn", "info", "trace", "debug",
+	};
+	char line[LOG_JSON_LINE_SIZE];
+	struct log_json_enc e = { line, line + sizeof(line) - LOG_JSON_RESERVE };
+	struct timespec ts;
+	int ret;
+
+	if (ctx == NULL)
+		return -EINVAL;
+
+	sancus_now(&ts);
+
+	json_putz(&e, "{\"ts\":");
+	json_seconds(&e, &ts, 6);
+
+	json_putz(&e, ",\"level\":");
+	if (level < ARRAY_SIZE(levels))
+		json_str(&e, levels[level], strlen(levels[level]));
+	else
+		json_u64(&e, level);
+
+	if (plen > 0)
+		json_member(&e, "prefix", prefix, plen);
+	if (mlen > 0)
+		json_member(&e, "msg", msg, mlen);
+	if (dlen > 0)
+		json_member(&e, "data", data, dlen);
+
+	for (size_t i = 0; i < count; i++) {
+		char *p = e.p;
+
+		/* only whole fields */
+		if (!json_field(&e, &fields[i])) {
+			e.p = p;
+			break;
+		}
+	}
+
+	/* always room for these */
+	*e.p++ = '}';
+	*e.p++ = '\n';
+
+	pthread_mutex_lock(&ctx->mutex);
+	ret = (int)sancus_write(ctx->fd, line, (size_t)(e.p - line));
+	pthread_mutex_unlock(&ctx->mutex);
+
+	return ret;
+}
+
+static int json_logger_write(unsigned level,
+			     const char *prefix, size_t plen,
+			     const char *msg, size_t mlen,
+			     const char *data, size_t dlen,
+			     void *ctx)
+{
+	return json_logger_emit(ctx, level, prefix, plen, msg, mlen,
+				data, dlen, NULL, 0);
+}
+
+static int json_logger_fields(unsigned level,
+			      const char *prefix, size_t plen,
+			      const char *msg, size_t mlen,
+			      const struct sancus_log_field *fields, size_t count,
+			      void *ctx)
+{
+	return json_logger_emit(ctx, level, prefix, plen, msg, mlen,
+				NULL, 0, fields, count);
+}
+
+static const struct sancus_logger_backend json_backend = {
+	.f = json_logger_write,
+	.fields = json_logger_fields,
+	.ctx = &json_backend_data,
+};
+
+int sancus_logger_set_json_backend(int fd)
+{
+	if (fd < 0)
+		return -EINVAL;
+
+	json_backend_data.fd = fd;
+	return sancus_logger_set_default_backend(&json_backend);
+}
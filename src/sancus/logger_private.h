@@ -0,0 +1,77 @@
+#ifndef __SANCUS_LOGGER_PRIVATE_H__
+#define __SANCUS_LOGGER_PRIVATE_H__
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <sys/uio.h>
+
+enum {
+	LOG_PRELUDE_SIZE =  64,
+	LOG_TEXT_IOVCNT  =   5,
+	LOG_LINE_IOVCNT  =   LOG_TEXT_IOVCNT + 2,
+};
+
+/**
+ * sancus_logger__text_iov - points @iov to the prefix, message and
+ * extra data of a backend call, ": " separated, skipping the empty
+ * ones. Returns the entries used, up to %LOG_TEXT_IOVCNT
+ */
+int sancus_logger__text_iov(struct iovec *iov,
+			    const char *prefix, size_t plen,
+			    const char *msg, size_t mlen,
+			    const char *data, size_t dlen);
+
+/**
+ * struct sancus_logger_line - a log line ready to be written
+ *
+ * @iov:	pieces of the line, pointing to the backend arguments
+ *		and to @prelude
+ * @iovcnt:	number of @iov entries in use
+ * @prelude:	storage for the rendered timestamp and level
+ */
+struct sancus_logger_line {
+	struct iovec iov[LOG_LINE_IOVCNT];
+	int iovcnt;
+
+	char prelude[LOG_PRELUDE_SIZE];
+};
+
+/**
+ * sancus_logger__render_line - renders a backend call in the text
+ * format of the fd backend, returns the length of the line
+ */
+size_t sancus_logger__render_line(struct sancus_logger_line *line,
+				  bool timestamp, unsigned level,
+				  const char *prefix, size_t plen,
+				  const char *msg, size_t mlen,
+				  const char *data, size_t dlen);
+
+/*
+ * binary records, see <sancus/logger_binary.h>
+ *
+ * @buf is expected to be 8 byte aligned, and its size a multiple of 8
+ */
+struct sancus_logger_binary_header;
+
+ssize_t sancus_logger__encode_printf(char *buf, size_t size, unsigned level,
+				     const char *prefix, size_t plen,
+				     const char *func, unsigned line,
+				     const char *fmt, va_list ap);
+
+ssize_t sancus_logger__encode_text(char *buf, size_t size, unsigned level,
+				   const char *prefix, size_t plen,
+				   const char *msg, size_t mlen,
+				   const char *data, size_t dlen);
+
+void sancus_logger__binary_header(struct sancus_logger_binary_header *);
+
+/*
+ * the records encoded in @buf made it to the stream, so the strings
+ * they define aren't defined again
+ */
+void sancus_logger__binary_commit(const char *buf, size_t len);
+
+/* forget all defined strings */
+void sancus_logger__binary_reset(void);
+
+#endif /* !__SANCUS_LOGGER_PRIVATE_H__ */
@@ -0,0 +1,51 @@
+#include <sancus/common.h>
+#include <sancus/clock.h>
+#include <sancus/logger.h>
+
+#include <stdint.h>
+
+static inline uint64_t log_now_ns(void)
+{
+	struct timespec ts;
+
+	sancus_now(&ts);
+	return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+/*
+ * token bucket kept as the theoretical arrival time of the next
+ * message (GCRA), so the whole bucket fits a single CAS.
+ */
+bool sancus_logger__ratelimit(struct sancus_logger_ratelimit *rl,
+			      const struct sancus_logger *logger,
+			      enum sancus_log_level level)
+{
+	uint64_t interval = (uint64_t)rl->interval_ms * UINT64_C(1000000);
+	uint64_t t = rl->burst > 1 ? interval / rl->burst : interval;
+	uint64_t now = log_now_ns();
+	uint64_t tat = __atomic_load_n(&rl->tat, __ATOMIC_RELAXED);
+	uint64_t next;
+	unsigned suppressed;
+
+	do {
+		uint64_t base = tat;
+
+		/* idle, or the clock went back */
+		if (base < now || base > now + interval)
+			base = now;
+
+		if (base - now > interval - t) {
+			__atomic_add_fetch(&rl->suppressed, 1, __ATOMIC_RELAXED);
+			return false;
+		}
+
+		next = base + t;
+	} while (!__atomic_compare_exchange_n(&rl->tat, &tat, next, true,
+					      __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	suppressed = __atomic_exchange_n(&rl->suppressed, 0, __ATOMIC_RELAXED);
+	if (suppressed > 0)
+		sancus_logger__printf(logger, level, NULL, 0,
+				      "%u messages suppressed", suppressed);
+	return true;
+}
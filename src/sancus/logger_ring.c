@@ -0,0 +1,278 @@
+#include <sancus/common.h>
+#include <sancus/clock.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+#include <sancus/logger_ring.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "logger_private.h"
+
+enum {
+	LOG_RING_DEFAULT_SIZE = 1 << 20,
+	LOG_RING_MIN_SIZE     = 4 * SANCUS_LOGGER_RING_TEXT_MAX,
+};
+
+/*
+ * ring access, wrapping around the end
+ */
+static void ring_put(char *data, uint64_t size, uint64_t pos,
+		     const void *s, size_t l)
+{
+	size_t off = (size_t)(pos & (size - 1));
+	size_t n = (size_t)size - off;
+
+	if (l <= n) {
+		memcpy(data + off, s, l);
+	} else {
+		memcpy(data + off, s, n);
+		memcpy(data, (const char *)s + n, l - n);
+	}
+}
+
+static void ring_get(const char *data, uint64_t size, uint64_t pos,
+		     void *s, size_t l)
+{
+	size_t off = (size_t)(pos & (size - 1));
+	size_t n = (size_t)size - off;
+
+	if (l <= n) {
+		memcpy(s, data + off, l);
+	} else {
+		memcpy(s, data + off, n);
+		memcpy((char *)s + n, data, l - n);
+	}
+}
+
+/*
+ * reader
+ */
+static inline bool ring_header_is_valid(const struct sancus_logger_ring_header *h,
+					size_t map_len)
+{
+	return memcmp(h->magic, SANCUS_LOGGER_RING_MAGIC, sizeof(h->magic)) == 0 &&
+		h->byte_order == SANCUS_LOGGER_RING_BYTE_ORDER &&
+		h->version == SANCUS_LOGGER_RING_VERSION &&
+		h->size >= SANCUS_LOGGER_RING_ALIGN &&
+		(h->size & (h->size - 1)) == 0 &&
+		h->size <= map_len - SANCUS_LOGGER_RING_HEADER_SIZE;
+}
+
+int sancus_logger_ring_reader_init(struct sancus_logger_ring_reader *r,
+				   const void *map, size_t map_len)
+{
+	const struct sancus_logger_ring_header *h = map;
+	uint64_t head;
+
+	if (r == NULL || map == NULL)
+		return -EINVAL;
+	else if (map_len < SANCUS_LOGGER_RING_HEADER_SIZE || !ring_header_is_valid(h, map_len))
+		return -EINVAL;
+
+	head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+
+	*r = (struct sancus_logger_ring_reader) {
+		.data = (const char *)map + SANCUS_LOGGER_RING_HEADER_SIZE,
+		.size = h->size,
+		.pos = head > h->size ? head - h->size : 0,
+		.head = head,
+	};
+
+	return 0;
+}
+
+int sancus_logger_ring_reader_next(struct sancus_logger_ring_reader *r,
+				   struct sancus_logger_ring_record *rec,
+				   char *buf, size_t size)
+{
+	if (r == NULL || rec == NULL)
+		return -EINVAL;
+
+	while (r->pos + sizeof(*rec) <= r->head) {
+		size_t rec_size;
+
+		ring_get(r->data, r->size, r->pos, rec, sizeof(*rec));
+		rec_size = SANCUS_LOGGER_RING_RECORD_SIZE(rec->len);
+
+		if (~rec->pos == r->pos &&
+		    rec->len <= SANCUS_LOGGER_RING_TEXT_MAX &&
+		    r->pos + rec_size <= r->head) {
+			size_t l = rec->len < size ? rec->len : size;
+
+			if (l > 0)
+				ring_get(r->data, r->size, r->pos + sizeof(*rec), buf, l);
+
+			rec->pos = r->pos;
+			r->pos += rec_size;
+			return (int)l;
+		}
+
+		/* torn, or not a record, resync */
+		r->pos += SANCUS_LOGGER_RING_ALIGN;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * backend
+ */
+struct sancus_logger_ring_backend_data {
+	struct sancus_logger_ring_header *header;
+	char *data;
+	size_t map_len;
+};
+
+static struct sancus_logger_ring_backend_data ring_backend_data;
+
+static int ring_logger_write(unsigned level,
+			     const char *prefix, size_t plen,
+			     const char *msg, size_t mlen,
+			     const char *data, size_t dlen,
+			     void *_ctx)
+{
+	struct sancus_logger_ring_backend_data *ctx = _ctx;
+	struct sancus_logger_ring_record rec = { .level = (uint8_t)level };
+	struct iovec iov[LOG_TEXT_IOVCNT];
+	uint64_t pos, off, size;
+	size_t len = 0;
+	int iovcnt;
+	struct timespec ts;
+
+	if (ctx == NULL || ctx->header == NULL)
+		return -EINVAL;
+
+	iovcnt = sancus_logger__text_iov(iov, prefix, plen, msg, mlen, data, dlen);
+
+	for (int i = 0; i < iovcnt; i++) {
+		if (len + iov[i].iov_len > SANCUS_LOGGER_RING_TEXT_MAX) {
+			iov[i].iov_len = SANCUS_LOGGER_RING_TEXT_MAX - len;
+			iovcnt = i + 1;
+			rec.flags |= SANCUS_LOGGER_RING_TRUNCATED;
+		}
+		len += iov[i].iov_len;
+	}
+
+	sancus_now(&ts);
+	rec.ts = (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+	rec.len = (uint32_t)len;
+
+	size = ctx->header->size;
+	pos = __atomic_fetch_add(&ctx->header->head,
+				 SANCUS_LOGGER_RING_RECORD_SIZE(len),
+				 __ATOMIC_RELAXED);
+
+	/* everything but @pos, which seals the record */
+	off = pos + sizeof(rec.pos);
+	ring_put(ctx->data, size, off, (const char *)&rec + sizeof(rec.pos),
+		 sizeof(rec) - sizeof(rec.pos));
+
+	off = pos + sizeof(rec);
+	for (int i = 0; i < iovcnt; i++) {
+		ring_put(ctx->data, size, off, iov[i].iov_base, iov[i].iov_len);
+		off += iov[i].iov_len;
+	}
+
+	/* aligned, never wraps */
+	__atomic_store_n((uint64_t *)(ctx->data + (pos & (size - 1))), ~pos,
+			 __ATOMIC_RELEASE);
+
+	return (int)len;
+}
+
+static int ring_logger_flush(void *_ctx)
+{
+	struct sancus_logger_ring_backend_data *ctx = _ctx;
+
+	if (ctx == NULL || ctx->header == NULL)
+		return -EINVAL;
+	else if (msync(ctx->header, ctx->map_len, MS_SYNC) < 0)
+		return -errno;
+
+	return 0;
+}
+
+static const struct sancus_logger_backend ring_backend = {
+	.f = ring_logger_write,
+	.flush = ring_logger_flush,
+	.ctx = &ring_backend_data,
+};
+
+static inline uint64_t ring_size_round(size_t size)
+{
+	uint64_t n = LOG_RING_MIN_SIZE;
+
+	if (size == 0)
+		size = LOG_RING_DEFAULT_SIZE;
+
+	while (n < size)
+		n <<= 1;
+	return n;
+}
+
+int sancus_logger_set_ring_backend(const struct sancus_logger_ring_settings *settings)
+{
+	struct sancus_logger_ring_backend_data *ctx = &ring_backend_data;
+	struct sancus_logger_ring_header *h;
+	struct stat st;
+	uint64_t size;
+	size_t map_len;
+	void *map;
+	int fd, err;
+
+	if (settings == NULL || settings->path == NULL)
+		return -EINVAL;
+	else if (ctx->header != NULL)
+		/* writers may still hold pointers into the old one */
+		return -EBUSY;
+
+	size = ring_size_round(settings->size);
+	map_len = (size_t)(SANCUS_LOGGER_RING_HEADER_SIZE + size);
+
+	fd = open(settings->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -errno;
+
+	if (fstat(fd, &st) < 0)
+		goto fail;
+
+	if ((size_t)st.st_size != map_len) {
+		/* also zeroes an old ring of a different size */
+		if (ftruncate(fd, 0) < 0 || ftruncate(fd, (off_t)map_len) < 0)
+			goto fail;
+	}
+
+	map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto fail;
+
+	sancus_close(fd);
+
+	h = map;
+	if (!ring_header_is_valid(h, map_len) || h->size != size) {
+		memset(map, 0, map_len);
+		*h = (struct sancus_logger_ring_header) {
+			.version = SANCUS_LOGGER_RING_VERSION,
+			.byte_order = SANCUS_LOGGER_RING_BYTE_ORDER,
+			.size = size,
+		};
+		memcpy(h->magic, SANCUS_LOGGER_RING_MAGIC, sizeof(h->magic));
+	}
+
+	*ctx = (struct sancus_logger_ring_backend_data) {
+		.header = h,
+		.data = (char *)map + SANCUS_LOGGER_RING_HEADER_SIZE,
+		.map_len = map_len,
+	};
+
+	return sancus_logger_set_default_backend(&ring_backend);
+fail:
+	err = -errno;
+	sancus_close(fd);
+	return err;
+}
@@ -0,0 +1,345 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <sancus/buffer.h>
+#include <sancus/list.h>
+#include <sancus/tcp_conn.h>
+#include <sancus/tcp_balancer.h>
+
+static inline unsigned peer_index(const struct sancus_tcp_balancer *self,
+				  const struct sancus_tcp_balancer_peer *p)
+{
+	return (unsigned)(p - self->peers);
+}
+
+static inline struct sancus_tcp_balancer_peer *peer_of_entry(struct sancus_list *e)
+{
+	return container_of(e, struct sancus_tcp_balancer_peer, entry);
+}
+
+/*
+ * load buckets
+ */
+static inline unsigned load_bucket(const struct sancus_tcp_balancer_peer *p)
+{
+	return p->outstanding < SANCUS_TCP_BALANCER_LOAD_MAX - 1 ?
+		p->outstanding : SANCUS_TCP_BALANCER_LOAD_MAX - 1;
+}
+
+/* at the tail, so ties rotate */
+static inline void load_insert(struct sancus_tcp_balancer *self,
+			       struct sancus_tcp_balancer_peer *p)
+{
+	unsigned b = load_bucket(p);
+
+	sancus_list_append(&self->load[b], &p->entry);
+	if (b < self->least)
+		self->least = b;
+}
+
+static inline void load_move(struct sancus_tcp_balancer *self,
+			     struct sancus_tcp_balancer_peer *p)
+{
+	sancus_list_del(&p->entry);
+	load_insert(self, p);
+}
+
+/*
+ * smooth weighted round-robin over the healthy peers, each one gains
+ * its weight every round and the one ahead is picked and set back by
+ * the total, so picks of the heavier peers are spread instead of
+ * coming in bursts. Rebuilt as peers are admitted or ejected
+ */
+static void schedule_build(struct sancus_tcp_balancer *self)
+{
+	long current[SANCUS_TCP_BALANCER_MAX] = { 0 };
+	unsigned total = 0;
+
+	if (self->settings->policy != SANCUS_TCP_BALANCER_ROUND_ROBIN)
+		return;
+
+	for (unsigned j = 0; j < self->healthy_count; j++)
+		total += self->peers[self->healthy[j]].weight;
+
+	for (unsigned k = 0; k < total; k++) {
+		unsigned best = self->healthy[0];
+
+		for (unsigned j = 0; j < self->healthy_count; j++) {
+			unsigned i = self->healthy[j];
+
+			current[i] += self->peers[i].weight;
+			if (current[i] > current[best])
+				best = i;
+		}
+
+		current[best] -= total;
+		self->schedule[k] = (uint8_t)best;
+	}
+
+	self->schedule_len = total;
+	self->cursor = 0;
+}
+
+/*
+ * health
+ */
+static void peer_admit(struct sancus_tcp_balancer *self, struct sancus_tcp_balancer_peer *p)
+{
+	p->ejected = false;
+	p->slot = self->healthy_count;
+	self->healthy[self->healthy_count++] = (uint8_t)peer_index(self, p);
+
+	load_insert(self, p);
+	schedule_build(self);
+}
+
+static void peer_eject(struct sancus_tcp_balancer *self, struct sancus_tcp_balancer_peer *p)
+{
+	unsigned last;
+
+	if (p->ejected)
+		return;
+
+	p->ejected = true;
+	p->ejections++;
+	sancus_list_del(&p->entry);
+
+	/* the last healthy one takes its slot */
+	last = self->healthy[--self->healthy_count];
+	self->healthy[p->slot] = (uint8_t)last;
+	self->peers[last].slot = p->slot;
+
+	schedule_build(self);
+}
+
+static void peer_on_connect(struct sancus_tcp_conn *conn, struct sancus_ev_loop *loop)
+{
+	struct sancus_tcp_balancer_peer *p = sancus_tcp_balancer_peer_of(conn);
+	struct sancus_tcp_balancer *self = p->balancer;
+
+	if (p->ejected)
+		peer_admit(self, p);
+
+	self->settings->conn->on_connect(conn, loop);
+}
+
+static void peer_on_error(struct sancus_tcp_conn *conn, struct sancus_ev_loop *loop,
+			  enum sancus_tcp_conn_error err)
+{
+	struct sancus_tcp_balancer_peer *p = sancus_tcp_balancer_peer_of(conn);
+	struct sancus_tcp_balancer *self = p->balancer;
+	int e = errno;
+
+	switch (err) {
+	case SANCUS_TCP_CONN_WATCHER_ERROR:
+		if (conn->state != SANCUS_TCP_CONN_WAITING)
+			sancus_tcp_conn_reconnect(conn, loop);
+		/* fall-through */
+	case SANCUS_TCP_CONN_CONNECT_ERROR:
+	case SANCUS_TCP_CONN_CONNECT_TIMEOUT:
+		/* already waiting to reconnect */
+		peer_eject(self, p);
+		break;
+	case SANCUS_TCP_CONN_WRITE_ERROR:
+	case SANCUS_TCP_CONN_READ_TIMEOUT:
+	default: /* -Wswitch-default */
+		break;
+	}
+
+	errno = e;
+	self->settings->conn->on_error(conn, loop, err);
+}
+
+/*
+ * policies
+ */
+static struct sancus_tcp_balancer_peer *pick_least(struct sancus_tcp_balancer *self)
+{
+	while (sancus_list_is_empty(&self->load[self->least])) {
+		self->least++;
+		assert(self->least < SANCUS_TCP_BALANCER_LOAD_MAX);
+	}
+
+	return peer_of_entry(self->load[self->least].next);
+}
+
+/* xorshift32 */
+static inline uint32_t pick_random(struct sancus_tcp_balancer *self)
+{
+	uint32_t x = self->seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	self->seed = x;
+	return x;
+}
+
+/* the less loaded of two healthy peers taken at random */
+static struct sancus_tcp_balancer_peer *pick_two(struct sancus_tcp_balancer *self)
+{
+	unsigned n = self->healthy_count;
+	unsigned i = pick_random(self) % n, j;
+	struct sancus_tcp_balancer_peer *a = &self->peers[self->healthy[i]], *b;
+
+	if (n == 1)
+		return a;
+
+	j = pick_random(self) % (n - 1);
+	if (j >= i)
+		j++;
+	b = &self->peers[self->healthy[j]];
+
+	return b->outstanding < a->outstanding ? b : a;
+}
+
+/* next one on the schedule, which only has healthy peers */
+static struct sancus_tcp_balancer_peer *pick_next(struct sancus_tcp_balancer *self)
+{
+	unsigned i = self->schedule[self->cursor];
+
+	if (++self->cursor == self->schedule_len)
+		self->cursor = 0;
+	return &self->peers[i];
+}
+
+/*
+ * exported functions
+ */
+void sancus_tcp_balancer_init(struct sancus_tcp_balancer *self,
+			      const struct sancus_tcp_balancer_settings *settings)
+{
+	struct sancus_tcp_conn_settings *conn = &self->conn_settings;
+
+	assert(settings);
+	assert(settings->conn);
+
+	self->settings = settings;
+
+	*conn = *settings->conn;
+	conn->on_connect = peer_on_connect;
+	conn->on_error = peer_on_error;
+	conn->reconnect = settings->reconnect;
+	if (sancus_time_is_zero(&conn->reconnect.initial_delay)) {
+		conn->reconnect.initial_delay = TIMESPEC_INIT_MS(0, 100);
+		conn->reconnect.max_delay = TIMESPEC_INIT(10, 0);
+		conn->reconnect.jitter = 50;
+	}
+
+	self->count = 0;
+	self->healthy_count = 0;
+
+	self->least = 0;
+	for (unsigned i = 0; i < SANCUS_TCP_BALANCER_LOAD_MAX; i++)
+		sancus_list_init(&self->load[i]);
+
+	self->seed = (uint32_t)(uintptr_t)self ^ 0x9e3779b9;
+	if (self->seed == 0)
+		self->seed = 1;
+
+	self->cursor = 0;
+	self->schedule_len = 0;
+}
+
+struct sancus_tcp_balancer_peer *sancus_tcp_balancer_add(struct sancus_tcp_balancer *self,
+							 const struct sockaddr *sa,
+							 socklen_t sa_len,
+							 unsigned weight)
+{
+	struct sancus_tcp_balancer_peer *p;
+
+	if (weight == 0 || weight > SANCUS_TCP_BALANCER_WEIGHT_MAX) {
+		errno = EINVAL;
+		return NULL;
+	} else if (self->count == SANCUS_TCP_BALANCER_MAX) {
+		errno = ENOSPC;
+		return NULL;
+	}
+
+	p = &self->peers[self->count];
+	*p = (struct sancus_tcp_balancer_peer) {
+		.balancer = self,
+		.weight = weight,
+	};
+
+	if (sancus_tcp_conn_connect(&p->conn, &self->conn_settings, sa, sa_len, true) != 1)
+		return NULL;
+
+	self->count++;
+	peer_admit(self, p);
+
+	return p;
+}
+
+struct sancus_tcp_balancer_peer *sancus_tcp_balancer_pick(struct sancus_tcp_balancer *self)
+{
+	struct sancus_tcp_balancer_peer *p;
+
+	if (self->healthy_count == 0) {
+		errno = EHOSTUNREACH;
+		return NULL;
+	}
+
+	switch (self->settings->policy) {
+	case SANCUS_TCP_BALANCER_POWER_OF_TWO:
+		p = pick_two(self);
+		break;
+	case SANCUS_TCP_BALANCER_ROUND_ROBIN:
+		p = pick_next(self);
+		break;
+	case SANCUS_TCP_BALANCER_LEAST_OUTSTANDING:
+	default: /* -Wswitch-default */
+		p = pick_least(self);
+	}
+
+	p->outstanding++;
+	p->picked++;
+	load_move(self, p);
+
+	return p;
+}
+
+void sancus_tcp_balancer_done(struct sancus_tcp_balancer *self,
+			      struct sancus_tcp_balancer_peer *peer)
+{
+	assert(peer->outstanding > 0);
+	peer->outstanding--;
+
+	if (!peer->ejected)
+		load_move(self, peer);
+}
+
+void sancus_tcp_balancer_eject(struct sancus_tcp_balancer *self, struct sancus_ev_loop *loop,
+			       struct sancus_tcp_balancer_peer *peer)
+{
+	peer_eject(self, peer);
+
+	if (peer->conn.state != SANCUS_TCP_CONN_WAITING)
+		sancus_tcp_conn_reconnect(&peer->conn, loop);
+}
+
+void sancus_tcp_balancer_start(struct sancus_tcp_balancer *self, struct sancus_ev_loop *loop)
+{
+	for (unsigned i = 0; i < self->count; i++)
+		sancus_tcp_conn_start(&self->peers[i].conn, loop);
+}
+
+void sancus_tcp_balancer_stop(struct sancus_tcp_balancer *self, struct sancus_ev_loop *loop)
+{
+	for (unsigned i = 0; i < self->count; i++)
+		sancus_tcp_conn_stop(&self->peers[i].conn, loop);
+}
+
+void sancus_tcp_balancer_close(struct sancus_tcp_balancer *self)
+{
+	for (unsigned i = 0; i < self->count; i++)
+		sancus_tcp_conn_close(&self->peers[i].conn);
+}
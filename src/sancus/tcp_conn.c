@@ -39,10 +39,268 @@
 #include <sys/un.h>
 
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
+#include <sancus/buffer.h>
 #include <sancus/socket.h>
 #include <sancus/tcp_conn.h>
 
+/* unknown to the headers, the regular handshake is used */
+#ifndef TCP_FASTOPEN_CONNECT
+#define TCP_FASTOPEN_CONNECT -1
+#endif
+
+static void io_cb(struct sancus_ev_loop *loop, struct sancus_ev_fd *w, int revents);
+
+/* changes the events watched, restarting the watcher if it was active */
+static void io_watch(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop,
+		     unsigned events)
+{
+	struct sancus_ev_fd *w = &self->io;
+
+	if (self->events != events) {
+		bool active = sancus_ev_is_active(w);
+		int fd = w->fd;
+
+		if (active)
+			sancus_ev_fd_stop(loop, w);
+		sancus_ev_fd_init(w, io_cb, fd, events);
+		if (active)
+			sancus_ev_fd_start(loop, w);
+
+		self->events = events;
+	}
+}
+
+/*
+ * output queue
+ */
+static ssize_t out_send(int fd, const char *data, size_t len)
+{
+	ssize_t l;
+
+	while ((l = send(fd, data, len, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+
+	/* or a Fast Open handshake that couldn't take data yet */
+	if (l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINPROGRESS))
+		l = 0;
+	return l;
+}
+
+/*
+ * sends as much of the queue as the socket takes, watching for
+ * writability while some is left. Returns the bytes left, or -1
+ */
+static ssize_t out_flush(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop)
+{
+	struct sancus_buffer *out = &self->out;
+
+	while (!sancus_buffer_is_empty(out)) {
+		ssize_t l = out_send(sancus_tcp_conn_fd(self), sancus_buffer_data(out),
+				     sancus_buffer_len(out));
+
+		if (l < 0)
+			return -1;
+		else if (l == 0)
+			break;
+
+		sancus_buffer_skip(out, (size_t)l);
+	}
+
+	io_watch(self, loop, sancus_buffer_is_empty(out) ?
+		 SANCUS_EV_READ : SANCUS_EV_READ|SANCUS_EV_WRITE);
+
+	return (ssize_t)sancus_buffer_len(out);
+}
+
+/*
+ * deadlines
+ */
+static inline void conn_arm_timeout(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop)
+{
+	const struct timespec *timeout = &self->settings->connect_timeout;
+
+	if (!sancus_time_is_zero(timeout))
+		sancus_ev_timer_start(loop, &self->timer, *timeout);
+}
+
+/*
+ * reads don't move the timer, it's pushed back lazily when it fires
+ * by what's left since @last_activity
+ */
+static inline bool conn_arm_deadline(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop)
+{
+	const struct timespec *timeout = &self->settings->read_timeout;
+	struct timespec now = sancus_ev_now(loop);
+	struct timespec due = self->last_activity;
+
+	if (sancus_time_is_zero(timeout))
+		return true;
+
+	sancus_time_add(&due, timeout);
+	if (!sancus_time_is_gt(&due, &now))
+		return false;
+
+	sancus_ev_timer_start(loop, &self->timer, sancus_time_left(&now, &due));
+	return true;
+}
+
+/*
+ * reconnect
+ */
+static inline bool conn_reconnects(const struct sancus_tcp_conn *self)
+{
+	return !sancus_time_is_zero(&self->settings->reconnect.initial_delay);
+}
+
+/* xorshift32, seeded apart for each connection */
+static uint32_t conn_random(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop)
+{
+	uint32_t x = self->seed;
+
+	if (x == 0) {
+		struct timespec now = sancus_ev_now(loop);
+
+		x = (uint32_t)(uintptr_t)self ^ (uint32_t)now.tv_nsec ^
+			((uint32_t)now.tv_sec << 16);
+		if (x == 0)
+			x = 1;
+	}
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	self->seed = x;
+	return x;
+}
+
+/* initial delay doubled on every attempt, capped and jittered */
+static struct timespec conn_backoff(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop,
+				   unsigned attempt)
+{
+	const struct sancus_tcp_conn_reconnect *r = &self->settings->reconnect;
+	long ms = sancus_time_ts_to_ms(&r->initial_delay);
+	long max = sancus_time_ts_to_ms(&r->max_delay);
+
+	for (unsigned i = 0; i < attempt && i < 30 && (max == 0 || ms < max); i++)
+		ms *= 2;
+
+	if (max > 0 && ms > max)
+		ms = max;
+
+	if (r->jitter > 0 && ms > 0) {
+		unsigned long span = (unsigned long)ms * (r->jitter < 100 ? r->jitter : 100) / 100;
+
+		ms -= (long)(conn_random(self, loop) % (span + 1));
+	}
+
+	return sancus_time_new_ms(ms);
+}
+
+
+/* closes the socket and waits to connect again */
+static void conn_schedule(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop)
+{
+	sancus_ev_timer_stop(loop, &self->timer);
+	sancus_ev_fd_stop(loop, &self->io);
+	if (self->io.fd >= 0)
+		sancus_close2(&self->io.fd);
+
+	self->state = SANCUS_TCP_CONN_WAITING;
+	sancus_ev_timer_start(loop, &self->timer, conn_backoff(self, loop, self->attempts));
+	self->attempts++;
+}
+
+/*
+ * connect failed, errno set. Reconnecting, the queued output is kept
+ * for the next attempt
+ */
+static void conn_failed(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop,
+			enum sancus_tcp_conn_error err)
+{
+	int e = errno;
+
+	if (conn_reconnects(self)) {
+		conn_schedule(self, loop);
+	} else {
+		self->state = SANCUS_TCP_CONN_FAILED;
+		sancus_ev_timer_stop(loop, &self->timer);
+		sancus_buffer_reset(&self->out);
+	}
+
+	errno = e;
+	self->settings->on_error(self, loop, err);
+}
+
+/*
+ * Fast Open
+ */
+static bool conn_handshaking(const struct sancus_tcp_conn *self)
+{
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+
+	if (!self->settings->fastopen || self->addr.ss_family == AF_UNIX)
+		return false;
+
+	memset(&ti, 0, sizeof(ti));
+	if (getsockopt(sancus_tcp_conn_fd(self), IPPROTO_TCP, TCP_INFO, &ti, &len) < 0)
+		return false;
+
+	return ti.tcpi_state == TCP_SYN_SENT;
+}
+
+/* the queued output goes in the SYN, if the peer's cookie is known */
+static int conn_send_syn(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop)
+{
+	if (sancus_buffer_is_empty(&self->out)) {
+		if (out_send(sancus_tcp_conn_fd(self), "", 0) < 0)
+			return -1;
+	} else if (out_flush(self, loop) < 0) {
+		return -1;
+	}
+
+	/* writable once connected */
+	io_watch(self, loop, SANCUS_EV_READ|SANCUS_EV_WRITE);
+	return 0;
+}
+
+static int conn_open(struct sancus_tcp_conn *self);
+
+static void timer_cb(struct sancus_ev_loop *loop, struct sancus_ev_timer *w, int UNUSED(revents))
+{
+	struct sancus_tcp_conn *self = container_of(w, struct sancus_tcp_conn, timer);
+
+	sancus_ev_timer_stop(loop, w);
+
+	switch (self->state) {
+	case SANCUS_TCP_CONN_INPROGRESS:
+	case SANCUS_TCP_CONN_CONNECTED:
+		errno = ETIMEDOUT;
+		conn_failed(self, loop, SANCUS_TCP_CONN_CONNECT_TIMEOUT);
+		break;
+	case SANCUS_TCP_CONN_RUNNING:
+		if (!conn_arm_deadline(self, loop)) {
+			errno = ETIMEDOUT;
+			self->settings->on_error(self, loop, SANCUS_TCP_CONN_READ_TIMEOUT);
+		}
+		break;
+	case SANCUS_TCP_CONN_WAITING:
+		if (conn_open(self) < 0) {
+			conn_failed(self, loop, SANCUS_TCP_CONN_CONNECT_ERROR);
+		} else {
+			sancus_ev_fd_start(loop, &self->io);
+			conn_arm_timeout(self, loop);
+		}
+		break;
+	case SANCUS_TCP_CONN_FAILED:
+	default: /* -Wswitch-default */
+		break;
+	}
+}
+
 static void io_cb(struct sancus_ev_loop *loop, struct sancus_ev_fd *w, int revents)
 {
 	struct sancus_tcp_conn *self = container_of(w, struct sancus_tcp_conn, io);
@@ -54,52 +312,76 @@ static void io_cb(struct sancus_ev_loop *loop, struct sancus_ev_fd *w, int reven
 	}
 
 	switch (self->state) {
-	case SANCUS_TCP_CONN_INPROGRESS:
-		assert(revents & SANCUS_EV_WRITE);
+	case SANCUS_TCP_CONN_INPROGRESS: {
+		/* failed to connect? */
+		int error;
+		socklen_t len = sizeof(error);
 
-		if (revents & SANCUS_EV_READ) {
-			/* failed to connected? */
-			int error;
-			socklen_t len = sizeof(error);
-
-			if (getsockopt(sancus_tcp_conn_fd(self),
-				       SOL_SOCKET, SO_ERROR, &error, &len) < 0)
-				; /* connect failed but errno already set. */
-			else if (error == 0)
-				goto connect_done;
-			else
-				errno = error;
-
-			/* might want to retry */
-			self->state = SANCUS_TCP_CONN_FAILED;
-			settings->on_error(self, loop, SANCUS_TCP_CONN_CONNECT_ERROR);
-			return;
-		}
+		assert(revents & SANCUS_EV_WRITE);
 
-		/* fall-through */
+		if (getsockopt(sancus_tcp_conn_fd(self),
+			       SOL_SOCKET, SO_ERROR, &error, &len) < 0)
+			; /* connect failed but errno already set. */
+		else if (error != 0)
+			errno = error;
+		else if (conn_handshaking(self))
+			break; /* Fast Open SYN not answered yet */
+		else
+			goto connect_done;
+
+		conn_failed(self, loop, SANCUS_TCP_CONN_CONNECT_ERROR);
+		return;
+	}
 	case SANCUS_TCP_CONN_CONNECTED:
 		assert(revents & SANCUS_EV_WRITE);
 
+		/*
+		 * a deferred Fast Open connect(), the SYN goes with the
+		 * first send() and the timeout keeps running until the
+		 * handshake completes
+		 */
+		if (conn_handshaking(self)) {
+			self->state = SANCUS_TCP_CONN_INPROGRESS;
+			if (conn_send_syn(self, loop) < 0)
+				conn_failed(self, loop, SANCUS_TCP_CONN_CONNECT_ERROR);
+			return;
+		}
+
 connect_done:
-		{
-			/* only reads from now on */
-			int fd = w->fd;
-			sancus_ev_fd_stop (loop, w);
-			sancus_ev_fd_init(w, io_cb, fd, SANCUS_EV_READ);
-			sancus_ev_fd_start(loop, w);
+		sancus_ev_timer_stop(loop, &self->timer);
+		self->attempts = 0;
+
+		/* pipelined output first, reads and writes as needed from now on */
+		self->state = SANCUS_TCP_CONN_RUNNING;
+		if (out_flush(self, loop) < 0) {
+			settings->on_error(self, loop, SANCUS_TCP_CONN_WRITE_ERROR);
+			return;
 		}
 
 		settings->on_connect(self, loop);
-		self->state = SANCUS_TCP_CONN_RUNNING;
 		sancus_tcp_conn_touch(self, loop);
+		conn_arm_deadline(self, loop);
 		break;
 	case SANCUS_TCP_CONN_RUNNING:
+		if (revents & SANCUS_EV_WRITE) {
+			bool queued = !sancus_buffer_is_empty(&self->out);
+			ssize_t l = out_flush(self, loop);
+
+			if (l < 0) {
+				settings->on_error(self, loop, SANCUS_TCP_CONN_WRITE_ERROR);
+				return;
+			} else if (l == 0 && queued && settings->on_drain != NULL) {
+				settings->on_drain(self, loop);
+			}
+		}
+
 		if (revents & SANCUS_EV_READ) {
 			settings->on_read(self, loop);
 			sancus_tcp_conn_touch(self, loop);
 		}
 		break;
 	case SANCUS_TCP_CONN_FAILED:
+	case SANCUS_TCP_CONN_WAITING:
 	default: /* -Wswitch-default */
 		assert(0); /* fix your app! */
 	}
@@ -137,23 +419,28 @@ static inline int init_local(struct sockaddr_un *sun, const char *path)
 	return 1;
 }
 
-static inline int init_tcp(struct sancus_tcp_conn *self,
-			   const struct sancus_tcp_conn_settings *settings,
-			   struct sockaddr *sa, socklen_t sa_len,
-			   bool cloexec)
+/* new socket, connecting to @addr */
+static int conn_open(struct sancus_tcp_conn *self)
 {
-	int fd = sancus_socket(sa->sa_family, SOCK_STREAM, 0, cloexec, true);
+	int fd = sancus_socket(self->addr.ss_family, SOCK_STREAM, 0, self->cloexec, true);
 	if (fd < 0)
 		return -1;
 
-	assert(self);
-	assert(settings);
-
 	sancus_ev_fd_init(&self->io, io_cb, fd, SANCUS_EV_READ|SANCUS_EV_WRITE);
+	self->events = SANCUS_EV_READ|SANCUS_EV_WRITE;
 
-	self->settings = settings;
+	/*
+	 * connect() returns right away and the SYN waits for the first
+	 * send(), carrying the output queued by then if the kernel has a
+	 * cookie of the peer. Without one it's a regular handshake
+	 */
+	if (self->settings->fastopen && self->addr.ss_family != AF_UNIX) {
+		int one = 1;
+
+		(void)setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &one, sizeof(one));
+	}
 
-	if (connect(fd, sa, sa_len) < 0) {
+	if (connect(fd, (struct sockaddr *)&self->addr, self->addrlen) < 0) {
 		if (errno == EINPROGRESS) {
 			self->state = SANCUS_TCP_CONN_INPROGRESS;
 		} else {
@@ -169,32 +456,168 @@ static inline int init_tcp(struct sancus_tcp_conn *self,
 	return 1;
 }
 
+static inline int init_tcp(struct sancus_tcp_conn *self,
+			   const struct sancus_tcp_conn_settings *settings,
+			   const struct sockaddr *sa, socklen_t sa_len,
+			   bool cloexec)
+{
+	assert(self);
+	assert(settings);
+
+	if (sa_len > sizeof(self->addr)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* kept to reconnect */
+	memcpy(&self->addr, sa, sa_len);
+	self->addrlen = sa_len;
+	self->cloexec = cloexec;
+
+	sancus_buffer_bind(&self->out, NULL, 0);
+	sancus_ev_timer_init(&self->timer, timer_cb);
+	self->attempts = 0;
+	self->seed = 0;
+
+	self->settings = settings;
+
+	return conn_open(self);
+}
+
 /*
  * exported functions
  */
 void sancus_tcp_conn_start(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop)
 {
-	if (!sancus_ev_is_active(&self->io)) {
+	if (!sancus_ev_is_active(&self->io) && self->state != SANCUS_TCP_CONN_WAITING) {
 
 		sancus_ev_fd_start(loop, &self->io);
 
 		if (sancus_time_is_zero(&self->last_activity))
 			sancus_tcp_conn_touch(self, loop);
 	}
+
+	if (sancus_ev_timer_is_active(&self->timer))
+		return;
+
+	switch (self->state) {
+	case SANCUS_TCP_CONN_INPROGRESS:
+	case SANCUS_TCP_CONN_CONNECTED:
+		conn_arm_timeout(self, loop);
+		break;
+	case SANCUS_TCP_CONN_RUNNING:
+		/* already reported, another full period from now */
+		if (!conn_arm_deadline(self, loop))
+			sancus_ev_timer_start(loop, &self->timer, self->settings->read_timeout);
+		break;
+	case SANCUS_TCP_CONN_WAITING:
+		/* stopped while waiting, the same delay starts over */
+		assert(self->attempts > 0);
+		sancus_ev_timer_start(loop, &self->timer,
+				      conn_backoff(self, loop, self->attempts - 1));
+		break;
+	case SANCUS_TCP_CONN_FAILED:
+	default: /* -Wswitch-default */
+		break;
+	}
 }
 
 void sancus_tcp_conn_stop(struct sancus_tcp_conn *self, struct sancus_ev_loop *loop)
 {
 	if (sancus_ev_is_active(&self->io))
 		sancus_ev_fd_stop(loop, &self->io);
+
+	/* no more timeouts nor reconnects */
+	if (sancus_ev_timer_is_active(&self->timer))
+		sancus_ev_timer_stop(loop, &self->timer);
+}
+
+void sancus_tcp_conn_set_output(struct sancus_tcp_conn *self,
+				char *buf, size_t size)
+{
+	sancus_buffer_bind(&self->out, buf, size);
+}
+
+ssize_t sancus_tcp_conn_write(struct sancus_tcp_conn *self,
+			      struct sancus_ev_loop *loop,
+			      const void *data, size_t len)
+{
+	struct sancus_buffer *out = &self->out;
+	size_t sent = 0;
+
+	if (self->state == SANCUS_TCP_CONN_FAILED) {
+		errno = ENOTCONN;
+		return -1;
+	} else if (len > sancus_buffer_size(out) - sancus_buffer_len(out)) {
+		errno = ENOBUFS;
+		return -1;
+	}
+
+	/* straight out if nothing is waiting */
+	if (self->state == SANCUS_TCP_CONN_RUNNING && sancus_buffer_is_empty(out)) {
+		ssize_t l = out_send(sancus_tcp_conn_fd(self), data, len);
+
+		if (l < 0)
+			return -1;
+		else if ((size_t)l == len)
+			return (ssize_t)len;
+
+		sent = (size_t)l;
+	}
+
+	if (sancus_buffer_tail_size(out) < len - sent)
+		sancus_buffer_rebase(out);
+
+	sancus_buffer_append(out, (const char *)data + sent, (ssize_t)(len - sent));
+
+	if (self->state == SANCUS_TCP_CONN_RUNNING)
+		io_watch(self, loop, SANCUS_EV_READ|SANCUS_EV_WRITE);
+
+	return (ssize_t)len;
+}
+
+int sancus_tcp_conn_reconnect(struct sancus_tcp_conn *self,
+			      struct sancus_ev_loop *loop)
+{
+	if (!conn_reconnects(self)) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	/* whatever was queued was meant for the old connection */
+	sancus_buffer_reset(&self->out);
+	conn_schedule(self, loop);
+	return 0;
+}
+
+bool sancus_tcp_conn_fastopened(const struct sancus_tcp_conn *self)
+{
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+
+	memset(&ti, 0, sizeof(ti));
+	if (self->io.fd < 0 ||
+	    getsockopt(self->io.fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0)
+		return false;
+
+	return (ti.tcpi_options & TCPI_OPT_SYN_DATA) != 0;
 }
 
 void sancus_tcp_conn_close(struct sancus_tcp_conn *self)
 {
-	assert(self->io.fd >= 0);
+	assert(self->io.fd >= 0 || self->state == SANCUS_TCP_CONN_WAITING);
 	assert(!sancus_ev_is_active(&self->io));
 
-	sancus_close2(&self->io.fd);
+	if (self->io.fd >= 0)
+		sancus_close2(&self->io.fd);
+}
+
+int sancus_tcp_conn_connect(struct sancus_tcp_conn *self,
+			    const struct sancus_tcp_conn_settings *settings,
+			    const struct sockaddr *sa, socklen_t sa_len,
+			    bool cloexec)
+{
+	return init_tcp(self, settings, sa, sa_len, cloexec);
 }
 
 int sancus_tcp_ipv4_connect(struct sancus_tcp_conn *self,
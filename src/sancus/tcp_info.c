@@ -0,0 +1,174 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/time.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
+#include <linux/sockios.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <sancus/tcp_info.h>
+
+static inline unsigned rtt_bucket(uint32_t rtt)
+{
+	unsigned bits = rtt == 0 ? 0 : 32 - (unsigned)__builtin_clz(rtt);
+
+	if (bits <= SANCUS_TCP_INFO_RTT_SHIFT)
+		return 0;
+	else if (bits - SANCUS_TCP_INFO_RTT_SHIFT >= SANCUS_TCP_INFO_RTT_BUCKETS)
+		return SANCUS_TCP_INFO_RTT_BUCKETS - 1;
+	return bits - SANCUS_TCP_INFO_RTT_SHIFT;
+}
+
+static void timer_cb(struct sancus_ev_loop *loop, struct sancus_ev_timer *w, int UNUSED(revents))
+{
+	struct sancus_tcp_info_sampler *self = container_of(w, struct sancus_tcp_info_sampler,
+							    timer);
+
+	/* a failed sample is just skipped, e.g. while reconnecting */
+	sancus_tcp_info_sampler_sample(self, loop);
+	sancus_ev_timer_start(loop, &self->timer, self->interval);
+}
+
+/*
+ * exported functions
+ */
+int sancus_tcp_info_get(int fd, struct sancus_tcp_info *info)
+{
+	struct tcp_info ti;
+	socklen_t len = sizeof(ti);
+	int outq, notsent;
+
+	memset(&ti, 0, sizeof(ti));
+	if (getsockopt(fd, IPPROTO_TCP, TCP_INFO, &ti, &len) < 0)
+		return -1;
+
+	/* not sent and not acked, and not sent alone */
+	if (ioctl(fd, SIOCOUTQ, &outq) < 0 || ioctl(fd, SIOCOUTQNSD, &notsent) < 0)
+		return -1;
+
+	*info = (struct sancus_tcp_info) {
+		.rtt = ti.tcpi_rtt,
+		.rttvar = ti.tcpi_rttvar,
+		.retransmits = ti.tcpi_total_retrans,
+		.cwnd = ti.tcpi_snd_cwnd,
+		.unacked = outq > notsent ? (uint32_t)(outq - notsent) : 0,
+		.unsent = notsent > 0 ? (uint32_t)notsent : 0,
+	};
+
+	return 0;
+}
+
+void sancus_tcp_info_stats_init(struct sancus_tcp_info_stats *self,
+				struct sancus_ev_loop *loop)
+{
+	*self = (struct sancus_tcp_info_stats) { .since = sancus_ev_now(loop) };
+}
+
+void sancus_tcp_info_stats_add(struct sancus_tcp_info_stats *self,
+			       const struct sancus_tcp_info *info,
+			       uint32_t retransmits)
+{
+	self->samples++;
+	self->rtt[rtt_bucket(info->rtt)]++;
+	if (info->rtt > self->rtt_max)
+		self->rtt_max = info->rtt;
+
+	self->retransmits += retransmits;
+}
+
+uint32_t sancus_tcp_info_stats_rtt(const struct sancus_tcp_info_stats *self, unsigned pct)
+{
+	unsigned long target, count = 0;
+
+	if (self->samples == 0)
+		return 0;
+
+	target = (self->samples * (pct < 100 ? pct : 100) + 99) / 100;
+	if (target == 0)
+		target = 1;
+
+	for (unsigned k = 0; k < SANCUS_TCP_INFO_RTT_BUCKETS - 1; k++) {
+		count += self->rtt[k];
+		if (count >= target)
+			return UINT32_C(1) << (SANCUS_TCP_INFO_RTT_SHIFT + k);
+	}
+
+	return UINT32_MAX;
+}
+
+double sancus_tcp_info_stats_retransmit_rate(const struct sancus_tcp_info_stats *self,
+					     struct sancus_ev_loop *loop)
+{
+	struct timespec now = sancus_ev_now(loop);
+	struct timespec dt = sancus_time_elapsed(&now, &self->since);
+	double sec = sancus_time_ts_to_fp(&dt);
+
+	return sec > 0 ? (double)self->retransmits / sec : 0;
+}
+
+void sancus_tcp_info_sampler_init(struct sancus_tcp_info_sampler *self,
+				  const struct sancus_ev_fd *io,
+				  struct timespec interval,
+				  struct sancus_tcp_info_stats *stats)
+{
+	*self = (struct sancus_tcp_info_sampler) {
+		.io = io,
+		.interval = interval,
+		.stats = stats,
+	};
+
+	sancus_ev_timer_init(&self->timer, timer_cb);
+}
+
+void sancus_tcp_info_sampler_start(struct sancus_tcp_info_sampler *self,
+				   struct sancus_ev_loop *loop)
+{
+	if (!sancus_ev_timer_is_active(&self->timer))
+		sancus_ev_timer_start(loop, &self->timer, self->interval);
+}
+
+void sancus_tcp_info_sampler_stop(struct sancus_tcp_info_sampler *self,
+				  struct sancus_ev_loop *loop)
+{
+	if (sancus_ev_timer_is_active(&self->timer))
+		sancus_ev_timer_stop(loop, &self->timer);
+}
+
+int sancus_tcp_info_sampler_sample(struct sancus_tcp_info_sampler *self,
+				   struct sancus_ev_loop *loop)
+{
+	struct sancus_tcp_info info;
+	uint32_t retransmits;
+	struct stat st;
+
+	if (self->io->fd < 0) {
+		errno = EBADF;
+		return -1;
+	} else if (fstat(self->io->fd, &st) < 0 ||
+		   sancus_tcp_info_get(self->io->fd, &info) < 0) {
+		return -1;
+	}
+
+	/* a new socket after a reconnect counts from zero */
+	if ((uint64_t)st.st_ino != self->socket) {
+		self->last = (struct sancus_tcp_info) { .retransmits = 0 };
+		self->socket = (uint64_t)st.st_ino;
+	}
+
+	retransmits = info.retransmits - self->last.retransmits;
+	self->last = info;
+
+	if (self->stats != NULL)
+		sancus_tcp_info_stats_add(self->stats, &info, retransmits);
+	if (self->on_sample != NULL)
+		self->on_sample(self, loop);
+
+	return 0;
+}
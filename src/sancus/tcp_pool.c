@@ -0,0 +1,318 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <sancus/alloc.h>
+#include <sancus/buffer.h>
+#include <sancus/list.h>
+#include <sancus/tcp_conn.h>
+#include <sancus/tcp_pool.h>
+
+static inline struct sancus_tcp_pool_conn *pool_conn_of_entry(struct sancus_list *e)
+{
+	return container_of(e, struct sancus_tcp_pool_conn, entry);
+}
+
+/*
+ * connections
+ */
+static struct sancus_tcp_pool_conn *pool_open(struct sancus_tcp_pool *self,
+					      struct sancus_ev_loop *loop)
+{
+	const struct sancus_tcp_pool_settings *settings = self->settings;
+	struct sancus_tcp_pool_conn *c;
+
+	/* the output queue follows */
+	c = sancus_zalloc(sizeof(*c) + settings->out_size);
+	if (c == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	if (sancus_tcp_conn_connect(&c->conn, settings->conn, (struct sockaddr *)&self->addr,
+				    self->addrlen, true) != 1) {
+		int e = errno;
+		sancus_free(c);
+		errno = e;
+		return NULL;
+	}
+
+	sancus_tcp_conn_set_output(&c->conn, (char *)(c + 1), settings->out_size);
+	sancus_tcp_conn_start(&c->conn, loop);
+	sancus_tcp_conn_touch(&c->conn, loop);
+
+	self->stats.opened++;
+	return c;
+}
+
+static void pool_destroy(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop,
+			 struct sancus_tcp_pool_conn *c)
+{
+	sancus_tcp_conn_stop(&c->conn, loop);
+	if (sancus_tcp_conn_fd(&c->conn) >= 0)
+		sancus_tcp_conn_close(&c->conn);
+	sancus_free(c);
+
+	self->stats.closed++;
+}
+
+static inline bool pool_is_full(const struct sancus_tcp_pool *self)
+{
+	unsigned max = self->settings->max_conns;
+
+	return max > 0 && self->stats.idle + self->stats.busy >= max;
+}
+
+/* idle connections shouldn't be closed nor have anything to say */
+static bool pool_is_alive(struct sancus_tcp_conn *conn)
+{
+	char c;
+	ssize_t l;
+
+	switch (conn->state) {
+	case SANCUS_TCP_CONN_INPROGRESS:
+	case SANCUS_TCP_CONN_CONNECTED:
+		return true;
+	case SANCUS_TCP_CONN_RUNNING:
+		break;
+	case SANCUS_TCP_CONN_FAILED:
+	case SANCUS_TCP_CONN_WAITING:
+	default:
+		return false;
+	}
+
+	while ((l = recv(sancus_tcp_conn_fd(conn), &c, 1, MSG_PEEK | MSG_DONTWAIT)) < 0 &&
+	       errno == EINTR)
+		;
+
+	return l < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+static inline bool pool_is_healthy(struct sancus_tcp_pool *self,
+				   struct sancus_tcp_pool_conn *c)
+{
+	const struct sancus_tcp_pool_settings *settings = self->settings;
+
+	if (!pool_is_alive(&c->conn))
+		return false;
+	else if (settings->health_check != NULL)
+		return settings->health_check(self, &c->conn);
+	return true;
+}
+
+static void pool_add_idle(struct sancus_tcp_pool *self, struct sancus_tcp_pool_conn *c)
+{
+	sancus_list_insert(&self->idle, &c->entry);
+	self->stats.idle++;
+}
+
+static void pool_del_idle(struct sancus_tcp_pool *self, struct sancus_tcp_pool_conn *c)
+{
+	sancus_list_del(&c->entry);
+	self->stats.idle--;
+}
+
+/*
+ * waiters
+ */
+static void pool_hand(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop,
+		      struct sancus_tcp_pool_conn *c)
+{
+	struct sancus_tcp_pool_waiter *w = container_of(self->waiters.next,
+							struct sancus_tcp_pool_waiter, entry);
+	struct timespec now = sancus_ev_now(loop);
+	struct timespec dt = sancus_time_elapsed(&now, &w->since);
+
+	sancus_list_del(&w->entry);
+	self->stats.waiting--;
+
+	self->stats.waits++;
+	sancus_time_add(&self->stats.wait_time, &dt);
+	if (sancus_time_is_gt(&dt, &self->stats.wait_max))
+		self->stats.wait_max = dt;
+
+	self->stats.busy++;
+	w->on_conn(w, loop, &c->conn);
+}
+
+/* capacity was freed, a new connection for the oldest waiter */
+static void pool_serve(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop)
+{
+	struct sancus_tcp_pool_conn *c;
+
+	if (!sancus_list_is_empty(&self->waiters) && !pool_is_full(self) &&
+	    (c = pool_open(self, loop)) != NULL)
+		pool_hand(self, loop, c);
+}
+
+/*
+ * exported functions
+ */
+int sancus_tcp_pool_init(struct sancus_tcp_pool *self,
+			 const struct sancus_tcp_pool_settings *settings,
+			 const char *addr, uint16_t port)
+{
+	struct sockaddr_in *sin = (struct sockaddr_in *)&self->addr;
+	struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *)&self->addr;
+
+	assert(settings);
+	assert(settings->conn);
+
+	*self = (struct sancus_tcp_pool) { .settings = settings };
+	sancus_list_init(&self->idle);
+	sancus_list_init(&self->waiters);
+
+	if (addr == NULL) {
+		return 0;
+	} else if (inet_pton(AF_INET, addr, &sin->sin_addr) == 1) {
+		sin->sin_family = AF_INET;
+		sin->sin_port = htons(port);
+		self->addrlen = sizeof(*sin);
+	} else if (inet_pton(AF_INET6, addr, &sin6->sin6_addr) == 1) {
+		sin6->sin6_family = AF_INET6;
+		sin6->sin6_port = htons(port);
+		self->addrlen = sizeof(*sin6);
+	} else {
+		return 0;
+	}
+
+	return 1;
+}
+
+struct sancus_tcp_conn *sancus_tcp_pool_checkout(struct sancus_tcp_pool *self,
+						 struct sancus_ev_loop *loop)
+{
+	struct sancus_list *e;
+	struct sancus_tcp_pool_conn *c;
+
+	while ((e = sancus_list_first(&self->idle)) != NULL) {
+		c = pool_conn_of_entry(e);
+		pool_del_idle(self, c);
+
+		if (pool_is_healthy(self, c)) {
+			self->stats.reused++;
+			self->stats.busy++;
+			return &c->conn;
+		}
+
+		self->stats.unhealthy++;
+		pool_destroy(self, loop, c);
+	}
+
+	if (pool_is_full(self)) {
+		errno = EAGAIN;
+		return NULL;
+	} else if ((c = pool_open(self, loop)) == NULL) {
+		return NULL;
+	}
+
+	self->stats.busy++;
+	return &c->conn;
+}
+
+void sancus_tcp_pool_checkin(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop,
+			     struct sancus_tcp_conn *conn)
+{
+	struct sancus_tcp_pool_conn *c = sancus_tcp_pool_conn_of(conn);
+	unsigned max_idle = self->settings->max_idle;
+
+	if (conn->state == SANCUS_TCP_CONN_FAILED) {
+		sancus_tcp_pool_discard(self, loop, conn);
+		return;
+	}
+
+	assert(self->stats.busy > 0);
+	self->stats.busy--;
+
+	if (!sancus_list_is_empty(&self->waiters)) {
+		self->stats.reused++;
+		pool_hand(self, loop, c);
+	} else if (max_idle > 0 && self->stats.idle >= max_idle) {
+		pool_destroy(self, loop, c);
+	} else {
+		pool_add_idle(self, c);
+	}
+}
+
+void sancus_tcp_pool_discard(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop,
+			     struct sancus_tcp_conn *conn)
+{
+	assert(self->stats.busy > 0);
+	self->stats.busy--;
+
+	pool_destroy(self, loop, sancus_tcp_pool_conn_of(conn));
+	pool_serve(self, loop);
+}
+
+void sancus_tcp_pool_wait(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop,
+			  struct sancus_tcp_pool_waiter *waiter)
+{
+	assert(waiter->on_conn);
+
+	waiter->since = sancus_ev_now(loop);
+	sancus_list_append(&self->waiters, &waiter->entry);
+	self->stats.waiting++;
+}
+
+void sancus_tcp_pool_cancel(struct sancus_tcp_pool *self,
+			    struct sancus_tcp_pool_waiter *waiter)
+{
+	sancus_list_del(&waiter->entry);
+	sancus_list_init(&waiter->entry);
+	self->stats.waiting--;
+}
+
+void sancus_tcp_pool_maintain(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop)
+{
+	const struct sancus_tcp_pool_settings *settings = self->settings;
+	struct timespec now = sancus_ev_now(loop);
+	bool expire = !sancus_time_is_zero(&settings->idle_timeout);
+
+	/* coldest first */
+	sancus_list_foreach_back2(&self->idle, e, prev) {
+		struct sancus_tcp_pool_conn *c = pool_conn_of_entry(e);
+		struct timespec dt = sancus_time_elapsed(&now, &c->conn.last_activity);
+
+		if (expire && !sancus_time_is_lt(&dt, &settings->idle_timeout)) {
+			self->stats.expired++;
+		} else if (!pool_is_healthy(self, c)) {
+			self->stats.unhealthy++;
+		} else {
+			continue;
+		}
+
+		pool_del_idle(self, c);
+		pool_destroy(self, loop, c);
+	}
+
+	while (self->stats.idle < settings->min_idle && !pool_is_full(self)) {
+		struct sancus_tcp_pool_conn *c = pool_open(self, loop);
+
+		if (c == NULL)
+			break;
+		pool_add_idle(self, c);
+	}
+}
+
+void sancus_tcp_pool_close(struct sancus_tcp_pool *self, struct sancus_ev_loop *loop)
+{
+	assert(self->stats.busy == 0);
+	assert(sancus_list_is_empty(&self->waiters));
+
+	sancus_list_foreach2(&self->idle, e, next) {
+		struct sancus_tcp_pool_conn *c = pool_conn_of_entry(e);
+
+		pool_del_idle(self, c);
+		pool_destroy(self, loop, c);
+	}
+}
@@ -26,10 +26,12 @@
  * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#define _GNU_SOURCE /* accept4() */
 
 #include <sancus/common.h>
 #include <sancus/ev.h>
 #include <sancus/fd.h>
+#include <sancus/time.h>
 
 #include <assert.h>
 #include <stdbool.h>
@@ -38,10 +40,333 @@
 #include <sys/un.h>
 
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <sancus/socket.h>
 #include <sancus/tcp_server.h>
 
+/* the peer gave up before we got to it, try the next */
+static inline bool accept_is_transient(int e)
+{
+	return e == ECONNABORTED || e == EPROTO || e == EPERM;
+}
+
+/*
+ * admission control, shared by the members of a group
+ */
+static inline struct sancus_tcp_server_admission *admission_of(struct sancus_tcp_server *self)
+{
+	return self->group != NULL ? &self->group->admission : &self->admission;
+}
+
+static inline bool admission_is_full(struct sancus_tcp_server *self)
+{
+	unsigned max = self->settings->max_connections;
+
+	return max > 0 && admission_of(self)->stats.connections >= max;
+}
+
+static inline unsigned admission_low_water(const struct sancus_tcp_server *self)
+{
+	const struct sancus_tcp_server_settings *settings = self->settings;
+
+	if (settings->resume_connections > 0 &&
+	    settings->resume_connections < settings->max_connections)
+		return settings->resume_connections;
+
+	return settings->max_connections - settings->max_connections / 10;
+}
+
+/*
+ * starts or stops the watchers of the server, or of its whole group,
+ * leaving alone those stopped by the application
+ */
+static void admission_watch(struct sancus_tcp_server *self, struct sancus_ev_loop *loop,
+			    bool on)
+{
+	struct sancus_tcp_server_group *group = self->group;
+	unsigned count = group != NULL ? group->count : 1;
+
+	for (unsigned i = 0; i < count; i++) {
+		struct sancus_tcp_server *server = group != NULL ? group->listeners[i] : self;
+
+		if (!server->started)
+			continue;
+		else if (on)
+			sancus_ev_fd_start(loop, &server->connect);
+		else
+			sancus_ev_fd_stop(loop, &server->connect);
+	}
+}
+
+static void admission_pause(struct sancus_tcp_server *self, struct sancus_ev_loop *loop)
+{
+	struct sancus_tcp_server_admission *adm = admission_of(self);
+
+	if (!adm->paused) {
+		admission_watch(self, loop, false);
+
+		adm->paused = true;
+		adm->paused_since = sancus_ev_now(loop);
+		adm->stats.pauses++;
+	}
+}
+
+/* ends the current pause, if any */
+static bool admission_settle(struct sancus_tcp_server_admission *adm,
+			     struct sancus_ev_loop *loop)
+{
+	if (adm->paused) {
+		struct timespec now = sancus_ev_now(loop);
+		struct timespec dt = sancus_time_elapsed(&now, &adm->paused_since);
+
+		sancus_time_add(&adm->stats.paused_time, &dt);
+		adm->paused = false;
+		return true;
+	}
+	return false;
+}
+
+static void admission_resume(struct sancus_tcp_server *self, struct sancus_ev_loop *loop)
+{
+	if (admission_settle(admission_of(self), loop))
+		admission_watch(self, loop, true);
+}
+
+static void admission_get_stats(const struct sancus_tcp_server_admission *adm,
+				struct sancus_ev_loop *loop,
+				struct sancus_tcp_server_stats *stats)
+{
+	*stats = adm->stats;
+
+	if (adm->paused) {
+		struct timespec now = sancus_ev_now(loop);
+		struct timespec dt = sancus_time_elapsed(&now, &adm->paused_since);
+
+		sancus_time_add(&stats->paused_time, &dt);
+	}
+}
+
+/* accept and reset right away, so the client fails fast */
+static bool admission_reject(struct sancus_tcp_server *self)
+{
+	struct linger ling = { 1, 0 };
+	int fd = sancus_accept4(self->connect.fd, NULL, NULL, true, true);
+
+	if (fd < 0)
+		return false;
+
+	setsockopt(fd, SOL_SOCKET, SO_LINGER, &ling, sizeof(ling));
+	sancus_close(fd);
+
+	admission_of(self)->stats.rejected++;
+	return true;
+}
+
+/*
+ * accepts up to @budget connections, telling if the listener is done
+ * for this wakeup
+ */
+static unsigned accept_some(struct sancus_tcp_server *self, struct sancus_ev_loop *loop,
+			    unsigned budget, bool *done)
+{
+	const struct sancus_tcp_server_settings *settings = self->settings;
+	struct sancus_tcp_server_admission *adm = admission_of(self);
+	struct sancus_tcp_server_accepted batch[SANCUS_TCP_SERVER_BATCH_MAX];
+	unsigned tries = 0, accepted = 0;
+	size_t count = 0;
+
+	*done = false;
+
+	while (!*done && tries++ < budget) {
+		struct sancus_tcp_server_accepted *c = &batch[count];
+		struct sockaddr *sa = (struct sockaddr *)&c->addr;
+
+		if (admission_is_full(self)) {
+			if (!settings->shed_load) {
+				admission_pause(self, loop);
+				*done = true;
+				break;
+			} else if (admission_reject(self)) {
+				continue;
+			}
+
+			c->fd = -1;
+		} else {
+			c->addrlen = sizeof(c->addr);
+			c->fd = sancus_accept4(self->connect.fd, sa, &c->addrlen, true, true);
+		}
+
+		if (c->fd < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				*done = true;
+			} else if (!accept_is_transient(errno)) {
+				settings->on_error(self, loop, SANCUS_TCP_SERVER_ACCEPT_ERROR);
+				*done = true;
+			}
+			continue;
+		}
+
+		accepted++;
+		adm->stats.accepted++;
+		adm->stats.connections++;
+
+		if (settings->on_connect_batch == NULL) {
+			if (!settings->on_connect(self, loop, c->fd, sa, c->addrlen)) {
+				sancus_close2(&c->fd);
+				adm->stats.connections--;
+			}
+		} else if (++count == ARRAY_SIZE(batch)) {
+			settings->on_connect_batch(self, loop, batch, count);
+			count = 0;
+		}
+	}
+
+	if (count > 0)
+		settings->on_connect_batch(self, loop, batch, count);
+
+	return accepted;
+}
+
+static inline unsigned accept_budget(const struct sancus_tcp_server_settings *settings)
+{
+	return settings->accept_budget > 0 ? settings->accept_budget :
+		SANCUS_TCP_SERVER_ACCEPT_BUDGET;
+}
+
+unsigned sancus_tcp_server_accept(struct sancus_tcp_server *self,
+				  struct sancus_ev_loop *loop)
+{
+	bool done;
+
+	if (self->group != NULL)
+		return sancus_tcp_server_group_accept(self->group, loop);
+
+	return accept_some(self, loop, accept_budget(self->settings), &done);
+}
+
+void sancus_tcp_server_release(struct sancus_tcp_server *self,
+			       struct sancus_ev_loop *loop)
+{
+	struct sancus_tcp_server_admission *adm = admission_of(self);
+
+	assert(adm->stats.connections > 0);
+
+	if (adm->stats.connections > 0)
+		adm->stats.connections--;
+
+	if (adm->paused && adm->stats.connections <= admission_low_water(self))
+		admission_resume(self, loop);
+}
+
+void sancus_tcp_server_get_stats(const struct sancus_tcp_server *self,
+				 struct sancus_ev_loop *loop,
+				 struct sancus_tcp_server_stats *stats)
+{
+	const struct sancus_tcp_server_admission *adm = self->group != NULL ?
+		&self->group->admission : &self->admission;
+
+	admission_get_stats(adm, loop, stats);
+}
+
+/*
+ * groups
+ */
+unsigned sancus_tcp_server_group_accept(struct sancus_tcp_server_group *self,
+					struct sancus_ev_loop *loop)
+{
+	unsigned budget = accept_budget(self->settings);
+	unsigned accepted = 0, tries = 0, pending = self->count;
+	bool done[SANCUS_TCP_SERVER_GROUP_MAX] = { false };
+	unsigned first = self->next;
+
+	if (self->count == 0)
+		return 0;
+
+	/* a different listener leads on every wakeup */
+	self->next = (first + 1) % self->count;
+
+	while (pending > 0 && tries < budget && !self->admission.paused) {
+		unsigned share = (budget - tries) / pending;
+
+		if (share == 0)
+			share = 1;
+
+		for (unsigned k = 0; k < self->count && tries < budget; k++) {
+			unsigned i = (first + k) % self->count;
+			unsigned n;
+
+			if (done[i])
+				continue;
+
+			if (share > budget - tries)
+				share = budget - tries;
+
+			n = accept_some(self->listeners[i], loop, share, &done[i]);
+			accepted += n;
+			tries += done[i] ? n + 1 : share;
+
+			if (done[i])
+				pending--;
+			if (self->admission.paused)
+				break;
+		}
+	}
+
+	return accepted;
+}
+
+void sancus_tcp_server_group_init(struct sancus_tcp_server_group *self,
+				  const struct sancus_tcp_server_settings *settings)
+{
+	assert(settings);
+
+	*self = (struct sancus_tcp_server_group) { .settings = settings };
+}
+
+int sancus_tcp_server_group_add(struct sancus_tcp_server_group *self,
+				struct sancus_tcp_server *server)
+{
+	if (server->settings != self->settings || server->group != NULL ||
+	    server->admission.stats.connections > 0 ||
+	    sancus_ev_is_active(&server->connect)) {
+		errno = EINVAL;
+		return -1;
+	} else if (self->count == ARRAY_SIZE(self->listeners)) {
+		errno = ENOSPC;
+		return -1;
+	}
+
+	server->group = self;
+	self->listeners[self->count++] = server;
+	return 0;
+}
+
+void sancus_tcp_server_group_start(struct sancus_tcp_server_group *self,
+				   struct sancus_ev_loop *loop)
+{
+	for (unsigned i = 0; i < self->count; i++)
+		sancus_tcp_server_start(self->listeners[i], loop);
+}
+
+void sancus_tcp_server_group_stop(struct sancus_tcp_server_group *self,
+				  struct sancus_ev_loop *loop)
+{
+	for (unsigned i = 0; i < self->count; i++)
+		sancus_tcp_server_stop(self->listeners[i], loop);
+}
+
+void sancus_tcp_server_group_close(struct sancus_tcp_server_group *self)
+{
+	for (unsigned i = 0; i < self->count; i++) {
+		sancus_tcp_server_close(self->listeners[i]);
+		self->listeners[i]->group = NULL;
+	}
+
+	self->count = self->next = 0;
+}
+
 /**
  * connect_cb - called when there is incoming
  */
@@ -49,23 +374,11 @@ static void connect_cb(struct sancus_ev_loop *loop, struct sancus_ev_fd *w, int
 {
 	struct sancus_tcp_server *self = container_of(w, struct sancus_tcp_server,
 						      connect);
-	const struct sancus_tcp_server_settings *settings = self->settings;
 
 	assert(!(revents & SANCUS_EV_ERROR));
 
-	if (revents & SANCUS_EV_READ) {
-		struct sockaddr_storage addr;
-		socklen_t addrlen = sizeof(addr);
-
-		int fd = sancus_accept(w->fd, (struct sockaddr*)&addr, &addrlen);
-		if (fd < 0) {
-			settings->on_error(self, loop,
-					   SANCUS_TCP_SERVER_ACCEPT_ERROR);
-		} else if (!settings->on_connect(self, loop, fd,
-						 (struct sockaddr*)&addr, addrlen)) {
-			sancus_close2(&fd);
-		}
-	}
+	if (revents & SANCUS_EV_READ)
+		sancus_tcp_server_accept(self, loop);
 }
 
 /*
@@ -115,6 +428,124 @@ static inline int init_local(struct sockaddr_un *sun, const char *path)
 	return 1;
 }
 
+/*
+ * listener options
+ */
+enum option_check {
+	OPTION_EXACT,
+	OPTION_AT_LEAST,	/* may be rounded up, like buffer sizes */
+	OPTION_NONZERO,		/* may be rounded, like TCP_DEFER_ACCEPT */
+};
+
+struct option_desc {
+	enum sancus_tcp_server_option opt;
+	int level, name;
+	enum option_check check;
+	bool tcp;
+};
+
+/* unknown to the headers, reported as ENOPROTOOPT */
+#ifndef TCP_DEFER_ACCEPT
+#define TCP_DEFER_ACCEPT -1
+#endif
+#ifndef TCP_FASTOPEN
+#define TCP_FASTOPEN -1
+#endif
+#ifndef SO_INCOMING_CPU
+#define SO_INCOMING_CPU -1
+#endif
+
+static const struct option_desc option_descs[] = {
+	{ SANCUS_TCP_SERVER_OPT_DEFER_ACCEPT, IPPROTO_TCP, TCP_DEFER_ACCEPT, OPTION_NONZERO, true },
+	{ SANCUS_TCP_SERVER_OPT_FASTOPEN, IPPROTO_TCP, TCP_FASTOPEN, OPTION_EXACT, true },
+	{ SANCUS_TCP_SERVER_OPT_RCVBUF, SOL_SOCKET, SO_RCVBUF, OPTION_AT_LEAST, false },
+	{ SANCUS_TCP_SERVER_OPT_SNDBUF, SOL_SOCKET, SO_SNDBUF, OPTION_AT_LEAST, false },
+	{ SANCUS_TCP_SERVER_OPT_NODELAY, IPPROTO_TCP, TCP_NODELAY, OPTION_NONZERO, true },
+	{ SANCUS_TCP_SERVER_OPT_INCOMING_CPU, SOL_SOCKET, SO_INCOMING_CPU, OPTION_EXACT, true },
+};
+
+/* value to set, 0 to leave it alone */
+static inline int option_value(const struct sancus_tcp_server_options *o,
+			       enum sancus_tcp_server_option opt)
+{
+	switch (opt) {
+	case SANCUS_TCP_SERVER_OPT_DEFER_ACCEPT:
+		return (int)o->defer_accept;
+	case SANCUS_TCP_SERVER_OPT_FASTOPEN:
+		return (int)o->fastopen;
+	case SANCUS_TCP_SERVER_OPT_RCVBUF:
+		return (int)o->rcvbuf;
+	case SANCUS_TCP_SERVER_OPT_SNDBUF:
+		return (int)o->sndbuf;
+	case SANCUS_TCP_SERVER_OPT_NODELAY:
+		return o->nodelay ? 1 : 0;
+	case SANCUS_TCP_SERVER_OPT_INCOMING_CPU:
+		return (int)o->incoming_cpu;
+	default:
+		return 0;
+	}
+}
+
+static int apply_option(int fd, const struct option_desc *d, int want)
+{
+	int got = 0;
+	socklen_t len = sizeof(got);
+
+	if (d->name < 0)
+		return ENOPROTOOPT;
+
+	/* SO_INCOMING_CPU is stored plus one, to tell CPU 0 from unset */
+	if (d->opt == SANCUS_TCP_SERVER_OPT_INCOMING_CPU)
+		want--;
+
+	if (setsockopt(fd, d->level, d->name, &want, sizeof(want)) < 0 ||
+	    getsockopt(fd, d->level, d->name, &got, &len) < 0)
+		return errno;
+
+	switch (d->check) {
+	case OPTION_EXACT:
+		return got == want ? 0 : ERANGE;
+	case OPTION_AT_LEAST:
+		return got >= want ? 0 : ERANGE;
+	case OPTION_NONZERO:
+	default:
+		return got != 0 ? 0 : ERANGE;
+	}
+}
+
+static void apply_options(struct sancus_tcp_server *self, int fd, bool tcp)
+{
+	const struct sancus_tcp_server_settings *settings = self->settings;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(option_descs); i++) {
+		const struct option_desc *d = &option_descs[i];
+		int want = option_value(&settings->options, d->opt);
+		int err;
+
+		if (want == 0 || (d->tcp && !tcp))
+			continue;
+
+		err = apply_option(fd, d, want);
+		if (err != 0 && settings->on_option_error != NULL) {
+			errno = err;
+			settings->on_option_error(self, d->opt, err);
+		}
+	}
+}
+
+static inline void init_server(struct sancus_tcp_server *self,
+			       const struct sancus_tcp_server_settings *settings,
+			       int fd)
+{
+	sancus_ev_fd_init(&self->connect, connect_cb, fd, SANCUS_EV_READ);
+	/* TODO: any ->data to add? */
+
+	self->settings = settings;
+	self->admission = (struct sancus_tcp_server_admission) { .paused = false };
+	self->group = NULL;
+	self->started = false;
+}
+
 static inline int init_tcp(struct sancus_tcp_server *self,
 			   const struct sancus_tcp_server_settings *settings,
 			   struct sockaddr *sa, socklen_t sa_len,
@@ -136,10 +567,8 @@ static inline int init_tcp(struct sancus_tcp_server *self,
 		setsockopt(fd, SOL_SOCKET, SO_LINGER, (void*)&ling, sizeof(ling));
 	}
 
-	sancus_ev_fd_init(&self->connect, connect_cb, fd, SANCUS_EV_READ);
-	/* TODO: any ->data to add? */
-
-	self->settings = settings;
+	init_server(self, settings, fd);
+	apply_options(self, fd, sa->sa_family != AF_LOCAL);
 
 	if (settings->pre_bind)
 		settings->pre_bind(self);
@@ -162,13 +591,32 @@ static inline int init_tcp(struct sancus_tcp_server *self,
 void sancus_tcp_server_start(struct sancus_tcp_server *self, struct sancus_ev_loop *loop)
 {
 	assert(!sancus_ev_is_active(&self->connect));
-	sancus_ev_fd_start(loop, &self->connect);
+	self->started = true;
+
+	/* joins the pause of its group, watched when it resumes */
+	if (!admission_of(self)->paused)
+		sancus_ev_fd_start(loop, &self->connect);
 }
 
 void sancus_tcp_server_stop(struct sancus_tcp_server *self, struct sancus_ev_loop *loop)
 {
+	struct sancus_tcp_server_group *group = self->group;
+	bool last = true;
+
+	/* stopped by the application, not to be resumed */
+	self->started = false;
+
 	if (sancus_ev_is_active(&self->connect))
 		sancus_ev_fd_stop(loop, &self->connect);
+
+	/* the pause of a group goes on while other members are started */
+	for (unsigned i = 0; group != NULL && i < group->count; i++) {
+		if (group->listeners[i]->started)
+			last = false;
+	}
+
+	if (last)
+		admission_settle(admission_of(self), loop);
 }
 
 void sancus_tcp_server_close(struct sancus_tcp_server *self)
@@ -224,3 +672,137 @@ int sancus_tcp_local_listen(struct sancus_tcp_server *self,
 	return init_tcp(self, settings, (struct sockaddr *)&sun, sizeof(sun),
 			cloexec, backlog);
 }
+
+/*
+ * listener handoff
+ */
+int sancus_tcp_server_adopt(struct sancus_tcp_server *self,
+			    const struct sancus_tcp_server_settings *settings,
+			    int fd, bool cloexec)
+{
+	int type = 0, listening = 0, fl;
+	socklen_t len = sizeof(type);
+
+	assert(self);
+	assert(settings);
+
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) < 0)
+		return -1;
+
+	len = sizeof(listening);
+	if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) < 0)
+		return -1;
+
+	if (type != SOCK_STREAM || !listening) {
+		errno = EINVAL;
+		return 0;
+	}
+
+	if ((fl = fcntl(fd, F_GETFL)) < 0 ||
+	    (!(fl & O_NONBLOCK) && fcntl(fd, F_SETFL, fl | O_NONBLOCK) < 0) ||
+	    (fl = fcntl(fd, F_GETFD)) < 0 ||
+	    fcntl(fd, F_SETFD, cloexec ? fl | FD_CLOEXEC : fl & ~FD_CLOEXEC) < 0)
+		return -1;
+
+	init_server(self, settings, fd);
+	return 1;
+}
+
+int sancus_tcp_server_send_fds(int sock, struct sancus_tcp_server *const *servers,
+			       size_t count)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * SANCUS_TCP_SERVER_HANDOFF_MAX)];
+	} control;
+	uint32_t n = (uint32_t)count;
+	struct iovec iov = { .iov_base = &n, .iov_len = sizeof(n) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = CMSG_SPACE(sizeof(int) * count),
+	};
+	struct cmsghdr *cmsg;
+	int *fds;
+	ssize_t l;
+
+	if (count == 0 || count > SANCUS_TCP_SERVER_HANDOFF_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(control.buf, 0, sizeof(control.buf));
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+
+	fds = (int *)CMSG_DATA(cmsg);
+	for (size_t i = 0; i < count; i++)
+		fds[i] = servers[i]->connect.fd;
+
+	/* the count goes along, so the receiver can tell a truncation */
+	while ((l = sendmsg(sock, &msg, MSG_NOSIGNAL)) < 0 && errno == EINTR)
+		;
+
+	return l < 0 ? -1 : 0;
+}
+
+ssize_t sancus_tcp_server_receive_fds(int sock, int *fds, size_t max)
+{
+	union {
+		struct cmsghdr align;
+		char buf[CMSG_SPACE(sizeof(int) * SANCUS_TCP_SERVER_HANDOFF_MAX)];
+	} control;
+	uint32_t n = 0;
+	struct iovec iov = { .iov_base = &n, .iov_len = sizeof(n) };
+	struct msghdr msg = {
+		.msg_iov = &iov,
+		.msg_iovlen = 1,
+		.msg_control = control.buf,
+		.msg_controllen = sizeof(control.buf),
+	};
+	struct cmsghdr *cmsg;
+	size_t count = 0;
+	int flags = 0;
+	ssize_t l;
+
+#ifdef MSG_CMSG_CLOEXEC
+	flags |= MSG_CMSG_CLOEXEC;
+#endif
+
+	while ((l = recvmsg(sock, &msg, flags)) < 0 && errno == EINTR)
+		;
+	if (l < 0)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		const int *p = (const int *)CMSG_DATA(cmsg);
+		size_t k;
+
+		if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		k = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+		for (size_t i = 0; i < k; i++) {
+			if (count < max) {
+				fds[count++] = p[i];
+#ifndef MSG_CMSG_CLOEXEC
+				fcntl(p[i], F_SETFD, FD_CLOEXEC);
+#endif
+			} else {
+				sancus_close(p[i]);
+			}
+		}
+	}
+
+	if ((size_t)l != sizeof(n) || n != count || (msg.msg_flags & MSG_CTRUNC)) {
+		while (count > 0)
+			sancus_close(fds[--count]);
+		errno = l == 0 ? ECONNRESET : EMSGSIZE;
+		return -1;
+	}
+
+	return (ssize_t)count;
+}
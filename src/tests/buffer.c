@@ -0,0 +1,123 @@
+#include <sancus/common.h>
+#include <sancus/buffer.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static int test__eq(const char *fn, const struct sancus_buffer *b,
+		    size_t base, size_t len)
+{
+	int err = 0;
+
+	if (b->base == base && b->len == len) {
+		pr_info("%s -> base:%zu len:%zu\n", fn, b->base, b->len);
+	} else {
+		pr_err("%s -> base:%zu len:%zu expected:%zu,%zu\n",
+		       fn, b->base, b->len, base, len);
+		err = 1;
+	}
+	return err;
+}
+
+#define test_eq(B, E, BASE, LEN) ((void)(E), test__eq(#E, (B), (BASE), (LEN)))
+
+static int test_small(void)
+{
+	char data[16];
+	struct sancus_buffer b;
+	int err = 0;
+
+	sancus_buffer_init(&b, data, sizeof(data));
+
+	err += test_eq(&b, sancus_buffer_appendz(&b, "hello world"), 0, 11);
+	err += test_eq(&b, sancus_buffer_appendz(&b, "0123456789"), 0, 11);
+	err += test_eq(&b, sancus_buffer__appendz(&b, true, "0123456789"), 0, 16);
+	err += test_eq(&b, sancus_buffer_truncate(&b, 11), 0, 11);
+	err += test_eq(&b, sancus_buffer_stripz(&b, "world"), 0, 6);
+	err += test_eq(&b, sancus_buffer_stripany(&b, " "), 0, 5);
+	err += test_eq(&b, sancus_buffer_skip(&b, 2), 2, 3);
+	err += test_eq(&b, sancus_buffer_rebase(&b), 0, 3);
+	err += test_eq(&b, sancus_buffer_pop(&b, 1), 0, 2);
+	err += test_eq(&b, sancus_buffer_reset(&b), 0, 0);
+
+	/* full buffer, reset mustn't write past the end */
+	err += test_eq(&b, sancus_buffer_append(&b, "0123456789abcdef", 16), 0, 16);
+	err += test_eq(&b, sancus_buffer_skip(&b, 16), 0, 0);
+
+	return err;
+}
+
+static int test_large(void)
+{
+	const size_t size = 3 * 65536;
+	char *data = malloc(size);
+	struct sancus_buffer b;
+	size_t i;
+	int err = 0;
+
+	if (data == NULL)
+		return 1;
+
+	sancus_buffer_init(&b, data, size);
+
+	for (i = 0; i < size / 16; i++)
+		sancus_buffer_append(&b, "0123456789abcdef", 16);
+
+	err += test_eq(&b, 0, 0, size);
+	/* no room left in the tail, skip() rebases */
+	err += test_eq(&b, sancus_buffer_skip(&b, 65536 + 3), 0, size - 65536 - 3);
+
+	if (memcmp(sancus_buffer_ptr(&b), "3456789abcdef", 13) != 0) {
+		pr_err("sancus_buffer_skip: unexpected data\n");
+		err++;
+	}
+
+	err += test_eq(&b, sancus_buffer_pop(&b, 65536), 0, size - 2 * 65536 - 3);
+
+	free(data);
+	return err;
+}
+
+static int test_read(void)
+{
+	char data[32];
+	struct sancus_buffer b;
+	int fd[2];
+	int err = 0;
+
+	if (pipe(fd) < 0)
+		return 1;
+
+	sancus_buffer_init(&b, data, sizeof(data));
+	sancus_buffer_appendz(&b, "abc");
+
+	sancus_write(fd[1], "defgh", 5);
+	err += test_eq(&b, sancus_buffer_read(&b, fd[0]), 0, 8);
+
+	if (memcmp(sancus_buffer_ptr(&b), "abcdefgh", 8) != 0) {
+		pr_err("sancus_buffer_read: unexpected data\n");
+		err++;
+	}
+
+	sancus_close(fd[0]);
+	sancus_close(fd[1]);
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	int err = 0;
+
+	err += test_small();
+	err += test_large();
+	err += test_read();
+
+	return err == 0 ? 0 : 1;
+}
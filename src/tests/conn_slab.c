@@ -0,0 +1,152 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/time.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <sancus/buffer.h>
+#include <sancus/stream.h>
+#include <sancus/tcp_conn.h>
+#include <sancus/conn_slab.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	CAPACITY  = 5,
+	USER_SIZE = 100,
+	CYCLES    = 100000,
+};
+
+static inline bool is_aligned(const void *p)
+{
+	return ((uintptr_t)p % SANCUS_CONN_SLAB_CACHELINE) == 0;
+}
+
+static int test_alloc(struct sancus_conn_slab *slab)
+{
+	struct sancus_conn *c[CAPACITY];
+	uint32_t h[CAPACITY];
+	int err = 0;
+
+	for (unsigned i = 0; i < CAPACITY; i++) {
+		c[i] = sancus_conn_slab_alloc(slab);
+		if (c[i] == NULL)
+			return 1;
+
+		h[i] = sancus_conn_slab_handle(slab, c[i]);
+		memset(sancus_conn_user(c[i]), 0xa5, USER_SIZE);
+
+		if (!is_aligned(c[i]) || !is_aligned(sancus_conn_user(c[i])) ||
+		    h[i] == SANCUS_CONN_HANDLE_NONE || sancus_conn_slab_get(slab, h[i]) != c[i]) {
+			pr_err("alloc: bad record %u\n", i);
+			err++;
+		}
+	}
+
+	if (sancus_conn_slab_alloc(slab) != NULL || errno != ENOBUFS) {
+		pr_err("alloc: not full at %u\n", CAPACITY);
+		err++;
+	}
+
+	/* back from the embedded structs */
+	if (sancus_conn_from_stream(&c[1]->stream) != c[1] ||
+	    sancus_conn_from_conn(&c[2]->conn) != c[2]) {
+		pr_err("alloc: container mismatch\n");
+		err++;
+	}
+
+	/* reused, zeroed and with a new handle */
+	sancus_conn_slab_free(slab, c[3]);
+	if (sancus_conn_slab_get(slab, h[3]) != NULL) {
+		pr_err("alloc: freed handle resolves\n");
+		err++;
+	}
+
+	if (sancus_conn_slab_alloc(slab) != c[3] ||
+	    sancus_conn_slab_get(slab, h[3]) != NULL ||
+	    ((unsigned char *)sancus_conn_user(c[3]))[USER_SIZE - 1] != 0) {
+		pr_err("alloc: stale handle resolves after reuse\n");
+		err++;
+	}
+
+	for (unsigned i = 0; i < CAPACITY; i++)
+		sancus_conn_slab_free(slab, c[i]);
+
+	/* made up handles */
+	if (sancus_conn_slab_get(slab, SANCUS_CONN_HANDLE_NONE) != NULL ||
+	    sancus_conn_slab_get(slab, UINT32_MAX) != NULL ||
+	    sancus_conn_slab_get(slab, h[0] + 1) != NULL) {
+		pr_err("alloc: invalid handle resolves\n");
+		err++;
+	}
+
+	if (err == 0)
+		pr_info("alloc: stride:%zu used:%u\n", slab->stride, slab->used);
+	return err;
+}
+
+/* a handle only matches again once the generation wraps */
+static int test_generations(void)
+{
+	struct sancus_conn_slab slab;
+	uint32_t first, h = 0;
+	unsigned wrapped = 0;
+
+	if (sancus_conn_slab_init(&slab, SANCUS_CONN_SLAB_MAX, 0) < 0)
+		return 1;
+
+	first = sancus_conn_slab_handle(&slab, sancus_conn_slab_alloc(&slab));
+	sancus_conn_slab_free(&slab, sancus_conn_slab_get(&slab, first));
+
+	for (unsigned i = 0; i < CYCLES && wrapped == 0; i++) {
+		struct sancus_conn *c = sancus_conn_slab_alloc(&slab);
+
+		h = sancus_conn_slab_handle(&slab, c);
+		if (h == first)
+			wrapped = i + 1;
+		sancus_conn_slab_free(&slab, c);
+	}
+
+	sancus_conn_slab_destroy(&slab);
+
+	if (wrapped != (UINT32_MAX >> 20) / 2 + 1) {
+		pr_err("generations: wrapped after %u reuses\n", wrapped);
+		return 1;
+	}
+
+	pr_info("generations: wrapped after %u reuses\n", wrapped);
+	return 0;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	struct sancus_conn_slab slab;
+	int err = 0;
+
+	if (sancus_conn_slab_init(&slab, 0, 0) == 0 || errno != EINVAL ||
+	    sancus_conn_slab_init(&slab, SANCUS_CONN_SLAB_MAX + 1, 0) == 0) {
+		pr_err("init: bad capacity accepted\n");
+		err++;
+	}
+
+	if (sancus_conn_slab_init(&slab, CAPACITY, USER_SIZE) < 0)
+		return 1;
+
+	err += test_alloc(&slab);
+	sancus_conn_slab_destroy(&slab);
+
+	err += test_generations();
+
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,213 @@
+#include <sancus/common.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	THREADS = 4,
+	LINES = 5000,
+};
+
+static DECL_SANCUS_LOGGER(logger, TEST_NAME, 0);
+
+/*
+ * struct output - what the reader got
+ *
+ * @lines:	lines logged by the producers
+ * @notes:	"log lines dropped" notes
+ * @reported:	sum of the lines reported dropped by the notes
+ * @unordered:	lines coming before an earlier one of the same thread
+ */
+struct output {
+	size_t lines;
+	size_t notes;
+	unsigned long reported;
+	size_t unordered;
+};
+
+/* appended to every 8th line when set, to make it longer than a ring */
+static const char *padding = "";
+
+static void *reader(void *arg)
+{
+	int fd = *(int *)arg;
+	struct output *out = calloc(1, sizeof(*out));
+	char buf[4096], line[256];
+	unsigned next[THREADS] = { 0 };
+	size_t ll = 0;
+	ssize_t l;
+
+	while ((l = sancus_read(fd, buf, sizeof(buf))) > 0) {
+		for (ssize_t i = 0; i < l; i++) {
+			const char *note;
+
+			if (buf[i] != '\n') {
+				if (ll < sizeof(line) - 1)
+					line[ll++] = buf[i];
+				continue;
+			}
+
+			line[ll] = '\0';
+			ll = 0;
+
+			note = strstr(line, "sancus: ");
+			if (note != NULL && strstr(note, " log lines dropped") != NULL) {
+				out->notes++;
+				out->reported += strtoul(note + 8, NULL, 10);
+			} else {
+				const char *p = strstr(line, "thread ");
+				unsigned id, n;
+
+				if (p != NULL && sscanf(p, "thread %u line %u", &id, &n) == 2 &&
+				    id < THREADS) {
+					if (n < next[id])
+						out->unordered++;
+					next[id] = n + 1;
+				}
+				out->lines++;
+			}
+		}
+	}
+
+	return out;
+}
+
+static void *producer(void *arg)
+{
+	unsigned id = (unsigned)(uintptr_t)arg;
+
+	for (unsigned i = 0; i < LINES; i++)
+		sancus_log_info(&logger, "thread %u line %u%s", id, i,
+				i % 8 == 0 ? padding : "");
+
+	return NULL;
+}
+
+/*
+ * logs from THREADS threads into a pipe. With @late_reader nothing is
+ * read until they are done, so the writer blocks and the rings fill
+ * up. With @early_stop the writer is stopped while they are logging
+ */
+static int run(enum sancus_logger_async_policy policy, size_t ring_size,
+	       bool late_reader, bool early_stop,
+	       struct output *out, unsigned long *dropped)
+{
+	struct sancus_logger_async_settings settings = {
+		.ring_size = ring_size,
+		.policy = policy,
+	};
+	unsigned long dropped0 = sancus_logger_async_dropped();
+	pthread_t rd, th[THREADS];
+	struct output *o;
+	int fd[2];
+	int err;
+
+	if (pipe(fd) < 0)
+		return -1;
+
+	if (!late_reader)
+		pthread_create(&rd, NULL, reader, &fd[0]);
+
+	settings.fd = fd[1];
+	err = sancus_logger_set_async_backend(&settings);
+	if (err < 0) {
+		pr_err("sancus_logger_set_async_backend: %s\n", strerror(-err));
+		return -1;
+	}
+
+	for (uintptr_t i = 0; i < THREADS; i++)
+		pthread_create(&th[i], NULL, producer, (void *)i);
+
+	if (early_stop)
+		sancus_logger_async_stop();
+
+	for (unsigned i = 0; i < THREADS; i++)
+		pthread_join(th[i], NULL);
+
+	if (late_reader)
+		pthread_create(&rd, NULL, reader, &fd[0]);
+
+	sancus_logger_async_stop();
+	sancus_close(fd[1]);
+
+	pthread_join(rd, (void **)&o);
+	sancus_close(fd[0]);
+
+	*out = *o;
+	*dropped = sancus_logger_async_dropped() - dropped0;
+	free(o);
+	return 0;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	struct output out;
+	unsigned long dropped;
+	int err = 0;
+
+	/* nothing lost */
+	if (run(SANCUS_LOGGER_ASYNC_BLOCK, 4096, false, false, &out, &dropped) < 0)
+		return 1;
+
+	if (out.lines != THREADS * LINES || out.notes != 0 || dropped != 0 ||
+	    out.unordered != 0) {
+		pr_err("block: %zu lines written, expected:%u, %lu dropped, %zu unordered\n",
+		       out.lines, THREADS * LINES, dropped, out.unordered);
+		err++;
+	} else {
+		pr_info("block: %zu lines written\n", out.lines);
+	}
+
+	/* every line either written or counted, and reported */
+	if (run(SANCUS_LOGGER_ASYNC_DROP, 4096, true, false, &out, &dropped) < 0)
+		return 1;
+
+	if (out.lines + dropped != THREADS * LINES || dropped == 0 ||
+	    out.reported != dropped || out.unordered != 0) {
+		pr_err("drop: %zu lines written, %lu dropped, %lu reported by %zu notes\n",
+		       out.lines, dropped, out.reported, out.notes);
+		err++;
+	} else {
+		pr_info("drop: %zu lines written, %lu dropped\n", out.lines, dropped);
+	}
+
+	/* stopped under their feet, the rest is written synchronously */
+	if (run(SANCUS_LOGGER_ASYNC_BLOCK, 4096, false, true, &out, &dropped) < 0)
+		return 1;
+
+	if (out.lines != THREADS * LINES || dropped != 0 || out.unordered != 0) {
+		pr_err("stop: %zu lines written, expected:%u, %lu dropped, %zu unordered\n",
+		       out.lines, THREADS * LINES, dropped, out.unordered);
+		err++;
+	} else {
+		pr_info("stop: %zu lines written\n", out.lines);
+	}
+
+	/* lines too long for the ring are written in order with the rest */
+	padding = " ....................................................."
+		  "......................................................";
+	if (run(SANCUS_LOGGER_ASYNC_BLOCK, 128, false, false, &out, &dropped) < 0)
+		return 1;
+
+	if (out.lines != THREADS * LINES || dropped != 0 || out.unordered != 0) {
+		pr_err("long: %zu lines written, expected:%u, %lu dropped, %zu unordered\n",
+		       out.lines, THREADS * LINES, dropped, out.unordered);
+		err++;
+	} else {
+		pr_info("long: %zu lines written\n", out.lines);
+	}
+
+	return err == 0 ? 0 : 1;
+}
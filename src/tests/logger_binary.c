@@ -0,0 +1,197 @@
+#include <sancus/common.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+#include <sancus/logger_binary.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	LINES = 1000,
+	REUSED = 2,	/* lines logged with a format rewritten in place */
+};
+
+static DECL_SANCUS_LOGGER(logger, TEST_NAME, 0);
+
+static int test_parser(void)
+{
+	static const struct {
+		const char *conv;
+		enum sancus_logger_arg type;
+		enum sancus_logger_arg_length length;
+		unsigned head_len;
+	} cases[] = {
+		{ "%-*.*lld", SANCUS_LOGGER_ARG_INT, SANCUS_LOGGER_ARG_LEN_LL, 5 },
+		{ "%08zx", SANCUS_LOGGER_ARG_UINT, SANCUS_LOGGER_ARG_LEN_Z, 3 },
+		{ "%.3s", SANCUS_LOGGER_ARG_STRING, SANCUS_LOGGER_ARG_LEN_NONE, 3 },
+		{ "%m", SANCUS_LOGGER_ARG_ERRNO, SANCUS_LOGGER_ARG_LEN_NONE, 1 },
+		{ "%%", SANCUS_LOGGER_ARG_NONE, SANCUS_LOGGER_ARG_LEN_NONE, 1 },
+		{ "%Lg", SANCUS_LOGGER_ARG_DOUBLE, SANCUS_LOGGER_ARG_LEN_BIG_L, 1 },
+	};
+	struct sancus_logger_binary_spec spec;
+	int err = 0;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(cases); i++) {
+		const char *s = cases[i].conv;
+
+		if (sancus_logger_binary_next(s, &spec) != s ||
+		    spec.len != strlen(s) ||
+		    spec.head_len != cases[i].head_len ||
+		    spec.type != cases[i].type ||
+		    spec.length != cases[i].length) {
+			pr_err("%s: unexpected spec\n", s);
+			err++;
+		}
+	}
+
+	if (sancus_logger_binary_next("no conversions", &spec) != NULL) {
+		pr_err("unexpected conversion\n");
+		err++;
+	}
+
+	return err;
+}
+
+static int test_stream(const char *buf, size_t len)
+{
+	struct sancus_logger_binary_header h;
+	size_t off = sizeof(h), strings = 0, lines = 0;
+	uint64_t ids[1 + REUSED];
+	uint64_t last = 0;
+	int err = 0;
+
+	memcpy(&h, buf, sizeof(h));
+	if (len < sizeof(h) ||
+	    memcmp(h.magic, SANCUS_LOGGER_BINARY_MAGIC, sizeof(h.magic)) != 0 ||
+	    h.version != SANCUS_LOGGER_BINARY_VERSION) {
+		pr_err("invalid header\n");
+		return 1;
+	}
+
+	while (off + sizeof(struct sancus_logger_record) <= len) {
+		const struct sancus_logger_record *rec = (const void *)(buf + off);
+		const char *p = (const char *)(rec + 1) + rec->prefix_len;
+		uint64_t v;
+
+		if (rec->len < sizeof(*rec) || rec->len > len - off || rec->len & 7) {
+			pr_err("%zu: invalid record\n", off);
+			return err + 1;
+		}
+
+		switch (rec->type) {
+		case SANCUS_LOGGER_RECORD_STRING:
+			if (strings < ARRAY_SIZE(ids))
+				ids[strings] = rec->fmt;
+			strings++;
+			break;
+		case SANCUS_LOGGER_RECORD_PRINTF:
+			/* defined before it's used */
+			v = 0;
+			for (size_t i = 0; i < strings && i < ARRAY_SIZE(ids); i++)
+				v += ids[i] == rec->fmt;
+			if (v != 1) {
+				pr_err("line %zu: format defined %llu times\n", lines,
+				       (unsigned long long)v);
+				err++;
+			}
+
+
+			/* "line %u" */
+			memcpy(&v, p, sizeof(v));
+			if (v != lines) {
+				pr_err("line %zu: got %llu\n", lines, (unsigned long long)v);
+				err++;
+			}
+			if (rec->ts < last) {
+				pr_err("line %zu: time went back\n", lines);
+				err++;
+			}
+			last = rec->ts;
+			lines++;
+			break;
+		default:
+			pr_err("%zu: unexpected record type %u\n", off, rec->type);
+			err++;
+		}
+
+		off += rec->len;
+	}
+
+	/* the constant format once, and each content of the reused one */
+	if (strings != 1 + REUSED || lines != LINES + REUSED || off != len) {
+		pr_err("strings:%zu lines:%zu (expected %u,%u) off:%zu len:%zu\n",
+		       strings, lines, 1 + REUSED, LINES + REUSED, off, len);
+		err++;
+	} else {
+		pr_info("strings:%zu lines:%zu bytes:%zu\n", strings, lines, len);
+	}
+
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	struct sancus_logger_async_settings settings = {
+		.ring_size = 65536,
+		.policy = SANCUS_LOGGER_ASYNC_BLOCK,
+		.binary = true,
+	};
+	char path[] = "/tmp/test-logger-binary.XXXXXX";
+	char *buf;
+	ssize_t len;
+	int fd, err = 0;
+
+	err += test_parser();
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	unlink(path);
+
+	settings.fd = fd;
+	len = sancus_logger_set_async_backend(&settings);
+	if (len < 0) {
+		pr_err("sancus_logger_set_async_backend: %s\n", strerror((int)-len));
+		return 1;
+	}
+
+	for (unsigned i = 0; i < LINES; i++)
+		sancus_log_info(&logger, "line %u", i);
+
+	/* same address, different contents */
+	for (unsigned i = 0; i < REUSED; i++) {
+		char fmt[32];
+
+		snprintf(fmt, sizeof(fmt), "%%u reused %u", i);
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+		sancus_log_info(&logger, fmt, LINES + i);
+#pragma GCC diagnostic pop
+	}
+
+	sancus_logger_async_stop();
+
+	buf = malloc(1 << 20);
+	if (buf == NULL)
+		return 1;
+
+	len = pread(fd, buf, 1 << 20, 0);
+	if (len < 0) {
+		pr_err("pread: %s\n", strerror(errno));
+		err++;
+	} else {
+		err += test_stream(buf, (size_t)len);
+	}
+
+	free(buf);
+	sancus_close(fd);
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,130 @@
+#include <sancus/common.h>
+#include <sancus/logger.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static unsigned written;
+
+static int count_write(unsigned UNUSED(level),
+		       const char *UNUSED(prefix), size_t UNUSED(plen),
+		       const char *UNUSED(msg), size_t UNUSED(mlen),
+		       const char *UNUSED(data), size_t UNUSED(dlen),
+		       void *UNUSED(ctx))
+{
+	written++;
+	return 0;
+}
+
+static const struct sancus_logger_backend count_backend = {
+	.f = count_write,
+};
+
+static int test__level(const char *name, const struct sancus_logger *log,
+		       unsigned mask, int expected)
+{
+	int got = sancus_logger_has_level(log, mask);
+
+	if (got != expected) {
+		pr_err("%s: has_level(%#x) -> %d, expected %d\n", name, mask, got, expected);
+		return 1;
+	}
+	return 0;
+}
+
+static int test__prefix(const struct sancus_logger *log, const char *expected)
+{
+	char buf[32] = "";
+	ssize_t rc = sancus_logger_render_prefix(log, buf, sizeof(buf));
+
+	if (rc < 0 || strcmp(buf, expected) != 0) {
+		pr_err("render_prefix -> %zd \"%s\", expected \"%s\"\n", rc, buf, expected);
+		return 1;
+	}
+	return 0;
+}
+
+static DECL_SANCUS_LOGGER(decl, "decl", 0);
+
+/* read-only loggers are resolved every time, never cached */
+static const struct sancus_logger rodata = SANCUS__LOGGER_INIT("const", 0);
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	struct sancus_logger root, l1, l2, l3, other;
+	unsigned stamp;
+	int err = 0;
+
+	sancus_logger_init(&root, "root", SANCUS_LOG_NORMAL);
+	sancus_logger_init2(&l1, &root, NULL, 0, NULL);
+	sancus_logger_init2(&l2, &l1, NULL, 0, NULL);
+	sancus_logger_init2(&l3, &l2, NULL, 0, NULL);
+
+	err += test__level("l3", &l3, SANCUS_LOG_INFO, 1);
+	err += test__level("l3", &l3, SANCUS_LOG_DEBUG, 0);
+	err += test__prefix(&l3, "root");
+
+	/* changes of an ancestor are seen by cached descendants */
+	sancus_logger_extend_mask(&root, SANCUS_LOG_DEBUG);
+	err += test__level("l3", &l3, SANCUS_LOG_DEBUG, 1);
+
+	sancus_logger_set_mask(&l2, SANCUS_LOG_QUIET);
+	err += test__level("l3", &l3, SANCUS_LOG_INFO, 0);
+	err += test__level("l1", &l1, SANCUS_LOG_INFO, 1);
+
+	sancus_logger_set_mask(&l2, 0);
+	err += test__level("l3", &l3, SANCUS_LOG_INFO, 1);
+
+	sancus_logger_set_prefix(&l1, "l1");
+	err += test__prefix(&l3, "l1");
+	err += test__prefix(&root, "root");
+
+	sancus_logger_set_backend(&l2, &count_backend);
+	sancus_log_info(&l3, "via l2");
+	sancus_log_info(&l1, "via default");
+	if (written != 1) {
+		pr_err("backend: %u lines written, expected 1\n", written);
+		err++;
+	}
+
+	/* a hit doesn't look at the parents */
+	sancus_logger_init(&other, "other", SANCUS_LOG_QUIET);
+	err += test__level("l3", &l3, SANCUS_LOG_INFO, 1);
+	stamp = l3.cached.stamp;
+	l3.parent = &other;
+	err += test__level("l3", &l3, SANCUS_LOG_INFO, 1);
+	err += test__prefix(&l3, "l1");
+	if (stamp == 0 || l3.cached.stamp != stamp) {
+		pr_err("cache: stamp %u -> %u without changes\n", stamp, l3.cached.stamp);
+		err++;
+	}
+	sancus_logger_set_mask(&l3, 0);
+	err += test__level("l3", &l3, SANCUS_LOG_INFO, 0);
+	l3.parent = &l2;
+	sancus_logger_set_mask(&l3, 0);
+	err += test__level("l3", &l3, SANCUS_LOG_INFO, 1);
+
+	/* declared ones are cached too */
+	err += test__level("decl", &decl, SANCUS_LOG_INFO, 1);
+	if (decl.cached.stamp == 0) {
+		pr_err("decl: not cached\n");
+		err++;
+	}
+
+	err += test__level("rodata", &rodata, SANCUS_LOG_INFO, 1);
+	err += test__prefix(&rodata, "const");
+	sancus_logger_set_backend(&root, &count_backend);
+	sancus_log_info(&rodata, "from read-only memory");
+
+	if (err == 0)
+		pr_info("ok\n");
+
+	return err == 0 ? 0 : 1;
+}
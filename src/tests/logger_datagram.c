@@ -0,0 +1,227 @@
+#include <sancus/common.h>
+#include <sancus/clock.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <syslog.h>
+
+#include <sancus/socket.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	THREADS = 4,
+	LINES   = 2000,
+};
+
+static int fake_clock(void *UNUSED(data), struct timespec *ts)
+{
+	*ts = TIMESPEC_INIT(1700000000, 123456789);
+	return 0;
+}
+
+static struct sancus_clock fake = {
+	.f = fake_clock,
+};
+
+static DECL_SANCUS_LOGGER(logger, "dgram", 0);
+
+static char path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+/* local stand-in for journald or syslogd */
+static int receiver(void)
+{
+	struct sockaddr_un sa = { .sun_family = AF_UNIX };
+	struct timeval tv = { .tv_sec = 2 };
+	int fd = sancus_socket(AF_UNIX, SOCK_DGRAM, 0, 1, 0);
+
+	if (fd < 0)
+		return -1;
+
+	strcpy(sa.sun_path, path);
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 ||
+	    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		sancus_close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static ssize_t receive(int fd, char *buf, size_t size)
+{
+	ssize_t l = recv(fd, buf, size - 1, 0);
+
+	buf[l > 0 ? l : 0] = '\0';
+	return l;
+}
+
+static int test__eq(const char *what, const char *got, size_t len,
+		    const char *expected, size_t expected_len)
+{
+	if (len != expected_len || memcmp(got, expected, len) != 0) {
+		pr_err("%s:\n  got:      %.*s\n  expected: %.*s\n", what,
+		       (int)len, got, (int)expected_len, expected);
+		return 1;
+	}
+
+	pr_info("%s: ok\n", what);
+	return 0;
+}
+
+#define test__eqz(W, G, L, E) test__eq((W), (G), (L), (E), sizeof(E) - 1)
+
+static int test_journald(int fd)
+{
+	struct sancus_logger_datagram_settings settings = {
+		.format = SANCUS_LOGGER_JOURNALD,
+		.path = path,
+		.ident = "test",
+	};
+	char buf[2048];
+	ssize_t l;
+	int err = 0;
+
+	if (sancus_logger_set_datagram_backend(&settings) < 0)
+		return 1;
+
+	sancus_log_warn(&logger, "connection %d lost", 3);
+	l = receive(fd, buf, sizeof(buf));
+	err += test__eqz("journald", buf, (size_t)l,
+			 "PRIORITY=4\n"
+			 "SYSLOG_FACILITY=1\n"
+			 "SYSLOG_IDENTIFIER=test\n"
+			 "MESSAGE=dgram: connection 3 lost\n");
+
+	sancus_log_info_fields(&logger, SANCUS_LOG_FIELDS(
+			SANCUS_LOG_UINT("bytes", 1024),
+			SANCUS_LOG_STR("remote-peer", "a\nb")),
+		"multi\nline");
+	l = receive(fd, buf, sizeof(buf));
+	err += test__eqz("journald fields", buf, (size_t)l,
+			 "PRIORITY=6\n"
+			 "SYSLOG_FACILITY=1\n"
+			 "SYSLOG_IDENTIFIER=test\n"
+			 "MESSAGE\n\x11\0\0\0\0\0\0\0dgram: multi\nline\n"
+			 "BYTES=1024\n"
+			 "REMOTE_PEER\n\x03\0\0\0\0\0\0\0a\nb\n");
+
+	return err;
+}
+
+static int test_syslog(int fd)
+{
+	struct sancus_logger_datagram_settings settings = {
+		.format = SANCUS_LOGGER_SYSLOG,
+		.path = path,
+		.ident = "test",
+		.facility = LOG_DAEMON,
+	};
+	char host[256] = "", buf[2048], expected[2048];
+	ssize_t l;
+	int n, err = 0;
+
+	if (sancus_logger_set_datagram_backend(&settings) < 0)
+		return 1;
+
+	gethostname(host, sizeof(host) - 1);
+
+	sancus_log_error(&logger, "failed");
+	l = receive(fd, buf, sizeof(buf));
+	n = snprintf(expected, sizeof(expected),
+		     "<27>1 2023-11-14T22:13:20.123456Z %s test %ld - - dgram: failed",
+		     host[0] ? host : "-", (long)getpid());
+	err += test__eq("syslog", buf, (size_t)l, expected, (size_t)n);
+
+	sancus_log_info_fields(&logger, SANCUS_LOG_FIELDS(
+			SANCUS_LOG_INT("fd", -1),
+			SANCUS_LOG_STR("path", "/a \"b\" ]")),
+		"opened");
+	l = receive(fd, buf, sizeof(buf));
+	n = snprintf(expected, sizeof(expected),
+		     "<30>1 2023-11-14T22:13:20.123456Z %s test %ld - "
+		     "[fields@32473 fd=\"-1\" path=\"/a \\\"b\\\" \\]\"] dgram: opened",
+		     host[0] ? host : "-", (long)getpid());
+	err += test__eq("syslog fields", buf, (size_t)l, expected, (size_t)n);
+
+	return err;
+}
+
+static void *writer(void *arg)
+{
+	unsigned id = (unsigned)(uintptr_t)arg;
+
+	for (unsigned i = 0; i < LINES; i++)
+		sancus_log_info(&logger, "thread %u line %u", id, i);
+
+	return NULL;
+}
+
+static int test_threads(int fd)
+{
+	pthread_t threads[THREADS];
+	char buf[2048];
+	unsigned count = 0;
+
+	for (unsigned i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, writer, (void *)(uintptr_t)i);
+
+	/* blocking datagrams, someone has to read while they write */
+	while (count < THREADS * LINES && receive(fd, buf, sizeof(buf)) > 0)
+		count++;
+
+	for (unsigned i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	sancus_logger_flush(&logger);
+
+	if (count != THREADS * LINES) {
+		pr_err("threads: %u datagrams, expected %u\n", count, THREADS * LINES);
+		return 1;
+	}
+
+	pr_info("threads: %u datagrams\n", count);
+	return 0;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	char dir[] = "/tmp/test-logger-datagram.XXXXXX";
+	int fd, err = 0;
+
+	if (mkdtemp(dir) == NULL)
+		return 1;
+	snprintf(path, sizeof(path), "%s/socket", dir);
+
+	fd = receiver();
+	if (fd < 0) {
+		pr_err("%s: %s\n", path, strerror(errno));
+		rmdir(dir);
+		return 1;
+	}
+
+	sancus_set_now_clock(&fake);
+
+	err += test_journald(fd);
+	err += test_syslog(fd);
+	err += test_threads(fd);
+
+	sancus_set_now_clock(NULL);
+	sancus_logger_set_default_backend(NULL);
+
+	sancus_close(fd);
+	unlink(path);
+	rmdir(dir);
+
+	return err == 0 ? 0 : 1;
+}
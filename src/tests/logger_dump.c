@@ -0,0 +1,167 @@
+#include <sancus/common.h>
+#include <sancus/logger.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static char output[8192];
+static size_t output_len;
+
+static int capture_write(unsigned UNUSED(level),
+			 const char *UNUSED(prefix), size_t UNUSED(plen),
+			 const char *UNUSED(msg), size_t UNUSED(mlen),
+			 const char *data, size_t dlen,
+			 void *UNUSED(ctx))
+{
+	if (output_len + dlen + 1 < sizeof(output)) {
+		memcpy(output + output_len, data, dlen);
+		output_len += dlen;
+		output[output_len++] = '\n';
+		output[output_len] = '\0';
+	}
+	return 0;
+}
+
+static const struct sancus_logger_backend capture_backend = {
+	.f = capture_write,
+};
+
+static DECL_SANCUS_LOGGER(logger, TEST_NAME, SANCUS_LOG_VERBOSE);
+
+/* what `hexdump -C` rows look like, one byte at a time */
+static size_t ref_hexdump(char *out, size_t size,
+			  const unsigned char *p, size_t len, size_t width)
+{
+	size_t l = 0;
+
+	for (size_t off = 0; off < len; off += width) {
+		size_t n = len - off < width ? len - off : width;
+
+		l += (size_t)snprintf(out + l, size - l, "%08zx ", off);
+		for (size_t i = 0; i < width; i++) {
+			if (i < n)
+				l += (size_t)snprintf(out + l, size - l, " %02x", p[off + i]);
+			else
+				l += (size_t)snprintf(out + l, size - l, "   ");
+		}
+
+		l += (size_t)snprintf(out + l, size - l, " |");
+		for (size_t i = 0; i < n; i++) {
+			unsigned char c = p[off + i];
+			out[l++] = (c < 0x20 || c > 0x7e) ? '.' : (char)c;
+		}
+		l += (size_t)snprintf(out + l, size - l, "|\n");
+	}
+
+	return l;
+}
+
+static int test_hexdump(void)
+{
+	static const struct {
+		const char *data;
+		size_t len;
+		const char *expected;
+	} width0[] = {
+		{ "A", 1, " 41 |A|\n" },
+		{ "\x01" "A" "\x03", 3, " 01 41 03 |.A.|\n" },
+		{ "hello, world\n", 13,
+		  " 68 65 6c 6c 6f 2c 20 77 6f 72 6c 64 0a |hello, world.|\n" },
+	};
+	unsigned char data[200];
+	char expected[8192];
+	int err = 0;
+
+	for (size_t i = 0; i < sizeof(data); i++)
+		data[i] = (unsigned char)(i * 7 + (i >> 3));
+
+	for (size_t width = 1; width <= 32; width++) {
+		size_t lens[] = { 0, 1, width - 1, width, width + 1, sizeof(data) };
+
+		for (unsigned j = 0; j < ARRAY_SIZE(lens); j++) {
+			size_t l = ref_hexdump(expected, sizeof(expected),
+					       data, lens[j], width);
+
+			output_len = 0;
+			sancus_log_info_hexdump(&logger, width, data, lens[j], "hexdump");
+
+			if (lens[j] > 0 &&
+			    (output_len != l || memcmp(output, expected, l) != 0)) {
+				pr_err("width:%zu len:%zu:\n%.*sexpected:\n%s",
+				       width, lens[j], (int)output_len, output, expected);
+				err++;
+			}
+		}
+	}
+
+	/* without width, rows have no offset and no padding */
+	for (unsigned j = 0; j < ARRAY_SIZE(width0); j++) {
+		size_t l = strlen(width0[j].expected);
+
+		output_len = 0;
+		sancus_log_info_hexdump(&logger, 0, width0[j].data, width0[j].len, "hexdump");
+
+		if (output_len != l || memcmp(output, width0[j].expected, l) != 0) {
+			pr_err("width:0 len:%zu:\n%.*sexpected:\n%s",
+			       width0[j].len, (int)output_len, output, width0[j].expected);
+			err++;
+		}
+	}
+
+	if (err == 0)
+		pr_info("hexdump: ok\n");
+	return err;
+}
+
+static int test_dump(void)
+{
+	static const struct {
+		const char *data;
+		size_t len;
+		const char *expected;
+	} cases[] = {
+		{ "hello world", 11, "\"hello world\" (11)" },
+		{ "a \"quoted\" \\path\\", 17, "\"a \\\"quoted\\\" \\\\path\\\\\" (17)" },
+		{ "tab\there\r\n", 10, "\"tab\\there\\r\\n\" (10)" },
+		{ "0123456789abcdef\x7f\x80\xff", 19, "\"0123456789abcdef\\x7f\\x80\\xff\" (19)" },
+		{ "\0\x01 end of a long printable tail", 31,
+		  "\"\\x00\\x01 end of a long printable tail\" (31)" },
+	};
+	int err = 0;
+
+	for (unsigned i = 0; i < ARRAY_SIZE(cases); i++) {
+		size_t l = strlen(cases[i].expected);
+
+		output_len = 0;
+		sancus_log_info_dump(&logger, cases[i].data, cases[i].len, "dump");
+
+		if (output_len != l + 1 || memcmp(output, cases[i].expected, l) != 0) {
+			pr_err("dump: %.*s, expected: %s\n",
+			       (int)output_len, output, cases[i].expected);
+			err++;
+		}
+	}
+
+	if (err == 0)
+		pr_info("dump: ok\n");
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	int err = 0;
+
+	sancus_logger_set_backend(&logger, &capture_backend);
+
+	err += test_hexdump();
+	err += test_dump();
+
+	return err == 0 ? 0 : 1;
+}
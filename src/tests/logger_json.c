@@ -0,0 +1,130 @@
+#include <sancus/common.h>
+#include <sancus/clock.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static char output[1024];
+
+static int capture_write(unsigned UNUSED(level),
+			 const char *UNUSED(prefix), size_t UNUSED(plen),
+			 const char *UNUSED(msg), size_t UNUSED(mlen),
+			 const char *data, size_t dlen,
+			 void *UNUSED(ctx))
+{
+	snprintf(output, sizeof(output), "%.*s", (int)dlen, data);
+	return 0;
+}
+
+static const struct sancus_logger_backend capture_backend = {
+	.f = capture_write,
+};
+
+static int fake_clock(void *UNUSED(data), struct timespec *ts)
+{
+	*ts = TIMESPEC_INIT(1700000000, 123456789);
+	return 0;
+}
+
+static struct sancus_clock fake = {
+	.f = fake_clock,
+};
+
+static DECL_SANCUS_LOGGER(logger, "json", 0);
+
+static int test__eq(const char *what, const char *got, const char *expected)
+{
+	if (strcmp(got, expected) != 0) {
+		pr_err("%s:\n  got:      %s\n  expected: %s\n", what, got, expected);
+		return 1;
+	}
+
+	pr_info("%s: %s\n", what, got);
+	return 0;
+}
+
+static int test_text(void)
+{
+	struct sancus_logger text;
+	int err = 0;
+
+	sancus_logger_init2(&text, &logger, NULL, 0, NULL);
+	sancus_logger_set_backend(&text, &capture_backend);
+
+	sancus_log_info_fields(&text, SANCUS_LOG_FIELDS(
+			SANCUS_LOG_INT("fd", -3),
+			SANCUS_LOG_STR("peer", "10.0.0.1:80"),
+			SANCUS_LOG_STR("reason", "connection reset"),
+			SANCUS_LOG_DURATION("elapsed", TIMESPEC_INIT(1, 500000000))),
+		"closed");
+
+	err += test__eq("text", output,
+			"fd=-3 peer=10.0.0.1:80 reason=\"connection reset\" elapsed=1.500s");
+	return err;
+}
+
+static int test_json(void)
+{
+	char buf[1024];
+	ssize_t l;
+	int fd[2];
+	int err = 0;
+
+	if (pipe(fd) < 0)
+		return 1;
+
+	sancus_logger_set_json_backend(fd[1]);
+
+	sancus_log_info_fields(&logger, SANCUS_LOG_FIELDS(
+			SANCUS_LOG_UINT("bytes", 1024),
+			SANCUS_LOG_STR("path", "/a \"b\"\n\x01"),
+			SANCUS_LOG_STR("none", NULL),
+			SANCUS_LOG_DURATION("rtt", TIMESPEC_INIT(0, 2500000))),
+		"request %d", 7);
+	sancus_log_warn(&logger, "plain\tmessage");
+	sancus_log_info_fields(&logger, SANCUS_LOG_FIELDS(
+			SANCUS_LOG_DURATION("skew", TIMESPEC_INIT(-2, 500000000)),
+			SANCUS_LOG_STR("bad", "\xc3\xa9 \xff \xe2\x82")),
+		"caf\xc3\xa9 \xc0\xaf");
+
+	sancus_logger_set_default_backend(NULL);
+	sancus_close(fd[1]);
+
+	l = sancus_read(fd[0], buf, sizeof(buf) - 1);
+	sancus_close(fd[0]);
+	buf[l > 0 ? l : 0] = '\0';
+
+	err += test__eq("json", buf,
+			"{\"ts\":1700000000.123456,\"level\":\"info\",\"prefix\":\"json\","
+			"\"msg\":\"request 7\",\"bytes\":1024,"
+			"\"path\":\"/a \\\"b\\\"\\n\\u0001\",\"none\":null,"
+			"\"rtt\":0.002500000}\n"
+			"{\"ts\":1700000000.123456,\"level\":\"warn\",\"prefix\":\"json\","
+			"\"msg\":\"plain\\tmessage\"}\n"
+			"{\"ts\":1700000000.123456,\"level\":\"info\",\"prefix\":\"json\","
+			"\"msg\":\"caf\xc3\xa9 \\ufffd\\ufffd\",\"skew\":-1.500000000,"
+			"\"bad\":\"\xc3\xa9 \\ufffd \\ufffd\\ufffd\"}\n");
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	int err = 0;
+
+	sancus_set_now_clock(&fake);
+
+	err += test_text();
+	err += test_json();
+
+	sancus_set_now_clock(NULL);
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+#include <sancus/common.h>
+#include <sancus/logger.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static unsigned written;
+
+static int count_write(unsigned UNUSED(level),
+		       const char *UNUSED(prefix), size_t UNUSED(plen),
+		       const char *UNUSED(msg), size_t UNUSED(mlen),
+		       const char *UNUSED(data), size_t UNUSED(dlen),
+		       void *UNUSED(ctx))
+{
+	written++;
+	return 0;
+}
+
+static const struct sancus_logger_backend count_backend = {
+	.f = count_write,
+};
+
+static DECL_SANCUS_LOGGER(logger, TEST_NAME, SANCUS_LOG_VERBOSE | SANCUS_LOG_TRACE);
+
+/*
+ * SANCUS_LOG_MIN_LEVEL is read where the macros are expanded, so each
+ * floor of the matrix gets its own function.
+ */
+#define TEST_LOG_SITES(N) \
+static unsigned test_sites_ ##N(void) \
+{ \
+	unsigned evaluated = 0; \
+	\
+	sancus_log_error(&logger, "%u", evaluated++); \
+	sancus_log_warn(&logger, "%u", evaluated++); \
+	sancus_log_info(&logger, "%u", evaluated++); \
+	sancus_log_trace(&logger, "%u", evaluated++); \
+	sancus_log_debug(&logger, "%u", evaluated++); \
+	\
+	sancus_log_warn_dump(&logger, "x", evaluated++ * 0, "%s", "dump"); \
+	sancus_log_info_hexdump(&logger, 8, "x", evaluated++ * 0, "%s", "hexdump"); \
+	sancus_log_trace_dump(&logger, "x", evaluated++ * 0, "%s", "dump"); \
+	sancus_log_debug_hexdump(&logger, 8, "x", evaluated++ * 0, "%s", "hexdump"); \
+	\
+	return evaluated; \
+}
+
+#undef SANCUS_LOG_MIN_LEVEL
+#define SANCUS_LOG_MIN_LEVEL SANCUS_LOG_ERROR_BIT
+TEST_LOG_SITES(error)
+
+#undef SANCUS_LOG_MIN_LEVEL
+#define SANCUS_LOG_MIN_LEVEL SANCUS_LOG_WARN_BIT
+TEST_LOG_SITES(warn)
+
+#undef SANCUS_LOG_MIN_LEVEL
+#define SANCUS_LOG_MIN_LEVEL SANCUS_LOG_INFO_BIT
+TEST_LOG_SITES(info)
+
+#undef SANCUS_LOG_MIN_LEVEL
+#define SANCUS_LOG_MIN_LEVEL SANCUS_LOG_TRACE_BIT
+TEST_LOG_SITES(trace)
+
+#undef SANCUS_LOG_MIN_LEVEL
+#define SANCUS_LOG_MIN_LEVEL SANCUS_LOG_DEBUG_BIT
+TEST_LOG_SITES(debug)
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	static const struct {
+		const char *name;
+		unsigned (*f)(void);
+		unsigned expected;
+	} matrix[] = {
+		{ "error", test_sites_error, 1 },
+		{ "warn",  test_sites_warn,  3 },
+		{ "info",  test_sites_info,  5 },
+		{ "trace", test_sites_trace, 7 },
+		{ "debug", test_sites_debug, 9 },
+	};
+	int err = 0;
+
+	sancus_logger_set_backend(&logger, &count_backend);
+
+	for (unsigned i = 0; i < ARRAY_SIZE(matrix); i++) {
+		unsigned evaluated;
+
+		written = 0;
+		evaluated = matrix[i].f();
+
+		if (evaluated != matrix[i].expected || written != evaluated) {
+			pr_err("%s: evaluated:%u written:%u expected:%u\n",
+			       matrix[i].name, evaluated, written, matrix[i].expected);
+			err++;
+		} else {
+			pr_info("%s: %u sites built\n", matrix[i].name, evaluated);
+		}
+	}
+
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,138 @@
+#include <sancus/common.h>
+#include <sancus/clock.h>
+#include <sancus/fd.h>
+#include <sancus/logger.h>
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	THREADS = 4,
+	LINES   = 5000,
+};
+
+/* advances 1ms on every reading */
+static long ticks;
+
+static int fake_clock(void *UNUSED(data), struct timespec *ts)
+{
+	long ms = 1000000 + __atomic_fetch_add(&ticks, 1, __ATOMIC_RELAXED);
+
+	*ts = TIMESPEC_INIT(ms / 1000, MS_TO_NS(ms % 1000));
+	return 0;
+}
+
+static struct sancus_clock fake = {
+	.f = fake_clock,
+};
+
+static DECL_SANCUS_LOGGER(logger, "prelude", 0);
+
+static int test_sequence(int fd)
+{
+	static const char expected[] =
+		"[0.000 +0.000] I/prelude: one\n"
+		"[0.001 +0.001] I/prelude: two\n"
+		"[123.458 +123.457] W/prelude: three\n";
+	char buf[256];
+	ssize_t l;
+
+	sancus_log_info(&logger, "one");
+	sancus_log_info(&logger, "two");
+	__atomic_add_fetch(&ticks, 123456, __ATOMIC_RELAXED);
+	sancus_log_warn(&logger, "three");
+
+	l = pread(fd, buf, sizeof(buf) - 1, 0);
+	buf[l > 0 ? l : 0] = '\0';
+
+	if (strcmp(buf, expected) != 0) {
+		pr_err("sequence:\n%sexpected:\n%s", buf, expected);
+		return 1;
+	}
+
+	pr_info("sequence: ok\n");
+	return 0;
+}
+
+static void *writer(void *UNUSED(arg))
+{
+	for (unsigned i = 0; i < LINES; i++)
+		sancus_log_info(&logger, "line %u", i);
+	return NULL;
+}
+
+static int test_threads(int fd)
+{
+	pthread_t threads[THREADS];
+	unsigned long e0 = 0, e1 = 0, d0, d1;
+	unsigned lines = 0;
+	char line[256];
+	FILE *f;
+	int err = 0;
+
+	if (ftruncate(fd, 0) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+		return 1;
+
+	for (unsigned i = 0; i < THREADS; i++)
+		pthread_create(&threads[i], NULL, writer, NULL);
+	for (unsigned i = 0; i < THREADS; i++)
+		pthread_join(threads[i], NULL);
+
+	f = fdopen(dup(fd), "r");
+	if (f == NULL)
+		return 1;
+	rewind(f);
+
+	/* whole lines, and no delta beyond the elapsed time */
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "[%lu.%lu +%lu.%lu] I/prelude: line", &e0, &e1, &d0, &d1) != 4 ||
+		    d0 * 1000 + d1 > e0 * 1000 + e1) {
+			pr_err("threads: bad line: %s", line);
+			err++;
+			break;
+		}
+		lines++;
+	}
+	fclose(f);
+
+	if (err == 0 && lines != THREADS * LINES) {
+		pr_err("threads: %u lines, expected %u\n", lines, THREADS * LINES);
+		err++;
+	} else if (err == 0) {
+		pr_info("threads: lines:%u elapsed:%lu.%03lu\n", lines, e0, e1);
+	}
+
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	char path[] = "/tmp/test-logger-prelude.XXXXXX";
+	int fd, err = 0;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	unlink(path);
+
+	sancus_set_now_clock(&fake);
+	sancus_logger_set_fd_backend(fd);
+
+	err += test_sequence(fd);
+	err += test_threads(fd);
+
+	sancus_logger_set_fd_backend(STDERR_FILENO);
+	sancus_set_now_clock(NULL);
+	sancus_close(fd);
+
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+#include <sancus/common.h>
+#include <sancus/clock.h>
+#include <sancus/logger.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static unsigned written, suppressed;
+
+static int count_write(unsigned UNUSED(level),
+		       const char *UNUSED(prefix), size_t UNUSED(plen),
+		       const char *msg, size_t mlen,
+		       const char *UNUSED(data), size_t UNUSED(dlen),
+		       void *UNUSED(ctx))
+{
+	unsigned n;
+
+	if (mlen > 0 && sscanf(msg, "%u messages suppressed", &n) == 1)
+		suppressed += n;
+	else
+		written++;
+	return 0;
+}
+
+static const struct sancus_logger_backend count_backend = {
+	.f = count_write,
+};
+
+static struct timespec now;
+
+static int fake_clock(void *UNUSED(data), struct timespec *ts)
+{
+	*ts = now;
+	return 0;
+}
+
+static struct sancus_clock fake = {
+	.f = fake_clock,
+};
+
+static DECL_SANCUS_LOGGER(logger, TEST_NAME, SANCUS_LOG_VERBOSE | SANCUS_LOG_TRACE);
+
+static void warn_burst(unsigned count)
+{
+	for (unsigned i = 0; i < count; i++)
+		sancus_log_warn_ratelimited(&logger, 1000, 3, "message %u", i);
+}
+
+static int test__eq(const char *what, unsigned w, unsigned s)
+{
+	if (written != w || suppressed != s) {
+		pr_err("%s: written:%u suppressed:%u, expected %u,%u\n",
+		       what, written, suppressed, w, s);
+		return 1;
+	}
+
+	pr_info("%s: written:%u suppressed:%u\n", what, written, suppressed);
+	return 0;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	int err = 0;
+
+	sancus_set_now_clock(&fake);
+	sancus_logger_set_backend(&logger, &count_backend);
+
+	now = TIMESPEC_INIT(1000, 0);
+
+	/* burst of 3, the rest suppressed */
+	warn_burst(10);
+	err += test__eq("burst", 3, 0);
+
+	/* a third of the window gives one token back */
+	now.tv_nsec = MS_TO_NS(334);
+	warn_burst(10);
+	err += test__eq("refill", 4, 7);
+
+	/* a whole window later the bucket is full again */
+	now.tv_sec += 2;
+	warn_burst(3);
+	err += test__eq("reopen", 7, 16);
+
+	/* 1 in 4 */
+	written = suppressed = 0;
+	for (unsigned i = 0; i < 100; i++)
+		sancus_log_trace_sampled(&logger, 4, "sample %u", i);
+	err += test__eq("sampled", 25, 0);
+
+	sancus_set_now_clock(NULL);
+	return err == 0 ? 0 : 1;
+}
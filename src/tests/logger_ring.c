@@ -0,0 +1,163 @@
+#include <sancus/common.h>
+#include <sancus/logger.h>
+#include <sancus/logger_ring.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	RING_SIZE = 16384,
+	LINES     = 2000,
+};
+
+static DECL_SANCUS_LOGGER(logger, "ring", 0);
+
+/* logs more than fits, and dies */
+static void child(const char *path)
+{
+	struct sancus_logger_ring_settings settings = {
+		.path = path,
+		.size = RING_SIZE,
+	};
+	struct rlimit nocore = { 0, 0 };
+
+	setrlimit(RLIMIT_CORE, &nocore);
+
+	if (sancus_logger_set_ring_backend(&settings) < 0)
+		_exit(1);
+
+	for (unsigned i = 0; i < LINES; i++)
+		sancus_log_info(&logger, "line %u", i);
+
+	sancus_assert(&logger, LINES == 0);
+	_exit(0);
+}
+
+static int check(const void *map, size_t map_len, unsigned *first, unsigned *count)
+{
+	struct sancus_logger_ring_reader r;
+	struct sancus_logger_ring_record rec;
+	char text[256];
+	unsigned n = 0, expected = 0;
+	bool asserted = false;
+	int rc;
+
+	if (sancus_logger_ring_reader_init(&r, map, map_len) < 0) {
+		pr_err("invalid ring header\n");
+		return 1;
+	}
+
+	while ((rc = sancus_logger_ring_reader_next(&r, &rec, text, sizeof(text) - 1)) >= 0) {
+		unsigned i;
+
+		text[rc] = '\0';
+
+		if (sscanf(text, "ring: line %u", &i) == 1) {
+			if (n > 0 && i != expected) {
+				pr_err("line %u after %u\n", i, expected - 1);
+				return 1;
+			} else if (n == 0) {
+				*first = i;
+			}
+			expected = i + 1;
+			n++;
+		} else if (strstr(text, "assertion") != NULL && !asserted) {
+			asserted = true;
+		} else {
+			pr_err("unexpected: %s\n", text);
+			return 1;
+		}
+	}
+
+	*count = n;
+	if (!asserted || expected != LINES) {
+		pr_err("asserted:%d last:%u\n", asserted, expected);
+		return 1;
+	}
+	return 0;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	char path[] = "/tmp/test-logger-ring.XXXXXX";
+	unsigned first = 0, count = 0, first2 = 0, count2 = 0;
+	struct stat st;
+	int fd, status, err = 0;
+	char *map;
+	pid_t pid;
+
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+
+	pid = fork();
+	if (pid == 0)
+		child(path);
+
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 ||
+	    !WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT) {
+		pr_err("child didn't abort\n");
+		err++;
+		goto done;
+	}
+
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size != SANCUS_LOGGER_RING_HEADER_SIZE + RING_SIZE) {
+		pr_err("unexpected ring file size\n");
+		err++;
+		goto done;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		err++;
+		goto done;
+	}
+
+	err += check(map, (size_t)st.st_size, &first, &count);
+	if (err == 0 && first == 0) {
+		pr_err("ring didn't wrap\n");
+		err++;
+	}
+	pr_info("crash: lines %u..%u survived\n", first, first + count - 1);
+
+	/* a torn record is skipped, and everything after it survives */
+	if (err == 0) {
+		struct sancus_logger_ring_reader r;
+		struct sancus_logger_ring_record rec;
+		char text[256];
+		uint64_t *sealp;
+
+		sancus_logger_ring_reader_init(&r, map, (size_t)st.st_size);
+		sancus_logger_ring_reader_next(&r, &rec, text, sizeof(text));
+
+		sealp = (uint64_t *)(map + SANCUS_LOGGER_RING_HEADER_SIZE + (rec.pos & (RING_SIZE - 1)));
+		*sealp = 0;
+
+		err += check(map, (size_t)st.st_size, &first2, &count2);
+		if (err == 0 && (first2 != first + 1 || count2 != count - 1)) {
+			pr_err("torn: lines %u..%u\n", first2, first2 + count2 - 1);
+			err++;
+		}
+		pr_info("torn: lines %u..%u survived\n", first2, first2 + count2 - 1);
+	}
+
+	munmap(map, (size_t)st.st_size);
+done:
+	close(fd);
+	unlink(path);
+	return err == 0 ? 0 : 1;
+}
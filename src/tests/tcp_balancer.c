@@ -0,0 +1,376 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <sancus/buffer.h>
+#include <sancus/list.h>
+#include <sancus/socket.h>
+#include <sancus/tcp_conn.h>
+#include <sancus/tcp_balancer.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static unsigned connected, errors;
+
+static void on_read(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_connect(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+	connected++;
+}
+
+static void on_error(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_conn_error UNUSED(err))
+{
+	errors++;
+}
+
+static const struct sancus_tcp_conn_settings conn_settings = {
+	.on_read = on_read,
+	.on_connect = on_connect,
+	.on_error = on_error,
+};
+
+static struct sockaddr_in upstream;
+static int lfd;
+
+static int listen_loopback(void)
+{
+	socklen_t len = sizeof(upstream);
+
+	upstream = (struct sockaddr_in) { .sin_family = AF_INET };
+	upstream.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	lfd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 1);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *)&upstream, sizeof(upstream)) < 0 ||
+	    listen(lfd, 64) < 0 || getsockname(lfd, (struct sockaddr *)&upstream, &len) < 0)
+		return -1;
+	return 0;
+}
+
+static int add_peers(struct sancus_tcp_balancer *b, struct sancus_ev_loop *loop,
+		     const unsigned *weights, unsigned count)
+{
+	for (unsigned i = 0; i < count; i++) {
+		if (sancus_tcp_balancer_add(b, (struct sockaddr *)&upstream, sizeof(upstream),
+					    weights[i]) == NULL) {
+			pr_err("add: %s\n", strerror(errno));
+			return -1;
+		}
+	}
+
+	sancus_tcp_balancer_start(b, loop);
+	return 0;
+}
+
+static void drop_peers(struct sancus_tcp_balancer *b, struct sancus_ev_loop *loop)
+{
+	int fd;
+
+	sancus_tcp_balancer_stop(b, loop);
+	sancus_tcp_balancer_close(b);
+
+	while ((fd = sancus_accept(lfd, NULL, NULL)) >= 0)
+		sancus_close(fd);
+}
+
+static inline unsigned index_of(struct sancus_tcp_balancer *b,
+				struct sancus_tcp_balancer_peer *p)
+{
+	return p == NULL ? ~0U : (unsigned)(p - b->peers);
+}
+
+static int test_least(void)
+{
+	static const struct sancus_tcp_balancer_settings settings = {
+		.conn = &conn_settings,
+		.policy = SANCUS_TCP_BALANCER_LEAST_OUTSTANDING,
+	};
+	static const unsigned weights[] = { 1, 1, 1 };
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	static struct sancus_tcp_balancer b;
+	struct sancus_tcp_balancer_peer *p;
+	int err = 0;
+
+	sancus_tcp_balancer_init(&b, &settings);
+	if (add_peers(&b, &loop, weights, ARRAY_SIZE(weights)) < 0)
+		return 1;
+
+	/* ties taken in turn */
+	for (unsigned i = 0; i < 6; i++) {
+		p = sancus_tcp_balancer_pick(&b);
+		if (index_of(&b, p) != i % 3) {
+			pr_err("least: pick %u went to %u\n", i, index_of(&b, p));
+			err++;
+		}
+	}
+
+	/* the one that answers first gets the next */
+	sancus_tcp_balancer_done(&b, &b.peers[1]);
+	p = sancus_tcp_balancer_pick(&b);
+	if (p != &b.peers[1]) {
+		pr_err("least: picked %u after peer 1 finished\n", index_of(&b, p));
+		err++;
+	}
+
+	sancus_tcp_balancer_done(&b, &b.peers[2]);
+	sancus_tcp_balancer_done(&b, &b.peers[2]);
+	for (unsigned i = 0; i < 2; i++) {
+		p = sancus_tcp_balancer_pick(&b);
+		if (p != &b.peers[2]) {
+			pr_err("least: picked %u with peer 2 idle\n", index_of(&b, p));
+			err++;
+		}
+	}
+
+	drop_peers(&b, &loop);
+
+	if (err == 0)
+		pr_info("least: ok\n");
+	return err;
+}
+
+static int test_two(void)
+{
+	static const struct sancus_tcp_balancer_settings settings = {
+		.conn = &conn_settings,
+		.policy = SANCUS_TCP_BALANCER_POWER_OF_TWO,
+	};
+	static const unsigned weights[] = { 1, 1 };
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	static struct sancus_tcp_balancer b;
+	int err = 0;
+	long d;
+
+	sancus_tcp_balancer_init(&b, &settings);
+	if (add_peers(&b, &loop, weights, ARRAY_SIZE(weights)) < 0)
+		return 1;
+
+	/* with two peers both are always compared */
+	for (unsigned i = 0; i < 101; i++) {
+		if (sancus_tcp_balancer_pick(&b) == NULL)
+			err++;
+	}
+
+	d = (long)b.peers[0].outstanding - (long)b.peers[1].outstanding;
+	if (err || d < -1 || d > 1) {
+		pr_err("two: outstanding %u/%u\n", b.peers[0].outstanding, b.peers[1].outstanding);
+		err++;
+	}
+
+	drop_peers(&b, &loop);
+
+	if (err == 0)
+		pr_info("two: %u/%u\n", b.peers[0].outstanding, b.peers[1].outstanding);
+	return err;
+}
+
+static int test_round_robin(void)
+{
+	static const struct sancus_tcp_balancer_settings settings = {
+		.conn = &conn_settings,
+		.policy = SANCUS_TCP_BALANCER_ROUND_ROBIN,
+	};
+	static const unsigned weights[] = { 1, 2, 3 };
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	static struct sancus_tcp_balancer b;
+	unsigned last = ~0U;
+	int err = 0;
+
+	sancus_tcp_balancer_init(&b, &settings);
+	if (add_peers(&b, &loop, weights, ARRAY_SIZE(weights)) < 0)
+		return 1;
+
+	for (unsigned i = 0; i < 60; i++) {
+		struct sancus_tcp_balancer_peer *p = sancus_tcp_balancer_pick(&b);
+		unsigned k = index_of(&b, p);
+
+		/* spread, not in bursts */
+		if (i % 6 != 0 && k == last) {
+			pr_err("round-robin: %u picked twice in a row\n", k);
+			err++;
+		}
+		last = k;
+
+		if (p != NULL)
+			sancus_tcp_balancer_done(&b, p);
+	}
+
+	for (unsigned i = 0; i < ARRAY_SIZE(weights); i++) {
+		if (b.peers[i].picked != 10 * weights[i]) {
+			pr_err("round-robin: peer %u picked %lu times\n", i, b.peers[i].picked);
+			err++;
+		}
+	}
+
+	drop_peers(&b, &loop);
+
+	if (err == 0)
+		pr_info("round-robin: ok\n");
+	return err;
+}
+
+/* ejected peers leave the schedule, picks don't skip over them */
+static int test_round_robin_eject(void)
+{
+	static const struct sancus_tcp_balancer_settings settings = {
+		.conn = &conn_settings,
+		.policy = SANCUS_TCP_BALANCER_ROUND_ROBIN,
+		.reconnect = {
+			.initial_delay = TIMESPEC_INIT_MS(0, 100),
+		},
+	};
+	static const unsigned weights[] = { 100, 1, 2 };
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	static struct sancus_tcp_balancer b;
+	struct sancus_tcp_balancer_peer *p, *heavy = &b.peers[0];
+	int err = 0;
+
+	sancus_tcp_balancer_init(&b, &settings);
+	if (add_peers(&b, &loop, weights, ARRAY_SIZE(weights)) < 0)
+		return 1;
+
+	sancus_tcp_balancer_eject(&b, &loop, heavy);
+	if (b.schedule_len != weights[1] + weights[2]) {
+		pr_err("round-robin eject: %u entries scheduled\n", b.schedule_len);
+		err++;
+	}
+
+	for (unsigned i = 0; i < 30; i++) {
+		p = sancus_tcp_balancer_pick(&b);
+		if (p == NULL || p == heavy) {
+			pr_err("round-robin eject: picked %u\n", index_of(&b, p));
+			err++;
+		} else {
+			sancus_tcp_balancer_done(&b, p);
+		}
+	}
+
+	for (unsigned i = 1; i < ARRAY_SIZE(weights); i++) {
+		if (b.peers[i].picked != 10 * weights[i]) {
+			pr_err("round-robin eject: peer %u picked %lu times\n", i, b.peers[i].picked);
+			err++;
+		}
+	}
+
+	/* and rejoin it once reconnected */
+	loop.now = heavy->conn.timer.at;
+	heavy->conn.timer.cb(&loop, &heavy->conn.timer, 0);
+	heavy->conn.io.cb(&loop, &heavy->conn.io, SANCUS_EV_WRITE);
+
+	p = sancus_tcp_balancer_pick(&b);
+	if (heavy->ejected || p != heavy ||
+	    b.schedule_len != weights[0] + weights[1] + weights[2]) {
+		pr_err("round-robin eject: ejected:%d picked:%u entries:%u\n",
+		       heavy->ejected, index_of(&b, p), b.schedule_len);
+		err++;
+	}
+
+	drop_peers(&b, &loop);
+
+	if (err == 0)
+		pr_info("round-robin eject: ok\n");
+	return err;
+}
+
+static int test_eject(void)
+{
+	static const struct sancus_tcp_balancer_settings settings = {
+		.conn = &conn_settings,
+		.policy = SANCUS_TCP_BALANCER_LEAST_OUTSTANDING,
+		.reconnect = {
+			.initial_delay = TIMESPEC_INIT_MS(0, 100),
+		},
+	};
+	static const unsigned weights[] = { 1, 1, 1 };
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	static struct sancus_tcp_balancer b;
+	struct sancus_tcp_balancer_peer *p, *sick = &b.peers[1];
+	int err = 0;
+
+	sancus_tcp_balancer_init(&b, &settings);
+	if (add_peers(&b, &loop, weights, ARRAY_SIZE(weights)) < 0)
+		return 1;
+
+	errors = connected = 0;
+	errno = EBADF;
+	sick->conn.settings->on_error(&sick->conn, &loop, SANCUS_TCP_CONN_WATCHER_ERROR);
+
+	if (!sick->ejected || sick->conn.state != SANCUS_TCP_CONN_WAITING || errors != 1) {
+		pr_err("eject: ejected:%d state:%d errors:%u\n",
+		       sick->ejected, sick->conn.state, errors);
+		err++;
+	}
+
+	for (unsigned i = 0; i < 10; i++) {
+		p = sancus_tcp_balancer_pick(&b);
+		if (p == NULL || p == sick) {
+			pr_err("eject: picked %u\n", index_of(&b, p));
+			err++;
+		}
+	}
+
+	/* back after the delay, and the least loaded */
+	loop.now = sick->conn.timer.at;
+	sick->conn.timer.cb(&loop, &sick->conn.timer, 0);
+	sick->conn.io.cb(&loop, &sick->conn.io, SANCUS_EV_WRITE);
+
+	p = sancus_tcp_balancer_pick(&b);
+	if (sick->ejected || connected != 1 || p != sick) {
+		pr_err("eject: ejected:%d connected:%u picked:%u\n",
+		       sick->ejected, connected, index_of(&b, p));
+		err++;
+	}
+
+	/* nobody left */
+	for (unsigned i = 0; i < ARRAY_SIZE(weights); i++)
+		sancus_tcp_balancer_eject(&b, &loop, &b.peers[i]);
+
+	p = sancus_tcp_balancer_pick(&b);
+	if (p != NULL || errno != EHOSTUNREACH || b.healthy_count != 0) {
+		pr_err("eject: picked %u with all ejected\n", index_of(&b, p));
+		err++;
+	}
+
+	drop_peers(&b, &loop);
+
+	if (err == 0)
+		pr_info("eject: ok\n");
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	int err = 0;
+
+	if (listen_loopback() < 0) {
+		pr_err("listen: %s\n", strerror(errno));
+		return 1;
+	}
+
+	err += test_least();
+	err += test_two();
+	err += test_round_robin();
+	err += test_round_robin_eject();
+	err += test_eject();
+
+	sancus_close(lfd);
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,208 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <sancus/buffer.h>
+#include <sancus/socket.h>
+#include <sancus/tcp_conn.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static int last_error = -1;
+static unsigned errors;
+
+static void on_read(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_connect(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_error(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_conn_error err)
+{
+	if (errno != ETIMEDOUT)
+		pr_err("error %d: %s\n", err, strerror(errno));
+
+	last_error = (int)err;
+	errors++;
+}
+
+static const struct sancus_tcp_conn_settings settings = {
+	.on_read = on_read,
+	.on_connect = on_connect,
+	.on_error = on_error,
+	.connect_timeout = TIMESPEC_INIT_MS(0, 500),
+	.read_timeout = TIMESPEC_INIT_MS(1, 0),
+};
+
+static int listen_loopback(uint16_t *port, int backlog)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+	int fd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 0);
+
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(fd, backlog) < 0 || getsockname(fd, (struct sockaddr *)&sin, &len) < 0)
+		return -1;
+
+	*port = ntohs(sin.sin_port);
+	return fd;
+}
+
+/* ms until the timer is due, -1 if stopped */
+static long due(struct sancus_tcp_conn *conn, struct sancus_ev_loop *loop)
+{
+	struct timespec dt = sancus_time_left(&loop->now, &conn->timer.at);
+
+	if (!sancus_ev_timer_is_active(&conn->timer))
+		return -1;
+	return sancus_time_ts_to_ms(&dt);
+}
+
+/* the loop gets to the timer */
+static void fire(struct sancus_tcp_conn *conn, struct sancus_ev_loop *loop)
+{
+	if (sancus_ev_timer_is_active(&conn->timer)) {
+		loop->now = conn->timer.at;
+		conn->timer.cb(loop, &conn->timer, 0);
+	}
+}
+
+/* a listener with a full backlog never completes the handshake */
+static int test_connect(void)
+{
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_conn conn;
+	uint16_t port;
+	int lfd, filler, err = 0;
+	long ms;
+
+	lfd = listen_loopback(&port, 0);
+	filler = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 1);
+	if (lfd < 0 || filler < 0)
+		return 1;
+
+	{
+		struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(port) };
+
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		connect(filler, (struct sockaddr *)&sin, sizeof(sin));
+	}
+
+	if (sancus_tcp_ipv4_connect(&conn, &settings, "127.0.0.1", port, true) != 1 ||
+	    conn.state != SANCUS_TCP_CONN_INPROGRESS) {
+		pr_err("connect: didn't stay in progress\n");
+		return 1;
+	}
+
+	sancus_tcp_conn_start(&conn, &loop);
+	ms = due(&conn, &loop);
+	fire(&conn, &loop);
+
+	if (ms != 500 || errors != 1 || last_error != SANCUS_TCP_CONN_CONNECT_TIMEOUT ||
+	    conn.state != SANCUS_TCP_CONN_FAILED || sancus_ev_timer_is_active(&conn.timer)) {
+		pr_err("connect: due:%ld errors:%u last:%d state:%d\n",
+		       ms, errors, last_error, conn.state);
+		err++;
+	}
+
+	sancus_tcp_conn_stop(&conn, &loop);
+	sancus_tcp_conn_close(&conn);
+	sancus_close(filler);
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("connect: ok\n");
+	return err;
+}
+
+/* reads push the deadline back without touching the timer */
+static int test_read(void)
+{
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_conn conn;
+	uint16_t port;
+	int lfd, peer, err = 0;
+	long armed, pushed, rearmed;
+
+	errors = 0;
+	last_error = -1;
+
+	lfd = listen_loopback(&port, 1);
+	if (lfd < 0 || sancus_tcp_ipv4_connect(&conn, &settings, "127.0.0.1", port, true) != 1)
+		return 1;
+
+	sancus_tcp_conn_start(&conn, &loop);
+	peer = sancus_accept(lfd, NULL, NULL);
+	conn.io.cb(&loop, &conn.io, SANCUS_EV_WRITE);
+
+	armed = due(&conn, &loop);
+
+	/* something read 600ms in */
+	loop.now.tv_nsec += MS_TO_NS(600);
+	sancus_tcp_conn_touch(&conn, &loop);
+
+	fire(&conn, &loop);
+	pushed = due(&conn, &loop);
+	if (conn.state != SANCUS_TCP_CONN_RUNNING || armed != 1000 || pushed != 600 ||
+	    errors != 0) {
+		pr_err("read: state:%d armed:%ld pushed:%ld errors:%u\n",
+		       conn.state, armed, pushed, errors);
+		err++;
+	}
+
+	/* and nothing since */
+	fire(&conn, &loop);
+	if (errors != 1 || last_error != SANCUS_TCP_CONN_READ_TIMEOUT ||
+	    sancus_ev_timer_is_active(&conn.timer)) {
+		pr_err("read: errors:%u last:%d\n", errors, last_error);
+		err++;
+	}
+
+	/* the user chose to carry on */
+	sancus_tcp_conn_start(&conn, &loop);
+	rearmed = due(&conn, &loop);
+	fire(&conn, &loop);
+	if (rearmed != 1000 || errors != 2) {
+		pr_err("read: rearmed:%ld errors:%u\n", rearmed, errors);
+		err++;
+	}
+
+	sancus_tcp_conn_stop(&conn, &loop);
+	sancus_tcp_conn_close(&conn);
+	sancus_close(peer);
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("read: ok\n");
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	int err = 0;
+
+	err += test_connect();
+	err += test_read();
+
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,254 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <sancus/buffer.h>
+#include <sancus/socket.h>
+#include <sancus/tcp_conn.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	TFO_CLIENT = 0x1,
+	TFO_SERVER = 0x2,
+};
+
+static const char request[] = "GET / HTTP/1.0\r\n\r\n";
+
+static unsigned connects, errors;
+static bool quiet;
+
+static void on_read(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_connect(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+	connects++;
+}
+
+static void on_error(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_conn_error err)
+{
+	errors++;
+	if (!quiet)
+		pr_err("error %d: %s\n", err, strerror(errno));
+}
+
+static const struct sancus_tcp_conn_settings settings = {
+	.on_read = on_read,
+	.on_connect = on_connect,
+	.on_error = on_error,
+	.connect_timeout = { 5, 0 },
+	.fastopen = true,
+};
+
+/* net.ipv4.tcp_fastopen, 0 if unknown */
+static unsigned fastopen_sysctl(void)
+{
+	FILE *f = fopen("/proc/sys/net/ipv4/tcp_fastopen", "r");
+	unsigned v = 0;
+
+	if (f != NULL) {
+		if (fscanf(f, "%u", &v) != 1)
+			v = 0;
+		fclose(f);
+	}
+	return v;
+}
+
+static int listen_fastopen(uint16_t *port)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+	int qlen = 16;
+	int fd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 1);
+
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+		return -1;
+
+	/* ignored unless the kernel has the server side enabled */
+	setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN, &qlen, sizeof(qlen));
+
+	if (listen(fd, 16) < 0 || getsockname(fd, (struct sockaddr *)&sin, &len) < 0)
+		return -1;
+
+	*port = ntohs(sin.sin_port);
+	return fd;
+}
+
+static bool wait_for(int fd, short events)
+{
+	struct pollfd pfd = { .fd = fd, .events = events };
+
+	return poll(&pfd, 1, 1000) == 1;
+}
+
+/* one request over a new connection, returns 1 if it went in the SYN */
+static int exchange(int lfd, uint16_t port)
+{
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_conn conn;
+	static char out[64];
+	char buf[64];
+	int peer, fastopened;
+	ssize_t l = -1;
+
+	if (sancus_tcp_ipv4_connect(&conn, &settings, "127.0.0.1", port, true) != 1) {
+		pr_err("connect: %s\n", strerror(errno));
+		return -1;
+	}
+
+	/* queued before the handshake, to go with it */
+	sancus_tcp_conn_set_output(&conn, out, sizeof(out));
+	if (sancus_tcp_conn_write(&conn, &loop, request, sizeof(request) - 1) < 0)
+		return -1;
+
+	sancus_tcp_conn_start(&conn, &loop);
+	connects = 0;
+
+	/* deferred connects are writable right away, and send the SYN */
+	for (int i = 0; i < 2 && conn.state != SANCUS_TCP_CONN_RUNNING; i++) {
+		if (conn.state == SANCUS_TCP_CONN_INPROGRESS)
+			wait_for(sancus_tcp_conn_fd(&conn), POLLOUT);
+		conn.io.cb(&loop, &conn.io, SANCUS_EV_WRITE);
+	}
+
+	if (conn.state != SANCUS_TCP_CONN_RUNNING || connects != 1) {
+		pr_err("exchange: state:%d connects:%u\n", conn.state, connects);
+		return -1;
+	}
+
+	if (wait_for(lfd, POLLIN) && (peer = sancus_accept(lfd, NULL, NULL)) >= 0) {
+		if (wait_for(peer, POLLIN))
+			l = recv(peer, buf, sizeof(buf), 0);
+		sancus_close(peer);
+	} else {
+		peer = -1;
+	}
+
+	fastopened = sancus_tcp_conn_fastopened(&conn);
+
+	sancus_tcp_conn_stop(&conn, &loop);
+	sancus_tcp_conn_close(&conn);
+
+	if (peer < 0 || l != sizeof(request) - 1 || memcmp(buf, request, (size_t)l) != 0) {
+		pr_err("exchange: request %s\n", peer < 0 ? "not accepted" : "not received");
+		return -1;
+	}
+	return fastopened;
+}
+
+/*
+ * nothing listening, the refusal is reported as a connect error and
+ * the connection is never seen as connected, even when deferred
+ */
+static int refused(void)
+{
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+	struct sancus_tcp_conn conn;
+	int fd, err = 0;
+	bool deferred;
+
+	/* a port nobody listens on */
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	fd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 1);
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    getsockname(fd, (struct sockaddr *)&sin, &len) < 0 ||
+	    sancus_tcp_ipv4_connect(&conn, &settings, "127.0.0.1", ntohs(sin.sin_port),
+				    true) != 1) {
+		pr_err("refused: %s\n", strerror(errno));
+		return 1;
+	}
+
+	sancus_tcp_conn_start(&conn, &loop);
+	deferred = conn.state == SANCUS_TCP_CONN_CONNECTED;
+	connects = errors = 0;
+	quiet = true;
+
+	for (int i = 0; i < 2 && conn.state != SANCUS_TCP_CONN_FAILED; i++) {
+		if (conn.state == SANCUS_TCP_CONN_INPROGRESS)
+			wait_for(sancus_tcp_conn_fd(&conn), POLLOUT);
+		conn.io.cb(&loop, &conn.io, SANCUS_EV_WRITE);
+
+		/* the SYN is out, the deadline still running */
+		if (conn.state == SANCUS_TCP_CONN_INPROGRESS &&
+		    !sancus_ev_timer_is_active(&conn.timer)) {
+			pr_err("refused: connect timeout stopped\n");
+			err++;
+		}
+	}
+
+	quiet = false;
+	if (conn.state != SANCUS_TCP_CONN_FAILED || errors != 1 || connects != 0) {
+		pr_err("refused: state:%d errors:%u connects:%u\n", conn.state, errors, connects);
+		err++;
+	}
+
+	sancus_tcp_conn_stop(&conn, &loop);
+	sancus_tcp_conn_close(&conn);
+	sancus_close(fd);
+
+	if (err == 0)
+		pr_info("refused: ok%s\n", deferred ? ", deferred" : "");
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	unsigned sysctl = fastopen_sysctl();
+	bool supported = (sysctl & (TFO_CLIENT|TFO_SERVER)) == (TFO_CLIENT|TFO_SERVER);
+	uint16_t port;
+	int lfd, first, second, err = 0;
+
+	lfd = listen_fastopen(&port);
+	if (lfd < 0) {
+		pr_err("listen: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* no cookie yet, a regular handshake asking for one */
+	first = exchange(lfd, port);
+	/* in the SYN if the server gave one */
+	second = exchange(lfd, port);
+
+	/* with a cookie cached for the address by now */
+	err += refused();
+
+	if (first != 0 || second < 0) {
+		err++;
+	} else if (supported && second != 1) {
+		pr_err("fastopen: enabled (%u) but not used\n", sysctl);
+		err++;
+	} else if (!supported && second != 0) {
+		pr_err("fastopen: used while disabled (%u)\n", sysctl);
+		err++;
+	}
+
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("fastopen: %s\n", second ? "in the SYN" : "fell back to a regular handshake");
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,190 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <sancus/buffer.h>
+#include <sancus/socket.h>
+#include <sancus/tcp_conn.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	OUT_SIZE = 1 << 16,
+	CHUNK    = 4096,
+	CHUNKS   = 256,	/* well beyond what the socket buffers take */
+};
+
+static unsigned connected, drained, errors;
+
+static void on_read(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_connect(struct sancus_tcp_conn *self, struct sancus_ev_loop *UNUSED(loop))
+{
+	/* the pipelined requests are already out */
+	if (sancus_tcp_conn_pending(self) == 0)
+		connected++;
+}
+
+static void on_error(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_conn_error err)
+{
+	pr_err("error %d: %s\n", err, strerror(errno));
+	errors++;
+}
+
+static void on_drain(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+	drained++;
+}
+
+static const struct sancus_tcp_conn_settings settings = {
+	.on_read = on_read,
+	.on_connect = on_connect,
+	.on_error = on_error,
+	.on_drain = on_drain,
+};
+
+static int listen_loopback(struct sockaddr_in *sin)
+{
+	socklen_t len = sizeof(*sin);
+	int fd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 0);
+	int small = CHUNK;
+
+	/* inherited by the accepted end */
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &small, sizeof(small));
+
+	*sin = (struct sockaddr_in) { .sin_family = AF_INET };
+	sin->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (fd < 0 || bind(fd, (struct sockaddr *)sin, sizeof(*sin)) < 0 ||
+	    listen(fd, 1) < 0 || getsockname(fd, (struct sockaddr *)sin, &len) < 0)
+		return -1;
+	return fd;
+}
+
+/* what the peer reads, checking the byte pattern */
+static size_t peer_drain(int fd, size_t *offset, unsigned *bad)
+{
+	char buf[CHUNK];
+	size_t total = 0;
+	ssize_t l;
+
+	while ((l = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+		for (ssize_t i = 0; i < l; i++, (*offset)++) {
+			if (buf[i] != (char)(*offset % 251))
+				(*bad)++;
+		}
+		total += (size_t)l;
+	}
+	return total;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	static char out[OUT_SIZE];
+	static const char request[] = "GET / HTTP/1.0\r\n\r\n";
+	struct sancus_ev_loop loop = { .now = { 1, 0 } };
+	struct sancus_tcp_conn conn;
+	struct sockaddr_in sin;
+	char chunk[CHUNK], buf[64];
+	size_t written = 0, received = 0, offset = 0;
+	unsigned bad = 0, queued_at = 0;
+	int lfd, peer, sndbuf = CHUNK, err = 0;
+	ssize_t l;
+
+	lfd = listen_loopback(&sin);
+	if (lfd < 0)
+		return 1;
+
+	if (sancus_tcp_ipv4_connect(&conn, &settings, "127.0.0.1", ntohs(sin.sin_port),
+				    true) != 1)
+		return 1;
+	sancus_tcp_conn_set_output(&conn, out, sizeof(out));
+	setsockopt(sancus_tcp_conn_fd(&conn), SOL_SOCKET, SO_SNDBUF, &sndbuf, sizeof(sndbuf));
+
+	/* pipelined while the handshake is pending */
+	if (sancus_tcp_conn_write(&conn, &loop, request, sizeof(request) - 1) < 0 ||
+	    sancus_tcp_conn_pending(&conn) != sizeof(request) - 1) {
+		pr_err("pipeline: not queued\n");
+		err++;
+	}
+
+	peer = sancus_accept(lfd, NULL, NULL);
+	if (peer < 0)
+		return 1;
+
+	/* writable, the handshake is done */
+	conn.io.cb(&loop, &conn.io, SANCUS_EV_WRITE);
+
+	l = recv(peer, buf, sizeof(buf), 0);
+	if (connected != 1 || l != (ssize_t)sizeof(request) - 1 ||
+	    memcmp(buf, request, (size_t)l) != 0) {
+		pr_err("pipeline: connected:%u received:%zd\n", connected, l);
+		err++;
+	}
+
+	/* until the socket is full and the queue takes over */
+	for (unsigned i = 0; i < CHUNKS; i++) {
+		for (unsigned j = 0; j < CHUNK; j++)
+			chunk[j] = (char)((written + j) % 251);
+
+		if (sancus_tcp_conn_write(&conn, &loop, chunk, CHUNK) < 0) {
+			if (errno != ENOBUFS || sancus_tcp_conn_pending(&conn) + CHUNK <= OUT_SIZE) {
+				pr_err("write: %s\n", strerror(errno));
+				err++;
+			}
+			break;
+		}
+
+		written += CHUNK;
+		if (queued_at == 0 && sancus_tcp_conn_pending(&conn) > 0)
+			queued_at = i + 1;
+	}
+
+	if (queued_at == 0 || drained != 0) {
+		pr_err("write: nothing queued\n");
+		err++;
+	}
+
+	/* the peer reads, writability flushes the queue */
+	while (received < written && errors == 0) {
+		size_t n = peer_drain(peer, &offset, &bad);
+
+		received += n;
+		if (n == 0)
+			conn.io.cb(&loop, &conn.io, SANCUS_EV_WRITE);
+	}
+
+	if (received != written || bad != 0 || drained != 1 || errors != 0 ||
+	    sancus_tcp_conn_pending(&conn) != 0) {
+		pr_err("drain: received:%zu/%zu bad:%u drained:%u\n", received, written,
+		       bad, drained);
+		err++;
+	}
+
+	sancus_tcp_conn_stop(&conn, &loop);
+	sancus_tcp_conn_close(&conn);
+	sancus_close(peer);
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("output: written:%zu queued after %u chunks\n", written, queued_at);
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,293 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <sancus/buffer.h>
+#include <sancus/socket.h>
+#include <sancus/tcp_conn.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	CLIENTS = 32,
+};
+
+static unsigned connected, timeouts;
+
+static void on_read(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_connect(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+	connected++;
+}
+
+static void on_error(struct sancus_tcp_conn *self, struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_conn_error err)
+{
+	if (err == SANCUS_TCP_CONN_CONNECT_TIMEOUT && errno == ETIMEDOUT &&
+	    self->state == SANCUS_TCP_CONN_WAITING)
+		timeouts++;
+	else
+		pr_err("error %d: %s\n", err, strerror(errno));
+}
+
+static const struct sancus_tcp_conn_settings settings = {
+	.on_read = on_read,
+	.on_connect = on_connect,
+	.on_error = on_error,
+	.reconnect = {
+		.initial_delay = TIMESPEC_INIT_MS(0, 100),
+		.max_delay = TIMESPEC_INIT_MS(1, 0),
+	},
+	.connect_timeout = TIMESPEC_INIT_MS(2, 0),
+};
+
+static const struct sancus_tcp_conn_settings jittered = {
+	.on_read = on_read,
+	.on_connect = on_connect,
+	.on_error = on_error,
+	.reconnect = {
+		.initial_delay = TIMESPEC_INIT_MS(1, 0),
+		.jitter = 100,
+	},
+};
+
+static int listen_loopback(uint16_t *port, int backlog)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+	int fd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 0);
+
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(fd, backlog) < 0 || getsockname(fd, (struct sockaddr *)&sin, &len) < 0)
+		return -1;
+
+	*port = ntohs(sin.sin_port);
+	return fd;
+}
+
+/* ms until the timer is due, -1 if stopped */
+static long due(struct sancus_tcp_conn *conn, struct sancus_ev_loop *loop)
+{
+	struct timespec dt = sancus_time_left(&loop->now, &conn->timer.at);
+
+	if (!sancus_ev_timer_is_active(&conn->timer))
+		return -1;
+	return sancus_time_ts_to_ms(&dt);
+}
+
+/* the loop gets to the timer */
+static long fire(struct sancus_tcp_conn *conn, struct sancus_ev_loop *loop)
+{
+	struct timespec dt = sancus_time_elapsed(&conn->timer.at, &loop->now);
+
+	if (!sancus_ev_timer_is_active(&conn->timer))
+		return -1;
+
+	loop->now = conn->timer.at;
+	conn->timer.cb(loop, &conn->timer, 0);
+	return sancus_time_ts_to_ms(&dt);
+}
+
+/*
+ * a listener with a full backlog never answers, so connects time out
+ * until it's drained
+ */
+static int test_backoff(void)
+{
+	static const long expected[] = { 100, 200, 400, 800, 1000, 1000 };
+	static const char request[] = "PING\r\n";
+	static char out[64];
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_conn conn;
+	uint16_t port;
+	int lfd, filler, peer, err = 0;
+	char buf[16];
+	ssize_t l;
+
+	lfd = listen_loopback(&port, 0);
+	filler = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 1);
+	if (lfd < 0 || filler < 0)
+		return 1;
+
+	{
+		struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(port) };
+
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		connect(filler, (struct sockaddr *)&sin, sizeof(sin));
+	}
+
+	if (sancus_tcp_ipv4_connect(&conn, &settings, "127.0.0.1", port, true) != 1 ||
+	    conn.state != SANCUS_TCP_CONN_INPROGRESS) {
+		pr_err("backoff: connect didn't stay in progress\n");
+		return 1;
+	}
+	sancus_tcp_conn_set_output(&conn, out, sizeof(out));
+	sancus_tcp_conn_start(&conn, &loop);
+
+	/* timeout, then the delay before the next attempt */
+	for (unsigned i = 0; i < ARRAY_SIZE(expected); i++) {
+		long timeout = fire(&conn, &loop);
+		long delay = conn.state == SANCUS_TCP_CONN_WAITING ? fire(&conn, &loop) : -1;
+
+		if (timeout != 2000 || delay != expected[i]) {
+			pr_err("backoff: attempt %u: timeout:%ld delay:%ld, expected %ld\n",
+			       i, timeout, delay, expected[i]);
+			err++;
+		}
+	}
+
+	/* queued while waiting, sent on the next connection */
+	if (sancus_tcp_conn_write(&conn, &loop, request, sizeof(request) - 1) < 0)
+		err++;
+
+	/* room again in the backlog */
+	sancus_close(sancus_accept(lfd, NULL, NULL));
+	sancus_close(filler);
+	fire(&conn, &loop);
+	fire(&conn, &loop);
+
+	peer = sancus_accept(lfd, NULL, NULL);
+	conn.io.cb(&loop, &conn.io, SANCUS_EV_WRITE);
+
+	l = peer < 0 ? -1 : recv(peer, buf, sizeof(buf), 0);
+	if (connected != 1 || conn.attempts != 0 || sancus_ev_timer_is_active(&conn.timer) ||
+	    l != sizeof(request) - 1 || timeouts != ARRAY_SIZE(expected) + 1) {
+		pr_err("backoff: connected:%u attempts:%u timeouts:%u received:%zd\n",
+		       connected, conn.attempts, timeouts, l);
+		err++;
+	}
+
+	sancus_tcp_conn_stop(&conn, &loop);
+	sancus_tcp_conn_close(&conn);
+	sancus_close(peer);
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("backoff: ok\n");
+	return err;
+}
+
+/* stopping while waiting doesn't give up on reconnecting */
+static int test_restart(void)
+{
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_conn conn;
+	long before, after;
+	uint16_t port;
+	int lfd, err = 0;
+
+	lfd = listen_loopback(&port, 1);
+	if (lfd < 0 || sancus_tcp_ipv4_connect(&conn, &settings, "127.0.0.1", port, true) != 1 ||
+	    sancus_tcp_conn_reconnect(&conn, &loop) < 0)
+		return 1;
+
+	before = due(&conn, &loop);
+
+	sancus_tcp_conn_stop(&conn, &loop);
+	if (sancus_ev_timer_is_active(&conn.timer)) {
+		pr_err("restart: still armed after stop\n");
+		err++;
+	}
+
+	sancus_tcp_conn_start(&conn, &loop);
+	after = due(&conn, &loop);
+
+	fire(&conn, &loop);
+	if (before != 100 || after != before || conn.state == SANCUS_TCP_CONN_WAITING) {
+		pr_err("restart: delay %ld, then %ld, state:%d\n", before, after, conn.state);
+		err++;
+	}
+
+	sancus_tcp_conn_stop(&conn, &loop);
+	sancus_tcp_conn_close(&conn);
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("restart: ok\n");
+	return err;
+}
+
+/* a backend blip doesn't bring them all back at once */
+static int test_jitter(void)
+{
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_conn conns[CLIENTS];
+	long delays[CLIENTS];
+	unsigned distinct = 0;
+	uint16_t port;
+	int lfd, err = 0;
+
+	lfd = listen_loopback(&port, CLIENTS);
+	if (lfd < 0)
+		return 1;
+
+	for (unsigned i = 0; i < CLIENTS; i++) {
+		struct timespec dt;
+
+		if (sancus_tcp_ipv4_connect(&conns[i], &jittered, "127.0.0.1", port, true) != 1 ||
+		    sancus_tcp_conn_reconnect(&conns[i], &loop) < 0)
+			return 1;
+
+		dt = sancus_time_elapsed(&conns[i].timer.at, &loop.now);
+		delays[i] = sancus_time_ts_to_ms(&dt);
+
+		if (delays[i] < 0 || delays[i] > 1000) {
+			pr_err("jitter: delay %ld out of range\n", delays[i]);
+			err++;
+		}
+	}
+
+	for (unsigned i = 0; i < CLIENTS; i++) {
+		unsigned j = 0;
+
+		while (j < i && delays[j] != delays[i])
+			j++;
+		if (j == i)
+			distinct++;
+
+		sancus_tcp_conn_stop(&conns[i], &loop);
+		sancus_tcp_conn_close(&conns[i]);
+	}
+
+	if (distinct < CLIENTS / 2) {
+		pr_err("jitter: only %u distinct delays\n", distinct);
+		err++;
+	}
+
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("jitter: distinct:%u/%u\n", distinct, CLIENTS);
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	int err = 0;
+
+	err += test_backoff();
+	err += test_restart();
+	err += test_jitter();
+
+	return err == 0 ? 0 : 1;
+}
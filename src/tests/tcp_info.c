@@ -0,0 +1,255 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <sancus/buffer.h>
+#include <sancus/socket.h>
+#include <sancus/tcp_conn.h>
+#include <sancus/tcp_info.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static unsigned sampled;
+
+static void on_read(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_connect(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_error(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_conn_error err)
+{
+	pr_err("error %d: %s\n", err, strerror(errno));
+}
+
+static void on_sample(struct sancus_tcp_info_sampler *UNUSED(self),
+		      struct sancus_ev_loop *UNUSED(loop))
+{
+	sampled++;
+}
+
+static const struct sancus_tcp_conn_settings settings = {
+	.on_read = on_read,
+	.on_connect = on_connect,
+	.on_error = on_error,
+};
+
+static int listen_loopback(uint16_t *port)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+	int fd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 0);
+
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(fd, 1) < 0 || getsockname(fd, (struct sockaddr *)&sin, &len) < 0)
+		return -1;
+
+	*port = ntohs(sin.sin_port);
+	return fd;
+}
+
+/* the loop gets to the timer */
+static void fire(struct sancus_tcp_info_sampler *s, struct sancus_ev_loop *loop)
+{
+	if (sancus_ev_timer_is_active(&s->timer)) {
+		loop->now = s->timer.at;
+		s->timer.cb(loop, &s->timer, 0);
+	}
+}
+
+/* both ends of a connection the peer doesn't read from */
+static int test_sampler(void)
+{
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_info_stats stats;
+	struct sancus_tcp_info_sampler client, server;
+	struct sancus_ev_fd accepted = { .fd = -1 };
+	struct sancus_tcp_conn conn;
+	static char chunk[4096];
+	uint16_t port;
+	int lfd, size = 4096, err = 0;
+	unsigned long queued = 0;
+
+	lfd = listen_loopback(&port);
+	if (lfd < 0 || sancus_tcp_ipv4_connect(&conn, &settings, "127.0.0.1", port, true) != 1)
+		return 1;
+
+	sancus_tcp_conn_start(&conn, &loop);
+	accepted.fd = sancus_accept(lfd, NULL, NULL);
+	conn.io.cb(&loop, &conn.io, SANCUS_EV_WRITE);
+
+	/* the peer's window fills up, leaving data in flight and queued */
+	setsockopt(accepted.fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+	for (;;) {
+		ssize_t l = send(sancus_tcp_conn_fd(&conn), chunk, sizeof(chunk),
+				 MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (l <= 0)
+			break;
+		queued += (unsigned long)l;
+	}
+
+	sancus_tcp_info_stats_init(&stats, &loop);
+	sancus_tcp_info_sampler_init(&client, &conn.io, TIMESPEC_INIT(1, 0), &stats);
+	sancus_tcp_info_sampler_init(&server, &accepted, TIMESPEC_INIT(1, 0), &stats);
+	client.on_sample = on_sample;
+
+	sancus_tcp_info_sampler_start(&client, &loop);
+	sancus_tcp_info_sampler_start(&server, &loop);
+
+	fire(&client, &loop);
+	fire(&server, &loop);
+
+	if (stats.samples != 2 || sampled != 1 || !sancus_ev_timer_is_active(&client.timer)) {
+		pr_err("sampler: samples:%lu sampled:%u\n", stats.samples, sampled);
+		err++;
+	}
+
+	if (client.last.cwnd == 0 || client.last.unacked + client.last.unsent == 0 ||
+	    client.last.unacked + client.last.unsent > queued || server.last.unsent != 0) {
+		pr_err("sampler: cwnd:%u unacked:%u unsent:%u of %lu\n", client.last.cwnd,
+		       client.last.unacked, client.last.unsent, queued);
+		err++;
+	}
+
+	/* a closed socket is skipped, and sampling goes on */
+	sancus_tcp_info_sampler_stop(&server, &loop);
+	sancus_close2(&accepted.fd);
+	if (sancus_tcp_info_sampler_sample(&server, &loop) == 0 || errno != EBADF) {
+		pr_err("sampler: sampled a closed socket\n");
+		err++;
+	}
+
+	sancus_tcp_info_sampler_stop(&client, &loop);
+	sancus_tcp_conn_stop(&conn, &loop);
+	sancus_tcp_conn_close(&conn);
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("sampler: rtt:%uus cwnd:%u unacked:%u unsent:%u\n", client.last.rtt,
+			client.last.cwnd, client.last.unacked, client.last.unsent);
+	return err;
+}
+
+/* a new connection on the same fd isn't taken for the old one */
+static int test_reconnect(void)
+{
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_info_sampler sampler;
+	struct sancus_ev_fd io = { .fd = -1 };
+	uint64_t first;
+	uint16_t port;
+	int lfd, peer[2] = { -1, -1 }, err = 0;
+
+	lfd = listen_loopback(&port);
+	if (lfd < 0)
+		return 1;
+
+	sancus_tcp_info_sampler_init(&sampler, &io, TIMESPEC_INIT(1, 0), NULL);
+
+	for (int i = 0; i < 2; i++) {
+		struct sockaddr_in sin = { .sin_family = AF_INET, .sin_port = htons(port) };
+		int fd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 0);
+
+		sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (fd < 0 || connect(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+		    (peer[i] = sancus_accept(lfd, NULL, NULL)) < 0) {
+			pr_err("reconnect: %s\n", strerror(errno));
+			return err + 1;
+		}
+
+		/* the second time, most likely the fd just closed */
+		io.fd = fd;
+		first = sampler.socket;
+
+		if (sancus_tcp_info_sampler_sample(&sampler, &loop) < 0 ||
+		    sampler.socket == first) {
+			pr_err("reconnect: attempt %d not told apart\n", i);
+			err++;
+		}
+
+		sancus_close2(&io.fd);
+	}
+
+	sancus_close(peer[0]);
+	sancus_close(peer[1]);
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("reconnect: ok\n");
+	return err;
+}
+
+static int test_stats(void)
+{
+	static const uint32_t rtts[] = { 10, 100, 300, 1000, 1500, 90000, 5000000 };
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_info_stats stats;
+	struct {
+		unsigned pct;
+		uint32_t rtt;
+	} expected[] = {
+		{ 0, 64 }, { 10, 64 }, { 20, 128 }, { 30, 512 }, { 50, 1024 },
+		{ 70, 2048 }, { 85, 131072 }, { 100, UINT32_MAX },
+	};
+	double rate;
+	int err = 0;
+
+	sancus_tcp_info_stats_init(&stats, &loop);
+	for (unsigned i = 0; i < ARRAY_SIZE(rtts); i++) {
+		struct sancus_tcp_info info = { .rtt = rtts[i] };
+
+		sancus_tcp_info_stats_add(&stats, &info, 2);
+	}
+
+	for (unsigned i = 0; i < ARRAY_SIZE(expected); i++) {
+		uint32_t rtt = sancus_tcp_info_stats_rtt(&stats, expected[i].pct);
+
+		if (rtt != expected[i].rtt) {
+			pr_err("stats: p%u: %u, expected %u\n", expected[i].pct, rtt,
+			       expected[i].rtt);
+			err++;
+		}
+	}
+
+	loop.now.tv_sec += 7;
+	rate = sancus_tcp_info_stats_retransmit_rate(&stats, &loop);
+	if (stats.rtt_max != 5000000 || rate < 1.99 || rate > 2.01) {
+		pr_err("stats: max:%u rate:%f\n", stats.rtt_max, rate);
+		err++;
+	}
+
+	if (err == 0)
+		pr_info("stats: ok\n");
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	int err = 0;
+
+	err += test_sampler();
+	err += test_reconnect();
+	err += test_stats();
+
+	return err == 0 ? 0 : 1;
+}
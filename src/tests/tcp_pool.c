@@ -0,0 +1,162 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <sancus/buffer.h>
+#include <sancus/list.h>
+#include <sancus/socket.h>
+#include <sancus/tcp_conn.h>
+#include <sancus/tcp_pool.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static void on_read(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_connect(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop))
+{
+}
+
+static void on_error(struct sancus_tcp_conn *UNUSED(self), struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_conn_error err)
+{
+	pr_err("error %d: %s\n", err, strerror(errno));
+}
+
+static const struct sancus_tcp_conn_settings conn_settings = {
+	.on_read = on_read,
+	.on_connect = on_connect,
+	.on_error = on_error,
+};
+
+static struct sancus_tcp_conn *handed;
+
+static void on_conn(struct sancus_tcp_pool_waiter *UNUSED(w), struct sancus_ev_loop *UNUSED(loop),
+		    struct sancus_tcp_conn *conn)
+{
+	handed = conn;
+}
+
+static int listen_loopback(uint16_t *port)
+{
+	struct sockaddr_in sin = { .sin_family = AF_INET };
+	socklen_t len = sizeof(sin);
+	int fd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 0);
+
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+	    listen(fd, 16) < 0 || getsockname(fd, (struct sockaddr *)&sin, &len) < 0)
+		return -1;
+
+	*port = ntohs(sin.sin_port);
+	return fd;
+}
+
+/* writable, the handshake is done */
+static inline void connected(struct sancus_tcp_conn *conn, struct sancus_ev_loop *loop)
+{
+	conn->io.cb(loop, &conn->io, SANCUS_EV_WRITE);
+}
+
+#define test__check(E) do { \
+	if (!(E)) { \
+		pr_err("%s:%d: `%s` failed\n", __FILE__, __LINE__, #E); \
+		err++; \
+	} \
+} while (0)
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	struct sancus_tcp_pool_settings settings = {
+		.conn = &conn_settings,
+		.out_size = 256,
+		.min_idle = 1,
+		.max_idle = 1,
+		.max_conns = 2,
+		.idle_timeout = TIMESPEC_INIT(5, 0),
+	};
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_pool_waiter waiter = { .on_conn = on_conn };
+	struct sancus_tcp_pool pool;
+	struct sancus_tcp_conn *a, *b;
+	uint16_t port;
+	int lfd, pa, pb, err = 0;
+
+	lfd = listen_loopback(&port);
+	if (lfd < 0)
+		return 1;
+
+	test__check(sancus_tcp_pool_init(&pool, &settings, "not an address", port) == 0);
+	if (sancus_tcp_pool_init(&pool, &settings, "127.0.0.1", port) != 1)
+		return 1;
+
+	/* new connections up to the limit, usable right away */
+	a = sancus_tcp_pool_checkout(&pool, &loop);
+	b = sancus_tcp_pool_checkout(&pool, &loop);
+	test__check(a != NULL && b != NULL && pool.stats.opened == 2 && pool.stats.busy == 2);
+	test__check(sancus_tcp_conn_write(a, &loop, "x", 1) == 1);
+
+	test__check(sancus_tcp_pool_checkout(&pool, &loop) == NULL && errno == EAGAIN);
+
+	pa = sancus_accept(lfd, NULL, NULL);
+	pb = sancus_accept(lfd, NULL, NULL);
+	if (a == NULL || b == NULL || pa < 0 || pb < 0)
+		return 1;
+	connected(a, &loop);
+	connected(b, &loop);
+
+	/* checked in straight to the waiter */
+	sancus_tcp_pool_wait(&pool, &loop, &waiter);
+	test__check(pool.stats.waiting == 1);
+
+	loop.now.tv_nsec = 500000000;
+	sancus_tcp_pool_checkin(&pool, &loop, a);
+	test__check(handed == a && pool.stats.waiting == 0 && pool.stats.busy == 2);
+	test__check(pool.stats.waits == 1 && pool.stats.wait_max.tv_nsec == 500000000);
+
+	/* kept up to max_idle, reused warmest first */
+	sancus_tcp_pool_checkin(&pool, &loop, b);
+	sancus_tcp_pool_checkin(&pool, &loop, a);
+	test__check(pool.stats.idle == 1 && pool.stats.busy == 0 && pool.stats.closed == 1);
+
+	test__check(sancus_tcp_pool_checkout(&pool, &loop) == b && pool.stats.reused == 2);
+	sancus_tcp_pool_checkin(&pool, &loop, b);
+
+	/* closed by the upstream, replaced to keep min_idle */
+	sancus_close(pb);
+	sancus_close(pa);
+	sancus_tcp_pool_maintain(&pool, &loop);
+	test__check(pool.stats.unhealthy == 1 && pool.stats.idle == 1 && pool.stats.opened == 3);
+
+	/* expired after idle_timeout without activity */
+	loop.now.tv_sec += 5;
+	sancus_tcp_pool_maintain(&pool, &loop);
+	test__check(pool.stats.expired == 1 && pool.stats.idle == 1 && pool.stats.opened == 4);
+
+	sancus_tcp_pool_close(&pool, &loop);
+	test__check(pool.stats.idle == 0 && pool.stats.closed == pool.stats.opened);
+
+	sancus_close(lfd);
+
+	if (err == 0)
+		pr_info("pool: opened:%lu reused:%lu closed:%lu\n", pool.stats.opened,
+			pool.stats.reused, pool.stats.closed);
+	return err == 0 ? 0 : 1;
+}
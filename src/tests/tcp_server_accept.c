@@ -0,0 +1,150 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <sancus/socket.h>
+#include <sancus/tcp_server.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	CLIENTS = 10,
+	BUDGET  = 4,
+};
+
+static unsigned connected, batches, bad_flags;
+
+static void check_flags(int fd)
+{
+	if (!(fcntl(fd, F_GETFL) & O_NONBLOCK) || !(fcntl(fd, F_GETFD) & FD_CLOEXEC))
+		bad_flags++;
+}
+
+static bool on_connect(struct sancus_tcp_server *UNUSED(self),
+		       struct sancus_ev_loop *UNUSED(loop),
+		       int fd, struct sockaddr *UNUSED(sa), socklen_t UNUSED(sa_len))
+{
+	check_flags(fd);
+	connected++;
+	return false;
+}
+
+static void on_connect_batch(struct sancus_tcp_server *UNUSED(self),
+			     struct sancus_ev_loop *UNUSED(loop),
+			     struct sancus_tcp_server_accepted *batch, size_t count)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (batch[i].addr.ss_family != AF_INET)
+			bad_flags++;
+		check_flags(batch[i].fd);
+		sancus_close(batch[i].fd);
+	}
+
+	connected += (unsigned)count;
+	batches++;
+}
+
+static void on_error(struct sancus_tcp_server *UNUSED(self),
+		     struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_server_error UNUSED(err))
+{
+	pr_err("accept: %s\n", strerror(errno));
+}
+
+static int connect_clients(const struct sancus_tcp_server *server, int *fds)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	if (getsockname(sancus_tcp_server_fd(server), (struct sockaddr *)&sin, &len) < 0)
+		return -1;
+
+	for (unsigned i = 0; i < CLIENTS; i++) {
+		fds[i] = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 0);
+		if (fds[i] < 0 || connect(fds[i], (struct sockaddr *)&sin, len) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static int test_accept(const struct sancus_tcp_server_settings *settings,
+		       const char *what, const unsigned *expected, unsigned steps)
+{
+	struct sancus_tcp_server server;
+	struct sancus_ev_loop loop = { .now = { 0, 0 } };
+	int fds[CLIENTS];
+	int err = 0;
+
+	connected = batches = bad_flags = 0;
+
+	if (sancus_tcp_ipv4_listen(&server, settings, "127.0.0.1", 0, true, CLIENTS) != 1 ||
+	    connect_clients(&server, fds) < 0) {
+		pr_err("%s: %s\n", what, strerror(errno));
+		return 1;
+	}
+
+	/* each wakeup stops at the budget, the last one at EAGAIN */
+	for (unsigned i = 0; i < steps; i++) {
+		unsigned n = sancus_tcp_server_accept(&server, &loop);
+
+		if (n != expected[i]) {
+			pr_err("%s: wakeup %u accepted %u, expected %u\n",
+			       what, i, n, expected[i]);
+			err++;
+		}
+	}
+
+	if (connected != CLIENTS || bad_flags != 0) {
+		pr_err("%s: connected:%u bad:%u\n", what, connected, bad_flags);
+		err++;
+	}
+
+	for (unsigned i = 0; i < CLIENTS; i++)
+		sancus_close(fds[i]);
+	sancus_tcp_server_close(&server);
+
+	if (err == 0)
+		pr_info("%s: connected:%u batches:%u\n", what, connected, batches);
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	static const struct sancus_tcp_server_settings single = {
+		.on_connect = on_connect,
+		.on_error = on_error,
+		.accept_budget = BUDGET,
+	};
+	static const struct sancus_tcp_server_settings batched = {
+		.on_connect_batch = on_connect_batch,
+		.on_error = on_error,
+		.accept_budget = BUDGET,
+	};
+	static const unsigned expected[] = { 4, 4, 2, 0 };
+	int err = 0;
+
+	err += test_accept(&single, "single", expected, ARRAY_SIZE(expected));
+	err += test_accept(&batched, "batched", expected, ARRAY_SIZE(expected));
+
+	if (err == 0 && batches != 3) {
+		pr_err("batched: %u batches, expected 3\n", batches);
+		err++;
+	}
+
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,173 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+#include <sancus/time.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+
+#include <sancus/socket.h>
+#include <sancus/tcp_server.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	CLIENTS = 6,
+};
+
+static int accepted[CLIENTS];
+static unsigned accepted_count;
+
+static bool on_connect(struct sancus_tcp_server *UNUSED(self),
+		       struct sancus_ev_loop *UNUSED(loop),
+		       int fd, struct sockaddr *UNUSED(sa), socklen_t UNUSED(sa_len))
+{
+	accepted[accepted_count++] = fd;
+	return true;
+}
+
+static void on_error(struct sancus_tcp_server *UNUSED(self),
+		     struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_server_error UNUSED(err))
+{
+	pr_err("accept: %s\n", strerror(errno));
+}
+
+static int connect_clients(const struct sancus_tcp_server *server, int *fds)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+
+	if (getsockname(sancus_tcp_server_fd(server), (struct sockaddr *)&sin, &len) < 0)
+		return -1;
+
+	for (unsigned i = 0; i < CLIENTS; i++) {
+		fds[i] = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 0);
+		if (fds[i] < 0 || connect(fds[i], (struct sockaddr *)&sin, len) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+static void close_all(struct sancus_tcp_server *server, int *fds)
+{
+	for (unsigned i = 0; i < CLIENTS; i++)
+		sancus_close(fds[i]);
+	for (unsigned i = 0; i < accepted_count; i++)
+		sancus_close(accepted[i]);
+	accepted_count = 0;
+
+	sancus_tcp_server_close(server);
+}
+
+#define test__check(W, E) do { \
+	if (!(E)) { \
+		pr_err("%s: `%s` failed\n", (W), #E); \
+		err++; \
+	} \
+} while (0)
+
+static int test_pause(void)
+{
+	static const struct sancus_tcp_server_settings settings = {
+		.on_connect = on_connect,
+		.on_error = on_error,
+		.max_connections = 3,
+		.resume_connections = 1,
+	};
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_server server;
+	struct sancus_tcp_server_stats stats;
+	int fds[CLIENTS];
+	int err = 0;
+
+	if (sancus_tcp_ipv4_listen(&server, &settings, "127.0.0.1", 0, true, CLIENTS) != 1 ||
+	    connect_clients(&server, fds) < 0)
+		return 1;
+
+	/* up to the cap, then paused */
+	test__check("pause", sancus_tcp_server_accept(&server, &loop) == 3);
+	test__check("pause", server.admission.paused &&
+		    server.admission.stats.pauses == 1);
+	test__check("pause", sancus_tcp_server_accept(&server, &loop) == 0);
+
+	/* above the low-water mark it stays paused */
+	loop.now.tv_sec += 2;
+	sancus_tcp_server_release(&server, &loop);
+	test__check("pause", server.admission.paused);
+
+	sancus_tcp_server_get_stats(&server, &loop, &stats);
+	test__check("pause", stats.connections == 2 && stats.paused_time.tv_sec == 2);
+
+	/* resumed at the low-water mark */
+	sancus_tcp_server_release(&server, &loop);
+	test__check("resume", !server.admission.paused &&
+		    server.admission.stats.paused_time.tv_sec == 2);
+
+	test__check("resume", sancus_tcp_server_accept(&server, &loop) == 2);
+	test__check("resume", server.admission.paused && server.admission.stats.pauses == 2);
+	test__check("resume", server.admission.stats.accepted == 5 &&
+		    server.admission.stats.rejected == 0);
+
+	close_all(&server, fds);
+
+	if (err == 0)
+		pr_info("pause: ok\n");
+	return err;
+}
+
+static int test_shed(void)
+{
+	static const struct sancus_tcp_server_settings settings = {
+		.on_connect = on_connect,
+		.on_error = on_error,
+		.max_connections = 2,
+		.shed_load = true,
+	};
+	struct sancus_ev_loop loop = { .now = { 100, 0 } };
+	struct sancus_tcp_server server;
+	struct timeval tv = { .tv_sec = 2 };
+	int fds[CLIENTS];
+	int err = 0;
+
+	if (sancus_tcp_ipv4_listen(&server, &settings, "127.0.0.1", 0, true, CLIENTS) != 1 ||
+	    connect_clients(&server, fds) < 0)
+		return 1;
+
+	test__check("shed", sancus_tcp_server_accept(&server, &loop) == 2);
+	test__check("shed", !server.admission.paused && server.admission.stats.rejected == CLIENTS - 2);
+
+	/* the rejected ones are reset, not left waiting */
+	for (unsigned i = 2; i < CLIENTS; i++) {
+		char c;
+
+		setsockopt(fds[i], SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		test__check("shed", recv(fds[i], &c, 1, 0) < 0 && errno == ECONNRESET);
+	}
+
+	close_all(&server, fds);
+
+	if (err == 0)
+		pr_info("shed: ok\n");
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	int err = 0;
+
+	err += test_pause();
+	err += test_shed();
+
+	return err == 0 ? 0 : 1;
+}
@@ -0,0 +1,301 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <netinet/in.h>
+
+#include <sancus/socket.h>
+#include <sancus/tcp_server.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	LISTENERS = 3,
+	CLIENTS   = 6,	/* per listener */
+	BUDGET    = 6,
+};
+
+static struct sancus_tcp_server servers[LISTENERS];
+static unsigned connected[LISTENERS];
+static int kept[LISTENERS * CLIENTS];
+static unsigned kept_count;
+static bool keep;
+
+static bool on_connect(struct sancus_tcp_server *self,
+		       struct sancus_ev_loop *UNUSED(loop),
+		       int fd, struct sockaddr *UNUSED(sa), socklen_t UNUSED(sa_len))
+{
+	connected[self - servers]++;
+
+	if (keep)
+		kept[kept_count++] = fd;
+	return keep;
+}
+
+static void on_error(struct sancus_tcp_server *UNUSED(self),
+		     struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_server_error UNUSED(err))
+{
+	pr_err("accept: %s\n", strerror(errno));
+}
+
+static int connect_client(const struct sancus_tcp_server *server)
+{
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(ss);
+	int fd;
+
+	if (getsockname(sancus_tcp_server_fd(server), (struct sockaddr *)&ss, &len) < 0)
+		return -1;
+
+	fd = sancus_socket(ss.ss_family, SOCK_STREAM, 0, 1, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr *)&ss, len) < 0) {
+		sancus_close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+/* two ipv4 ports and a local socket, all queueing CLIENTS each */
+static int setup(struct sancus_tcp_server_group *group,
+		 const struct sancus_tcp_server_settings *settings,
+		 const char *path, int *clients)
+{
+	sancus_tcp_server_group_init(group, settings);
+
+	for (unsigned i = 0; i < LISTENERS; i++) {
+		int rc = i < LISTENERS - 1 ?
+			sancus_tcp_ipv4_listen(&servers[i], settings, "127.0.0.1", 0,
+					       true, CLIENTS) :
+			sancus_tcp_local_listen(&servers[i], settings, path, true, CLIENTS);
+
+		if (rc != 1 || sancus_tcp_server_group_add(group, &servers[i]) < 0)
+			return -1;
+
+		for (unsigned j = 0; j < CLIENTS; j++) {
+			int fd = connect_client(&servers[i]);
+
+			if (fd < 0)
+				return -1;
+			clients[i * CLIENTS + j] = fd;
+		}
+		connected[i] = 0;
+	}
+	return 0;
+}
+
+static void teardown(struct sancus_tcp_server_group *group, int *clients)
+{
+	for (unsigned i = 0; i < LISTENERS * CLIENTS; i++)
+		sancus_close(clients[i]);
+	for (unsigned i = 0; i < kept_count; i++)
+		sancus_close(kept[i]);
+	kept_count = 0;
+
+	sancus_tcp_server_group_close(group);
+}
+
+static int test_fair(const char *path)
+{
+	static const struct sancus_tcp_server_settings settings = {
+		.on_connect = on_connect,
+		.on_error = on_error,
+		.accept_budget = BUDGET,
+	};
+	static const unsigned expected[] = { BUDGET, BUDGET, BUDGET, 0 };
+	struct sancus_ev_loop loop = { .now = { 0, 0 } };
+	struct sancus_tcp_server_group group;
+	struct sancus_tcp_server_stats stats;
+	int clients[LISTENERS * CLIENTS];
+	int err = 0;
+
+	keep = false;
+	if (setup(&group, &settings, path, clients) < 0) {
+		pr_err("fair: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* the budget is split evenly, whichever listener wakes up */
+	for (unsigned i = 0; i < ARRAY_SIZE(expected); i++) {
+		unsigned n = sancus_tcp_server_accept(&servers[i % LISTENERS], &loop);
+
+		if (n != expected[i]) {
+			pr_err("fair: wakeup %u accepted %u, expected %u\n", i, n, expected[i]);
+			err++;
+		}
+
+		for (unsigned j = 0; i < 3 && j < LISTENERS; j++) {
+			if (connected[j] != (i + 1) * BUDGET / LISTENERS) {
+				pr_err("fair: wakeup %u listener %u at %u\n", i, j, connected[j]);
+				err++;
+			}
+		}
+	}
+
+	sancus_tcp_server_get_stats(&servers[0], &loop, &stats);
+	if (stats.accepted != LISTENERS * CLIENTS) {
+		pr_err("fair: accepted %lu\n", stats.accepted);
+		err++;
+	}
+
+	teardown(&group, clients);
+
+	if (err == 0)
+		pr_info("fair: ok\n");
+	return err;
+}
+
+static int test_shared_limit(const char *path)
+{
+	static const struct sancus_tcp_server_settings settings = {
+		.on_connect = on_connect,
+		.on_error = on_error,
+		.max_connections = 4,
+		.resume_connections = 2,
+	};
+	struct sancus_ev_loop loop = { .now = { 0, 0 } };
+	struct sancus_tcp_server_group group;
+	struct sancus_tcp_server_stats stats;
+	struct sancus_tcp_server other;
+	int clients[LISTENERS * CLIENTS];
+	int err = 0;
+
+	keep = true;
+	if (setup(&group, &settings, path, clients) < 0) {
+		pr_err("limit: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* one cap for all listeners */
+	if (sancus_tcp_server_group_accept(&group, &loop) != 4 || !group.admission.paused) {
+		pr_err("limit: not paused at the cap\n");
+		err++;
+	}
+
+	/* released through any member */
+	loop.now.tv_sec = 3;
+	sancus_tcp_server_release(&servers[2], &loop);
+	sancus_tcp_server_release(&servers[0], &loop);
+
+	sancus_tcp_server_get_stats(&servers[1], &loop, &stats);
+	if (group.admission.paused || stats.connections != 2 ||
+	    stats.pauses != 1 || stats.paused_time.tv_sec != 3) {
+		pr_err("limit: connections:%u pauses:%lu paused:%lds\n", stats.connections,
+		       stats.pauses, (long)stats.paused_time.tv_sec);
+		err++;
+	}
+
+	/* other settings don't belong */
+	if (sancus_tcp_ipv4_listen(&other, &settings, "127.0.0.1", 0, true, 1) == 1) {
+		other.settings = NULL;
+		if (sancus_tcp_server_group_add(&group, &other) == 0 || errno != EINVAL) {
+			pr_err("limit: added a server with other settings\n");
+			err++;
+		}
+		sancus_tcp_server_close(&other);
+	}
+
+	teardown(&group, clients);
+
+	if (err == 0)
+		pr_info("limit: ok\n");
+	return err;
+}
+
+static int test_stop_member(const char *path)
+{
+	static const struct sancus_tcp_server_settings settings = {
+		.on_connect = on_connect,
+		.on_error = on_error,
+		.max_connections = 4,
+		.resume_connections = 2,
+	};
+	struct sancus_ev_loop loop = { .now = { 0, 0 } };
+	struct sancus_tcp_server_group group;
+	struct sancus_tcp_server_stats stats;
+	int clients[LISTENERS * CLIENTS];
+	int err = 0;
+
+	keep = true;
+	if (setup(&group, &settings, path, clients) < 0) {
+		pr_err("stop: %s\n", strerror(errno));
+		return 1;
+	}
+
+	sancus_tcp_server_group_start(&group, &loop);
+	if (sancus_tcp_server_group_accept(&group, &loop) != 4 || !group.admission.paused) {
+		pr_err("stop: not paused at the cap\n");
+		err++;
+	}
+
+	/* the others are still waiting for the pause to end */
+	loop.now.tv_sec = 1;
+	sancus_tcp_server_stop(&servers[1], &loop);
+	if (!group.admission.paused || servers[1].started || !servers[0].started) {
+		pr_err("stop: pause ended by a single member\n");
+		err++;
+	}
+
+	loop.now.tv_sec = 2;
+	sancus_tcp_server_release(&servers[0], &loop);
+	sancus_tcp_server_release(&servers[0], &loop);
+
+	sancus_tcp_server_get_stats(&servers[0], &loop, &stats);
+	if (group.admission.paused || stats.pauses != 1 || stats.paused_time.tv_sec != 2) {
+		pr_err("stop: paused:%d pauses:%lu paused:%lds\n", group.admission.paused,
+		       stats.pauses, (long)stats.paused_time.tv_sec);
+		err++;
+	}
+
+	/* stopping them all ends it */
+	if (sancus_tcp_server_group_accept(&group, &loop) != 2 || !group.admission.paused) {
+		pr_err("stop: not paused again\n");
+		err++;
+	}
+
+	loop.now.tv_sec = 3;
+	sancus_tcp_server_group_stop(&group, &loop);
+
+	sancus_tcp_server_get_stats(&servers[0], &loop, &stats);
+	if (group.admission.paused || stats.pauses != 2 || stats.paused_time.tv_sec != 3) {
+		pr_err("stop: group still paused\n");
+		err++;
+	}
+
+	teardown(&group, clients);
+
+	if (err == 0)
+		pr_info("stop: ok\n");
+	return err;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	char path[] = "/tmp/test-tcp-server-group.XXXXXX";
+	int fd, err = 0;
+
+	/* a unique name for the local socket */
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	sancus_close(fd);
+
+	err += test_fair(path);
+	err += test_shared_limit(path);
+	err += test_stop_member(path);
+
+	unlink(path);
+	return err == 0 ? 0 : 1;
+}
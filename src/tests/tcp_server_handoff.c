@@ -0,0 +1,140 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+
+#include <sancus/socket.h>
+#include <sancus/tcp_server.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+enum {
+	SERVERS = 2,
+};
+
+static unsigned connected;
+
+static bool on_connect(struct sancus_tcp_server *UNUSED(self),
+		       struct sancus_ev_loop *UNUSED(loop),
+		       int UNUSED(fd), struct sockaddr *UNUSED(sa), socklen_t UNUSED(sa_len))
+{
+	connected++;
+	return false;
+}
+
+static void on_error(struct sancus_tcp_server *UNUSED(self),
+		     struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_server_error UNUSED(err))
+{
+	pr_err("accept: %s\n", strerror(errno));
+}
+
+static const struct sancus_tcp_server_settings settings = {
+	.on_connect = on_connect,
+	.on_error = on_error,
+};
+
+static int connect_client(const struct sancus_tcp_server *server)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	int fd;
+
+	if (getsockname(sancus_tcp_server_fd(server), (struct sockaddr *)&sin, &len) < 0)
+		return -1;
+
+	fd = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr *)&sin, len) < 0) {
+		sancus_close(fd);
+		fd = -1;
+	}
+	return fd;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	struct sancus_tcp_server old[SERVERS], new[SERVERS];
+	struct sancus_tcp_server *servers[SERVERS];
+	struct sancus_ev_loop loop = { .now = { 0, 0 } };
+	int sv[2], fds[SERVERS], clients[SERVERS], other;
+	ssize_t n;
+	int err = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+		return 1;
+
+	for (unsigned i = 0; i < SERVERS; i++) {
+		if (sancus_tcp_ipv4_listen(&old[i], &settings, "127.0.0.1", 0, true, 16) != 1)
+			return 1;
+		servers[i] = &old[i];
+	}
+
+	if (sancus_tcp_server_send_fds(sv[0], servers, SERVERS) < 0) {
+		pr_err("send: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* a too small receiver gets nothing */
+	n = sancus_tcp_server_receive_fds(sv[1], fds, SERVERS - 1);
+	if (n != -1 || errno != EMSGSIZE) {
+		pr_err("receive: %zd, expected EMSGSIZE\n", n);
+		err++;
+	}
+
+	sancus_tcp_server_send_fds(sv[0], servers, SERVERS);
+	n = sancus_tcp_server_receive_fds(sv[1], fds, SERVERS);
+	if (n != SERVERS) {
+		pr_err("receive: %zd: %s\n", n, strerror(errno));
+		return 1;
+	}
+
+	/* queued on the shared listeners while the old process goes away */
+	for (unsigned i = 0; i < SERVERS; i++) {
+		clients[i] = connect_client(&old[i]);
+		sancus_tcp_server_stop(&old[i], &loop);
+		sancus_tcp_server_close(&old[i]);
+	}
+
+	for (unsigned i = 0; i < SERVERS; i++) {
+		if (sancus_tcp_server_adopt(&new[i], &settings, fds[i], true) != 1) {
+			pr_err("adopt: %s\n", strerror(errno));
+			return 1;
+		}
+		sancus_tcp_server_accept(&new[i], &loop);
+		sancus_close(clients[i]);
+	}
+
+	if (connected != SERVERS) {
+		pr_err("connected %u, expected %u\n", connected, SERVERS);
+		err++;
+	}
+
+	/* only listening stream sockets */
+	other = sancus_socket(AF_INET, SOCK_STREAM, 0, 1, 1);
+	if (sancus_tcp_server_adopt(&old[0], &settings, other, true) != 0) {
+		pr_err("adopted a socket not listening\n");
+		err++;
+	}
+	sancus_close(other);
+
+	for (unsigned i = 0; i < SERVERS; i++)
+		sancus_tcp_server_close(&new[i]);
+	sancus_close(sv[0]);
+	sancus_close(sv[1]);
+
+	if (err == 0)
+		pr_info("handoff: connected:%u\n", connected);
+	return err == 0 ? 0 : 1;
+}
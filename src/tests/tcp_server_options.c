@@ -0,0 +1,103 @@
+#include <sancus/common.h>
+#include <sancus/ev.h>
+#include <sancus/fd.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <sancus/tcp_server.h>
+
+#if 1
+#define pr_info(...) fprintf(stdout, __VA_ARGS__)
+#else
+#define pr_info(...) do { } while(0)
+#endif
+#define pr_err(...)  fprintf(stderr, __VA_ARGS__)
+
+static int option_errors[SANCUS_TCP_SERVER_OPT_INCOMING_CPU + 1];
+
+static bool on_connect(struct sancus_tcp_server *UNUSED(self),
+		       struct sancus_ev_loop *UNUSED(loop),
+		       int UNUSED(fd), struct sockaddr *UNUSED(sa), socklen_t UNUSED(sa_len))
+{
+	return false;
+}
+
+static void on_error(struct sancus_tcp_server *UNUSED(self),
+		     struct sancus_ev_loop *UNUSED(loop),
+		     enum sancus_tcp_server_error UNUSED(err))
+{
+}
+
+static void on_option_error(struct sancus_tcp_server *UNUSED(self),
+			    enum sancus_tcp_server_option opt, int err)
+{
+	option_errors[opt] = err;
+}
+
+static int getopt_int(int fd, int level, int name)
+{
+	int v = -1;
+	socklen_t len = sizeof(v);
+
+	getsockopt(fd, level, name, &v, &len);
+	return v;
+}
+
+int main(int UNUSED(argc), char **UNUSED(argv))
+{
+	static const struct sancus_tcp_server_settings settings = {
+		.on_connect = on_connect,
+		.on_error = on_error,
+		.on_option_error = on_option_error,
+		.options = {
+			.defer_accept = 5,
+			.fastopen = 16,
+			.rcvbuf = 1 << 30, /* beyond rmem_max, clamped */
+			.sndbuf = 65536,
+			.nodelay = true,
+			.incoming_cpu = 1,
+		},
+	};
+	struct sancus_tcp_server server;
+	int fd, err = 0;
+
+	if (sancus_tcp_ipv4_listen(&server, &settings, "127.0.0.1", 0, true, 16) != 1) {
+		pr_err("listen: %s\n", strerror(errno));
+		return 1;
+	}
+	fd = sancus_tcp_server_fd(&server);
+
+	/* a clamped value is reported, and doesn't stop the others */
+	if (option_errors[SANCUS_TCP_SERVER_OPT_RCVBUF] != ERANGE) {
+		pr_err("rcvbuf: %s, expected ERANGE\n",
+		       strerror(option_errors[SANCUS_TCP_SERVER_OPT_RCVBUF]));
+		err++;
+	}
+
+	for (unsigned i = 0; i < ARRAY_SIZE(option_errors); i++) {
+		if (i != SANCUS_TCP_SERVER_OPT_RCVBUF && option_errors[i] != 0) {
+			pr_err("option %u: %s\n", i, strerror(option_errors[i]));
+			err++;
+		}
+	}
+
+	if (getopt_int(fd, SOL_SOCKET, SO_SNDBUF) < 65536 ||
+	    getopt_int(fd, IPPROTO_TCP, TCP_NODELAY) == 0 ||
+	    getopt_int(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT) == 0) {
+		pr_err("options not set\n");
+		err++;
+	}
+
+	sancus_tcp_server_close(&server);
+
+	if (err == 0)
+		pr_info("options: ok\n");
+	return err == 0 ? 0 : 1;
+}
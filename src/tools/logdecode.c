@@ -0,0 +1,451 @@
+/*
+ * sancus-logdecode - renders a binary log stream as text
+ *
+ * usage: sancus-logdecode [<file>|-]
+ */
+#include <sancus/common.h>
+#include <sancus/buffer.h>
+#include <sancus/fd.h>
+#include <sancus/logger_binary.h>
+#include <sancus/time.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define pr_err(...) fprintf(stderr, __VA_ARGS__)
+
+enum {
+	LD_MESSAGE_SIZE = 2 * SANCUS_LOGGER_BINARY_RECORD_MAX,
+};
+
+struct ld_string {
+	uint64_t id;
+	const char *s;
+};
+
+struct ld_message {
+	const struct sancus_logger_record *rec;
+	size_t index;
+};
+
+struct ld_stream {
+	struct ld_string *strings;
+	size_t strings_count;
+
+	struct ld_message *messages;
+	size_t messages_count;
+};
+
+/*
+ * payload reader
+ */
+struct ld_payload {
+	const char *p, *pe;
+};
+
+static bool ld_get(struct ld_payload *r, void *v, size_t l)
+{
+	if ((size_t)(r->pe - r->p) < l)
+		return false;
+
+	memcpy(v, r->p, l);
+	r->p += l;
+	return true;
+}
+
+static bool ld_str(struct ld_payload *r, const char **s, size_t *l)
+{
+	uint32_t v;
+
+	if (!ld_get(r, &v, sizeof(v)))
+		return false;
+
+	if (v == UINT32_MAX) {
+		*s = NULL;
+		*l = 0;
+	} else if ((size_t)(r->pe - r->p) < v) {
+		return false;
+	} else {
+		*s = r->p;
+		*l = v;
+		r->p += v;
+	}
+	return true;
+}
+
+/*
+ * dictionary
+ */
+static int ld_string_cmp(const void *a, const void *b)
+{
+	const struct ld_string *sa = a, *sb = b;
+
+	return sa->id < sb->id ? -1 : sa->id > sb->id;
+}
+
+static const char *ld_lookup(const struct ld_stream *st, uint64_t id)
+{
+	struct ld_string key = { .id = id }, *s;
+
+	if (id == 0)
+		return NULL;
+
+	s = bsearch(&key, st->strings, st->strings_count, sizeof(key), ld_string_cmp);
+	return s != NULL ? s->s : "(undefined)";
+}
+
+static int ld_message_cmp(const void *a, const void *b)
+{
+	const struct ld_message *ma = a, *mb = b;
+
+	if (ma->rec->ts != mb->rec->ts)
+		return ma->rec->ts < mb->rec->ts ? -1 : 1;
+	return ma->index < mb->index ? -1 : ma->index > mb->index;
+}
+
+/*
+ * printf rendering
+ */
+#define ld_appendv(B, F, S, N, T, V) do { \
+	T __v = (V); \
+	char __buf[LD_MESSAGE_SIZE]; \
+	int __rc; \
+	switch (N) { \
+	case 2: \
+		__rc = snprintf(__buf, sizeof(__buf), (F), (S)[0], (S)[1], __v); \
+		break; \
+	case 1: \
+		__rc = snprintf(__buf, sizeof(__buf), (F), (S)[0], __v); \
+		break; \
+	default: \
+		__rc = snprintf(__buf, sizeof(__buf), (F), __v); \
+	} \
+	if (__rc > 0) \
+		sancus_buffer__append((B), true, __buf, \
+				      (size_t)__rc < sizeof(__buf) ? __rc : (ssize_t)sizeof(__buf) - 1); \
+} while (0)
+
+/* the conversions come from the recorded formats */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+
+static void ld_format(struct sancus_buffer *b, const char *fmt, struct ld_payload *r)
+{
+	struct sancus_logger_binary_spec spec;
+	const char *p;
+
+	while ((p = sancus_logger_binary_next(fmt, &spec)) != NULL) {
+		char conv[32];
+		int32_t stars[2];
+		unsigned nstars = 0;
+		size_t l = spec.head_len;
+
+		/* literal text */
+		sancus_buffer__append(b, true, fmt, p - fmt);
+		fmt = p + spec.len;
+
+		if (spec.star_width && !ld_get(r, &stars[nstars++], sizeof(int32_t)))
+			return;
+		if (spec.star_prec && !ld_get(r, &stars[nstars++], sizeof(int32_t)))
+			return;
+
+		if (l > sizeof(conv) - 4)
+			l = sizeof(conv) - 4;
+		memcpy(conv, p, l);
+
+		switch (spec.type) {
+		case SANCUS_LOGGER_ARG_INT:
+		case SANCUS_LOGGER_ARG_UINT: {
+			uint64_t v;
+
+			if (!ld_get(r, &v, sizeof(v)))
+				return;
+
+			if (spec.conv == 'c') {
+				memcpy(conv + l, "c", 2);
+				ld_appendv(b, conv, stars, nstars, int, (int)v);
+			} else {
+				conv[l++] = 'l';
+				conv[l++] = 'l';
+				conv[l++] = spec.conv;
+				conv[l] = '\0';
+				ld_appendv(b, conv, stars, nstars, unsigned long long, v);
+			}
+			}
+			break;
+		case SANCUS_LOGGER_ARG_DOUBLE: {
+			double v;
+
+			if (!ld_get(r, &v, sizeof(v)))
+				return;
+
+			conv[l++] = spec.conv;
+			conv[l] = '\0';
+			ld_appendv(b, conv, stars, nstars, double, v);
+			}
+			break;
+		case SANCUS_LOGGER_ARG_PTR: {
+			uint64_t v;
+
+			if (!ld_get(r, &v, sizeof(v)))
+				return;
+
+			memcpy(conv + l, "p", 2);
+			ld_appendv(b, conv, stars, nstars, void *, (void *)(uintptr_t)v);
+			}
+			break;
+		case SANCUS_LOGGER_ARG_STRING:
+		case SANCUS_LOGGER_ARG_ERRNO: {
+			char s[SANCUS_LOGGER_BINARY_RECORD_MAX + 1];
+			const char *v;
+			size_t vl;
+
+			if (!ld_str(r, &v, &vl))
+				return;
+
+			if (v == NULL) {
+				memcpy(s, "(null)", 7);
+			} else {
+				memcpy(s, v, vl);
+				s[vl] = '\0';
+			}
+
+			memcpy(conv + l, "s", 2);
+			ld_appendv(b, conv, stars, nstars, const char *, s);
+			}
+			break;
+		case SANCUS_LOGGER_ARG_NONE:
+		default:
+			if (spec.conv == '%')
+				sancus_buffer__append(b, true, "%", 1);
+			else if (spec.conv != 'n')
+				sancus_buffer__append(b, true, p, spec.len);
+		}
+	}
+
+	sancus_buffer__appendz(b, true, fmt);
+}
+
+#pragma GCC diagnostic pop
+
+/*
+ * output
+ */
+static void ld_print(const struct ld_stream *st, const struct sancus_logger_record *rec,
+		     const struct timespec *dt0, const struct timespec *dt1)
+{
+	static const char levels[] = "EWITD";
+	char mbuf0[LD_MESSAGE_SIZE];
+	struct sancus_buffer mbuf;
+	struct ld_payload r = {
+		(const char *)(rec + 1),
+		(const char *)rec + rec->len,
+	};
+	const char *prefix = r.p, *data = NULL;
+	size_t plen = rec->prefix_len, dlen = 0;
+
+	sancus_buffer_init(&mbuf, mbuf0, sizeof(mbuf0));
+
+	if ((size_t)(r.pe - r.p) < plen)
+		return;
+	r.p += plen;
+
+	if (rec->type == SANCUS_LOGGER_RECORD_PRINTF) {
+		const char *func = ld_lookup(st, rec->func);
+		const char *fmt = ld_lookup(st, rec->fmt);
+
+		if (func) {
+			sancus_buffer__appendz(&mbuf, true, func);
+			if (rec->line)
+				sancus_buffer__appendf(&mbuf, true, ":%u", rec->line);
+			sancus_buffer__append(&mbuf, true, ": ", 2);
+		}
+		if (fmt)
+			ld_format(&mbuf, fmt, &r);
+
+		sancus_buffer_stripany(&mbuf, "\n\t :");
+	} else {
+		const char *msg;
+		size_t mlen;
+
+		if (ld_str(&r, &msg, &mlen))
+			sancus_buffer__append(&mbuf, true, msg, (ssize_t)mlen);
+		if (!ld_str(&r, &data, &dlen))
+			data = NULL, dlen = 0;
+	}
+
+	printf("[" TIMESPEC_FMT_MS " +" TIMESPEC_FMT_MS "] ",
+	       TIMESPEC_SPLIT_MS(dt0), TIMESPEC_SPLIT_MS(dt1));
+
+	if (rec->level < sizeof(levels) - 1)
+		printf("%c/", levels[rec->level]);
+	else
+		printf("%u/", rec->level);
+
+	if (plen) {
+		fwrite(prefix, 1, plen, stdout);
+		if (mbuf.len || dlen)
+			fputs(": ", stdout);
+	}
+	if (mbuf.len) {
+		fwrite(sancus_buffer_ptr(&mbuf), 1, mbuf.len, stdout);
+		if (dlen)
+			fputs(": ", stdout);
+	}
+	if (dlen)
+		fwrite(data, 1, dlen, stdout);
+
+	if (rec->flags & SANCUS_LOGGER_RECORD_TRUNCATED)
+		fputs(" [truncated]", stdout);
+	fputc('\n', stdout);
+}
+
+static inline struct timespec ld_ts(uint64_t ns)
+{
+	return TIMESPEC_INIT(ns / 1000000000, ns % 1000000000);
+}
+
+/*
+ * input
+ */
+static char *ld_read_all(int fd, size_t *len)
+{
+	size_t size = 65536, l = 0;
+	char *buf = malloc(size);
+	ssize_t rc;
+
+	while (buf != NULL) {
+		if (l == size) {
+			char *p = realloc(buf, size *= 2);
+			if (p == NULL)
+				break;
+			buf = p;
+		}
+
+		rc = sancus_read(fd, buf + l, size - l);
+		if (rc > 0) {
+			l += (size_t)rc;
+		} else if (rc == 0) {
+			*len = l;
+			return buf;
+		} else if (rc != -EAGAIN) {
+			errno = (int)-rc;
+			break;
+		}
+	}
+
+	free(buf);
+	return NULL;
+}
+
+static int ld_index(struct ld_stream *st, const char *buf, size_t len)
+{
+	size_t off = sizeof(struct sancus_logger_binary_header);
+	size_t count = (len - off) / sizeof(struct sancus_logger_record);
+
+	st->strings = calloc(count + 1, sizeof(*st->strings));
+	st->messages = calloc(count + 1, sizeof(*st->messages));
+	if (st->strings == NULL || st->messages == NULL)
+		return -ENOMEM;
+
+	while (len - off >= sizeof(struct sancus_logger_record)) {
+		const struct sancus_logger_record *rec = (const void *)(buf + off);
+
+		if (rec->len < sizeof(*rec) || rec->len > len - off || rec->len & 7) {
+			pr_err("%zu: invalid record\n", off);
+			return -EINVAL;
+		}
+
+		if (rec->type == SANCUS_LOGGER_RECORD_STRING) {
+			size_t l = rec->len - sizeof(*rec);
+			char *s = malloc(l + 1);
+
+			if (s == NULL)
+				return -ENOMEM;
+
+			/* padding is NUL */
+			memcpy(s, rec + 1, l);
+			s[l] = '\0';
+
+			st->strings[st->strings_count++] = (struct ld_string) { rec->fmt, s };
+		} else {
+			st->messages[st->messages_count] = (struct ld_message) {
+				rec, st->messages_count,
+			};
+			st->messages_count++;
+		}
+
+		off += rec->len;
+	}
+
+	qsort(st->strings, st->strings_count, sizeof(*st->strings), ld_string_cmp);
+	qsort(st->messages, st->messages_count, sizeof(*st->messages), ld_message_cmp);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	struct sancus_logger_binary_header h;
+	struct ld_stream st = { 0 };
+	struct timespec first, prev;
+	size_t len;
+	char *buf;
+	int fd = 0;
+
+	if (argc > 2) {
+		pr_err("usage: %s [<file>|-]\n", argv[0]);
+		return 2;
+	} else if (argc == 2 && strcmp(argv[1], "-") != 0) {
+		fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			pr_err("%s: %s\n", argv[1], strerror(errno));
+			return 1;
+		}
+	}
+
+	buf = ld_read_all(fd, &len);
+	if (buf == NULL) {
+		pr_err("read: %s\n", strerror(errno));
+		return 1;
+	} else if (len < sizeof(h)) {
+		pr_err("missing header\n");
+		return 1;
+	}
+
+	memcpy(&h, buf, sizeof(h));
+	if (memcmp(h.magic, SANCUS_LOGGER_BINARY_MAGIC, sizeof(h.magic)) != 0) {
+		pr_err("not a sancus binary log\n");
+		return 1;
+	} else if (h.byte_order != SANCUS_LOGGER_BINARY_BYTE_ORDER) {
+		pr_err("unsupported byte order\n");
+		return 1;
+	} else if (h.version != SANCUS_LOGGER_BINARY_VERSION) {
+		pr_err("unsupported version %u\n", h.version);
+		return 1;
+	}
+
+	if (ld_index(&st, buf, len) < 0)
+		return 1;
+
+	for (size_t i = 0; i < st.messages_count; i++) {
+		const struct sancus_logger_record *rec = st.messages[i].rec;
+		struct timespec ts = ld_ts(rec->ts), dt0, dt1;
+
+		if (i == 0) {
+			dt0 = dt1 = TIMESPEC_INIT(0, 0);
+			first = ts;
+		} else {
+			dt0 = dt1 = ts;
+			sancus_time_sub(&dt0, &first);
+			sancus_time_sub(&dt1, &prev);
+		}
+		prev = ts;
+
+		ld_print(&st, rec, &dt0, &dt1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,82 @@
+/*
+ * sancus-logring - renders what survives in a log ring file, oldest first
+ *
+ * usage: sancus-logring <file>
+ */
+#include <sancus/common.h>
+#include <sancus/logger_ring.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define pr_err(...) fprintf(stderr, __VA_ARGS__)
+
+static void lr_print(const struct sancus_logger_ring_record *rec,
+		     const char *text, size_t len)
+{
+	static const char levels[] = "EWITD";
+	time_t sec = (time_t)(rec->ts / 1000000000);
+	long usec = (long)(rec->ts % 1000000000) / 1000;
+	struct tm tm;
+
+	gmtime_r(&sec, &tm);
+	printf("%04d-%02d-%02dT%02d:%02d:%02d.%06ldZ ",
+	       tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
+	       tm.tm_hour, tm.tm_min, tm.tm_sec, usec);
+
+	if (rec->level < sizeof(levels) - 1)
+		printf("%c/", levels[rec->level]);
+	else
+		printf("%u/", rec->level);
+
+	fwrite(text, 1, len, stdout);
+
+	if (rec->flags & SANCUS_LOGGER_RING_TRUNCATED)
+		fputs(" [truncated]", stdout);
+	fputc('\n', stdout);
+}
+
+int main(int argc, char **argv)
+{
+	struct sancus_logger_ring_reader r;
+	struct sancus_logger_ring_record rec;
+	char text[SANCUS_LOGGER_RING_TEXT_MAX];
+	struct stat st;
+	void *map;
+	int fd, rc;
+
+	if (argc != 2) {
+		pr_err("usage: %s <file>\n", argv[0]);
+		return 2;
+	}
+
+	fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		pr_err("%s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		pr_err("%s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	close(fd);
+
+	if (sancus_logger_ring_reader_init(&r, map, (size_t)st.st_size) < 0) {
+		pr_err("%s: not a sancus log ring\n", argv[1]);
+		return 1;
+	}
+
+	while ((rc = sancus_logger_ring_reader_next(&r, &rec, text, sizeof(text))) >= 0)
+		lr_print(&rec, text, (size_t)rc);
+
+	munmap(map, (size_t)st.st_size);
+	return 0;
+}